@@ -36,28 +36,28 @@ using namespace utils;
 
 class FilamentFixture : public benchmark::Fixture {
 protected:
-    static constexpr size_t BATCH_SIZE = 512;
-
     Frustum frustum{};
     std::vector<float3> boxesCenter;
     std::vector<float3> boxesExtent;
     std::vector<float4> spheres;
     Culler::result_type* UTILS_RESTRICT visibles = nullptr;
-
+    size_t count = 0;
 
 public:
-    FilamentFixture() {
+    // state.range(0) is the number of objects
+    void SetUp(benchmark::State& state) override {
 
         std::default_random_engine gen; // NOLINT
         std::uniform_real_distribution<float> rand(-100.0f, 100.0f);
 
-        const size_t batch = BATCH_SIZE;
+        count = size_t(state.range(0));
+        const size_t capacity = Culler::round(count);
         frustum = Frustum{ mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f) };
 
-        boxesCenter.resize(batch);
-        boxesExtent.resize(batch);
-        spheres.resize(batch);
-        for (size_t i = 0; i < batch; i++) {
+        boxesCenter.resize(capacity);
+        boxesExtent.resize(capacity);
+        spheres.resize(capacity);
+        for (size_t i = 0; i < count; i++) {
             float4& sphere = spheres[i];
             float z = std::fabs(rand(gen));
             sphere.z = -z;
@@ -73,34 +73,67 @@ public:
             };
         }
 
-        visibles = (Culler::result_type*)utils::aligned_alloc(batch * sizeof(*visibles), 32);
+        visibles = (Culler::result_type*)utils::aligned_alloc(capacity * sizeof(*visibles), 32);
     }
 
-    ~FilamentFixture() override {
+    void TearDown(benchmark::State& state) override {
         utils::aligned_free(visibles);
+        visibles = nullptr;
     }
 };
 
-BENCHMARK_F(FilamentFixture, boxCulling)(benchmark::State& state) {
+// state.range(1) is the Culler::Kernel to use
+static bool setKernelLabel(benchmark::State& state, Culler::Kernel kernel) {
+    static const char* const names[] = { "generic", "neon", "avx2", "avx512" };
+    if (!Culler::isSupported(kernel)) {
+        state.SkipWithError("kernel not supported on this CPU");
+        return false;
+    }
+    state.SetLabel(names[size_t(kernel)]);
+    return true;
+}
+
+static void cullingArguments(benchmark::internal::Benchmark* b) {
+    for (int64_t count : { 1 << 10, 1 << 13, 1 << 16, 1 << 20 }) {
+        for (Culler::Kernel kernel : { Culler::Kernel::GENERIC, Culler::Kernel::NEON,
+                Culler::Kernel::AVX2, Culler::Kernel::AVX512 }) {
+            b->Args({ count, int64_t(kernel) });
+        }
+    }
+}
+
+BENCHMARK_DEFINE_F(FilamentFixture, boxCulling)(benchmark::State& state) {
+    const Culler::Kernel kernel = Culler::Kernel(state.range(1));
+    if (!setKernelLabel(state, kernel)) {
+        return;
+    }
     {
         PerformanceCounters pc(state);
         for (auto _ : state) {
-            Culler::Test::intersects(visibles, frustum, boxesCenter.data(), boxesExtent.data(), BATCH_SIZE);
+            Culler::Test::intersects(kernel, visibles, frustum,
+                    boxesCenter.data(), boxesExtent.data(), count);
         }
         benchmark::ClobberMemory();
         pc.stop();
-        state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+        state.SetItemsProcessed(state.iterations() * count);
     }
 }
 
-BENCHMARK_F(FilamentFixture, sphereCulling)(benchmark::State& state) {
+BENCHMARK_DEFINE_F(FilamentFixture, sphereCulling)(benchmark::State& state) {
+    const Culler::Kernel kernel = Culler::Kernel(state.range(1));
+    if (!setKernelLabel(state, kernel)) {
+        return;
+    }
     {
         PerformanceCounters pc(state);
         for (auto _ : state) {
-            Culler::Test::intersects(visibles, frustum, spheres.data(), BATCH_SIZE);
+            Culler::Test::intersects(kernel, visibles, frustum, spheres.data(), count);
         }
         benchmark::ClobberMemory();
         pc.stop();
-        state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+        state.SetItemsProcessed(state.iterations() * count);
     }
 }
+
+BENCHMARK_REGISTER_F(FilamentFixture, boxCulling)->Apply(cullingArguments);
+BENCHMARK_REGISTER_F(FilamentFixture, sphereCulling)->Apply(cullingArguments);
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Box.h>
+#include <filament/Camera.h>
+#include <filament/Engine.h>
+#include <filament/IndexBuffer.h>
+#include <filament/LightManager.h>
+#include <filament/Material.h>
+#include <filament/MaterialInstance.h>
+#include <filament/RenderableManager.h>
+#include <filament/Renderer.h>
+#include <filament/Scene.h>
+#include <filament/TransformManager.h>
+#include <filament/VertexBuffer.h>
+#include <filament/View.h>
+
+#include "RenderPass.h"
+
+#include "details/Camera.h"
+#include "details/Engine.h"
+#include "details/Scene.h"
+#include "details/View.h"
+
+#include <utils/EntityManager.h>
+
+#include <random>
+#include <vector>
+
+#include <math.h>
+
+using namespace filament;
+using namespace filament::details;
+using namespace math;
+using namespace utils;
+
+/*
+ * Measures the CPU cost of a frame rendered with the noop backend, and of each of its stages,
+ * for a synthetic scene of:
+ *  - range(0) renderables, all sharing the same cube geometry,
+ *  - range(1) point and spot lights,
+ *  - renderables in hierarchies range(2) levels deep,
+ *  - range(3) material instances, which give as many material sorting keys.
+ *
+ * Before each frame, the roots of the hierarchies and the lights move, so that no stage can
+ * reuse the work of the previous frame. This is done while the timer is paused.
+ */
+class FrameFixture : public benchmark::Fixture {
+protected:
+    // a pass that only records the draw commands, without a render target
+    class CommandPass final : public RenderPass {
+        void beginRenderPass(driver::DriverApi&, Viewport const&,
+                const CameraInfo&) noexcept override { }
+        void endRenderPass(driver::DriverApi&, Viewport const&) noexcept override { }
+    public:
+        CommandPass() noexcept : RenderPass("CommandPass") { }
+    };
+
+    Engine* engine = nullptr;
+    SwapChain* swapChain = nullptr;
+    Renderer* renderer = nullptr;
+    Scene* scene = nullptr;
+    View* view = nullptr;
+    Camera* camera = nullptr;
+    VertexBuffer* vertexBuffer = nullptr;
+    IndexBuffer* indexBuffer = nullptr;
+    std::vector<MaterialInstance*> materialInstances;
+    std::vector<Entity> renderables;
+    std::vector<Entity> lights;
+    std::vector<Entity> roots;
+    std::vector<mat4f> rootTransforms;
+    std::vector<float3> lightPositions;
+    LinearAllocatorArena* arena = nullptr;
+    uint32_t frame = 0;
+
+    static constexpr float3 CUBE_VERTICES[8] = {
+            { -0.5f, -0.5f, -0.5f }, {  0.5f, -0.5f, -0.5f },
+            { -0.5f,  0.5f, -0.5f }, {  0.5f,  0.5f, -0.5f },
+            { -0.5f, -0.5f,  0.5f }, {  0.5f, -0.5f,  0.5f },
+            { -0.5f,  0.5f,  0.5f }, {  0.5f,  0.5f,  0.5f },
+    };
+
+    static constexpr uint16_t CUBE_INDICES[36] = {
+            0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+            0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5,
+            0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+    };
+
+public:
+    void SetUp(benchmark::State& state) override {
+        const size_t renderableCount = size_t(state.range(0));
+        const size_t lightCount = size_t(state.range(1));
+        const size_t depth = size_t(state.range(2));
+        const size_t materialCount = size_t(state.range(3));
+
+        engine = Engine::create(Engine::Backend::NOOP);
+        swapChain = engine->createSwapChain(nullptr);
+        renderer = engine->createRenderer();
+        scene = engine->createScene();
+        view = engine->createView();
+        camera = engine->createCamera();
+        camera->setProjection(60.0, 16.0 / 9.0, 0.1, 200.0);
+        view->setCamera(camera);
+        view->setScene(scene);
+        view->setViewport({ 0, 0, 1920, 1080 });
+
+        vertexBuffer = VertexBuffer::Builder()
+                .vertexCount(8)
+                .bufferCount(1)
+                .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+                .build(*engine);
+        vertexBuffer->setBufferAt(*engine, 0, { CUBE_VERTICES, sizeof(CUBE_VERTICES) });
+        indexBuffer = IndexBuffer::Builder()
+                .indexCount(36)
+                .bufferType(IndexBuffer::IndexType::USHORT)
+                .build(*engine);
+        indexBuffer->setBuffer(*engine, { CUBE_INDICES, sizeof(CUBE_INDICES) });
+
+        Material const* material = engine->getDefaultMaterial();
+        materialInstances.resize(materialCount);
+        for (MaterialInstance*& mi : materialInstances) {
+            mi = material->createInstance();
+        }
+
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> x(-60.0f, 60.0f);
+        std::uniform_real_distribution<float> y(-30.0f, 30.0f);
+        std::uniform_real_distribution<float> z(-150.0f, -10.0f);
+
+        // the renderables form chains of 'depth' transforms, each child is offset from its parent
+        TransformManager& tcm = engine->getTransformManager();
+        renderables.resize(renderableCount);
+        EntityManager::get().create(renderableCount, renderables.data());
+        for (size_t i = 0; i < renderableCount; i++) {
+            const Entity e = renderables[i];
+            if (i % depth == 0) {
+                roots.push_back(e);
+                rootTransforms.push_back(mat4f::translate(float3{ x(gen), y(gen), z(gen) }));
+                tcm.create(e, {}, rootTransforms.back());
+            } else {
+                tcm.create(e, tcm.getInstance(renderables[i - 1]),
+                        mat4f::translate(float3{ 1.5f, 0.0f, 0.0f }));
+            }
+            RenderableManager::Builder(1)
+                    .boundingBox({{ -0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, 0.5f }})
+                    .material(0, materialInstances[i % materialCount])
+                    .geometry(0, RenderableManager::PrimitiveType::TRIANGLES,
+                            vertexBuffer, indexBuffer, 0, 36)
+                    .build(*engine, e);
+            scene->addEntity(e);
+        }
+
+        std::uniform_real_distribution<float> radius(2.0f, 10.0f);
+        std::uniform_int_distribution<int> isSpot(0, 1);
+        lights.resize(lightCount);
+        EntityManager::get().create(lightCount, lights.data());
+        for (Entity e : lights) {
+            const auto type = isSpot(gen) ? LightManager::Type::SPOT : LightManager::Type::POINT;
+            lightPositions.push_back({ x(gen), y(gen), z(gen) });
+            LightManager::Builder(type)
+                    .position(lightPositions.back())
+                    .direction({ 0, -1, 0 })
+                    .falloff(radius(gen))
+                    .spotLightCone(0.3f, 0.6f)
+                    .build(*engine, e);
+            scene->addEntity(e);
+        }
+
+        arena = new LinearAllocatorArena("benchmark", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+
+        // the first frame creates the programs and the per-view state
+        renderFrame();
+    }
+
+    void TearDown(benchmark::State& state) override {
+        delete arena;
+        for (Entity e : lights) {
+            engine->destroy(e);
+        }
+        EntityManager::get().destroy(lights.size(), lights.data());
+        for (Entity e : renderables) {
+            engine->destroy(e);
+        }
+        EntityManager::get().destroy(renderables.size(), renderables.data());
+        for (MaterialInstance* mi : materialInstances) {
+            engine->destroy(mi);
+        }
+        lights.clear();
+        renderables.clear();
+        materialInstances.clear();
+        roots.clear();
+        rootTransforms.clear();
+        lightPositions.clear();
+        engine->destroy(vertexBuffer);
+        engine->destroy(indexBuffer);
+        engine->destroy(camera);
+        engine->destroy(view);
+        engine->destroy(scene);
+        engine->destroy(renderer);
+        engine->destroy(swapChain);
+        Engine::destroy(&engine);
+    }
+
+    // moves the roots of the hierarchies and the lights
+    void animate() {
+        frame++;
+        TransformManager& tcm = engine->getTransformManager();
+        const float angle = frame * 0.01f;
+        const mat4f rotation = mat4f::rotate(angle, float3{ 0, 1, 0 });
+        for (size_t i = 0, c = roots.size(); i < c; i++) {
+            tcm.setTransform(tcm.getInstance(roots[i]), rootTransforms[i] * rotation);
+        }
+        LightManager& lcm = engine->getLightManager();
+        for (size_t i = 0, c = lights.size(); i < c; i++) {
+            const float3 offset = { sinf(angle + i), 0, cosf(angle + i) };
+            lcm.setPosition(lcm.getInstance(lights[i]), lightPositions[i] + offset);
+        }
+    }
+
+    // returns false if the renderer skipped the frame
+    bool renderFrame() {
+        if (!renderer->beginFrame(swapChain)) {
+            return false;
+        }
+        renderer->render(view);
+        renderer->endFrame();
+        return true;
+    }
+
+    // runs what the renderer does before generating the commands
+    void prepareView() {
+        FEngine& fengine = upcast(*engine);
+        filament::details::ArenaScope scope(*arena);
+        FView* fview = upcast(view);
+        fview->prepare(fengine, fengine.getDriverApi(), scope, fview->getViewport(), {});
+    }
+
+    RenderPass::RenderFlags getRenderFlags() const {
+        FView const* fview = upcast(view);
+        RenderPass::RenderFlags flags = 0;
+        if (fview->hasDirectionalLight()) flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
+        if (fview->hasDynamicLighting())  flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
+        return flags;
+    }
+};
+
+constexpr float3 FrameFixture::CUBE_VERTICES[8];
+constexpr uint16_t FrameFixture::CUBE_INDICES[36];
+
+static void frameArguments(benchmark::internal::Benchmark* b) {
+    b->ArgNames({ "renderables", "lights", "depth", "materials" });
+    // a reference scene, then each parameter varied on its own
+    b->Args({ 4096, 64, 1, 16 });
+    b->Args({ 1024, 64, 1, 16 });
+    b->Args({ 4096, 0, 1, 16 });
+    b->Args({ 4096, 256, 1, 16 });
+    b->Args({ 4096, 64, 4, 16 });
+    b->Args({ 4096, 64, 16, 16 });
+    b->Args({ 4096, 64, 1, 1 });
+    b->Args({ 4096, 64, 1, 128 });
+    b->Unit(benchmark::kMicrosecond);
+}
+
+// Renderer::beginFrame(), render() and endFrame()
+BENCHMARK_DEFINE_F(FrameFixture, render)(benchmark::State& state) {
+    size_t skipped = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        animate();
+        state.ResumeTiming();
+        skipped += renderFrame() ? 0 : 1;
+    }
+    state.counters["skipped"] = skipped;
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// FScene::prepare(), which gathers the renderables and the lights
+BENCHMARK_DEFINE_F(FrameFixture, scenePrepare)(benchmark::State& state) {
+    FScene* fscene = upcast(scene);
+    for (auto _ : state) {
+        state.PauseTiming();
+        animate();
+        state.ResumeTiming();
+        fscene->prepare(mat4f{});
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// frustum culling of the renderables
+BENCHMARK_DEFINE_F(FrameFixture, culling)(benchmark::State& state) {
+    FEngine& fengine = upcast(*engine);
+    FScene* fscene = upcast(scene);
+    FCamera const* fcamera = upcast(camera);
+    const Frustum frustum = FCamera::getFrustum(fcamera->getCullingProjectionMatrix(),
+            FCamera::getViewMatrix(fcamera->getModelMatrix()));
+    for (auto _ : state) {
+        state.PauseTiming();
+        animate();
+        fscene->prepare(mat4f{});
+        state.ResumeTiming();
+        // bit 0 is the one the view uses for the renderables
+        FView::cullRenderables(fengine.getJobSystem(), fscene->getRenderableData(), frustum, 0,
+                fscene->getBoundingVolumeHierarchy());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// froxelization of the lights visible this frame
+BENCHMARK_DEFINE_F(FrameFixture, froxelize)(benchmark::State& state) {
+    FEngine& fengine = upcast(*engine);
+    FView* fview = upcast(view);
+    for (auto _ : state) {
+        state.PauseTiming();
+        animate();
+        prepareView();
+        state.ResumeTiming();
+        fview->froxelize(fengine);
+        state.PauseTiming();
+        fview->commitFroxels(fengine.getDriverApi());
+        fengine.flush();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+// generation and sort of the commands of the depth and color passes
+BENCHMARK_DEFINE_F(FrameFixture, generateCommands)(benchmark::State& state) {
+    FEngine& fengine = upcast(*engine);
+    FView* fview = upcast(view);
+    const size_t capacity = FEngine::CONFIG_PER_FRAME_COMMANDS_SIZE / sizeof(RenderPass::Command);
+    std::vector<RenderPass::Command> storage(capacity);
+    CommandPass pass;
+    for (auto _ : state) {
+        state.PauseTiming();
+        animate();
+        prepareView();
+        fengine.flush();
+        GrowingSlice<RenderPass::Command> commands(storage.data(), storage.size());
+        state.ResumeTiming();
+        pass.appendSortedCommands(fengine, fengine.getJobSystem(), *fview->getScene(),
+                fview->getVisibleRenderables(), RenderPass::DEPTH_AND_COLOR, getRenderFlags(),
+                fview->getCameraInfo(), commands, nullptr);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// recording of the sorted commands of the depth and color passes into the command stream
+BENCHMARK_DEFINE_F(FrameFixture, recordCommands)(benchmark::State& state) {
+    FEngine& fengine = upcast(*engine);
+    FView* fview = upcast(view);
+    FEngine::DriverApi& driver = fengine.getDriverApi();
+    const size_t capacity = FEngine::CONFIG_PER_FRAME_COMMANDS_SIZE / sizeof(RenderPass::Command);
+    std::vector<RenderPass::Command> storage(capacity);
+    GrowingSlice<RenderPass::Command> commands(storage.data(), storage.size());
+
+    animate();
+    prepareView();
+    CommandPass pass;
+    Slice<RenderPass::Command> sorted = pass.appendSortedCommands(fengine,
+            fengine.getJobSystem(), *fview->getScene(), fview->getVisibleRenderables(),
+            RenderPass::DEPTH_AND_COLOR, getRenderFlags(), fview->getCameraInfo(), commands,
+            nullptr);
+
+    for (auto _ : state) {
+        RenderPass::recordDriverCommands(fengine.getJobSystem(), driver, *fview->getScene(),
+                sorted, {});
+        state.PauseTiming();
+        // the driver thread consumes the commands, so that the stream never fills up
+        fengine.flush();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * (sorted.size() - 1));
+}
+
+BENCHMARK_REGISTER_F(FrameFixture, render)->Apply(frameArguments);
+BENCHMARK_REGISTER_F(FrameFixture, scenePrepare)->Apply(frameArguments);
+BENCHMARK_REGISTER_F(FrameFixture, culling)->Apply(frameArguments);
+BENCHMARK_REGISTER_F(FrameFixture, froxelize)->Apply(frameArguments);
+BENCHMARK_REGISTER_F(FrameFixture, generateCommands)->Apply(frameArguments);
+BENCHMARK_REGISTER_F(FrameFixture, recordCommands)->Apply(frameArguments);
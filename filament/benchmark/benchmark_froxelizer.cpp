@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Engine.h>
+#include <filament/LightManager.h>
+#include <filament/Scene.h>
+
+#include "details/Allocators.h"
+#include "details/Camera.h"
+#include "details/Engine.h"
+#include "details/Froxelizer.h"
+#include "details/Scene.h"
+
+#include <utils/EntityManager.h>
+
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace filament::details;
+using namespace math;
+using namespace utils;
+
+/*
+ * Measures the per-frame cost of the punctual lights of a scene containing range(0) point and
+ * spot lights, all in front of the camera:
+ *  - sortLights: sorting them and keeping the CONFIG_MAX_LIGHT_COUNT closest ones,
+ *  - froxelizeLights: froxelizing them, there are at most CONFIG_MAX_LIGHT_COUNT.
+ */
+class FroxelizerFixture : public benchmark::Fixture {
+protected:
+    Engine* engine = nullptr;
+    Scene* scene = nullptr;
+    std::vector<Entity> lights;
+    Froxelizer* froxelizer = nullptr;
+    LinearAllocatorArena* arena = nullptr;
+    CameraInfo camera = {};
+    Viewport viewport{ 0, 0, 1920, 1080 };
+
+public:
+    void SetUp(benchmark::State& state) override {
+        const size_t count = size_t(state.range(0));
+        engine = Engine::create(Engine::Backend::NOOP);
+        scene = engine->createScene();
+
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> x(-40.0f, 40.0f);
+        std::uniform_real_distribution<float> y(0.0f, 10.0f);
+        std::uniform_real_distribution<float> z(-100.0f, -1.0f);
+        std::uniform_real_distribution<float> radius(2.0f, 10.0f);
+        std::uniform_int_distribution<int> isSpot(0, 1);
+
+        lights.resize(count);
+        EntityManager::get().create(count, lights.data());
+        for (Entity e : lights) {
+            const auto type = isSpot(gen) ? LightManager::Type::SPOT : LightManager::Type::POINT;
+            LightManager::Builder(type)
+                    .position({ x(gen), y(gen), z(gen) })
+                    .direction({ 0, -1, 0 })
+                    .falloff(radius(gen))
+                    .spotLightCone(0.3f, 0.6f)
+                    .build(*engine, e);
+            scene->addEntity(e);
+        }
+
+        FEngine& fengine = upcast(*engine);
+        froxelizer = new Froxelizer(fengine);
+        arena = new LinearAllocatorArena("benchmark", 4 * 1024 * 1024);
+
+        camera.projection = mat4f::perspective(60.0f,
+                float(viewport.width) / float(viewport.height), 0.1f, 100.0f);
+        camera.cullingProjection = camera.projection;
+        camera.zn = 0.1f;
+        camera.zf = 100.0f;
+    }
+
+    void TearDown(benchmark::State& state) override {
+        FEngine& fengine = upcast(*engine);
+        froxelizer->terminate(fengine.getDriverApi());
+        delete froxelizer;
+        delete arena;
+        for (Entity e : lights) {
+            engine->destroy(e);
+        }
+        EntityManager::get().destroy(lights.size(), lights.data());
+        lights.clear();
+        engine->destroy(scene);
+        Engine::destroy(&engine);
+    }
+};
+
+BENCHMARK_DEFINE_F(FroxelizerFixture, sortLights)(benchmark::State& state) {
+    FScene* fscene = upcast(scene);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        // this restores all the lights, prepareDynamicLights() drops those in excess
+        fscene->prepare(mat4f{});
+        state.ResumeTiming();
+
+        filament::details::ArenaScope scope(*arena);
+        fscene->prepareDynamicLights(camera, scope, froxelizer->getLightBuffer());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_DEFINE_F(FroxelizerFixture, froxelizeLights)(benchmark::State& state) {
+    FEngine& fengine = upcast(*engine);
+    FScene* fscene = upcast(scene);
+    FEngine::DriverApi& driver = fengine.getDriverApi();
+
+    for (auto _ : state) {
+        filament::details::ArenaScope scope(*arena);
+
+        state.PauseTiming();
+        fscene->prepare(mat4f{});
+        fscene->prepareDynamicLights(camera, scope, froxelizer->getLightBuffer());
+        state.ResumeTiming();
+
+        froxelizer->prepare(fengine, driver, scope, viewport, camera, fscene->getLightData());
+        froxelizer->froxelizeLights(fengine);
+
+        state.PauseTiming();
+        froxelizer->commit(driver);
+        fengine.flush();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(FroxelizerFixture, sortLights)->RangeMultiplier(4)->Range(64, 4096);
+BENCHMARK_REGISTER_F(FroxelizerFixture, froxelizeLights)->RangeMultiplier(2)
+        ->Range(16, CONFIG_MAX_LIGHT_COUNT);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "RenderPass.h"
+
+#include <utils/JobSystem.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace filament::details;
+using namespace utils;
+
+/*
+ * Measures the sorting of range(0) commands, with keys shaped like the ones generated for a
+ * depth + color pass.
+ */
+class SortFixture : public benchmark::Fixture {
+protected:
+    using Command = RenderPass::Command;
+    JobSystem* js = nullptr;
+    std::vector<Command> keys;
+    std::vector<Command> commands;
+    std::vector<Command> scratch;
+
+public:
+    void SetUp(benchmark::State& state) override {
+        const size_t count = size_t(state.range(0));
+        std::default_random_engine gen; // NOLINT
+        std::uniform_int_distribution<uint32_t> distance;
+        std::uniform_int_distribution<uint32_t> material(0, 255);
+        std::uniform_int_distribution<uint32_t> pass(0, 99);
+
+        keys.resize(count);
+        for (Command& cmd : keys) {
+            const uint32_t p = pass(gen);
+            if (p < 45) {
+                cmd.key = uint64_t(RenderPass::Pass::DEPTH) |
+                        RenderPass::makeField(distance(gen), RenderPass::DISTANCE_BITS_MASK,
+                                RenderPass::DISTANCE_BITS_SHIFT);
+            } else if (p < 90) {
+                cmd.key = uint64_t(RenderPass::Pass::COLOR) |
+                        RenderPass::makeMaterialSortingKey(material(gen), material(gen));
+            } else if (p < 98) {
+                cmd.key = uint64_t(RenderPass::Pass::BLENDED) |
+                        RenderPass::makeFieldTruncate(distance(gen),
+                                RenderPass::BLEND_DISTANCE_MASK, RenderPass::BLEND_DISTANCE_SHIFT);
+            } else {
+                cmd.key = uint64_t(RenderPass::Pass::SENTINEL);
+            }
+        }
+        commands.resize(count);
+        scratch.resize(count);
+
+        js = new JobSystem();
+        js->adopt();
+    }
+
+    void TearDown(benchmark::State& state) override {
+        js->emancipate();
+        delete js;
+        js = nullptr;
+    }
+};
+
+BENCHMARK_DEFINE_F(SortFixture, stdSort)(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::copy(keys.begin(), keys.end(), commands.begin());
+        state.ResumeTiming();
+        std::sort(commands.begin(), commands.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_DEFINE_F(SortFixture, radixSort)(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::copy(keys.begin(), keys.end(), commands.begin());
+        state.ResumeTiming();
+        RenderPass::sortCommands(*js,
+                commands.data(), commands.data() + commands.size(), scratch.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(SortFixture, stdSort)->Arg(10000)->Arg(100000)->Arg(1000000);
+BENCHMARK_REGISTER_F(SortFixture, radixSort)->Arg(10000)->Arg(100000)->Arg(1000000);
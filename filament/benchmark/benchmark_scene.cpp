@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Box.h>
+#include <filament/Engine.h>
+#include <filament/RenderableManager.h>
+#include <filament/Scene.h>
+#include <filament/TransformManager.h>
+
+#include "details/Scene.h"
+
+#include <utils/EntityManager.h>
+
+#include <vector>
+#include <random>
+
+using namespace filament;
+using namespace filament::details;
+using namespace math;
+using namespace utils;
+
+/*
+ * Measures FScene::prepare() on a scene of range(0) renderables, when range(1) of them
+ * moved since the previous frame.
+ */
+class SceneFixture : public benchmark::Fixture {
+protected:
+    Engine* engine = nullptr;
+    Scene* scene = nullptr;
+    std::vector<Entity> entities;
+
+public:
+    void SetUp(benchmark::State& state) override {
+        const size_t count = size_t(state.range(0));
+        engine = Engine::create(Engine::Backend::NOOP);
+        scene = engine->createScene();
+        entities.resize(count);
+        EntityManager::get().create(count, entities.data());
+        for (Entity e : entities) {
+            RenderableManager::Builder(0)
+                    .boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }})
+                    .build(*engine, e);
+            scene->addEntity(e);
+        }
+    }
+
+    void TearDown(benchmark::State& state) override {
+        for (Entity e : entities) {
+            engine->destroy(e);
+        }
+        EntityManager::get().destroy(entities.size(), entities.data());
+        entities.clear();
+        engine->destroy(scene);
+        Engine::destroy(&engine);
+    }
+
+    void moveRenderables(size_t changes, std::default_random_engine& gen) {
+        TransformManager& tcm = engine->getTransformManager();
+        std::uniform_int_distribution<size_t> index(0, entities.size() - 1);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        for (size_t i = 0; i < changes; i++) {
+            auto ti = tcm.getInstance(entities[index(gen)]);
+            tcm.setTransform(ti, mat4f::translate(
+                    float3{ position(gen), position(gen), position(gen) }));
+        }
+    }
+};
+
+static void sceneArguments(benchmark::internal::Benchmark* b) {
+    for (int64_t count : { 1024, 8192, 65536 }) {
+        for (int64_t changes : { 0, 16, 256, 4096 }) {
+            if (changes <= count) {
+                b->Args({ count, changes });
+            }
+        }
+    }
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, prepareIncremental)(benchmark::State& state) {
+    FScene* fscene = upcast(scene);
+    std::default_random_engine gen; // NOLINT
+    const size_t changes = size_t(state.range(1));
+
+    // the first prepare() gathers everything
+    fscene->prepare(mat4f{});
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        moveRenderables(changes, gen);
+        state.ResumeTiming();
+        fscene->prepare(mat4f{});
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, prepareFull)(benchmark::State& state) {
+    FScene* fscene = upcast(scene);
+    std::default_random_engine gen; // NOLINT
+    const size_t changes = size_t(state.range(1));
+
+    // changing the world origin every frame forces prepare() to gather everything
+    const mat4f origins[2] = { mat4f{}, mat4f::translate(float3{ 1, 0, 0 }) };
+    size_t frame = 0;
+    fscene->prepare(origins[frame]);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        moveRenderables(changes, gen);
+        state.ResumeTiming();
+        fscene->prepare(origins[++frame & 1]);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(SceneFixture, prepareIncremental)->Apply(sceneArguments);
+BENCHMARK_REGISTER_F(SceneFixture, prepareFull)->Apply(sceneArguments);
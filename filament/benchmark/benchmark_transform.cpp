@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "components/TransformManager.h"
+
+#include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
+
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace filament::details;
+using namespace math;
+using namespace utils;
+
+/*
+ * Measures commitLocalTransformTransaction() on a hierarchy of range(0) nodes, when the local
+ * transform of range(1) of them changed during the transaction.
+ */
+class TransformFixture : public benchmark::Fixture {
+protected:
+    JobSystem js;
+    FTransformManager tcm{ &js };
+    std::vector<Entity> entities;
+
+public:
+    void SetUp(benchmark::State& state) override {
+        const size_t count = size_t(state.range(0));
+        js.adopt();
+        entities.resize(count);
+        EntityManager::get().create(count, entities.data());
+
+        // a forest of shallow trees, each node has up to 8 children
+        std::default_random_engine gen; // NOLINT
+        for (size_t i = 0; i < count; i++) {
+            TransformManager::Instance parent;
+            if (i >= 16) {
+                std::uniform_int_distribution<size_t> index(0, i / 8);
+                parent = tcm.getInstance(entities[index(gen)]);
+            }
+            tcm.create(entities[i], parent, mat4f::translate(float3{ 1, 0, 0 }));
+        }
+    }
+
+    void TearDown(benchmark::State& state) override {
+        for (Entity e : entities) {
+            tcm.destroy(e);
+        }
+        EntityManager::get().destroy(entities.size(), entities.data());
+        entities.clear();
+        js.emancipate();
+    }
+};
+
+BENCHMARK_DEFINE_F(TransformFixture, commit)(benchmark::State& state) {
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<size_t> index(0, entities.size() - 1);
+    const size_t changes = size_t(state.range(1));
+    for (auto _ : state) {
+        tcm.openLocalTransformTransaction();
+        for (size_t i = 0; i < changes; i++) {
+            auto ti = tcm.getInstance(entities[index(gen)]);
+            tcm.setTransform(ti, mat4f::translate(float3{ 1, 0, 0 }));
+        }
+        tcm.commitLocalTransformTransaction();
+    }
+}
+
+BENCHMARK_REGISTER_F(TransformFixture, commit)
+        ->Args({ 100000, 1000 })
+        ->Args({ 100000, 100000 });
@@ -21,6 +21,7 @@
 
 #include <limits>
 
+#include <math/affine.h>
 #include <math/mat4.h>
 #include <math/vec3.h>
 
@@ -64,6 +65,7 @@ public:
 
     friend Box rigidTransform(Box const& box, const math::mat4f& m) noexcept;
     friend Box rigidTransform(Box const& box, const math::mat3f& m) noexcept;
+    friend Box rigidTransform(Box const& box, const math::affinef& m) noexcept;
 };
 
 struct Aabb {
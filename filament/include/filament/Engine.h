@@ -182,6 +182,30 @@ public:
     static Engine* create(Backend backend = Backend::DEFAULT,
             Platform* platform = nullptr, void* sharedGLContext = nullptr);
 
+    /**
+     * Creates an Engine like create(), which also writes every command it sends to the backend,
+     * including the content of the buffers they reference, into a trace file. The trace can be
+     * replayed on any backend with the `cmdreplay` tool, for instance to benchmark the rendering
+     * of a scene without the application, or to reproduce its GPU load.
+     *
+     * The capture starts with the Engine, before it creates its own objects, so that the trace
+     * creates every object its commands use. A capture can't be started on an Engine that
+     * already exists, because the content of its buffers and textures is not kept once it's
+     * sent to the backend. The capture ends when stopCommandCapture() is called or when the
+     * Engine is destroyed. Only one capture can be in progress at a time.
+     *
+     * @param path              Path of the trace file to create.
+     * @param backend           Driver backend to use, see create().
+     * @param platform          A pointer to an object that implements Platform, see create().
+     * @param sharedGLContext   A platform-dependant OpenGL context, see create().
+     *
+     * @return A pointer to the newly created Engine, or nullptr if the Engine couldn't be
+     *         created, if the trace file couldn't be created or if another capture is in
+     *         progress.
+     */
+    static Engine* createWithCommandCapture(const char* path, Backend backend = Backend::DEFAULT,
+            Platform* platform = nullptr, void* sharedGLContext = nullptr);
+
     /**
      * Destroy the Engine instance and all associated resources.
      *
@@ -316,6 +340,38 @@ public:
      */
     void* streamAlloc(size_t size, size_t alignment = alignof(double)) noexcept;
 
+    /**
+     * Statistics of the pool of offscreen render targets used for post-processing.
+     */
+    struct RenderTargetPoolStats {
+        uint32_t hits;          //!< number of render targets reused from the pool
+        uint32_t misses;        //!< number of render targets that had to be allocated
+        uint32_t evictions;     //!< number of render targets freed by the pool
+        size_t bytesResident;   //!< approximate GPU memory used by the pool, in bytes
+        size_t bytesInUse;      //!< part of bytesResident used by the frames being rendered
+    };
+
+    /**
+     * Sets the amount of GPU memory the pool of offscreen render targets tries to stay under.
+     * The least recently used render targets are freed when needed. Render targets in use
+     * by the frame being rendered are never freed, so the budget can be exceeded temporarily.
+     *
+     * @param bytes Budget in bytes, the default is 128 MiB.
+     */
+    void setRenderTargetPoolBudget(size_t bytes) noexcept;
+
+    //! Returns the budget set by setRenderTargetPoolBudget(), in bytes.
+    size_t getRenderTargetPoolBudget() const noexcept;
+
+    /**
+     * Returns the statistics of the pool of offscreen render targets. Counters are cumulative
+     * since the Engine was created.
+     */
+    RenderTargetPoolStats getRenderTargetPoolStats() const noexcept;
+
+    //! Stops the capture started by createWithCommandCapture() and closes the trace file.
+    void stopCommandCapture() noexcept;
+
 
     /**
      * helper for creating an Entity and Camera component in one call
@@ -117,6 +117,9 @@ class FLightManager;
  * It therefore makes sense to provide artists with a parameter to disable this coupling. This
  * is the difference between Type.SPOT and Type.FOCUSED_SPOT.
  *
+ * Spot lights are able to cast shadows. The most important ones on screen, up to 8 per View,
+ * share the View's shadow atlas, see View::setShadowAtlasOptions().
+ *
  * @see Builder.position(), Builder.direction(), Builder.falloff(), Builder.spotLightCone()
  *
  * Performance considerations
@@ -172,11 +175,22 @@ public:
         SPOT,           //!< Physically correct spot light.
     };
 
+    /**
+     * How often the shadows of a light are expected to change.
+     */
+    enum class ShadowHint : uint8_t {
+        DYNAMIC,    //!< The shadow map is rendered every frame.
+        STATIC,     //!< The shadow map is rendered only when the engine detects a change.
+    };
+
     /**
      * Control the quality / performance of the shadow map associated to this light
      */
     struct ShadowOptions {
-        /** size of the shadow map in texels. Must be a power-of-two. */
+        /** size of the shadow map in texels. Must be a power-of-two.
+         * For spot lights this is the largest size, the shadow map is smaller when the
+         * light covers a smaller part of the screen.
+         */
         uint32_t mapSize = 1024;
 
         /** constant bias in world units (e.g. meters) by which shadow are moved away from the
@@ -210,6 +224,62 @@ public:
          * use the camera far distance.
          */
         float shadowFarHint = 100.0f;
+
+        /** Number of shadow cascades to use for this light. Must be between 1 and 4.
+         * A value greater than 1 turns on cascaded shadow mapping. Each cascade is a
+         * mapSize x mapSize region of the shadow map texture. Only applicable to Type.SUN
+         * and Type.DIRECTIONAL lights.
+         */
+        uint8_t shadowCascades = 1;
+
+        /** The split positions of the shadow cascades, as fractions of the distance between
+         * the camera near plane and shadowFar (or the camera far plane when shadowFar is 0).
+         * Only the first shadowCascades - 1 values are used, they must be in increasing order
+         * and in ]0, 1[. See ShadowCascades for helpers to compute them.
+         */
+        float cascadeSplitPositions[3] = { 0.25f, 0.50f, 0.75f };
+    };
+
+    /**
+     * Helpers to compute the ShadowOptions::cascadeSplitPositions of a light.
+     * All these methods write cascades - 1 values to splitPositions.
+     */
+    struct ShadowCascades {
+        /**
+         * Splits the shadow distance in cascades of equal length.
+         *
+         * @param splitPositions Array of at least cascades - 1 floats
+         * @param cascades       Number of shadow cascades, between 1 and 4
+         */
+        static void computeUniformSplits(float* splitPositions, uint8_t cascades) noexcept;
+
+        /**
+         * Splits the shadow distance so that the ratio of the far and near distances of all
+         * cascades is the same. This makes the best use of the shadow map resolution, but
+         * the first cascade is often very small.
+         *
+         * @param splitPositions Array of at least cascades - 1 floats
+         * @param cascades       Number of shadow cascades, between 1 and 4
+         * @param near           Camera near plane distance, must be greater than 0
+         * @param far            Shadow far distance, i.e. ShadowOptions::shadowFar or the
+         *                       camera far plane distance
+         */
+        static void computeLogSplits(float* splitPositions, uint8_t cascades,
+                float near, float far) noexcept;
+
+        /**
+         * Blends the logarithmic and uniform splits, the "practical split scheme".
+         *
+         * @param splitPositions Array of at least cascades - 1 floats
+         * @param cascades       Number of shadow cascades, between 1 and 4
+         * @param near           Camera near plane distance, must be greater than 0
+         * @param far            Shadow far distance, i.e. ShadowOptions::shadowFar or the
+         *                       camera far plane distance
+         * @param lambda         Weight of the logarithmic splits, between 0 (uniform splits)
+         *                       and 1 (logarithmic splits)
+         */
+        static void computePracticalSplits(float* splitPositions, uint8_t cascades,
+                float near, float far, float lambda) noexcept;
     };
 
     //! Use Builder to construct a Light object instance
@@ -236,7 +306,9 @@ public:
          * @return This Builder, for chaining calls.
          *
          * @warning
-         * - Only a Type.DIRECTIONAL or Type.SUN light can cast shadows
+         * - Only Type.DIRECTIONAL, Type.SUN, Type.SPOT and Type.FOCUSED_SPOT lights can cast
+         *   shadows
+         * - At most 8 spot lights cast shadows in a View, picked by their size on screen
          */
         Builder& castShadows(bool enable) noexcept;
 
@@ -638,6 +710,27 @@ public:
      * @return the halo falloff
      */
     float getSunHaloFalloff(Instance i) const noexcept;
+
+    /**
+     * Hints whether the shadows of this light change every frame.
+     *
+     * With ShadowHint::STATIC, the shadow map of the light is reused from the previous frame
+     * when the light, its shadow camera and the shadow casters didn't change. Setting a
+     * parameter of a caster's material instance updates the shadow map, but casters whose
+     * vertices move without any change of their transform, geometry or parameters (e.g.
+     * vertex animation driven by the time in the material) don't. Skinned casters always do.
+     *
+     * @param i     Instance of the component obtained from getInstance().
+     * @param hint  ShadowHint::DYNAMIC (the default) or ShadowHint::STATIC.
+     */
+    void setShadowHint(Instance i, ShadowHint hint) noexcept;
+
+    /**
+     * returns the shadow hint of this light.
+     * @param i     Instance of the component obtained from getInstance().
+     * @return the shadow hint of this light.
+     */
+    ShadowHint getShadowHint(Instance i) const noexcept;
 };
 
 } // namespace filament
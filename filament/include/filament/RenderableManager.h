@@ -59,6 +59,9 @@ public:
         float reserved = 0;
     };
 
+    // maximum number of levels of detail of a renderable
+    static constexpr size_t MAX_LEVEL_COUNT = 8;
+
     class Builder : public BuilderBase<BuilderDetails> {
         friend struct BuilderDetails;
     public:
@@ -82,6 +85,11 @@ public:
         Builder& culling(bool enable) noexcept; // true by default
         Builder& castShadows(bool enable) noexcept; // false by default
         Builder& receiveShadows(bool enable) noexcept; // true by default
+
+        // Occluders hide the renderables behind them when occlusion culling is enabled on the
+        // View. They are rasterized using their world-space bounding box, so only renderables
+        // that fill it (e.g. walls, floors, buildings) should be marked as occluders.
+        Builder& occluder(bool enable) noexcept; // false by default
         Builder& skinning(size_t boneCount) noexcept; // 0 by default, 255 max
         Builder& skinning(size_t boneCount, Bone const* bones) noexcept;
         Builder& skinning(size_t boneCount, math::mat4f const* transforms) noexcept;
@@ -89,6 +97,23 @@ public:
         // Sets an ordering index for blended primitives that all live at the same Z value.
         Builder& blendOrder(size_t index, uint16_t order) noexcept; // 0 by default
 
+        /**
+         * Declares that the primitives [first, first + count) form the given level of detail.
+         *
+         * Level 0 is the most detailed, levels must be declared without gaps and their errors
+         * must not decrease. Each frame, a View draws the coarsest level whose error, projected
+         * on screen, stays below View::LevelOfDetailOptions::threshold.
+         * Primitives that are not part of any level are never drawn. Renderables without levels
+         * of detail draw all their primitives.
+         *
+         * @param level Level of detail, in the range [0, MAX_LEVEL_COUNT).
+         * @param first Index of the first primitive of this level.
+         * @param count Number of primitives in this level.
+         * @param error Largest distance between the surface of this level and the surface of
+         *              the most detailed geometry, in the renderable's local units.
+         */
+        Builder& levelOfDetail(uint8_t level, size_t first, size_t count, float error) noexcept;
+
         /**
          * Adds the Renderable component to an entity.
          *
@@ -137,6 +162,10 @@ public:
     bool isShadowCaster(Instance instance) const noexcept;
     bool isShadowReceiver(Instance instance) const noexcept;
 
+    // changes whether this renderable is used as an occluder, see Builder::occluder()
+    void setOccluder(Instance instance, bool enable) noexcept;
+    bool isOccluder(Instance instance) const noexcept;
+
     void setBones(Instance instance, Bone const* transforms, size_t boneCount = 1, size_t offset = 0) noexcept;
     void setBones(Instance instance, math::mat4f const* transforms, size_t boneCount = 1, size_t offset = 0) noexcept;
 
@@ -144,9 +173,13 @@ public:
     // getters...
     const Box& getAxisAlignedBoundingBox(Instance instance) const noexcept;
 
-    // number of render primitives in this renderable
+    // number of render primitives in this renderable, of all levels of detail
+    // primitives are addressed by the index they were given to the Builder
     size_t getPrimitiveCount(Instance instance) const noexcept;
 
+    // number of levels of detail of this renderable, 1 if none were declared
+    size_t getLevelCount(Instance instance) const noexcept;
+
     // set/change the material of a given render primitive
     void setMaterialInstanceAt(Instance instance,
             size_t primitiveIndex, MaterialInstance const* materialInstance) noexcept;
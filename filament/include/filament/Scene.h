@@ -114,6 +114,27 @@ public:
      * @return The total number of Light objects in the Scene.
      */
     size_t getLightCount() const noexcept;
+
+    /**
+     * Enables or disables the bounding volume hierarchy used to accelerate culling.
+     *
+     * When enabled, the Scene maintains a hierarchy of the bounding boxes of its Renderables,
+     * which lets culling accept or reject large groups of them at once. This is beneficial for
+     * large scenes where most Renderables don't move, but adds some cost when Renderables are
+     * added, removed or moved.
+     *
+     * Disabled by default.
+     *
+     * @param enabled true to enable the bounding volume hierarchy, false to disable it.
+     */
+    void setBoundingVolumeHierarchyEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether the bounding volume hierarchy is enabled.
+     *
+     * @return true if the bounding volume hierarchy is enabled, false otherwise.
+     */
+    bool isBoundingVolumeHierarchyEnabled() const noexcept;
 };
 
 } // namespace filament
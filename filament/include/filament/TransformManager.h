@@ -116,7 +116,8 @@ public:
     /**
      * Set a local transform of a transform component.
      * @param ci              The instance of the transform component to set the local transform to.
-     * @param localTransform  The local transform (i.e. relative to the parent).
+     * @param localTransform  The local transform (i.e. relative to the parent). This must be an
+     *                        affine transform, i.e. its last row must be (0, 0, 0, 1).
      * @see getTransform()
      * @attention This operation can be slow if the hierarchy of transform is too deep, and this
      *            will be particularly bad when updating a lot of transforms. In that case,
@@ -131,7 +132,7 @@ public:
      *         returns the value set by setTransform().
      * @see setTransform()
      */
-    const math::mat4f& getTransform(Instance ci) const noexcept;
+    math::mat4f getTransform(Instance ci) const noexcept;
 
     /**
      * Return the world transform of a transform component.
@@ -141,7 +142,7 @@ public:
      *         transform.
      * @see setTransform()
      */
-    const math::mat4f& getWorldTransform(Instance ci) const noexcept;
+    math::mat4f getWorldTransform(Instance ci) const noexcept;
 
     /**
      * Opens a local transform transaction. During a transaction, getWorldTransform() can
@@ -161,6 +162,11 @@ public:
      * Commits the currently open local transform transaction. When this returns, calls
      * to getWorldTransform() will return the proper value.
      *
+     * Only the world transforms of the components whose local transform changed during the
+     * transaction, and of their descendants, are updated. If the hierarchy changed since the
+     * last commit (see setParent()), components are first reordered, which invalidates all
+     * Instances.
+     *
      * @attention failing to call this method when done updating the local transform will cause
      *            a lot of rendering problems. The system never closes the transaction
      *            automatically.
@@ -77,21 +77,26 @@ public:
      * homogeneousScaling: by default the system scales the major axis first. Set this to true
      *                     to force homogeneous scaling.
      * scaleRate: rate at which the scale will change to reach the target frame rate
-     *            This value can be computed as 1 / N, where N is the number of frames
-     *            needed to reach 64% of the target scale factor.
-     *            Higher values make the dynamic resolution react faster.
+     *            (the integral gain of the controller). This value can be computed as 1 / N,
+     *            where N is roughly the number of frames needed to reach the target scale.
+     *            Higher values make the dynamic resolution react faster. It is limited to
+     *            about 2 / history, above that the resolution would oscillate.
      * targetFrameTimeMilli: desired frame time in milliseconds
      * headRoomRatio: additional headroom for the GPU as a ratio of the targetFrameTime.
      *                Useful for taking into account constant costs like post-processing or
      *                GPU drivers on different platforms.
-     * history:   History size. higher values, tend to filter more (clamped to 30)
+     * history:   History size, the scale follows the median of the last 'history' frame
+     *            times. higher values, tend to filter more (clamped to 32)
      * minScale:  the minimum scale in X and Y this View should use
      * maxScale:  the maximum scale in X and Y this View should use
      *
+     * The scale is driven by the GPU time of each frame when the backend supports timer
+     * queries, otherwise by the time measured between fences. The resolution is never
+     * lowered while the frame is CPU-bound, since it wouldn't make the frame faster.
+     *
      * \note
      * Dynamic resolution is only supported on platforms where the time to render
-     * a frame can be measured accurately. Dynamic resolution is currently only
-     * supported on Android.
+     * a frame can be measured accurately.
      */
     struct DynamicResolutionOptions {
         DynamicResolutionOptions() = default;
@@ -137,6 +142,84 @@ public:
         QualityLevel hdrColorBuffer = QualityLevel::HIGH; //!< quality of the color buffer
     };
 
+    /**
+     * Options for the software occlusion culling of a View.
+     *
+     * When enabled, the bounding boxes of the renderables marked as occluders (see
+     * RenderableManager::Builder::occluder()) are rasterized on the CPU in a small depth buffer,
+     * and renderables entirely hidden behind them are culled before any draw call is
+     * generated for them.
+     *
+     * enabled:    enable or disable occlusion culling on a View
+     * resolution: width in pixels of the depth buffer used for occlusion culling, its height
+     *             is derived from the aspect ratio of the viewport. Higher values cull more
+     *             objects, at a higher CPU cost.
+     */
+    struct OcclusionCullingOptions {
+        uint16_t resolution = 256;      //!< width of the occlusion depth buffer
+        bool enabled = false;           //!< enable or disable occlusion culling
+    };
+
+    /**
+     * Occlusion culling statistics of the last frame rendered with a View.
+     */
+    struct OcclusionCullingStats {
+        uint32_t occluders = 0;         //!< number of visible occluders
+        uint32_t tested = 0;            //!< number of renderables tested against the occluders
+        uint32_t occluded = 0;          //!< number of renderables found to be hidden
+    };
+
+    /**
+     * GPU memory used by the intermediate buffers of post-processing during the last frame
+     * rendered with a View, not counting the buffer the scene is rendered into. Buffers that
+     * are not needed at the same time share their memory. Sizes are estimates, drivers may pad
+     * or compress buffers.
+     */
+    struct PostProcessingMemoryStats {
+        size_t peak = 0;                //!< largest amount of memory in use at once, in bytes
+        size_t unaliased = 0;           //!< memory needed if no buffers were shared, in bytes
+        uint32_t buffers = 0;           //!< number of intermediate buffers
+        uint32_t allocations = 0;       //!< number of buffers actually allocated
+    };
+
+    /**
+     * Options for the selection of the level of detail of renderables.
+     *
+     * Each frame, a View draws the coarsest level of detail of a renderable whose error,
+     * projected on screen, is smaller than the threshold. A renderable switches to a coarser
+     * level only once the error of that level is smaller than (1 - hysteresis) * threshold,
+     * which prevents levels from flickering when the error is close to the threshold.
+     * Each View keeps track of the levels it selected, so that several Views of the same
+     * renderables don't interfere. The error is projected in the viewport actually rendered,
+     * i.e. after dynamic resolution scaling.
+     *
+     * @see RenderableManager::Builder::levelOfDetail()
+     */
+    struct LevelOfDetailOptions {
+        float threshold = 1.0f;         //!< maximum screen-space error, in pixels
+        float hysteresis = 0.25f;       //!< fraction of the threshold, between 0 and 1
+    };
+
+    /**
+     * Options for the shadow atlas of a View.
+     *
+     * The shadow maps of the directional light and of up to 8 shadow casting spot lights are
+     * stored in a single depth texture, the shadow atlas. Each frame, the spot lights that
+     * matter most on screen get the largest shadow maps (at most their
+     * LightManager::ShadowOptions::mapSize), and the rest share what's left of the atlas.
+     *
+     * maxSize:      width and height in texels that the shadow atlas can't exceed, must be a
+     *               power of two. The atlas is made larger if the directional light's shadow
+     *               map doesn't fit.
+     * updateBudget: maximum number of spot light shadow maps rendered per frame. The others
+     *               keep their content from a previous frame. Spot lights with static shadows
+     *               are not counted, since they are only rendered when something changed.
+     */
+    struct ShadowAtlasOptions {
+        uint16_t maxSize = 4096;        //!< maximum width and height of the shadow atlas
+        uint8_t updateBudget = 4;       //!< spot light shadow maps rendered per frame
+    };
+
     /**
      * List of available post-processing anti-aliasing techniques.
      */
@@ -389,6 +472,59 @@ public:
      */
     DynamicResolutionOptions getDynamicResolutionOptions() const noexcept;
 
+    /**
+     * Sets the occlusion culling options for this view. Occlusion culling is disabled by
+     * default.
+     *
+     * @param options The occlusion culling options to use on this view
+     */
+    void setOcclusionCullingOptions(OcclusionCullingOptions const& options) noexcept;
+
+    /**
+     * Returns the occlusion culling options associated with this view.
+     * @return value set by setOcclusionCullingOptions().
+     */
+    OcclusionCullingOptions getOcclusionCullingOptions() const noexcept;
+
+    /**
+     * Returns how many renderables were tested and culled by occlusion culling during the last
+     * frame rendered with this view. All values are zero when occlusion culling is disabled.
+     */
+    OcclusionCullingStats getOcclusionCullingStats() const noexcept;
+
+    /**
+     * Returns how much GPU memory post-processing used during the last frame rendered with
+     * this view. All values are zero when post-processing is disabled.
+     */
+    PostProcessingMemoryStats getPostProcessingMemoryStats() const noexcept;
+
+    /**
+     * Sets the options used to select the level of detail of the renderables drawn by this
+     * view.
+     *
+     * @param options The level of detail options to use on this view
+     */
+    void setLevelOfDetailOptions(LevelOfDetailOptions const& options) noexcept;
+
+    /**
+     * Returns the level of detail options associated with this view.
+     * @return value set by setLevelOfDetailOptions().
+     */
+    LevelOfDetailOptions getLevelOfDetailOptions() const noexcept;
+
+    /**
+     * Sets the options of the shadow atlas used by this view's shadow casting lights.
+     *
+     * @param options The shadow atlas options to use on this view
+     */
+    void setShadowAtlasOptions(ShadowAtlasOptions const& options) noexcept;
+
+    /**
+     * Returns the shadow atlas options associated with this view.
+     * @return value set by setShadowAtlasOptions().
+     */
+    ShadowAtlasOptions getShadowAtlasOptions() const noexcept;
+
     /**
      * Sets the rendering quality for this view. Refer to RenderQuality for more
      * information about the different settings available.
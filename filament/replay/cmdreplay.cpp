@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <filament/Engine.h>
+#include <filament/Fence.h>
+
+#include "details/Engine.h"
+
+#include "driver/CommandReplay.h"
+
+#include <utils/Path.h>
+
+#include <getopt/getopt.h>
+
+#include <SDL.h>
+
+#include <NativeWindowHelper.h>
+
+#include <algorithm>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace filament;
+using namespace filament::details;
+using namespace utils;
+
+struct Config {
+    Engine::Backend backend = Engine::Backend::NOOP;
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t repeat = 1;
+};
+
+static void printUsage(const char* name) {
+    std::string execName(Path(name).getName());
+    std::string usage(
+            "CMDREPLAY replays a trace captured with Engine::createWithCommandCapture()\n"
+                    "Usage:\n"
+                    "    CMDREPLAY [options] <trace file>\n"
+                    "\n"
+                    "Options:\n"
+                    "   --help, -h\n"
+                    "       Print this message\n\n"
+                    "   --api, -a\n"
+                    "       Specify the backend API: noop (default), opengl, vulkan or metal\n\n"
+                    "   --size=<width>x<height>, -s <width>x<height>\n"
+                    "       Size of the window the trace is replayed on, 1280x720 by default,\n"
+                    "       not used by the noop backend\n\n"
+                    "   --repeat=<count>, -r <count>\n"
+                    "       Replay the trace <count> times\n\n"
+    );
+
+    const std::string from("CMDREPLAY");
+    for (size_t pos = usage.find(from); pos != std::string::npos; pos = usage.find(from, pos)) {
+        usage.replace(pos, from.length(), execName);
+    }
+    printf("%s", usage.c_str());
+}
+
+static int handleArguments(int argc, char* argv[], Config* config) {
+    static constexpr const char* OPTSTR = "ha:s:r:";
+    static const struct option OPTIONS[] = {
+            { "help",   no_argument,       0, 'h' },
+            { "api",    required_argument, 0, 'a' },
+            { "size",   required_argument, 0, 's' },
+            { "repeat", required_argument, 0, 'r' },
+            { 0, 0, 0, 0 }  // termination of the option list
+    };
+
+    int opt;
+    int optionIndex = 0;
+
+    while ((opt = getopt_long(argc, argv, OPTSTR, OPTIONS, &optionIndex)) >= 0) {
+        std::string arg(optarg ? optarg : "");
+        switch (opt) {
+            default:
+            case 'h':
+                printUsage(argv[0]);
+                exit(0);
+            case 'a':
+                if (arg == "noop") {
+                    config->backend = Engine::Backend::NOOP;
+                } else if (arg == "opengl") {
+                    config->backend = Engine::Backend::OPENGL;
+                } else if (arg == "vulkan") {
+                    config->backend = Engine::Backend::VULKAN;
+                } else if (arg == "metal") {
+                    config->backend = Engine::Backend::METAL;
+                } else {
+                    fprintf(stderr, "Unrecognized backend. Must be 'noop', 'opengl', 'vulkan' "
+                            "or 'metal'.\n");
+                    exit(1);
+                }
+                break;
+            case 's':
+                if (sscanf(arg.c_str(), "%ux%u", &config->width, &config->height) != 2 ||
+                        !config->width || !config->height) {
+                    fprintf(stderr, "Invalid size, must be <width>x<height>.\n");
+                    exit(1);
+                }
+                break;
+            case 'r':
+                config->repeat = uint32_t(std::max(1, std::stoi(arg)));
+                break;
+        }
+    }
+
+    return optind;
+}
+
+static void printStats(uint32_t iteration, CommandReplay::Stats const& stats) {
+    const double ms = 1e-6;
+    const double average = stats.frames ? stats.totalNs * ms / stats.frames : 0.0;
+    printf("#%u: %u commands (%u skipped), %u frames, %.3f ms total, "
+           "%.3f ms/frame (min %.3f ms, max %.3f ms)\n",
+            iteration, stats.commands, stats.skipped, stats.frames, stats.totalNs * ms,
+            average, stats.minFrameNs * ms, stats.maxFrameNs * ms);
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    int optionIndex = handleArguments(argc, argv, &config);
+
+    int numArgs = argc - optionIndex;
+    if (numArgs < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const char* const path = argv[optionIndex];
+
+    // the swap chains of the trace are all created for this window, the noop backend needs none
+    SDL_Window* window = nullptr;
+    void* nativeWindow = nullptr;
+    if (config.backend != Engine::Backend::NOOP) {
+        if (SDL_Init(SDL_INIT_EVENTS) != 0) {
+            fprintf(stderr, "SDL_Init failure: %s\n", SDL_GetError());
+            return 1;
+        }
+        window = SDL_CreateWindow(Path(path).getName().c_str(),
+                SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                int(config.width), int(config.height), SDL_WINDOW_SHOWN);
+        nativeWindow = ::getNativeWindow(window);
+#if defined(FILAMENT_DRIVER_SUPPORTS_VULKAN) && defined(__APPLE__)
+        // We request a Metal layer for rendering via MoltenVK.
+        if (config.backend == Engine::Backend::VULKAN) {
+            setUpMetalLayer(nativeWindow);
+        }
+#endif
+    }
+
+    Engine* engine = Engine::create(config.backend);
+    if (!engine) {
+        fprintf(stderr, "Cannot create the engine for the requested backend.\n");
+        return 1;
+    }
+    FEngine& fengine = upcast(*engine);
+
+    int result = 0;
+    for (uint32_t i = 0; i < config.repeat; i++) {
+        bool success = false;
+        CommandReplay::Stats stats;
+
+        // the replay runs on the driver thread, between the commands of the engine
+        fengine.getDriverApi().queueCommand([&fengine, nativeWindow, path, &success, &stats]() {
+            CommandReplay replay(fengine.getDriver(), nativeWindow);
+            success = replay.replay(path);
+            stats = replay.getStats();
+        });
+        Fence::waitAndDestroy(engine->createFence());
+
+        if (!success) {
+            fprintf(stderr, "Cannot replay %s\n", path);
+            result = 1;
+            break;
+        }
+        printStats(i, stats);
+
+        if (window) {
+            SDL_PumpEvents();
+        }
+    }
+
+    Engine::destroy(&engine);
+
+    if (window) {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
+    return result;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/BoundingVolumeHierarchy.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Range.h>
+#include <utils/Systrace.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include <assert.h>
+#include <math.h>
+
+using namespace math;
+using namespace utils;
+
+namespace filament {
+namespace details {
+
+namespace {
+
+enum class Intersection : uint8_t {
+    OUTSIDE, INTERSECTS, INSIDE
+};
+
+// same test as Culler::intersects(), but also tells whether the box is entirely inside
+inline Intersection classify(float4 const* UTILS_RESTRICT planes,
+        float3 const& center, float3 const& extent) noexcept {
+    Intersection result = Intersection::INSIDE;
+    for (size_t j = 0; j < 6; j++) {
+        const float d = planes[j].x * center.x + planes[j].y * center.y +
+                        planes[j].z * center.z + planes[j].w;
+        const float r = std::abs(planes[j].x) * extent.x + std::abs(planes[j].y) * extent.y +
+                        std::abs(planes[j].z) * extent.z;
+        if (!(d - r < 0)) {
+            return Intersection::OUTSIDE;
+        }
+        if (!(d + r < 0)) {
+            result = Intersection::INTERSECTS;
+        }
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+void BoundingVolumeHierarchy::clear() noexcept {
+    mNodes.clear();
+    mOrder.clear();
+    mPositions.clear();
+    mLeaves.clear();
+}
+
+void BoundingVolumeHierarchy::build(float3 const* center, float3 const* extent, size_t count) {
+    SYSTRACE_CALL();
+
+    clear();
+    if (count == 0) {
+        return;
+    }
+
+    mOrder.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        mOrder[i] = i;
+    }
+    mLeaves.resize((count + Culler::MODULO - 1) / Culler::MODULO);
+    mNodes.reserve(2 * mLeaves.size());
+
+    buildNode(center, extent, 0, uint32_t(count), 0);
+
+    mPositions.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        mPositions[mOrder[i]] = i;
+    }
+}
+
+uint32_t BoundingVolumeHierarchy::buildNode(float3 const* center, float3 const* extent,
+        uint32_t first, uint32_t count, uint32_t parent) {
+    const uint32_t index = uint32_t(mNodes.size());
+    mNodes.push_back({});
+    Node& node = mNodes.back();
+    node.first = first;
+    node.count = count;
+    node.parent = parent;
+    computeBounds(node, center, extent);
+
+    if (node.isLeaf()) {
+        node.right = 0;
+        const size_t end = (first + count + Culler::MODULO - 1) / Culler::MODULO;
+        for (size_t i = first / Culler::MODULO; i < end; i++) {
+            mLeaves[i] = index;
+        }
+        return index;
+    }
+
+    // Split at the median of the centers along their longest axis. The split position is
+    // rounded to a multiple of Culler::MODULO so that all leaves (but the last one) can be
+    // processed by the culling kernel without touching their neighbors.
+    float3 cmin{ std::numeric_limits<float>::max() };
+    float3 cmax{ std::numeric_limits<float>::lowest() };
+    uint32_t const* const UTILS_RESTRICT order = mOrder.data();
+    for (size_t i = first, c = first + count; i < c; i++) {
+        cmin = min(cmin, center[order[i]]);
+        cmax = max(cmax, center[order[i]]);
+    }
+    const float3 d = cmax - cmin;
+    const size_t axis = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+    const uint32_t half = uint32_t((count / 2 + Culler::MODULO - 1) & ~(Culler::MODULO - 1));
+    uint32_t* const begin = mOrder.data() + first;
+    std::nth_element(begin, begin + half, begin + count,
+            [center, axis](uint32_t lhs, uint32_t rhs) {
+                return center[lhs][axis] < center[rhs][axis];
+            });
+
+    // note: 'node' is invalidated by the recursion
+    buildNode(center, extent, first, half, index);
+    const uint32_t right = buildNode(center, extent, first + half, count - half, index);
+    mNodes[index].right = right;
+    return index;
+}
+
+void BoundingVolumeHierarchy::computeBounds(Node& node,
+        float3 const* center, float3 const* extent) const noexcept {
+    float3 bmin;
+    float3 bmax;
+    if (node.isLeaf() || !node.right) {
+        // leaf, or inner node during build() whose children don't exist yet
+        bmin = float3{ std::numeric_limits<float>::max() };
+        bmax = float3{ std::numeric_limits<float>::lowest() };
+        uint32_t const* const UTILS_RESTRICT order = mOrder.data();
+        for (size_t i = node.first, c = node.first + node.count; i < c; i++) {
+            const uint32_t p = order[i];
+            bmin = min(bmin, center[p] - extent[p]);
+            bmax = max(bmax, center[p] + extent[p]);
+        }
+    } else {
+        // inner node during refit(), both children are already up-to-date
+        Node const& left = (&node)[1];
+        Node const& right = mNodes[node.right];
+        bmin = min(left.center - left.extent, right.center - right.extent);
+        bmax = max(left.center + left.extent, right.center + right.extent);
+    }
+    // make sure rounding doesn't shrink the box
+    node.center = (bmax + bmin) * 0.5f;
+    node.extent = max(bmax - node.center, node.center - bmin);
+}
+
+void BoundingVolumeHierarchy::refit(float3 const* center, float3 const* extent,
+        uint32_t const* primitives, size_t count) {
+    SYSTRACE_CALL();
+
+    if (mNodes.empty() || count == 0) {
+        return;
+    }
+
+    // collect the leaves containing the primitives, and all their ancestors
+    std::vector<uint32_t>& nodes = mRefitNodes;
+    std::vector<bool>& marks = mRefitMarks;
+    nodes.clear();
+    marks.assign(mNodes.size(), false);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = mLeaves[mPositions[primitives[i]] / Culler::MODULO];
+        while (!marks[index]) {
+            marks[index] = true;
+            nodes.push_back(index);
+            index = mNodes[index].parent;
+        }
+    }
+
+    // nodes are stored in depth-first order, so children always come after their parent
+    std::sort(nodes.begin(), nodes.end(), std::greater<uint32_t>());
+    for (uint32_t index : nodes) {
+        computeBounds(mNodes[index], center, extent);
+    }
+}
+
+void BoundingVolumeHierarchy::cull(JobSystem& js, Culler::result_type* results,
+        Frustum const& frustum, float3 const* center, float3 const* extent, size_t bit) const {
+    SYSTRACE_CALL();
+
+    if (mNodes.empty()) {
+        return;
+    }
+
+    float4 const* const planes = frustum.getNormalizedPlanes();
+    const Culler::result_type visible = Culler::result_type(1u << bit);
+
+    // Walk the hierarchy, boxes of nodes entirely inside the frustum are accepted directly,
+    // and leaves that intersect it are collected so their boxes can be tested in parallel.
+    // Nodes are visited in order, which allows us to merge adjacent leaves.
+    std::vector<Range<uint32_t>> ranges;
+    ranges.reserve(mLeaves.size());
+    uint32_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+    while (top) {
+        Node const& node = mNodes[stack[--top]];
+        const Intersection intersection = classify(planes, node.center, node.extent);
+        if (intersection == Intersection::OUTSIDE) {
+            continue;
+        }
+        if (intersection == Intersection::INSIDE) {
+            for (size_t i = node.first, c = node.first + node.count; i < c; i++) {
+                results[i] |= visible;
+            }
+            continue;
+        }
+        if (node.isLeaf()) {
+            if (!ranges.empty() && ranges.back().last == node.first) {
+                ranges.back().last += node.count;
+            } else {
+                ranges.push_back({ node.first, node.first + node.count });
+            }
+            continue;
+        }
+        assert(top + 2 <= sizeof(stack) / sizeof(stack[0]));
+        stack[top++] = node.right;
+        stack[top++] = uint32_t(&node - mNodes.data() + 1);
+    }
+
+    // the flat culling kernel is used on the leaves
+    auto work = [results, &frustum, center, extent, bit](Range<uint32_t>* ranges, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t first = ranges[i].first;
+            Culler::intersects(results + first, frustum,
+                    center + first, extent + first, ranges[i].size(), bit);
+        }
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, ranges.data(), uint32_t(ranges.size()),
+            std::cref(work), jobs::CountSplitter<4, 8>());
+    js.runAndWait(job);
+}
+
+} // namespace details
+} // namespace filament
@@ -29,4 +29,9 @@ Box rigidTransform(Box const& UTILS_RESTRICT box, const math::mat3f& UTILS_RESTR
     return { u * box.center, abs(u) * box.halfExtent };
 }
 
+Box rigidTransform(Box const& UTILS_RESTRICT box, const math::affinef& UTILS_RESTRICT m) noexcept {
+    const mat3f u(m.upperLeft());
+    return { u * box.center + m.getTranslation(), abs(u) * box.halfExtent };
+}
+
 } // namespace filament
@@ -18,27 +18,82 @@
 
 #include <math/fast.h>
 
+#include <string.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define FILAMENT_CULLER_USE_NEON 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || defined(__GNUC__))
+#   include <immintrin.h>
+#   define FILAMENT_CULLER_USE_X86 1
+#   define FILAMENT_CULLER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 using namespace math;
 
 namespace filament {
 namespace details {
 
-void Culler::intersects(
+namespace {
+
+using result_type = Culler::result_type;
+
+using BoxKernel = void(*)(result_type* results, float4 const* planes,
+        float3 const* center, float3 const* extent, size_t count, size_t bit);
+
+using SphereKernel = void(*)(result_type* results, float4 const* planes,
+        float4 const* b, size_t count);
+
+// ------------------------------------------------------------------------------------------------
+// Generic kernels
+// ------------------------------------------------------------------------------------------------
+
+void intersectsGeneric(
         result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
-        math::float4 const* UTILS_RESTRICT b,
-        size_t count) noexcept {
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+
+    // we use a vectorize width of 8 because, on ARMv8 it allows the compiler to write eight
+    // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
+    // ends-up being slower.
+    #pragma clang loop vectorize_width(8)
+    for (size_t i = 0; i < count; i++) {
+        int visible = ~0;
 
-    math::float4 const * const UTILS_RESTRICT planes = frustum.mPlanes;
+        #pragma clang loop unroll(full)
+        for (size_t j = 0; j < 6; j++) {
+            // clang doesn't seem to generate vector * scalar instructions, which leads
+            // to increased register pressure and stack spills
+            const float dot =
+                    planes[j].x * center[i].x - std::abs(planes[j].x) * extent[i].x +
+                    planes[j].y * center[i].y - std::abs(planes[j].y) * extent[i].y +
+                    planes[j].z * center[i].z - std::abs(planes[j].z) * extent[i].z +
+                    planes[j].w;
+
+            visible &= fast::signbit(dot) << bit;
+        }
+
+        results[i] |= result_type(visible);
+    }
+}
+
+void intersectsGeneric(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
 
     // we use a vectorize width of 8 because, on ARMv8 it allow the compiler to write 8
     // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
     // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
     #pragma clang loop vectorize_width(8)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
-        math::float4 const sphere(b[i]);
+        float4 const sphere(b[i]);
 
         #pragma clang loop unroll(full)
         for (size_t j = 0; j < 6; j++) {
@@ -54,38 +109,345 @@ void Culler::intersects(
     }
 }
 
-void Culler::intersects(
+// ------------------------------------------------------------------------------------------------
+// NEON kernels
+// ------------------------------------------------------------------------------------------------
+
+#if defined(FILAMENT_CULLER_USE_NEON)
+
+// returns the sign bits of two vectors of 4 floats, as eight 0/1 bytes
+inline uint8x8_t signsToBytes(uint32x4_t lo, uint32x4_t hi) noexcept {
+    uint16x8_t s = vcombine_u16(vmovn_u32(vshrq_n_u32(lo, 31)), vmovn_u32(vshrq_n_u32(hi, 31)));
+    return vmovn_u16(s);
+}
+
+void intersectsNEON(
         result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
-        math::float3 const* UTILS_RESTRICT center,
-        math::float3 const* UTILS_RESTRICT extent,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
         size_t count, size_t bit) noexcept {
+    const int8x8_t shift = vdup_n_s8(int8_t(bit));
+    for (size_t i = 0; i < count; i += 8) {
+        // vld3q de-interleaves the float3s for us
+        const float32x4x3_t c[2] = { vld3q_f32(&center[i].x), vld3q_f32(&center[i + 4].x) };
+        const float32x4x3_t e[2] = { vld3q_f32(&extent[i].x), vld3q_f32(&extent[i + 4].x) };
+        uint32x4_t visible[2] = { vdupq_n_u32(~0u), vdupq_n_u32(~0u) };
+        for (size_t j = 0; j < 6; j++) {
+            const float px = planes[j].x, ax = std::abs(px);
+            const float py = planes[j].y, ay = std::abs(py);
+            const float pz = planes[j].z, az = std::abs(pz);
+            const float32x4_t pw = vdupq_n_f32(planes[j].w);
+            for (size_t k = 0; k < 2; k++) {
+                float32x4_t dot = vmulq_n_f32(c[k].val[0], px);
+                dot = vsubq_f32(dot, vmulq_n_f32(e[k].val[0], ax));
+                dot = vaddq_f32(dot, vmulq_n_f32(c[k].val[1], py));
+                dot = vsubq_f32(dot, vmulq_n_f32(e[k].val[1], ay));
+                dot = vaddq_f32(dot, vmulq_n_f32(c[k].val[2], pz));
+                dot = vsubq_f32(dot, vmulq_n_f32(e[k].val[2], az));
+                dot = vaddq_f32(dot, pw);
+                visible[k] = vandq_u32(visible[k], vreinterpretq_u32_f32(dot));
+            }
+        }
+        const uint8x8_t bytes = vshl_u8(signsToBytes(visible[0], visible[1]), shift);
+        vst1_u8(results + i, vorr_u8(vld1_u8(results + i), bytes));
+    }
+}
 
-    math::float4 const * UTILS_RESTRICT const planes = frustum.mPlanes;
+void intersectsNEON(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        // vld4q de-interleaves the float4s for us
+        const float32x4x4_t s[2] = { vld4q_f32(&b[i].x), vld4q_f32(&b[i + 4].x) };
+        uint32x4_t visible[2] = { vdupq_n_u32(~0u), vdupq_n_u32(~0u) };
+        for (size_t j = 0; j < 6; j++) {
+            const float32x4_t pw = vdupq_n_f32(planes[j].w);
+            for (size_t k = 0; k < 2; k++) {
+                float32x4_t dot = vmulq_n_f32(s[k].val[0], planes[j].x);
+                dot = vaddq_f32(dot, vmulq_n_f32(s[k].val[1], planes[j].y));
+                dot = vaddq_f32(dot, vmulq_n_f32(s[k].val[2], planes[j].z));
+                dot = vaddq_f32(dot, pw);
+                dot = vsubq_f32(dot, s[k].val[3]);
+                visible[k] = vandq_u32(visible[k], vreinterpretq_u32_f32(dot));
+            }
+        }
+        vst1_u8(results + i, signsToBytes(visible[0], visible[1]));
+    }
+}
 
-    // we use a vectorize width of 8 because, on ARMv8 it allows the compiler to write eight
-    // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
-    // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
-    #pragma clang loop vectorize_width(8)
-    for (size_t i = 0; i < count; i++) {
-        int visible = ~0;
+#endif // FILAMENT_CULLER_USE_NEON
 
-        #pragma clang loop unroll(full)
+// ------------------------------------------------------------------------------------------------
+// x86-64 kernels
+//
+// These are compiled for their target ISA regardless of the compiler flags, and only called
+// if the CPU supports it. The arithmetic is done in the same order as the generic kernels and
+// without FMA, so that all kernels return the same results.
+// ------------------------------------------------------------------------------------------------
+
+#if defined(FILAMENT_CULLER_USE_X86)
+
+// spreads the 8 low bits of 'mask' to the low bit of each byte of the result
+inline uint64_t expandBits(uint64_t mask) noexcept {
+    mask = (mask | (mask << 28)) & 0x0000000F0000000Full;
+    mask = (mask | (mask << 14)) & 0x0003000300030003ull;
+    mask = (mask | (mask <<  7)) & 0x0101010101010101ull;
+    return mask;
+}
+
+FILAMENT_CULLER_TARGET("avx2")
+void intersectsAVX2(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    const __m256i index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    for (size_t i = 0; i < count; i += 8) {
+        float const* const c = &center[i].x;
+        float const* const e = &extent[i].x;
+        const __m256 cx = _mm256_i32gather_ps(c + 0, index, 4);
+        const __m256 cy = _mm256_i32gather_ps(c + 1, index, 4);
+        const __m256 cz = _mm256_i32gather_ps(c + 2, index, 4);
+        const __m256 ex = _mm256_i32gather_ps(e + 0, index, 4);
+        const __m256 ey = _mm256_i32gather_ps(e + 1, index, 4);
+        const __m256 ez = _mm256_i32gather_ps(e + 2, index, 4);
+        __m256 visible = signMask;
         for (size_t j = 0; j < 6; j++) {
-            // clang doesn't seem to generate vector * scalar instructions, which leads
-            // to increased register pressure and stack spills
-            const float dot =
-                    planes[j].x * center[i].x - std::abs(planes[j].x) * extent[i].x +
-                    planes[j].y * center[i].y - std::abs(planes[j].y) * extent[i].y +
-                    planes[j].z * center[i].z - std::abs(planes[j].z) * extent[i].z +
-                    planes[j].w;
+            const __m256 px = _mm256_set1_ps(planes[j].x);
+            const __m256 py = _mm256_set1_ps(planes[j].y);
+            const __m256 pz = _mm256_set1_ps(planes[j].z);
+            __m256 dot = _mm256_mul_ps(px, cx);
+            dot = _mm256_sub_ps(dot, _mm256_mul_ps(_mm256_andnot_ps(signMask, px), ex));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(py, cy));
+            dot = _mm256_sub_ps(dot, _mm256_mul_ps(_mm256_andnot_ps(signMask, py), ey));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(pz, cz));
+            dot = _mm256_sub_ps(dot, _mm256_mul_ps(_mm256_andnot_ps(signMask, pz), ez));
+            dot = _mm256_add_ps(dot, _mm256_set1_ps(planes[j].w));
+            visible = _mm256_and_ps(visible, dot);
+        }
+        const uint64_t bytes = expandBits(uint32_t(_mm256_movemask_ps(visible))) << bit;
+        uint64_t r;
+        memcpy(&r, results + i, sizeof(r));
+        r |= bytes;
+        memcpy(results + i, &r, sizeof(r));
+    }
+}
 
-            visible &= fast::signbit(dot) << bit;
+FILAMENT_CULLER_TARGET("avx2")
+void intersectsAVX2(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    const __m256i index = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    for (size_t i = 0; i < count; i += 8) {
+        float const* const s = &b[i].x;
+        const __m256 sx = _mm256_i32gather_ps(s + 0, index, 4);
+        const __m256 sy = _mm256_i32gather_ps(s + 1, index, 4);
+        const __m256 sz = _mm256_i32gather_ps(s + 2, index, 4);
+        const __m256 sw = _mm256_i32gather_ps(s + 3, index, 4);
+        __m256 visible = signMask;
+        for (size_t j = 0; j < 6; j++) {
+            __m256 dot = _mm256_mul_ps(_mm256_set1_ps(planes[j].x), sx);
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(planes[j].y), sy));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(planes[j].z), sz));
+            dot = _mm256_add_ps(dot, _mm256_set1_ps(planes[j].w));
+            dot = _mm256_sub_ps(dot, sw);
+            visible = _mm256_and_ps(visible, dot);
         }
+        const uint64_t bytes = expandBits(uint32_t(_mm256_movemask_ps(visible)));
+        memcpy(results + i, &bytes, sizeof(bytes));
+    }
+}
 
-        results[i] |= result_type(visible);
+FILAMENT_CULLER_TARGET("avx512f")
+void intersectsAVX512(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    const __m512i index = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21,
+            24, 27, 30, 33, 36, 39, 42, 45);
+    const __m512i absMask = _mm512_set1_epi32(0x7FFFFFFF);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i value = _mm512_set1_epi32(1 << bit);
+    for (size_t i = 0; i < count; i += 16) {
+        // count is a multiple of 8, the last iteration may only have 8 elements
+        const __mmask16 valid = (count - i >= 16) ? __mmask16(0xFFFF) : __mmask16(0x00FF);
+        float const* const c = &center[i].x;
+        float const* const e = &extent[i].x;
+        const __m512 undefined = _mm512_setzero_ps();
+        const __m512 cx = _mm512_mask_i32gather_ps(undefined, valid, index, c + 0, 4);
+        const __m512 cy = _mm512_mask_i32gather_ps(undefined, valid, index, c + 1, 4);
+        const __m512 cz = _mm512_mask_i32gather_ps(undefined, valid, index, c + 2, 4);
+        const __m512 ex = _mm512_mask_i32gather_ps(undefined, valid, index, e + 0, 4);
+        const __m512 ey = _mm512_mask_i32gather_ps(undefined, valid, index, e + 1, 4);
+        const __m512 ez = _mm512_mask_i32gather_ps(undefined, valid, index, e + 2, 4);
+        __m512i visible = _mm512_set1_epi32(-1);
+        for (size_t j = 0; j < 6; j++) {
+            const __m512 px = _mm512_set1_ps(planes[j].x);
+            const __m512 py = _mm512_set1_ps(planes[j].y);
+            const __m512 pz = _mm512_set1_ps(planes[j].z);
+            const __m512 ax = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(px), absMask));
+            const __m512 ay = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(py), absMask));
+            const __m512 az = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(pz), absMask));
+            __m512 dot = _mm512_mul_ps(px, cx);
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(ax, ex));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(py, cy));
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(ay, ey));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(pz, cz));
+            dot = _mm512_sub_ps(dot, _mm512_mul_ps(az, ez));
+            dot = _mm512_add_ps(dot, _mm512_set1_ps(planes[j].w));
+            visible = _mm512_and_epi32(visible, _mm512_castps_si512(dot));
+        }
+        // the sign bit is set for visible elements
+        const __mmask16 mask = _mm512_cmplt_epi32_mask(visible, zero);
+        const __m128i bytes = _mm512_cvtepi32_epi8(_mm512_maskz_mov_epi32(mask, value));
+        if (valid == 0xFFFF) {
+            __m128i r = _mm_loadu_si128((__m128i const*)(results + i));
+            _mm_storeu_si128((__m128i*)(results + i), _mm_or_si128(r, bytes));
+        } else {
+            __m128i r = _mm_loadl_epi64((__m128i const*)(results + i));
+            _mm_storel_epi64((__m128i*)(results + i), _mm_or_si128(r, bytes));
+        }
+    }
+}
+
+FILAMENT_CULLER_TARGET("avx512f")
+void intersectsAVX512(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    const __m512i index = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28,
+            32, 36, 40, 44, 48, 52, 56, 60);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    for (size_t i = 0; i < count; i += 16) {
+        // count is a multiple of 8, the last iteration may only have 8 elements
+        const __mmask16 valid = (count - i >= 16) ? __mmask16(0xFFFF) : __mmask16(0x00FF);
+        float const* const s = &b[i].x;
+        const __m512 undefined = _mm512_setzero_ps();
+        const __m512 sx = _mm512_mask_i32gather_ps(undefined, valid, index, s + 0, 4);
+        const __m512 sy = _mm512_mask_i32gather_ps(undefined, valid, index, s + 1, 4);
+        const __m512 sz = _mm512_mask_i32gather_ps(undefined, valid, index, s + 2, 4);
+        const __m512 sw = _mm512_mask_i32gather_ps(undefined, valid, index, s + 3, 4);
+        __m512i visible = _mm512_set1_epi32(-1);
+        for (size_t j = 0; j < 6; j++) {
+            __m512 dot = _mm512_mul_ps(_mm512_set1_ps(planes[j].x), sx);
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(_mm512_set1_ps(planes[j].y), sy));
+            dot = _mm512_add_ps(dot, _mm512_mul_ps(_mm512_set1_ps(planes[j].z), sz));
+            dot = _mm512_add_ps(dot, _mm512_set1_ps(planes[j].w));
+            dot = _mm512_sub_ps(dot, sw);
+            visible = _mm512_and_epi32(visible, _mm512_castps_si512(dot));
+        }
+        // the sign bit is set for visible elements
+        const __mmask16 mask = _mm512_cmplt_epi32_mask(visible, zero);
+        const __m128i bytes = _mm512_cvtepi32_epi8(_mm512_maskz_mov_epi32(mask, one));
+        if (valid == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(results + i), bytes);
+        } else {
+            _mm_storel_epi64((__m128i*)(results + i), bytes);
+        }
+    }
+}
+
+#endif // FILAMENT_CULLER_USE_X86
+
+// ------------------------------------------------------------------------------------------------
+// Kernel selection
+// ------------------------------------------------------------------------------------------------
+
+struct Kernels {
+    Culler::Kernel kernel;
+    BoxKernel boxes;
+    SphereKernel spheres;
+};
+
+Kernels getKernels(Culler::Kernel kernel) noexcept {
+    switch (kernel) {
+#if defined(FILAMENT_CULLER_USE_NEON)
+        case Culler::Kernel::NEON:
+            return { kernel, &intersectsNEON, &intersectsNEON };
+#endif
+#if defined(FILAMENT_CULLER_USE_X86)
+        case Culler::Kernel::AVX2:
+            return { kernel, &intersectsAVX2, &intersectsAVX2 };
+        case Culler::Kernel::AVX512:
+            return { kernel, &intersectsAVX512, &intersectsAVX512 };
+#endif
+        default:
+            return { Culler::Kernel::GENERIC, &intersectsGeneric, &intersectsGeneric };
+    }
+}
+
+Kernels selectKernels() noexcept {
+    for (Culler::Kernel kernel : {
+            Culler::Kernel::AVX512, Culler::Kernel::AVX2, Culler::Kernel::NEON }) {
+        if (Culler::isSupported(kernel)) {
+            return getKernels(kernel);
+        }
     }
+    return getKernels(Culler::Kernel::GENERIC);
+}
+
+// this is initialized once, the first time Culler is used
+Kernels const& getSelectedKernels() noexcept {
+    static const Kernels kernels = selectKernels();
+    return kernels;
+}
+
+} // anonymous namespace
+
+bool Culler::isSupported(Kernel kernel) noexcept {
+    switch (kernel) {
+        case Kernel::GENERIC:
+            return true;
+#if defined(FILAMENT_CULLER_USE_NEON)
+        case Kernel::NEON:
+            return true;
+#endif
+#if defined(FILAMENT_CULLER_USE_X86)
+        case Kernel::AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        case Kernel::AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+Culler::Kernel Culler::getKernel() noexcept {
+    return getSelectedKernels().kernel;
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        math::float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    getSelectedKernels().spheres(results, frustum.mPlanes, b, count);
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        math::float3 const* UTILS_RESTRICT center,
+        math::float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    getSelectedKernels().boxes(results, frustum.mPlanes, center, extent, count, bit);
 }
 
 /*
@@ -135,5 +497,21 @@ void Culler::Test::intersects(
     Culler::intersects(results, frustum, b, count);
 }
 
+void Culler::Test::intersects(Kernel kernel,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        math::float3 const* UTILS_RESTRICT c,
+        math::float3 const* UTILS_RESTRICT e,
+        size_t count) noexcept {
+    getKernels(kernel).boxes(results, frustum.mPlanes, c, e, round(count), 0);
+}
+
+void Culler::Test::intersects(Kernel kernel,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        math::float4 const* UTILS_RESTRICT b, size_t count) noexcept {
+    getKernels(kernel).spheres(results, frustum.mPlanes, b, round(count));
+}
+
 } // namespace details
 } // namespace filament
@@ -69,7 +69,8 @@ namespace details {
 static std::unordered_map<Engine const*, std::unique_ptr<FEngine>> sEngines;
 static std::mutex sEnginesLock;
 
-FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLContext) {
+FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLContext,
+        const char* commandCapturePath) {
     FEngine* instance = new FEngine(backend, platform, sharedGLContext);
 
     slog.i << "FEngine (" << sizeof(void*) * 8 << " bits) created at " << instance << " "
@@ -88,8 +89,14 @@ FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLCont
             instance->mPlatform = platform;
         }
         instance->mDriver = platform->createDriver(sharedGLContext);
-        instance->init();
+        instance->init(commandCapturePath);
         instance->execute();
+        if (UTILS_UNLIKELY(commandCapturePath && !instance->getDriverApi().isCapturing())) {
+            // the trace file couldn't be created or another capture is in progress
+            instance->shutdown();
+            delete instance;
+            return nullptr;
+        }
         return instance;
     }
 
@@ -106,7 +113,14 @@ FEngine* FEngine::create(Backend backend, Platform* platform, void* sharedGLCont
     }
 
     // now we can initialize the largest part of the engine
-    instance->init();
+    instance->init(commandCapturePath);
+
+    if (UTILS_UNLIKELY(commandCapturePath && !instance->getDriverApi().isCapturing())) {
+        // the trace file couldn't be created or another capture is in progress
+        instance->shutdown();
+        delete instance;
+        return nullptr;
+    }
 
     return instance;
 }
@@ -128,7 +142,7 @@ FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext) :
         mSharedGLContext(sharedGLContext),
         mEntityManager(EntityManager::get()),
         mRenderableManager(*this),
-        mTransformManager(),
+        mTransformManager(&mJobSystem),
         mLightManager(*this),
         mCameraManager(*this),
         mPerViewUib(PerViewUib::getUib()),
@@ -152,11 +166,16 @@ FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext) :
  * possible.
  */
 
-void FEngine::init() {
+void FEngine::init(const char* commandCapturePath) {
     // this must be first.
     mCommandStream = CommandStream(*mDriver, mCommandBufferQueue.getCircularBuffer());
     DriverApi& driverApi = getDriverApi();
 
+    // the capture must start before the first command, so that the trace creates every object
+    if (commandCapturePath) {
+        driverApi.startCapture(commandCapturePath);
+    }
+
     // Parse all post process shaders now, but create them lazily
     mPostProcessParser = std::make_unique<filaflat::MaterialParser>(mBackend,
             MATERIALS_POSTPROCESS_DATA, MATERIALS_POSTPROCESS_SIZE);
@@ -235,6 +254,9 @@ void FEngine::shutdown() {
     size_t wmpct = wm / (CONFIG_COMMAND_BUFFERS_SIZE / 100);
     slog.d << "CircularBuffer: High watermark "
            << wm / 1024 << " KiB (" << wmpct << "%)" << io::endl;
+    auto backPressure = mCommandBufferQueue.getBackPressureStats();
+    slog.d << "CommandBufferQueue: waited " << backPressure.waitCount << " times, "
+           << backPressure.waitTimeNs / 1000000 << " ms total" << io::endl;
 #endif
 
     DriverApi& driver = getDriverApi();
@@ -289,6 +311,9 @@ void FEngine::shutdown() {
         driver.destroyProgram(mPostProcessProgram);
     }
 
+    // closes the trace after the commands added by the terminate() calls
+    driver.stopCapture();
+
     // There might be commands added by the terminate() calls
     flushCommandBuffer(mCommandBufferQueue);
     if (!UTILS_HAS_THREADING) {
@@ -723,11 +748,10 @@ bool FEngine::execute() {
     }
 
     // execute all command buffers
-    for (auto& item : buffers) {
-        if (UTILS_LIKELY(item.begin)) {
-            mCommandStream.execute(item.begin);
-            mCommandBufferQueue.releaseBuffer(item);
-        }
+    for (uint32_t index : buffers) {
+        auto const& item = mCommandBufferQueue.getSlice(index);
+        mCommandStream.execute(item.begin);
+        mCommandBufferQueue.releaseBuffer(item);
     }
 
     return true;
@@ -742,7 +766,12 @@ bool FEngine::execute() {
 using namespace details;
 
 Engine* Engine::create(Backend backend, Platform* platform, void* sharedGLContext) {
-    std::unique_ptr<FEngine> engine(FEngine::create(backend, platform, sharedGLContext));
+    return createWithCommandCapture(nullptr, backend, platform, sharedGLContext);
+}
+
+Engine* Engine::createWithCommandCapture(const char* path,
+        Backend backend, Platform* platform, void* sharedGLContext) {
+    std::unique_ptr<FEngine> engine(FEngine::create(backend, platform, sharedGLContext, path));
     if (UTILS_UNLIKELY(!engine)) {
         // something went wrong during the driver or engine initialization
         return nullptr;
@@ -879,6 +908,23 @@ void* Engine::streamAlloc(size_t size, size_t alignment) noexcept {
     return upcast(this)->streamAlloc(size, alignment);
 }
 
+void Engine::setRenderTargetPoolBudget(size_t bytes) noexcept {
+    upcast(this)->getRenderTargetPool().setBudget(bytes);
+}
+
+size_t Engine::getRenderTargetPoolBudget() const noexcept {
+    return upcast(this)->getRenderTargetPool().getBudget();
+}
+
+Engine::RenderTargetPoolStats Engine::getRenderTargetPoolStats() const noexcept {
+    RenderTargetPool::Stats const stats = upcast(this)->getRenderTargetPool().getStats();
+    return { stats.hits, stats.misses, stats.evictions, stats.bytesResident, stats.bytesInUse };
+}
+
+void Engine::stopCommandCapture() noexcept {
+    upcast(this)->getDriverApi().stopCapture();
+}
+
 // The external-facing execute does a flush, and is meant only for single-threaded environments.
 // It also discards the boolean return value, which would otherwise indicate a thread exit.
 void Engine::execute() {
@@ -18,6 +18,8 @@
 
 #include "details/Fence.h"
 
+#include "driver/DriverApi.h"
+
 #include <utils/JobSystem.h>
 #include <utils/Log.h>
 #include <utils/Systrace.h>
@@ -39,8 +41,34 @@ FrameInfoManager::FrameInfoManager(FEngine& engine)
 
 FrameInfoManager::~FrameInfoManager() noexcept = default;
 
+void FrameInfoManager::run() {
+    // the GPU time of each frame is measured when supported
+    driver::DriverApi& driver = mEngine.getDriverApi();
+    if (driver.isTimerQuerySupported()) {
+        for (auto& query : mTimerQueries) {
+            query = driver.createTimerQuery();
+        }
+    }
+    mSyncThread.run();
+}
+
+void FrameInfoManager::terminate() {
+    mSyncThread.requestExitAndWait();
+    driver::DriverApi& driver = mEngine.getDriverApi();
+    for (auto& query : mTimerQueries) {
+        if (query) {
+            driver.destroyTimerQuery(query);
+            query.clear();
+        }
+    }
+    mPendingTimerQueries.clear();
+}
+
 void FrameInfo::beginFrame(FrameInfoManager* mgr) {
     Fence* fence = mgr->getEngine().createFence(Fence::Type::HARD);
+    if (query) {
+        mgr->mEngine.getDriverApi().beginTimerQuery(query);
+    }
     mgr->push([this, fence]() {
         Fence::waitAndDestroy(fence, Fence::Mode::DONT_FLUSH);
         laps[START] = clock::now();
@@ -56,6 +84,9 @@ void FrameInfo::lap(FrameInfoManager* mgr, lap_id id) {
 }
 
 void FrameInfo::endFrame(FrameInfoManager* mgr) {
+    if (query) {
+        mgr->mEngine.getDriverApi().endTimerQuery(query);
+    }
     Fence* fence = mgr->getEngine().createFence(Fence::Type::HARD);
     mgr->push([this, mgr, fence]() {
         char buf[256];
@@ -64,6 +95,7 @@ void FrameInfo::endFrame(FrameInfoManager* mgr) {
 
         Fence::waitAndDestroy(fence, Fence::Mode::DONT_FLUSH);
         laps[FINISH] = clock::now();
+        mgr->updateGpuFrameTime(query);
         mgr->finish(this);
     });
 }
@@ -74,15 +106,28 @@ void FrameInfoManager::beginFrame(uint32_t frameId) {
     SYSTRACE_CONTEXT();
     SYSTRACE_ASYNC_BEGIN("frame latency", frameId);
 
+    mCpuFrameStart = clock::now();
+
+    // each GPU time result is only reported for one frame
+    std::unique_lock<std::mutex> lock(mLock);
+    mLastGpuFrameTime = mNextGpuFrameTime;
+    mNextGpuFrameTime = {};
+    lock.unlock();
+
     FrameInfo* info = obtain();
     mCurrentFrameInfo = info;
     if (info) {
         info->frame = frameId;
+        // there are never more than POOL_COUNT frames in flight
+        info->query = mTimerQueries[mTimerQueryIndex];
+        mTimerQueryIndex = (mTimerQueryIndex + 1) % POOL_COUNT;
         info->beginFrame(this);
     }
 }
 
 void FrameInfoManager::endFrame() {
+    mLastCpuFrameTime = clock::now() - mCpuFrameStart;
+
     FrameInfo* const info = mCurrentFrameInfo;
     if (info) {
         mCurrentFrameInfo = nullptr;
@@ -94,6 +139,10 @@ void FrameInfoManager::cancelFrame() {
     FrameInfo* info = mCurrentFrameInfo;
     if (info) {
         mCurrentFrameInfo = nullptr;
+        if (info->query) {
+            // the query was started, but we won't use its result
+            mEngine.getDriverApi().endTimerQuery(info->query);
+        }
         push([this, info]() {
             mPoolArena.free(info);
         });
@@ -124,6 +173,37 @@ void FrameInfoManager::finish(FrameInfo* info) noexcept {
     mPoolArena.free(info);
 }
 
+void FrameInfoManager::updateGpuFrameTime(Handle<HwTimerQuery> query) noexcept {
+    auto& pending = mPendingTimerQueries;
+    if (query) {
+        pending.push_back(query);
+    }
+
+    // The driver reads the results of the queries after the GPU is done with them, which
+    // can be a frame or two after the frame's fence signaled. Results arrive in order.
+    driver::DriverApi& driver = mEngine.getDriverApi();
+    uint64_t elapsed = 0;
+    while (!pending.empty()) {
+        const uint64_t value = driver.getTimerQueryValue(pending.front());
+        if (!value) {
+            break;
+        }
+        elapsed = value;
+        pending.pop_front();
+    }
+
+    // give up on results that never came (e.g. discarded by the driver), their query will
+    // be reused soon
+    while (pending.size() > POOL_COUNT / 2) {
+        pending.pop_front();
+    }
+
+    if (elapsed) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mNextGpuFrameTime = std::chrono::duration<uint64_t, std::nano>(elapsed);
+    }
+}
+
 // ------------------------------------------------------------------------------------------------
 
 FrameInfoManager::SyncThread::~SyncThread() {
@@ -19,6 +19,8 @@
 
 #include "details/Engine.h"
 
+#include "driver/Handle.h"
+
 #include <filament/Fence.h>
 
 #include <utils/Allocator.h>
@@ -68,6 +70,7 @@ public:
 
     uint32_t frame = 0;
     time_point laps[MAX_LAPS_IDS] = { time_point::max() };
+    Handle<HwTimerQuery> query;     // measures the GPU time of this frame, if supported
 };
 
 class FrameInfoManager {
@@ -88,13 +91,9 @@ public:
 
     Engine& getEngine() { return mEngine; }
 
-    void run() {
-        mSyncThread.run();
-    }
+    void run();
 
-    void terminate() {
-        mSyncThread.requestExitAndWait();
-    }
+    void terminate();
 
     // call this immediately after "make current"
     void beginFrame(uint32_t frameId);
@@ -123,6 +122,18 @@ public:
         return info.laps[FrameInfo::FINISH] - info.laps[FrameInfo::START];
     }
 
+    // GPU time of the last frame whose timer query result arrived since the previous
+    // beginFrame(), or 0 if there is none or timer queries aren't supported. Results arrive
+    // asynchronously, usually a frame or two late.
+    duration getLastGpuFrameTime() const noexcept {
+        return mLastGpuFrameTime;
+    }
+
+    // time spent by the calling thread between the last beginFrame() and endFrame()
+    duration getLastCpuFrameTime() const noexcept {
+        return mLastCpuFrameTime;
+    }
+
     std::vector<FrameInfo> getHistory() const noexcept {
         std::unique_lock<std::mutex> lock(mLock);
         return mFrameInfoHistory;
@@ -169,14 +180,29 @@ private:
     FrameInfo* obtain() noexcept;
     void finish(FrameInfo* info) noexcept;
 
+    // called from the SyncThread, publishes the results of the timer queries available
+    void updateGpuFrameTime(Handle<HwTimerQuery> query) noexcept;
+
     using PoolArena = utils::Arena<utils::ObjectPoolAllocator<FrameInfo>, utils::LockingPolicy::SpinLock>;
     FEngine& mEngine;
     PoolArena mPoolArena;
     SyncThread mSyncThread;
     FrameInfo* mCurrentFrameInfo = nullptr;
 
+    // a FrameInfo in flight uses one of these, they're used in order
+    Handle<HwTimerQuery> mTimerQueries[POOL_COUNT];
+    size_t mTimerQueryIndex = 0;
+
+    // timer queries of finished frames waiting for their result, only used by the SyncThread
+    std::deque<Handle<HwTimerQuery>> mPendingTimerQueries;
+
+    time_point mCpuFrameStart;
+    duration mLastCpuFrameTime{};
+    duration mLastGpuFrameTime{};
+
     mutable std::mutex mLock;
     std::vector<FrameInfo> mFrameInfoHistory;
+    duration mNextGpuFrameTime{};   // written by the SyncThread, read by beginFrame()
 };
 
 
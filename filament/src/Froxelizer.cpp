@@ -23,6 +23,8 @@
 
 #include <filament/Viewport.h>
 
+#include <private/filament/SibGenerator.h>
+
 #include <utils/Allocator.h>
 #include <utils/BinaryTreeArray.h>
 #include <utils/Systrace.h>
@@ -69,43 +71,72 @@ constexpr size_t FROXEL_BUFFER_WIDTH        = 1u << FROXEL_BUFFER_WIDTH_SHIFT;
 constexpr size_t FROXEL_BUFFER_WIDTH_MASK   = FROXEL_BUFFER_WIDTH - 1u;
 constexpr size_t FROXEL_BUFFER_HEIGHT       = (FROXEL_BUFFER_ENTRY_COUNT_MAX + FROXEL_BUFFER_WIDTH_MASK) / FROXEL_BUFFER_WIDTH;
 
-constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 5u;
+constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 6u;
 constexpr size_t RECORD_BUFFER_WIDTH        = 1u << RECORD_BUFFER_WIDTH_SHIFT;
 
 constexpr size_t RECORD_BUFFER_HEIGHT       = 2048;
-constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT; // 64K
+constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT; // 128K
+
+// The light buffer holds 4 RGBA32F texels per light (64 KiB with 1024 lights)
+constexpr size_t LIGHT_BUFFER_WIDTH_SHIFT   = 6u;
+constexpr size_t LIGHT_BUFFER_WIDTH         = 1u << LIGHT_BUFFER_WIDTH_SHIFT;
+constexpr size_t LIGHT_BUFFER_TEXEL_COUNT   = CONFIG_MAX_LIGHT_COUNT * sizeof(PunctualLightData) / sizeof(float4);
+constexpr size_t LIGHT_BUFFER_HEIGHT        = (LIGHT_BUFFER_TEXEL_COUNT + LIGHT_BUFFER_WIDTH - 1) / LIGHT_BUFFER_WIDTH;
 
-// Buffer needed for Froxelizer internal data structures (~256 KiB)
+// Buffer needed for Froxelizer internal data structures (~288 KiB)
 constexpr size_t PER_FROXELDATA_ARENA_SIZE = sizeof(float4) *
                                                  (FROXEL_BUFFER_ENTRY_COUNT_MAX +
                                                   FROXEL_BUFFER_ENTRY_COUNT_MAX + 3 +
-                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1);
+                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1 +
+                                                  FROXEL_BUFFER_ENTRY_COUNT_MAX / 4 + 1);
 
 
 // number of lights processed by one group (e.g. 32)
 static constexpr size_t LIGHT_PER_GROUP = sizeof(Froxelizer::LightGroupType) * 8;
 
-// number of groups (i.e. jobs) to use for froxelization (e.g. 8)
+// number of groups (i.e. jobs) to use for froxelization (e.g. 32)
 static constexpr size_t GROUP_COUNT =
         (CONFIG_MAX_LIGHT_COUNT + LIGHT_PER_GROUP - 1) / LIGHT_PER_GROUP;
 
+// groups are tracked with a bitset32
+static_assert(GROUP_COUNT <= 32, "too many light groups");
+static constexpr uint32_t ALL_GROUPS = ~0u >> (32u - GROUP_COUNT);
+
 
-// record buffer cannot be larger than 65K entries because we're using uint16_t to store indices
-// so its maximum size is 128 KiB
-static_assert(RECORD_BUFFER_ENTRY_COUNT <= 65536,
-        "RecordBuffer cannot be larger than 65536 entries");
+// offsets in the record buffer are stored on 32 bits, the record buffer is only limited by
+// the minimum texture size guaranteed by GLES
+static_assert(RECORD_BUFFER_HEIGHT <= 2048,
+        "RecordBuffer cannot be taller than 2048 rows");
 
 Froxelizer::Froxelizer(FEngine& engine)
-        : mArena("froxel", PER_FROXELDATA_ARENA_SIZE) {
+        : mArena("froxel", PER_FROXELDATA_ARENA_SIZE +
+                GROUP_COUNT * sizeof(FroxelThreadData) + CACHELINE_SIZE +
+                CONFIG_MAX_LIGHT_COUNT * sizeof(LightParams)) {
 
     DriverApi& driverApi = engine.getDriverApi();
 
-    // RecordBuffer cannot be larger than 65536 entries, because indices are uint16_t
+    // froxel thread data and light parameters are kept from one frame to the next, they're
+    // allocated first so that update() never rewinds them.
+    mFroxelShardedData = {
+            mArena.alloc<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
+            uint32_t(GROUP_COUNT) };
+    mLightParams = {
+            mArena.alloc<LightParams>(CONFIG_MAX_LIGHT_COUNT),
+            uint32_t(CONFIG_MAX_LIGHT_COUNT) };
+    assert(mFroxelShardedData.begin());
+    assert(mLightParams.begin());
+
+    // nothing has been froxelized yet
+    mDirtyGroups.setValue(ALL_GROUPS);
+
+    // records are light indices, froxels hold a 32-bits offset into the records
     GPUBuffer::ElementType type = std::is_same<RecordBufferType, uint8_t>::value
                                   ? GPUBuffer::ElementType::UINT8 : GPUBuffer::ElementType::UINT16;
     mRecordsBuffer = GPUBuffer(driverApi, { type, 1 }, RECORD_BUFFER_WIDTH, RECORD_BUFFER_HEIGHT);
-    mFroxelBuffer  = GPUBuffer(driverApi, { GPUBuffer::ElementType::UINT16, 2 },
+    mFroxelBuffer  = GPUBuffer(driverApi, { GPUBuffer::ElementType::UINT32, 2 },
             FROXEL_BUFFER_WIDTH, FROXEL_BUFFER_HEIGHT);
+    mLightBuffer   = GPUBuffer(driverApi, { GPUBuffer::ElementType::FLOAT, 4 },
+            LIGHT_BUFFER_WIDTH, LIGHT_BUFFER_HEIGHT);
 }
 
 Froxelizer::~Froxelizer() {
@@ -116,13 +147,17 @@ void Froxelizer::terminate(DriverApi& driverApi) noexcept {
     // call reset() on our LinearAllocator arenas
     mArena.reset();
 
+    mRowRadii = nullptr;
     mBoundingSpheres = nullptr;
     mPlanesY = nullptr;
     mPlanesX = nullptr;
     mDistancesZ = nullptr;
+    mFroxelShardedData.clear();
+    mLightParams.clear();
 
     mRecordsBuffer.terminate(driverApi);
     mFroxelBuffer.terminate(driverApi);
+    mLightBuffer.terminate(driverApi);
 }
 
 void Froxelizer::setOptions(float zLightNear, float zLightFar) noexcept {
@@ -149,28 +184,41 @@ void Froxelizer::setProjection(const mat4f& projection, float near, float far) n
     }
 }
 
-bool Froxelizer::prepare(
+bool Froxelizer::prepare(FEngine& engine,
         FEngine::DriverApi& driverApi, ArenaScope& arena, Viewport const& viewport,
-        const math::mat4f& projection, float projectionNear, float projectionFar) noexcept {
+        CameraInfo const& camera, const FScene::LightSoa& lightData) noexcept {
     setViewport(viewport);
-    setProjection(projection, projectionNear, projectionFar);
+    setProjection(camera.projection, camera.zn, camera.zf);
 
     bool uniformsNeedUpdating = false;
     if (UTILS_UNLIKELY(mDirtyFlags)) {
+        // the froxels themselves changed, all lights need to be froxelized again
+        mDirtyGroups.setValue(ALL_GROUPS);
         uniformsNeedUpdating = update();
     }
 
+    updateLightParams(engine, camera, lightData);
+
+    if (mDirtyGroups.none()) {
+        // Nothing changed since the last frame, the GPU buffers already have the right
+        // content: skip froxelization and the upload altogether.
+        mFroxelBufferUser.clear();
+        mRecordBufferUser.clear();
+        mLightRecords.clear();
+        return uniformsNeedUpdating;
+    }
+
     /*
      * Allocations that need to persists until the driver consumes them are done from
      * the command stream.
      */
 
-    // froxel buffer (~32 KiB)
+    // froxel buffer (~64 KiB)
     mFroxelBufferUser = {
             driverApi.allocatePod<FroxelEntry>(FROXEL_BUFFER_ENTRY_COUNT_MAX),
             FROXEL_BUFFER_ENTRY_COUNT_MAX };
 
-    // record buffer (~64 KiB)
+    // record buffer (~256 KiB)
     mRecordBufferUser = {
             driverApi.allocatePod<RecordBufferType>(RECORD_BUFFER_ENTRY_COUNT),
             RECORD_BUFFER_ENTRY_COUNT };
@@ -179,31 +227,67 @@ bool Froxelizer::prepare(
      * Temporary allocations for processing all froxel data
      */
 
-    // light records per froxel (~256 KiB)
+    // light records per froxel (~1 MiB)
     mLightRecords = {
             arena.allocate<LightRecord>(FROXEL_BUFFER_ENTRY_COUNT_MAX, CACHELINE_SIZE),
             FROXEL_BUFFER_ENTRY_COUNT_MAX };
 
-    // froxel thread data (~256 KiB)
-    mFroxelShardedData = {
-            arena.allocate<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
-            uint32_t(GROUP_COUNT)
-    };
-
     assert(mFroxelBufferUser.begin());
     assert(mRecordBufferUser.begin());
     assert(mLightRecords.begin());
-    assert(mFroxelShardedData.begin());
 
 #ifndef NDEBUG
     memset(mFroxelBufferUser.data(),    0x55, mFroxelBufferUser.sizeInBytes());
     memset(mRecordBufferUser.data(),    0xEB, mRecordBufferUser.sizeInBytes());
-    memset(mFroxelShardedData.data(),   0xFD, mFroxelShardedData.sizeInBytes());
 #endif
 
     return uniformsNeedUpdating;
 }
 
+void Froxelizer::updateLightParams(FEngine& engine,
+        const CameraInfo& UTILS_RESTRICT camera,
+        const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
+    SYSTRACE_CALL();
+
+    auto& lcm = engine.getLightManager();
+    auto const* UTILS_RESTRICT spheres      = lightData.data<FScene::POSITION_RADIUS>();
+    auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
+    auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
+    LightParams* const UTILS_RESTRICT lightParams = mLightParams.data();
+
+    const mat3f& vn = camera.view.upperLeft();
+    const size_t count = lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT;
+    const size_t previousCount = mLightCount;
+    assert(count <= CONFIG_MAX_LIGHT_COUNT);
+
+    // The froxels of a light only depend on its view-space parameters (and the projection,
+    // which is handled by mDirtyFlags). A light's index in the light buffer is also its index
+    // here, so an unchanged entry means its bits in the froxel data are still valid, even
+    // if the light itself is a different one.
+    for (size_t i = 0; i < count; i++) {
+        const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
+        FLightManager::Instance li = instances[j];
+        const LightParams light = {
+                .position = (camera.view * float4{ spheres[j].xyz, 1 }).xyz, // to view-space
+                .cosSqr = lcm.getCosOuterSquared(li),   // spot only
+                .axis = vn * directions[j],             // spot only
+                .invSin = lcm.getSinInverse(li),        // spot only
+                .radius = spheres[j].w,
+        };
+        if (i >= previousCount || memcmp(&lightParams[i], &light, sizeof(LightParams)) != 0) {
+            lightParams[i] = light;
+            mDirtyGroups.set(i % GROUP_COUNT);
+        }
+    }
+
+    // lights that went away must be removed from their group
+    for (size_t i = count; i < previousCount; i++) {
+        mDirtyGroups.set(i % GROUP_COUNT);
+    }
+
+    mLightCount = count;
+}
+
 void Froxelizer::computeFroxelLayout(
         uint2* dim, uint16_t* countX, uint16_t* countY, uint16_t* countZ,
         Viewport const& viewport) noexcept {
@@ -284,6 +368,7 @@ bool Froxelizer::update() noexcept {
             // this is a LinearAllocator arena, use rewind() instead of free (which is a no op).
             mArena.rewind(mDistancesZ);
 
+            mRowRadii = nullptr;
             mBoundingSpheres = nullptr;
             mPlanesY = nullptr;
             mPlanesX = nullptr;
@@ -294,11 +379,13 @@ bool Froxelizer::update() noexcept {
         mPlanesX         = mArena.alloc<float4>(froxelCountX + 1);
         mPlanesY         = mArena.alloc<float4>(froxelCountY + 1);
         mBoundingSpheres = mArena.alloc<float4>(froxelCount);
+        mRowRadii        = mArena.alloc<float>(froxelCountY * froxelCountZ);
 
         assert(mDistancesZ);
         assert(mPlanesX);
         assert(mPlanesY);
         assert(mBoundingSpheres);
+        assert(mRowRadii);
 
         mDistancesZ[0] = 0.0f;
         const float zLightNear = mZLightNear;
@@ -336,6 +423,7 @@ bool Froxelizer::update() noexcept {
         assert(mPlanesX);
         assert(mPlanesY);
         assert(mBoundingSpheres);
+        assert(mRowRadii);
 
         // clip-space dimensions
         const float froxelWidthInClipSpace  = (2.0f * mFroxelDimension.x) / mViewport.width;
@@ -375,6 +463,7 @@ bool Froxelizer::update() noexcept {
         float2* const UTILS_RESTRICT minMaxX = reinterpret_cast<float2*>(stack);
 
         float4* const        UTILS_RESTRICT boundingSpheres = mBoundingSpheres;
+        float*  const        UTILS_RESTRICT rowRadii = mRowRadii;
         float4  const* const UTILS_RESTRICT planesX = mPlanesX;
         float4  const* const UTILS_RESTRICT planesY = mPlanesY;
         float   const* const UTILS_RESTRICT planesZ = mDistancesZ;
@@ -432,13 +521,18 @@ bool Froxelizer::update() noexcept {
                 }
                 assert(minp.y < maxp.y);
 
+                float rowRadius = 0.0f;
                 for (size_t ix = 0, nx = froxelCountX; ix < nx; ++ix) {
                     // note: clang vectorizes this loop!
                     assert(getFroxelIndex(ix, iy, iz) == fi);
                     minp.x = minMaxX[ix][0];
                     maxp.x = minMaxX[ix][1];
-                    boundingSpheres[fi++] = { (maxp + minp) * 0.5f, length((maxp - minp) * 0.5f) };
+                    const float radius = length((maxp - minp) * 0.5f);
+                    boundingSpheres[fi++] = { (maxp + minp) * 0.5f, radius };
+                    rowRadius = std::max(rowRadius, radius);
                 }
+                // largest froxel of the row, see froxelizeSpotLightRow()
+                rowRadii[iz * froxelCountY + iy] = rowRadius;
             }
         }
 
@@ -523,25 +617,30 @@ std::pair<size_t, size_t> Froxelizer::clipToIndices(float2 const& clip) const no
 
 
 void Froxelizer::commit(driver::DriverApi& driverApi) {
+    if (mFroxelBufferUser.empty()) {
+        // the GPU buffers are up-to-date
+        return;
+    }
     // send data to GPU
     mFroxelBuffer.commit(driverApi, mFroxelBufferUser);
     mRecordsBuffer.commit(driverApi, mRecordBufferUser);
-#ifndef NDEBUG
     mFroxelBufferUser.clear();
     mRecordBufferUser.clear();
-    mFroxelShardedData.clear();
-#endif
 }
 
-void Froxelizer::froxelizeLights(FEngine& engine,
-        CameraInfo const& UTILS_RESTRICT camera,
-        const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
+void Froxelizer::froxelizeLights(FEngine& engine) noexcept {
     // note: this is called asynchronously
-    froxelizeLoop(engine, camera, lightData);
+    if (mDirtyGroups.none()) {
+        // prepare() found that last frame's froxels are still valid
+        return;
+    }
+
+    froxelizeLoop(engine);
     froxelizeAssignRecordsCompress();
+    mDirtyGroups.reset();
 
 #ifndef NDEBUG
-    if (lightData.size()) {
+    if (mLightCount) {
         // go through every froxel
         auto const& recordBufferUser(mRecordBufferUser);
         auto gpuFroxelEntries(mFroxelBufferUser);
@@ -557,70 +656,51 @@ void Froxelizer::froxelizeLights(FEngine& engine,
                 assert(lightIndex <= CONFIG_MAX_LIGHT_INDEX);
 
                 // make sure it corresponds to an existing light
-                assert(lightIndex < lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT);
+                assert(lightIndex < mLightCount);
             }
         }
     }
 #endif
 }
 
-void Froxelizer::froxelizeLoop(FEngine& engine,
-        const CameraInfo& UTILS_RESTRICT camera,
-        const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
+void Froxelizer::froxelizeLoop(FEngine& engine) noexcept {
     SYSTRACE_CALL();
 
     Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
-    memset(froxelThreadData.data(), 0, froxelThreadData.sizeInBytes());
-
-    auto& lcm = engine.getLightManager();
-    auto const* UTILS_RESTRICT spheres      = lightData.data<FScene::POSITION_RADIUS>();
-    auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
-    auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
+    LightParams const* const UTILS_RESTRICT lightParams = mLightParams.data();
 
-    auto process = [ this, &froxelThreadData,
-                     spheres, directions, instances, &camera, &lcm ]
-            (size_t count, size_t offset, size_t stride) {
+    // only the groups with a light that changed are processed, the others still hold last
+    // frame's data.
+    auto process = [ this, &froxelThreadData, lightParams, count = mLightCount ]
+            (size_t group) {
 
         const mat4f& projection = mProjection;
-        const mat3f& vn = camera.view.upperLeft();
-
-        for (size_t i = offset; i < count; i += stride) {
-            const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
-            FLightManager::Instance li = instances[j];
-            LightParams light = {
-                    .position = (camera.view * float4{ spheres[j].xyz, 1 }).xyz, // to view-space
-                    .cosSqr = lcm.getCosOuterSquared(li),   // spot only
-                    .axis = vn * directions[j],             // spot only
-                    .invSin = lcm.getSinInverse(li),        // spot only
-                    .radius = spheres[j].w,
-            };
-
-            const size_t group = i % GROUP_COUNT;
-            const size_t bit   = i / GROUP_COUNT;
+        FroxelThreadData& threadData = froxelThreadData[group];
+        memset(threadData.data(), 0, sizeof(FroxelThreadData));
+
+        for (size_t i = group; i < count; i += GROUP_COUNT) {
+            const size_t bit = i / GROUP_COUNT;
             assert(bit < LIGHT_PER_GROUP);
 
-            FroxelThreadData& threadData = froxelThreadData[group];
+            LightParams const& light = lightParams[i];
             const bool isSpot = light.invSin != std::numeric_limits<float>::infinity();
             threadData[0] |= isSpot << bit;
             froxelizePointAndSpotLight(threadData, bit, projection, light);
         }
     };
 
-    // we do 64 lights per job
+    // we do 32 lights per job
     JobSystem& js = engine.getJobSystem();
 
     constexpr bool SINGLE_THREADED = false;
     if (!SINGLE_THREADED) {
         auto parent = js.createJob();
-        for (size_t i = 0; i < GROUP_COUNT; i++) {
-            js.run(jobs::createJob(js, parent, std::cref(process),
-                    lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, i, GROUP_COUNT));
-        }
+        mDirtyGroups.forEachSetBit([&js, parent, &process](size_t group) {
+            js.run(jobs::createJob(js, parent, std::cref(process), group));
+        });
         js.runAndWait(parent);
     } else {
-        js.runAndWait(jobs::createJob(js, nullptr, std::cref(process),
-                lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, 0, 1)
-        );
+        mDirtyGroups.forEachSetBit(process);
     }
 }
 
@@ -660,7 +740,7 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
         }
     }
 
-    uint16_t offset = 0;
+    uint32_t offset = 0;
     FroxelEntry* const UTILS_RESTRICT froxels = mFroxelBufferUser.data();
 
     const size_t froxelCountX = mFroxelCountX;
@@ -680,15 +760,15 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
     for (size_t i = 0, c = getFroxelCount(); i < c;) {
         LightRecord b = records[i];
         if (b.lights.none()) {
-            froxels[remap(i++)].u32 = 0;
+            froxels[remap(i++)].u64 = 0;
             continue;
         }
 
-        // We have a limitation of 255 spot + 255 point lights per froxel.
+        // the counts are stored on 16 bits, which always fits CONFIG_MAX_LIGHT_COUNT
         FroxelEntry entry = {
                 .offset = offset,
-                .pointLightCount = (uint8_t)std::min(size_t(255), (b.lights & ~spotLights).count()),
-                .spotLightCount  = (uint8_t)std::min(size_t(255), (b.lights &  spotLights).count())
+                .pointLightCount = (uint16_t)(b.lights & ~spotLights).count(),
+                .spotLightCount  = (uint16_t)(b.lights &  spotLights).count()
         };
         const size_t lightCount = entry.count[0] + entry.count[1];
 
@@ -699,7 +779,7 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
             // note: instead of dropping froxels we could look for similar records we've already
             // filed up.
             do { // this compiles to memset() when remap() is identity
-                froxels[remap(i++)].u32 = 0;
+                froxels[remap(i++)].u64 = 0;
             } while(i < c);
             goto out_of_memory;
         }
@@ -707,23 +787,18 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
         // iterate the bitfield
         auto beginPoint = froxelRecords + offset;
         auto beginSpot  = froxelRecords + offset + entry.count[0];
-        b.lights.forEachSetBit([&spotLights,
-                point = beginPoint, spot = beginSpot, beginPoint, beginSpot]
+        b.lights.forEachSetBit([&spotLights, point = beginPoint, spot = beginSpot]
                 (size_t l) mutable {
 
             // make sure to keep this code branch-less
             const bool isSpot = spotLights[l];
-            auto& p = isSpot ? spot      : point;
-            auto  s = isSpot ? beginSpot : beginPoint;
+            auto& p = isSpot ? spot : point;
 
             const size_t word = l / LIGHT_PER_GROUP;
             const size_t bit  = l % LIGHT_PER_GROUP;
             l = (bit * GROUP_COUNT) | (word % GROUP_COUNT);
 
-            *p = (RecordBufferType)l;
-            // we need to "cancel" the write if we have more than 255 spot or point lights
-            // (this is a limitation of the data type used to store the light counts per froxel)
-            p += (p - s < 255) ? 1 : 0;
+            *p++ = (RecordBufferType)l;
         });
 
         offset += lightCount;
@@ -735,7 +810,7 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
 #ifndef NDEBUG
             if (lightCount) { reused++; }
 #endif
-            froxels[remap(i++)].u32 = entry.u32;
+            froxels[remap(i++)].u64 = entry.u64;
             if (i >= c) break;
 
             if (records[i].lights != b.lights && i >= froxelCountX) {
@@ -743,7 +818,7 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
                 // we re-try with the record above it, which saves many froxel records
                 // (north of 10% in practice).
                 b = records[i - froxelCountX];
-                entry.u32 = froxels[remap(i - froxelCountX)].u32;
+                entry.u64 = froxels[remap(i - froxelCountX)].u64;
             }
         } while(records[i].lights == b.lights);
     }
@@ -882,13 +957,8 @@ void Froxelizer::froxelizePointAndSpotLight(
                     size_t fi = getFroxelIndex(bx, iy, iz) + 1;
                     if (light.invSin != std::numeric_limits<float>::infinity()) {
                         // This is a spotlight (common case)
-                        // this loops gets vectorized (on arm64) w/ clang
-                        while (bx++ != ex) {
-                            // see if this froxel intersects the cone
-                            bool intersect = sphereConeIntersectionFast(boundingSpheres[fi - 1],
-                                    light.position, light.axis, light.invSin, light.cosSqr);
-                            froxelThread[fi++] |= LightGroupType(intersect) << bit;
-                        }
+                        froxelizeSpotLightRow(&froxelThread[fi], boundingSpheres + fi - 1,
+                                ex - bx, mRowRadii[iz * mFroxelCountY + iy], bit, light);
                     } else {
                         // this loops gets vectorized (on arm64) w/ clang
                         while (bx++ != ex) {
@@ -901,6 +971,44 @@ void Froxelizer::froxelizePointAndSpotLight(
     }
 }
 
+/*
+ * Sets 'bit' in the 'count' froxel entries of a row whose bounding sphere intersects the cone
+ * of a spotlight.
+ *
+ * The froxels of a row only differ in x, so their centers are aligned and a sphere bounding
+ * all of them is tested first: most rows that touch the light's bounding sphere but not its
+ * cone are rejected with a single test. The remaining froxels are tested 4 at a time.
+ */
+void Froxelizer::froxelizeSpotLightRow(LightGroupType* UTILS_RESTRICT entries,
+        float4 const* UTILS_RESTRICT spheres, size_t count, float rowRadius, size_t bit,
+        const Froxelizer::LightParams& UTILS_RESTRICT light) noexcept {
+
+    if (count > 4) {
+        const float3 first = spheres[0].xyz;
+        const float3 last = spheres[count - 1].xyz;
+        const float4 row = { (first + last) * 0.5f, distance(first, last) * 0.5f + rowRadius };
+        if (!sphereConeIntersectionFast(row,
+                light.position, light.axis, light.invSin, light.cosSqr)) {
+            return;
+        }
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32_t intersect = sphereConeIntersectionFast4(spheres + i,
+                light.position, light.axis, light.invSin, light.cosSqr);
+        entries[i + 0] |= LightGroupType((intersect >> 0u) & 1u) << bit;
+        entries[i + 1] |= LightGroupType((intersect >> 1u) & 1u) << bit;
+        entries[i + 2] |= LightGroupType((intersect >> 2u) & 1u) << bit;
+        entries[i + 3] |= LightGroupType((intersect >> 3u) & 1u) << bit;
+    }
+    for (; i < count; i++) {
+        const bool intersect = sphereConeIntersectionFast(spheres[i],
+                light.position, light.axis, light.invSin, light.cosSqr);
+        entries[i] |= LightGroupType(intersect) << bit;
+    }
+}
+
 /*
  *
  * lightTree            output the light tree structure there (must be large enough to hold a complete tree)
@@ -933,22 +1041,20 @@ void Froxelizer::computeLightTree(
                 lightTree[index] = {
                         .min = min,
                         .max = max,
+                        .offset = uint32_t(lightRecordsOffset + col),
                         .next = uint16_t(next),
-                        .offset = uint16_t(lightRecordsOffset + col),
                         .isLeaf = 1,
                         .count = 1,
-                        .reserved = 0,
                 };
             },
             [lightTree](size_t index, size_t l, size_t r, size_t next) {
                 lightTree[index] = {
                         .min = std::min(lightTree[l].min, lightTree[r].min),
                         .max = std::max(lightTree[l].max, lightTree[r].max),
-                        .next = uint16_t(next),
                         .offset = 0,
+                        .next = uint16_t(next),
                         .isLeaf = 0,
                         .count = 0,
-                        .reserved = 0,
                 };
             });
 }
@@ -75,6 +75,34 @@ inline bool sphereConeIntersectionFast(
     return (e * e >= dd * coneCosSquared && e > 0);
 }
 
+// same as sphereConeIntersectionFast() for 4 spheres at once, returns a 4-bits mask
+// the spheres are transposed so that each lane of the computation is one sphere, which lets
+// the compiler use SIMD instructions.
+inline uint32_t sphereConeIntersectionFast4(
+        math::float4 const* UTILS_RESTRICT spheres,
+        math::float3 const& conePosition,
+        math::float3 const& coneAxis,
+        float coneSinInverse,
+        float coneCosSquared) noexcept {
+    const math::float4 x = { spheres[0].x, spheres[1].x, spheres[2].x, spheres[3].x };
+    const math::float4 y = { spheres[0].y, spheres[1].y, spheres[2].y, spheres[3].y };
+    const math::float4 z = { spheres[0].z, spheres[1].z, spheres[2].z, spheres[3].z };
+    const math::float4 w = { spheres[0].w, spheres[1].w, spheres[2].w, spheres[3].w };
+    const math::float4 s = w * coneSinInverse;
+    const math::float4 dx = x - conePosition.x + s * coneAxis.x;
+    const math::float4 dy = y - conePosition.y + s * coneAxis.y;
+    const math::float4 dz = z - conePosition.z + s * coneAxis.z;
+    const math::float4 e = dx * coneAxis.x + dy * coneAxis.y + dz * coneAxis.z;
+    const math::float4 dd = dx * dx + dy * dy + dz * dz;
+    const math::float4 ee = e * e;
+    const math::float4 cc = dd * coneCosSquared;
+    uint32_t result = 0;
+    for (size_t i = 0; i < 4; i++) {
+        result |= uint32_t(ee[i] >= cc[i] && e[i] > 0) << i;
+    }
+    return result;
+}
+
 inline bool sphereConeIntersection(
         math::float4 const& sphere,
         math::float3 const& conePosition,
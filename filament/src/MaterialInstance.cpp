@@ -94,6 +94,7 @@ void FMaterialInstance::terminate(FEngine& engine) {
 void FMaterialInstance::commitSlow(FEngine& engine) const {
     // update uniforms if needed
     FEngine::DriverApi& driver = engine.getDriverApi();
+    mGeneration++;
     if (mUniforms.isDirty()) {
         driver.updateUniformBuffer(mUbHandle, mUniforms.toBufferDescriptor(driver));
         mUniforms.clean();
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/OcclusionCuller.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+
+#include <math.h>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#   define FILAMENT_OCCLUSION_USE_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define FILAMENT_OCCLUSION_USE_NEON 1
+#endif
+
+using namespace math;
+using namespace utils;
+
+namespace filament {
+namespace details {
+
+namespace {
+
+// the 12 triangles of a box, corner i is at center + extent * (bit0, bit1, bit2 ? 1 : -1)
+constexpr uint8_t BOX_TRIANGLES[12][3] = {
+        { 0, 2, 6 }, { 0, 6, 4 },   // -x
+        { 1, 3, 7 }, { 1, 7, 5 },   // +x
+        { 0, 1, 5 }, { 0, 5, 4 },   // -y
+        { 2, 3, 7 }, { 2, 7, 6 },   // +y
+        { 0, 1, 3 }, { 0, 3, 2 },   // -z
+        { 4, 5, 7 }, { 4, 7, 6 },   // +z
+};
+
+// projects the 8 corners of a box in clip-space
+inline void projectBox(float4* UTILS_RESTRICT corners, mat4f const& clipFromWorld,
+        float3 const& center, float3 const& extent) noexcept {
+    const float4 c = clipFromWorld * float4{ center, 1 };
+    const float4 x = clipFromWorld[0] * extent.x;
+    const float4 y = clipFromWorld[1] * extent.y;
+    const float4 z = clipFromWorld[2] * extent.z;
+    for (size_t i = 0; i < 8; i++) {
+        corners[i] = c + ((i & 1) ? x : -x) + ((i & 2) ? y : -y) + ((i & 4) ? z : -z);
+    }
+}
+
+// corners closer than this to the camera plane can't be projected reliably
+constexpr float MIN_W = 1e-5f;
+
+// number of pixels rasterized at once by rasterizeSpan()
+#if defined(FILAMENT_OCCLUSION_USE_SSE2) || defined(FILAMENT_OCCLUSION_USE_NEON)
+constexpr int32_t SPAN_ALIGNMENT = 4;
+#else
+constexpr int32_t SPAN_ALIGNMENT = 1;
+#endif
+
+/*
+ * Rasterizes the pixels [xs, xe) of a row of a triangle, xs and xe are multiples of
+ * SPAN_ALIGNMENT. A pixel is covered if its three edge functions, ex * x + e, are positive,
+ * its depth is dx * x + z. All kernels do the same operations in the same order, without FMA,
+ * so they produce the same depth buffer.
+ */
+#if defined(FILAMENT_OCCLUSION_USE_SSE2)
+
+inline void rasterizeSpan(float* UTILS_RESTRICT row, int32_t xs, int32_t xe,
+        float3 const& ex, float3 const& e, float dx, float z) noexcept {
+    const __m128 offset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 ex0 = _mm_set1_ps(ex[0]), e0 = _mm_set1_ps(e[0]);
+    const __m128 ex1 = _mm_set1_ps(ex[1]), e1 = _mm_set1_ps(e[1]);
+    const __m128 ex2 = _mm_set1_ps(ex[2]), e2 = _mm_set1_ps(e[2]);
+    const __m128 vdx = _mm_set1_ps(dx), vz = _mm_set1_ps(z);
+    for (int32_t x = xs; x < xe; x += 4) {
+        const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offset);
+        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex0, px), e0), zero);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex1, px), e1), zero));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex2, px), e2), zero));
+        const __m128 r = _mm_loadu_ps(row + x);
+        const __m128 d = _mm_min_ps(r, _mm_add_ps(_mm_mul_ps(vdx, px), vz));
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, d), _mm_andnot_ps(inside, r)));
+    }
+}
+
+#elif defined(FILAMENT_OCCLUSION_USE_NEON)
+
+inline void rasterizeSpan(float* UTILS_RESTRICT row, int32_t xs, int32_t xe,
+        float3 const& ex, float3 const& e, float dx, float z) noexcept {
+    const float32x4_t offset = { 0.5f, 1.5f, 2.5f, 3.5f };
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t ex0 = vdupq_n_f32(ex[0]), e0 = vdupq_n_f32(e[0]);
+    const float32x4_t ex1 = vdupq_n_f32(ex[1]), e1 = vdupq_n_f32(e[1]);
+    const float32x4_t ex2 = vdupq_n_f32(ex[2]), e2 = vdupq_n_f32(e[2]);
+    const float32x4_t vdx = vdupq_n_f32(dx), vz = vdupq_n_f32(z);
+    for (int32_t x = xs; x < xe; x += 4) {
+        const float32x4_t px = vaddq_f32(vdupq_n_f32(float(x)), offset);
+        uint32x4_t inside = vcgeq_f32(vaddq_f32(vmulq_f32(ex0, px), e0), zero);
+        inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(vmulq_f32(ex1, px), e1), zero));
+        inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(vmulq_f32(ex2, px), e2), zero));
+        const float32x4_t r = vld1q_f32(row + x);
+        const float32x4_t d = vminq_f32(r, vaddq_f32(vmulq_f32(vdx, px), vz));
+        vst1q_f32(row + x, vbslq_f32(inside, d, r));
+    }
+}
+
+#else
+
+inline void rasterizeSpan(float* UTILS_RESTRICT row, int32_t xs, int32_t xe,
+        float3 const& ex, float3 const& e, float dx, float z) noexcept {
+    for (int32_t x = xs; x < xe; x++) {
+        const float px = x + 0.5f;
+        const bool inside = (ex[0] * px + e[0] >= 0) &
+                            (ex[1] * px + e[1] >= 0) &
+                            (ex[2] * px + e[2] >= 0);
+        const float d = std::min(row[x], dx * px + z);
+        row[x] = inside ? d : row[x];
+    }
+}
+
+#endif
+
+} // anonymous namespace
+
+void OcclusionCuller::setResolution(size_t width, size_t height) {
+    width  = std::min(std::max(width,  MIN_RESOLUTION), MAX_RESOLUTION);
+    height = std::min(std::max(height, MIN_RESOLUTION), MAX_RESOLUTION);
+    width  = (width  + TILE_SIZE - 1) & ~(TILE_SIZE - 1);
+    height = (height + TILE_SIZE - 1) & ~(TILE_SIZE - 1);
+    if (width != mWidth || height != mHeight) {
+        mWidth = width;
+        mHeight = height;
+        mDepth.resize(width * height);
+        mTiles.resize((width / TILE_SIZE) * (height / TILE_SIZE));
+    }
+}
+
+void OcclusionCuller::cull(JobSystem& js, FRenderableManager const& rcm,
+        FScene::RenderableSoa& renderableData,
+        mat4f const& clipFromWorld, uint8_t visibleLayers, size_t bit) {
+    SYSTRACE_CALL();
+
+    mStats = {};
+    if (!mWidth || !mHeight) {
+        return;
+    }
+
+    Culler::result_type* const UTILS_RESTRICT visibleMask =
+            renderableData.data<FScene::VISIBLE_MASK>();
+    auto const* const UTILS_RESTRICT instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const UTILS_RESTRICT transforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* const UTILS_RESTRICT visibility = renderableData.data<FScene::VISIBILITY_STATE>();
+    uint8_t const* const UTILS_RESTRICT layers = renderableData.data<FScene::LAYERS>();
+    float3 const* const UTILS_RESTRICT center = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    float3 const* const UTILS_RESTRICT extent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+    const Culler::result_type visible = Culler::result_type(1u << bit);
+    const uint32_t count = uint32_t(renderableData.size());
+
+    // only the renderables that would be visible without occlusion culling participate
+    auto participates = [=](size_t i) {
+        return (visibleMask[i] & visible) && (layers[i] & visibleLayers) && visibility[i].culling;
+    };
+
+    // set-up the triangles of all visible occluders, from their oriented box
+    mTriangles.clear();
+    for (size_t i = 0; i < count; i++) {
+        if (visibility[i].occluder && participates(i)) {
+            Box const& box = rcm.getAABB(instances[i]);
+            addOccluder(clipFromWorld * transforms[i].toMat4(), box.center, box.halfExtent);
+            mStats.occluders++;
+        }
+    }
+    if (mTriangles.empty()) {
+        return;
+    }
+
+    // rasterize them in parallel, each job owns a band of tiles
+    auto rasterizeWork = [this](uint32_t first, uint32_t count) {
+        rasterize(first, count);
+    };
+    auto rasterizeJob = jobs::parallel_for(js, nullptr, 0, uint32_t(mHeight / TILE_SIZE),
+            std::cref(rasterizeWork), jobs::CountSplitter<2, 8>());
+    js.runAndWait(rasterizeJob);
+
+    // test all visible renderables against the depth buffer
+    std::atomic<uint32_t> tested{ 0 };
+    std::atomic<uint32_t> occluded{ 0 };
+    auto testWork = [&](uint32_t first, uint32_t count) {
+        uint32_t localTested = 0;
+        uint32_t localOccluded = 0;
+        for (size_t i = first, c = first + count; i < c; i++) {
+            if (participates(i)) {
+                localTested++;
+                if (isOccluded(clipFromWorld, center[i], extent[i])) {
+                    visibleMask[i] &= ~visible;
+                    localOccluded++;
+                }
+            }
+        }
+        tested.fetch_add(localTested, std::memory_order_relaxed);
+        occluded.fetch_add(localOccluded, std::memory_order_relaxed);
+    };
+    auto testJob = jobs::parallel_for(js, nullptr, 0, count,
+            std::cref(testWork), jobs::CountSplitter<64, 8>());
+    js.runAndWait(testJob);
+
+    mStats.tested = tested.load(std::memory_order_relaxed);
+    mStats.occluded = occluded.load(std::memory_order_relaxed);
+}
+
+void OcclusionCuller::addOccluder(mat4f const& clipFromModel,
+        float3 const& center, float3 const& extent) {
+    float4 corners[8];
+    projectBox(corners, clipFromModel, center, extent);
+
+    // we don't clip triangles, occluders crossing the camera plane are simply ignored
+    float3 screen[8];
+    const float2 size{ float(mWidth), float(mHeight) };
+    for (size_t i = 0; i < 8; i++) {
+        if (corners[i].w < MIN_W) {
+            return;
+        }
+        const float3 ndc = corners[i].xyz * (1.0f / corners[i].w);
+        screen[i] = float3{ (ndc.xy * 0.5f + 0.5f) * size, ndc.z };
+    }
+
+    for (auto const& triangle : BOX_TRIANGLES) {
+        addTriangle(screen[triangle[0]], screen[triangle[1]], screen[triangle[2]]);
+    }
+}
+
+void OcclusionCuller::addTriangle(float3 p0, float3 p1, float3 p2) {
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area < 0) {
+        std::swap(p1, p2);
+        area = -area;
+    }
+    if (area < std::numeric_limits<float>::epsilon()) {
+        // degenerate triangles don't cover any pixel
+        return;
+    }
+
+    Triangle t;
+    t.xmin = int32_t(std::max(0.0f, std::floor(std::min({ p0.x, p1.x, p2.x }))));
+    t.ymin = int32_t(std::max(0.0f, std::floor(std::min({ p0.y, p1.y, p2.y }))));
+    t.xmax = int32_t(std::min(float(mWidth),  std::ceil(std::max({ p0.x, p1.x, p2.x }))));
+    t.ymax = int32_t(std::min(float(mHeight), std::ceil(std::max({ p0.y, p1.y, p2.y }))));
+    if (t.xmin >= t.xmax || t.ymin >= t.ymax) {
+        return;
+    }
+
+    // the edge function of (a, b) is positive on the side of the third vertex
+    auto edge = [](float3 const& a, float3 const& b) {
+        return float3{ a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x };
+    };
+    t.edges[0] = edge(p1, p2);
+    t.edges[1] = edge(p2, p0);
+    t.edges[2] = edge(p0, p1);
+
+    // interpolate the depth with the barycentric coordinates, and push it back by the largest
+    // variation within a pixel, so that what's stored is never in front of the occluder
+    const float3 depth = (t.edges[0] * p0.z + t.edges[1] * p1.z + t.edges[2] * p2.z) / area;
+    t.depth = float3{ depth.xy, depth.z + 0.5f * (std::abs(depth.x) + std::abs(depth.y)) };
+
+    mTriangles.push_back(t);
+}
+
+void OcclusionCuller::rasterize(size_t firstTileRow, size_t tileRowCount) noexcept {
+    const int32_t width = int32_t(mWidth);
+    const int32_t y0 = int32_t(firstTileRow * TILE_SIZE);
+    const int32_t y1 = int32_t((firstTileRow + tileRowCount) * TILE_SIZE);
+    float* const UTILS_RESTRICT buffer = mDepth.data();
+
+    std::fill(buffer + y0 * width, buffer + y1 * width, std::numeric_limits<float>::infinity());
+
+    for (Triangle const& t : mTriangles) {
+        const int32_t ymin = std::max(t.ymin, y0);
+        const int32_t ymax = std::min(t.ymax, y1);
+        for (int32_t y = ymin; y < ymax; y++) {
+            // all the tests are done at the center of the pixels
+            const float py = y + 0.5f;
+            const float e0 = t.edges[0].y * py + t.edges[0].z;
+            const float e1 = t.edges[1].y * py + t.edges[1].z;
+            const float e2 = t.edges[2].y * py + t.edges[2].z;
+            const float z = t.depth.y * py + t.depth.z;
+            // The span is widened to whole vectors, the pixels added are outside of the
+            // triangle's bounds, they fail the edge tests. The width is a multiple of TILE_SIZE.
+            const int32_t xs = t.xmin & ~(SPAN_ALIGNMENT - 1);
+            const int32_t xe = (t.xmax + SPAN_ALIGNMENT - 1) & ~(SPAN_ALIGNMENT - 1);
+            rasterizeSpan(buffer + y * width, xs, xe,
+                    { t.edges[0].x, t.edges[1].x, t.edges[2].x }, { e0, e1, e2 },
+                    t.depth.x, z);
+        }
+    }
+
+    // compute the farthest depth of each tile
+    const size_t tilesPerRow = mWidth / TILE_SIZE;
+    for (size_t ty = firstTileRow, c = firstTileRow + tileRowCount; ty < c; ty++) {
+        float* const UTILS_RESTRICT tiles = mTiles.data() + ty * tilesPerRow;
+        std::fill(tiles, tiles + tilesPerRow, std::numeric_limits<float>::lowest());
+        for (size_t y = ty * TILE_SIZE, e = y + TILE_SIZE; y < e; y++) {
+            float const* const UTILS_RESTRICT row = buffer + y * mWidth;
+            for (size_t x = 0; x < mWidth; x++) {
+                tiles[x / TILE_SIZE] = std::max(tiles[x / TILE_SIZE], row[x]);
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(mat4f const& clipFromWorld,
+        float3 const& center, float3 const& extent) const noexcept {
+    float4 corners[8];
+    projectBox(corners, clipFromWorld, center, extent);
+
+    float2 bmin{ std::numeric_limits<float>::max() };
+    float2 bmax{ std::numeric_limits<float>::lowest() };
+    float zmin = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < 8; i++) {
+        if (corners[i].w < MIN_W) {
+            // the box crosses the camera plane, it can't be hidden
+            return false;
+        }
+        const float3 ndc = corners[i].xyz * (1.0f / corners[i].w);
+        bmin = min(bmin, ndc.xy);
+        bmax = max(bmax, ndc.xy);
+        zmin = std::min(zmin, ndc.z);
+    }
+
+    // screen-space rectangle covered by the box, grown by one pixel because occluders are only
+    // sampled at the center of the pixels
+    const float2 size{ float(mWidth), float(mHeight) };
+    bmin = floor((bmin * 0.5f + 0.5f) * size) - 1.0f;
+    bmax = ceil((bmax * 0.5f + 0.5f) * size) + 1.0f;
+    const int32_t x0 = int32_t(std::max(0.0f, bmin.x));
+    const int32_t y0 = int32_t(std::max(0.0f, bmin.y));
+    const int32_t x1 = int32_t(std::min(size.x, bmax.x));
+    const int32_t y1 = int32_t(std::min(size.y, bmax.y));
+    if (x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+
+    // the box is hidden if every pixel it covers has an occluder in front of it
+    const int32_t tileSize = int32_t(TILE_SIZE);
+    const size_t tilesPerRow = mWidth / TILE_SIZE;
+    for (int32_t ty = y0 / tileSize; ty <= (y1 - 1) / tileSize; ty++) {
+        for (int32_t tx = x0 / tileSize; tx <= (x1 - 1) / tileSize; tx++) {
+            if (mTiles[ty * tilesPerRow + tx] < zmin) {
+                continue;
+            }
+            const int32_t ys = std::max(y0, ty * tileSize);
+            const int32_t ye = std::min(y1, (ty + 1) * tileSize);
+            const int32_t xs = std::max(x0, tx * tileSize);
+            const int32_t xe = std::min(x1, (tx + 1) * tileSize);
+            for (int32_t y = ys; y < ye; y++) {
+                float const* const UTILS_RESTRICT row = mDepth.data() + y * mWidth;
+                for (int32_t x = xs; x < xe; x++) {
+                    if (!(row[x] < zmin)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace details
+} // namespace filament
@@ -15,7 +15,6 @@
  */
 
 #include "PostProcessManager.h"
-#include "RenderTargetPool.h"
 
 #include "details/Engine.h"
 
@@ -34,8 +33,6 @@ using namespace details;
 void PostProcessManager::init(FEngine& engine) noexcept {
     mEngine = &engine;
 
-    mCommands.reserve(8);
-
     mPostProcessUb = UniformBuffer(engine.getPerPostProcessUib());
 
     // create sampler for post-process FBO
@@ -52,10 +49,9 @@ void PostProcessManager::terminate(driver::DriverApi& driver) noexcept {
     driver.destroyUniformBuffer(mPostProcessUbh);
 }
 
-void PostProcessManager::setSource(uint32_t viewportWidth, uint32_t viewportHeight,
+void PostProcessManager::setSource(DriverApi& driver, uint32_t viewportWidth, uint32_t viewportHeight,
         Handle<HwTexture> texture, uint32_t textureWidth, uint32_t textureHeight) const noexcept {
     FEngine& engine = *mEngine;
-    DriverApi& driver = engine.getDriverApi();
 
     // FXAA requires linear filtering. The post-processing stage however, doesn't
     // use samplers.
@@ -82,110 +78,6 @@ void PostProcessManager::setSource(uint32_t viewportWidth, uint32_t viewportHeig
     driver.updateUniformBuffer(mPostProcessUbh, ub.toBufferDescriptor(driver));
 }
 
-void PostProcessManager::blit(driver::TextureFormat format) noexcept {
-    mCommands.push_back({{}, format});
-}
-
-void PostProcessManager::pass(driver::TextureFormat format, Handle<HwProgram> program) noexcept {
-    mCommands.push_back({program, format});
-}
-
-void PostProcessManager::finish(driver::TargetBufferFlags discarded,
-        Handle<HwRenderTarget> viewRenderTarget,
-        Viewport const& vp,
-        RenderTargetPool::Target const* previous,
-        Viewport const& svp) {
-
-    assert(viewRenderTarget);
-    assert(previous);
-
-    FEngine& engine = *mEngine;
-    DriverApi& driver = engine.getDriverApi();
-    RenderTargetPool& rtp = engine.getRenderTargetPool();
-    Handle<HwRenderPrimitive> const& fullScreenRenderPrimitive = engine.getFullScreenRenderPrimitive();
-    std::vector<Command>& commands = mCommands;
-
-    if (UTILS_UNLIKELY(commands.empty())) {
-        rtp.put(previous);
-        return;
-    }
-
-    Driver::PipelineState pipeline;
-
-    pipeline.rasterState.culling = Driver::RasterState::CullingMode::NONE;
-    pipeline.rasterState.colorWrite = true;
-    pipeline.rasterState.depthFunc = Driver::RasterState::DepthFunc::A;
-
-    RenderPassParams params = {};
-    params.discardStart = TargetBufferFlags::ALL;
-    params.discardEnd = TargetBufferFlags::DEPTH_AND_STENCIL;
-    params.left = 0;
-    params.bottom = 0;
-    params.width = svp.width;
-    params.height = svp.height;
-    params.dependencies = RenderPassParams::DEPENDENCY_BY_REGION;
-
-    for (size_t i = 0, c = commands.size() - 1; i < c; i++) {
-        // if the next command is a blit, it we don't need a texture
-        uint8_t flags = !commands[i + 1].program ? RenderTargetPool::Target::NO_TEXTURE : uint8_t();
-
-        // create a render target for this pass
-        RenderTargetPool::Target const* target = rtp.get(
-                TargetBufferFlags::COLOR, svp.width, svp.height, 1, commands[i].format, flags);
-
-        assert(target);
-
-        if (commands[i].program) {
-            // set the source for this pass (i.e. previous target)
-            setSource(params.width, params.height, previous->texture, previous->w, previous->h);
-
-            // draw a full screen triangle
-            pipeline.program = commands[i].program;
-            driver.beginRenderPass(target->target, params);
-            driver.draw(pipeline, fullScreenRenderPrimitive);
-            driver.endRenderPass();
-        } else {
-            driver.blit(TargetBufferFlags::COLOR,
-                    target->target, 0, 0, svp.width, svp.height,
-                    previous->target, 0, 0, svp.width, svp.height);
-        }
-        // return the previous target to the pool
-        rtp.put(previous);
-        previous = target;
-    }
-
-    assert(!commands.empty());
-    assert(previous);
-
-    // The last command is special, it always draw to the viewRenderTarget and uses
-    // the non scaled viewport.
-    if (commands.back().program) {
-        params.discardStart = discarded;
-        params.discardEnd = TargetBufferFlags::DEPTH_AND_STENCIL;
-        params.left = vp.left;
-        params.bottom = vp.bottom;
-        params.width = vp.width;
-        params.height = vp.height;
-
-        setSource(params.width, params.height, previous->texture, previous->w, previous->h);
-        pipeline.program = commands.back().program;
-        driver.beginRenderPass(viewRenderTarget, params);
-        driver.draw(pipeline, fullScreenRenderPrimitive);
-        driver.endRenderPass();
-
-    } else {
-        driver.blit(TargetBufferFlags::COLOR,
-                viewRenderTarget, vp.left, vp.bottom, vp.width, vp.height,
-                previous->target, 0, 0, svp.width, svp.height);
-    }
-
-    rtp.put(previous);
-
-    // clear our command buffer
-    commands.clear();
-}
-
-
 // ------------------------------------------------------------------------------------------------
 
 FrameGraphResource PostProcessManager::msaa(FrameGraph& fg,
@@ -259,7 +151,8 @@ FrameGraphResource PostProcessManager::toneMapping(FrameGraph& fg,
                 auto const& targetDesc = resources.getDescriptor(data.output);
                 auto const& textureDesc = resources.getDescriptor(data.input);
                 auto const& texture = resources.getTexture(data.input, TextureUsage::COLOR_ATTACHMENT);
-                setSource(targetDesc.width, targetDesc.height, texture, textureDesc.width, textureDesc.height);
+                setSource(driver, targetDesc.width, targetDesc.height, texture,
+                        textureDesc.width, textureDesc.height);
 
                 auto const& target = resources.getRenderTarget(data.output);
                 driver.beginRenderPass(target.target, target.params);
@@ -309,7 +202,8 @@ FrameGraphResource PostProcessManager::fxaa(FrameGraph& fg,
                 auto const& targetDesc = resources.getDescriptor(data.output);
                 auto const& textureDesc = resources.getDescriptor(data.input);
                 auto const& texture = resources.getTexture(data.input, TextureUsage::COLOR_ATTACHMENT);
-                setSource(targetDesc.width, targetDesc.height, texture, textureDesc.width, textureDesc.height);
+                setSource(driver, targetDesc.width, targetDesc.height, texture,
+                        textureDesc.width, textureDesc.height);
 
                 auto const& target = resources.getRenderTarget(data.output);
                 driver.beginRenderPass(target.target, target.params);
@@ -322,7 +216,7 @@ FrameGraphResource PostProcessManager::fxaa(FrameGraph& fg,
 
 FrameGraphResource PostProcessManager::dynamicScaling(FrameGraph& fg,
         FrameGraphResource input, driver::TextureFormat outFormat,
-        Viewport const& outViewport) noexcept {
+        Viewport const& inViewport, Viewport const& outViewport) noexcept {
 
     struct PostProcessScaling {
         FrameGraphResource input;
@@ -345,11 +239,11 @@ FrameGraphResource PostProcessManager::dynamicScaling(FrameGraph& fg,
                     PostProcessScaling const& data, DriverApi& driver) {
                 auto in = resources.getRenderTarget(data.input);
                 auto out = resources.getRenderTarget(data.output);
-                auto const& inDesc = resources.getDescriptor(data.input);
                 driver.blit(TargetBufferFlags::COLOR,
                         out.target, outViewport.left, outViewport.bottom, outViewport.width,
                         outViewport.height,
-                        in.target, 0, 0, inDesc.width, inDesc.height);
+                        in.target, inViewport.left, inViewport.bottom, inViewport.width,
+                        inViewport.height);
             });
 
     return ppScaling.getData().output;
@@ -17,8 +17,6 @@
 #ifndef TNT_FILAMENT_POSTPROCESS_MANAGER_H
 #define TNT_FILAMENT_POSTPROCESS_MANAGER_H
 
-#include "RenderTargetPool.h"
-
 #include "UniformBuffer.h"
 
 #include "fg/FrameGraphResource.h"
@@ -30,8 +28,6 @@
 
 #include <filament/driver/DriverEnums.h>
 
-#include <vector>
-
 namespace filament {
 
 namespace details {
@@ -43,24 +39,8 @@ class PostProcessManager {
 public:
     void init(details::FEngine& engine) noexcept;
     void terminate(driver::DriverApi& driver) noexcept;
-    void setSource(uint32_t viewportWidth, uint32_t viewportHeight, Handle <HwTexture> texture,
-            uint32_t textureWidth, uint32_t textureHeight) const noexcept;
-
-    // start() is a scam, it does nothing
-    void start() noexcept { }
-
-    // a fullscreen pass, using the given format as target and writing into the specified program
-    void pass(driver::TextureFormat format, Handle<HwProgram> program) noexcept;
-
-    // a blit pass, using the given format as target
-    void blit(driver::TextureFormat format = driver::TextureFormat::RGBA8) noexcept;
-
-    void finish(driver::TargetBufferFlags discarded,
-            Handle<HwRenderTarget> viewRenderTarget,
-            Viewport const& vp,
-            RenderTargetPool::Target const* linearTarget,
-            Viewport const& svp);
-
+    void setSource(driver::DriverApi& driver, uint32_t viewportWidth, uint32_t viewportHeight,
+            Handle <HwTexture> texture, uint32_t textureWidth, uint32_t textureHeight) const noexcept;
 
     FrameGraphResource msaa(
             FrameGraph& fg, FrameGraphResource input,
@@ -74,21 +54,15 @@ public:
             FrameGraph& fg, FrameGraphResource input, driver::TextureFormat outFormat,
             bool translucent) noexcept;
 
+    // scales the 'inViewport' region of 'input' to 'outViewport'
     FrameGraphResource dynamicScaling(
-            FrameGraph& fg, FrameGraphResource input,
-            driver::TextureFormat outFormat, Viewport const& outViewport) noexcept;
+            FrameGraph& fg, FrameGraphResource input, driver::TextureFormat outFormat,
+            Viewport const& inViewport, Viewport const& outViewport) noexcept;
 
 
 private:
     details::FEngine* mEngine = nullptr;
 
-    struct Command {
-        Handle<HwProgram> program = {};
-        driver::TextureFormat format;
-    };
-
-    std::vector<Command> mCommands;
-
     // we need only one of these
     mutable UniformBuffer mPostProcessUb;
     Handle<HwSamplerBuffer> mPostProcessSbh;
@@ -26,6 +26,8 @@
 // NOTE: We only need Renderer.h here because the definition of some FRenderer methods are here
 #include "details/Renderer.h"
 
+#include "driver/CommandStream.h"
+
 #include <private/filament/UibGenerator.h>
 
 #include <utils/JobSystem.h>
@@ -42,14 +44,11 @@ namespace details {
 
 RenderPass::~RenderPass() noexcept = default;
 
-UTILS_ALWAYS_INLINE // this allows the compiler to devirtualize some calls
-inline              // this removes the code from the compilation unit
-void RenderPass::render(
+Slice<RenderPass::Command> RenderPass::appendSortedCommands(
         FEngine& engine, JobSystem& js,
         FScene& scene, Range<uint32_t> vr,
-        uint32_t commandTypeFlags, RenderFlags renderFlags,
-        const CameraInfo& camera, Viewport const& viewport,
-        GrowingSlice<Command>& commands) noexcept {
+        uint32_t commandTypeFlags, RenderFlags renderFlags, const CameraInfo& camera,
+        GrowingSlice<Command>& commands, CommandCache* cache) const noexcept {
 
     SYSTRACE_CONTEXT();
 
@@ -61,6 +60,19 @@ void RenderPass::render(
     // up-to-date summed primitive counts needed for generateCommands()
     updateSummedPrimitiveCounts(const_cast<FScene::RenderableSoa&>(soa), vr);
 
+    // we extract camera position/forward outside of the loop, because these are not cheap.
+    const float3 cameraPosition(camera.getPosition());
+    const float3 cameraForwardVector(camera.getForwardVector());
+
+    // the cache can only hold the commands of a single pass
+    cache = commands.empty() ? cache : nullptr;
+    const CommandCache::Key cacheKey =
+            makeCacheKey(engine, scene, vr, commandTypeFlags, renderFlags);
+
+    if (cache && cache->reuse(js, cacheKey, soa, cameraPosition, cameraForwardVector, commands)) {
+        return cache->getCommands();
+    }
+
     // compute how much maximum storage we need for this pass
     uint32_t growBy = FScene::getPrimitiveCount(soa, vr.last);
     // double the color pass for transparent objects that need to render twice
@@ -69,13 +81,12 @@ void RenderPass::render(
     growBy *= uint32_t(colorPass * 2 + depthPass);
     Command* const curr = commands.grow(growBy);
 
-    // we extract camera position/forward outside of the loop, because these are not cheap.
-    const float3 cameraPosition(camera.getPosition());
-    const float3 cameraForwardVector(camera.getForwardVector());
-    auto work = [commandTypeFlags, curr, &soa, renderFlags, cameraPosition, cameraForwardVector]
+    const VisibilityMask visibilityMask = mVisibilityMask;
+    auto work = [commandTypeFlags, curr, &soa, renderFlags, visibilityMask,
+            cameraPosition, cameraForwardVector]
             (uint32_t startIndex, uint32_t indexCount) {
         RenderPass::generateCommands(commandTypeFlags, curr,
-                soa, { startIndex, startIndex + indexCount }, renderFlags,
+                soa, { startIndex, startIndex + indexCount }, renderFlags, visibilityMask,
                 cameraPosition, cameraForwardVector);
     };
 
@@ -94,15 +105,41 @@ void RenderPass::render(
 
     { // sort all commands
         SYSTRACE_NAME("sort commands");
-        std::sort(commands.begin(), commands.end());
+        // the unused part of the command buffer serves as scratch memory for the radix sort
+        sortCommands(js, commands.begin(), commands.end(),
+                commands.remain() >= commands.size() ? commands.end() : nullptr);
+    }
+
+    if (cache) {
+        cache->store(cacheKey, soa, cameraPosition, cameraForwardVector, commands);
     }
+    return commands;
+}
+
+UTILS_ALWAYS_INLINE // this allows the compiler to devirtualize some calls
+inline              // this removes the code from the compilation unit
+void RenderPass::render(
+        FEngine& engine, JobSystem& js,
+        FScene& scene, Range<uint32_t> vr,
+        uint32_t commandTypeFlags, RenderFlags renderFlags,
+        const CameraInfo& camera, Viewport const& viewport,
+        GrowingSlice<Command>& commands, CommandCache* cache,
+        InstanceBuffer* instances) noexcept {
+
+    Slice<Command> sortedCommands = appendSortedCommands(engine, js, scene, vr,
+            commandTypeFlags, renderFlags, camera, commands, cache);
 
     // Take care not to upload data within the render pass (synchronize can commit froxel data)
     driver::DriverApi& driver = engine.getDriverApi();
+    Handle<HwUniformBuffer> instanceUbh;
+    if (instances) {
+        instanceUbh = instances->update(driver, scene.getRenderableData(), sortedCommands);
+    }
+
     beginRenderPass(driver, viewport, camera);
 
     // Now, execute all commands
-    RenderPass::recordDriverCommands(driver, scene, commands);
+    RenderPass::recordDriverCommands(js, driver, scene, sortedCommands, instanceUbh);
 
     endRenderPass(driver, viewport);
 
@@ -112,46 +149,564 @@ void RenderPass::render(
     engine.flush();
 }
 
+UTILS_NOINLINE
+void RenderPass::sortCommands(JobSystem& js,
+        Command* const begin, Command* const end, Command* const scratch) noexcept {
+    SYSTRACE_CALL();
+
+    const size_t count = size_t(end - begin);
+    if (!scratch || count < RADIX_SORT_MIN_COUNT) {
+        std::sort(begin, end);
+        return;
+    }
+
+    /*
+     * This is a least-significant-digit radix sort: each pass distributes the commands in 256
+     * buckets according to one byte of their key. Each job handles a contiguous block of
+     * commands and owns a contiguous range of each bucket, which keeps the passes stable.
+     */
+
+    constexpr size_t RADIX = 256;
+    const size_t blockCount = std::min(RADIX_SORT_MAX_BLOCKS, count / RADIX_SORT_BLOCK_SIZE);
+    const size_t blockSize = (count + blockCount - 1) / blockCount;
+    auto blockRange = [count, blockSize](size_t b) {
+        return Range<size_t>{ b * blockSize, std::min(count, (b + 1) * blockSize) };
+    };
+
+    auto forEachBlock = [&js, blockCount](auto const& work) {
+        auto blocks = [&work](uint32_t first, uint32_t count) {
+            for (uint32_t b = first; b < first + count; b++) {
+                work(b);
+            }
+        };
+        auto job = jobs::parallel_for(js, nullptr, 0, uint32_t(blockCount),
+                std::cref(blocks), jobs::CountSplitter<1, 8>());
+        js.runAndWait(job);
+    };
+
+    // Find which bytes of the keys actually vary, the others don't need a pass. Sentinels are
+    // ignored, but then we need a pass on the most significant byte to put them last.
+    uint64_t keysOr[RADIX_SORT_MAX_BLOCKS];
+    uint64_t keysAnd[RADIX_SORT_MAX_BLOCKS];
+    bool hasSentinel[RADIX_SORT_MAX_BLOCKS];
+    forEachBlock([&](size_t b) {
+        uint64_t keyOr = 0;
+        uint64_t keyAnd = ~uint64_t(0);
+        bool sentinel = false;
+        for (size_t i : blockRange(b)) {
+            const uint64_t key = begin[i].key;
+            const bool isSentinel = key == uint64_t(Pass::SENTINEL);
+            keyOr  |= isSentinel ? 0 : key;
+            keyAnd &= isSentinel ? ~uint64_t(0) : key;
+            sentinel |= isSentinel;
+        }
+        keysOr[b] = keyOr;
+        keysAnd[b] = keyAnd;
+        hasSentinel[b] = sentinel;
+    });
+    uint64_t keyOr = 0;
+    uint64_t keyAnd = ~uint64_t(0);
+    uint64_t varying = 0;
+    for (size_t b = 0; b < blockCount; b++) {
+        keyOr |= keysOr[b];
+        keyAnd &= keysAnd[b];
+        varying |= hasSentinel[b] ? PASS_MASK : 0;
+    }
+    varying |= keyOr & ~keyAnd;
+
+    uint32_t offsets[RADIX_SORT_MAX_BLOCKS][RADIX];
+    Command* src = begin;
+    Command* dst = scratch;
+    for (size_t shift = 0; shift < 64; shift += 8) {
+        if (!((varying >> shift) & 0xFF)) {
+            continue;
+        }
+
+        // count the commands in each bucket, per block
+        forEachBlock([&](size_t b) {
+            uint32_t* const UTILS_RESTRICT histogram = offsets[b];
+            std::fill_n(histogram, RADIX, 0);
+            for (size_t i : blockRange(b)) {
+                histogram[(src[i].key >> shift) & 0xFF]++;
+            }
+        });
+
+        // compute where each block starts writing in each bucket
+        uint32_t sum = 0;
+        for (size_t digit = 0; digit < RADIX; digit++) {
+            for (size_t b = 0; b < blockCount; b++) {
+                const uint32_t n = offsets[b][digit];
+                offsets[b][digit] = sum;
+                sum += n;
+            }
+        }
+
+        forEachBlock([&](size_t b) {
+            uint32_t* const UTILS_RESTRICT offset = offsets[b];
+            Command const* const UTILS_RESTRICT in = src;
+            Command* const UTILS_RESTRICT out = dst;
+            for (size_t i : blockRange(b)) {
+                out[offset[(in[i].key >> shift) & 0xFF]++] = in[i];
+            }
+        });
+
+        std::swap(src, dst);
+    }
+
+    // after an odd number of passes, the result is in the scratch buffer
+    if (src != begin) {
+        forEachBlock([&](size_t b) {
+            Range<size_t> const range = blockRange(b);
+            std::copy(src + range.first, src + range.last, begin + range.first);
+        });
+    }
+}
+
+size_t RenderPass::batchCommands(Command* const commands) noexcept {
+    auto isInstanceOf = [](PrimitiveInfo const& lhs, PrimitiveInfo const& rhs) {
+        return lhs.primitiveHandle == rhs.primitiveHandle &&
+               lhs.mi == rhs.mi &&
+               lhs.materialVariant.key == rhs.materialVariant.key &&
+               lhs.rasterState == rhs.rasterState &&
+               !rhs.perRenderableBones;
+    };
+
+    size_t count = 0;
+    Command* c = commands;
+    while (c->key != uint64_t(Pass::SENTINEL)) {
+        PrimitiveInfo const& info = c->primitive;
+        size_t n = 1;
+        if (!info.perRenderableBones) {
+            while (n < CONFIG_MAX_INSTANCES && c[n].key != uint64_t(Pass::SENTINEL) &&
+                    isInstanceOf(info, c[n].primitive)) {
+                n++;
+            }
+        }
+        c->primitive.instanceCount = uint8_t(n);
+        count += n > 1 ? n : 0;
+        c += n;
+    }
+    return count;
+}
+
+Handle<HwUniformBuffer> RenderPass::InstanceBuffer::update(FEngine::DriverApi& driver,
+        FScene::RenderableSoa const& soa, Slice<Command>& commands) {
+    SYSTRACE_CALL();
+
+    if (commands.empty()) {
+        return {};
+    }
+
+    Command* const first = commands.begin();
+    const size_t count = batchCommands(first);
+    SYSTRACE_VALUE32("instanceCount", count);
+    if (!count) {
+        return {};
+    }
+
+    const size_t size = FScene::getRenderableUniformsSize(count);
+    if (mSize < size) {
+        // allocate 1/3 extra, with a minimum of 16 instances
+        const size_t capacity = std::max(size_t(16u), (4u * count + 2u) / 3u);
+        mSize = uint32_t(FScene::getRenderableUniformsSize(capacity));
+        driver.destroyUniformBuffer(mUbh);
+        mUbh = driver.createUniformBuffer(mSize, driver::BufferUsage::STREAM);
+    }
+
+    // allocate space into the command stream directly
+    void* const buffer = driver.allocate(size);
+
+    // the instances are stored in the same order the draws are recorded
+    affinef const* const UTILS_RESTRICT transforms = soa.data<FScene::WORLD_TRANSFORM>();
+    size_t offset = 0;
+    for (Command const* c = first; c->key != uint64_t(Pass::SENTINEL);
+            c += c->primitive.instanceCount) {
+        const size_t n = c->primitive.instanceCount;
+        if (n > 1) {
+            for (size_t i = 0; i < n; i++) {
+                FScene::setRenderableUniforms(buffer, offset, transforms[c[i].primitive.index]);
+                offset += sizeof(PerRenderableUib);
+            }
+        }
+    }
+
+    driver.updateUniformBuffer(mUbh, { buffer, size });
+    return mUbh;
+}
+
+void RenderPass::InstanceBuffer::terminate(FEngine::DriverApi& driver) {
+    driver.destroyUniformBuffer(mUbh);
+    mUbh.clear();
+    mSize = 0;
+}
+
+UTILS_NOINLINE // no need to be inlined
+void RenderPass::recordDriverCommands(JobSystem& js,
+        FEngine::DriverApi& driver, FScene& scene,
+        Slice<Command> const& commands,
+        Handle<HwUniformBuffer> instanceUbh) noexcept {
+    SYSTRACE_CALL();
+
+    if (commands.empty()) {
+        return;
+    }
+
+    if (commands.size() < RECORD_COMMANDS_PER_JOB * 2) {
+        Command const* const last = recordDriverCommands(driver, scene,
+                commands.cbegin(), commands.cend(), instanceUbh, 0);
+        SYSTRACE_VALUE32("commandCount", last - commands.cbegin());
+        return;
+    }
+
+    /*
+     * Large passes are split in chunks of consecutive commands, each recorded by its own job
+     * into a CommandSegment. The segments are then appended to the driver's stream in order,
+     * so the driver sees exactly the commands the serial loop would have recorded.
+     *
+     * Chunks never start in the middle of an instanced batch, and each one starts with the
+     * offset in the instance buffer the serial loop would have reached. Materials create their
+     * programs lazily, which isn't thread-safe, so this walk also creates the ones we need.
+     *
+     * Each segment records into memory allocated in the driver's stream, which lives until the
+     * driver executed this frame's commands. It's sized for a draw and its uniforms per
+     * command, the segment only allocates more from the heap when materials change often.
+     */
+
+    struct Chunk {
+        Command const* first;
+        Command const* last;
+        size_t instanceOffset;
+        CommandSegment segment;
+    };
+
+    const size_t chunkSize = std::max(RECORD_COMMANDS_PER_JOB,
+            (commands.size() + RECORD_MAX_JOBS - 1) / RECORD_MAX_JOBS);
+
+    Chunk chunks[RECORD_MAX_JOBS];
+    size_t chunkCount = 0;
+    chunks[0].first = commands.cbegin();
+    chunks[0].instanceOffset = 0;
+
+    FMaterialInstance const* mi = nullptr;
+    FMaterial const* ma = nullptr;
+    Command const* c;
+    size_t instanceCount;
+    size_t instanceOffset = 0;
+    for (c = commands.cbegin(); c->key != -1LLU; c += instanceCount) {
+        if (size_t(c - chunks[chunkCount].first) >= chunkSize) {
+            chunks[chunkCount++].last = c;
+            chunks[chunkCount].first = c;
+            chunks[chunkCount].instanceOffset = instanceOffset;
+        }
+        const PrimitiveInfo& info = c->primitive;
+        if (mi != info.mi) {
+            mi = info.mi;
+            ma = mi->getMaterial();
+        }
+        ma->getProgram(info.materialVariant.key);
+        instanceCount = instanceUbh ? info.instanceCount : 1;
+        if (instanceCount > 1) {
+            instanceOffset += instanceCount * sizeof(PerRenderableUib);
+        }
+    }
+    chunks[chunkCount++].last = c;
+
+    SYSTRACE_VALUE32("commandCount", c - commands.cbegin());
+
+    using DrawCommand = CommandType<decltype(&Driver::draw)>::Command<&Driver::draw>;
+    using BindCommand = CommandType<decltype(&Driver::bindUniformBufferRange)>::Command<
+            &Driver::bindUniformBufferRange>;
+    constexpr size_t commandSize =
+            CommandBase::align(sizeof(DrawCommand)) + CommandBase::align(sizeof(BindCommand));
+    for (size_t i = 0; i < chunkCount; i++) {
+        const size_t size = (chunks[i].last - chunks[i].first) * commandSize;
+        chunks[i].segment = CommandSegment(
+                driver.allocate(size, alignof(std::max_align_t)), size);
+    }
+
+    JobSystem::Job* parent = js.createJob();
+    for (size_t i = 0; i < chunkCount; i++) {
+        Chunk* const pChunk = &chunks[i];
+        FEngine::DriverApi const* const pDriver = &driver;
+        FScene* const pScene = &scene;
+        js.run(js.createJob(parent,
+                [pChunk, pDriver, pScene, instanceUbh](JobSystem&, JobSystem::Job*) {
+                    FEngine::DriverApi stream(*pDriver, pChunk->segment);
+                    recordDriverCommands(stream, *pScene, pChunk->first, pChunk->last,
+                            instanceUbh, pChunk->instanceOffset);
+                }));
+    }
+    js.runAndWait(parent);
+
+    for (size_t i = 0; i < chunkCount; i++) {
+        driver.append(std::move(chunks[i].segment));
+    }
+}
+
 UTILS_NOINLINE // no need to be inlined
-void RenderPass::recordDriverCommands(
+RenderPass::Command const* RenderPass::recordDriverCommands(
         FEngine::DriverApi& UTILS_RESTRICT driver,  // using restrict here is very important
         FScene& UTILS_RESTRICT scene,
-        Slice<Command> const& commands) noexcept {
+        Command const* first, Command const* last,
+        Handle<HwUniformBuffer> instanceUbh, size_t instanceOffset) noexcept {
     SYSTRACE_CALL();
 
-    if (!commands.empty()) {
-        Driver::PipelineState pipeline;
-        Handle<HwUniformBuffer> uboHandle = scene.getRenderableUBO();
-        FMaterialInstance const* UTILS_RESTRICT mi = nullptr;
-        FMaterial const* UTILS_RESTRICT ma = nullptr;
-        Command const* UTILS_RESTRICT c;
-        for (c = commands.cbegin(); c->key != -1LLU; ++c) {
-            /*
-             * Be careful when changing code below, this is the hot inner-loop
-             */
-
-            // per-renderable uniform
-            const PrimitiveInfo info = c->primitive;
-            pipeline.rasterState = info.rasterState;
-            if (UTILS_UNLIKELY(mi != info.mi)) {
-                // this is always taken the first time
-                mi = info.mi;
-                pipeline.polygonOffset = mi->getPolygonOffset();
-                ma = mi->getMaterial();
-                mi->use(driver);
-            }
+    // the per-renderable uniforms are declared as an array of CONFIG_MAX_INSTANCES entries
+    constexpr size_t uniformsSize = CONFIG_MAX_INSTANCES * sizeof(PerRenderableUib);
+
+    Driver::PipelineState pipeline;
+    Handle<HwUniformBuffer> uboHandle = scene.getRenderableUBO();
+    FMaterialInstance const* UTILS_RESTRICT mi = nullptr;
+    FMaterial const* UTILS_RESTRICT ma = nullptr;
+    Command const* UTILS_RESTRICT c;
+    size_t instanceCount;
+    for (c = first; c != last && c->key != -1LLU; c += instanceCount) {
+        /*
+         * Be careful when changing code below, this is the hot inner-loop
+         */
 
-            pipeline.program = ma->getProgram(info.materialVariant.key);
+        // per-renderable uniform
+        const PrimitiveInfo info = c->primitive;
+        pipeline.rasterState = info.rasterState;
+        if (UTILS_UNLIKELY(mi != info.mi)) {
+            // this is always taken the first time
+            mi = info.mi;
+            pipeline.polygonOffset = mi->getPolygonOffset();
+            ma = mi->getMaterial();
+            mi->use(driver);
+        }
+
+        pipeline.program = ma->getProgram(info.materialVariant.key);
+        if (info.perRenderableBones) {
+            driver.bindUniformBuffer(BindingPoints::PER_RENDERABLE_BONES, info.perRenderableBones);
+        }
+        instanceCount = instanceUbh ? info.instanceCount : 1;
+        if (UTILS_LIKELY(instanceCount == 1)) {
             size_t offset = info.index * sizeof(PerRenderableUib);
-            if (info.perRenderableBones) {
-                driver.bindUniformBuffer(BindingPoints::PER_RENDERABLE_BONES, info.perRenderableBones);
-            }
-            driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, uboHandle, offset, sizeof(PerRenderableUib));
+            driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, uboHandle, offset, uniformsSize);
             driver.draw(pipeline, info.primitiveHandle);
+        } else {
+            driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE, instanceUbh, instanceOffset, uniformsSize);
+            driver.drawInstanced(pipeline, info.primitiveHandle, uint32_t(instanceCount));
+            instanceOffset += instanceCount * sizeof(PerRenderableUib);
+        }
+    }
+    return c;
+}
+
+/* static */
+UTILS_ALWAYS_INLINE
+inline uint32_t RenderPass::computeDistanceBits(float3 const& center,
+        float3 const& cameraPosition, float3 const& cameraForward) noexcept {
+    // Signed distance from camera to object's center. Positive distances are in front of
+    // the camera. Some objects with a center behind the camera can still be visible
+    // so their distance will be negative (this happens a lot for the shadow map).
+
+    // Using the center is not very good with large AABBs. Instead we can try to use
+    // the closest point on the bounding sphere instead:
+    //      d = center - cameraPosition;
+    //      d -= normalize(d) * length(soaWorldAABB[i].halfExtent);
+    // However this doesn't work well at all for large planes.
+
+    // Code below is equivalent to:
+    // float3 d = center - cameraPosition;
+    // float distance = dot(d, cameraForward);
+    // but saves a couple of instruction, because once inlined, part of the math is done
+    // outside of the caller's loop.
+    float distance = dot(center, cameraForward) - dot(cameraPosition, cameraForward);
+
+
+    // We negate the distance to the camera in order to create a bit pattern that will
+    // be sorted properly, this works because:
+    // - positive distances (now negative), will still be sorted by their absolute value
+    //   due to float representation.
+    // - negative distances (now positive) will be sorted BEFORE everything else, and we
+    //   don't care too much about their order (i.e. should objects far behind the camera
+    //   be sorted first? -- unclear, and probably irrelevant).
+    //   Here, objects close to the camera (but behind) will be drawn first.
+    // An alternative that keeps the mathematical ordering is given here:
+    //   distanceBits ^= ((int32_t(distanceBits) >> 31) | 0x80000000u);
+    distance = -distance;
+    return reinterpret_cast<uint32_t&>(distance);
+}
+
+RenderPass::CommandCache::Key RenderPass::makeCacheKey(FEngine& engine, FScene& scene,
+        Range<uint32_t> vr, uint32_t commandTypeFlags, RenderFlags renderFlags) const noexcept {
+    CommandCache::Key key;
+    key.scene = &scene;
+    // shadow commands only depend on the shadow casters, not on the rest of the scene
+    key.sceneGeneration = (commandTypeFlags & CommandTypeFlags::SHADOW) ?
+            scene.getShadowCasterGeneration() : scene.getCacheGeneration();
+    key.primitiveGeneration = engine.getRenderableManager().getPrimitiveGeneration();
+    if (commandTypeFlags & CommandTypeFlags::SHADOW) {
+        // a caster's material parameters (e.g. alpha masking, vertex displacement) change its
+        // shadow without changing its commands. Generations only grow, so their sum over the
+        // same casters (which matches() checks) changes whenever any of them does.
+        FScene::RenderableSoa const& soa = scene.getRenderableData();
+        auto const* const UTILS_RESTRICT primitives = soa.data<FScene::PRIMITIVES>();
+        uint64_t generation = 0;
+        for (uint32_t i : vr) {
+            if (!mVisibilityMask || (getVisibilityMask(soa, i) & mVisibilityMask)) {
+                for (FRenderPrimitive const& primitive : primitives[i]) {
+                    generation += primitive.getMaterialInstance()->getGeneration();
+                }
+            }
         }
+        key.materialGeneration = generation;
+    }
+    key.visibleRenderables = vr;
+    key.commandTypeFlags = commandTypeFlags;
+    key.renderFlags = renderFlags;
+    key.visibilityMask = mVisibilityMask;
+    return key;
+}
 
-        SYSTRACE_VALUE32("commandCount", c - commands.cbegin());
+bool RenderPass::isCached(FEngine& engine, FScene& scene, Range<uint32_t> vr,
+        uint32_t commandTypeFlags, RenderFlags renderFlags, const CameraInfo& camera,
+        CommandCache const& cache) const noexcept {
+    FScene::RenderableSoa const& soa = scene.getRenderableData();
+    return cache.matches(makeCacheKey(engine, scene, vr, commandTypeFlags, renderFlags), soa) &&
+           camera.getPosition() == cache.mCameraPosition &&
+           camera.getForwardVector() == cache.mCameraForward;
+}
+
+bool RenderPass::CommandCache::matches(Key const& key,
+        FScene::RenderableSoa const& soa) const noexcept {
+    const Range<uint32_t> vr = key.visibleRenderables;
+    if (!mValid ||
+            key.scene != mKey.scene ||
+            key.sceneGeneration != mKey.sceneGeneration ||
+            key.primitiveGeneration != mKey.primitiveGeneration ||
+            key.materialGeneration != mKey.materialGeneration ||
+            key.visibleRenderables.first != mKey.visibleRenderables.first ||
+            key.visibleRenderables.last != mKey.visibleRenderables.last ||
+            key.commandTypeFlags != mKey.commandTypeFlags ||
+            key.renderFlags != mKey.renderFlags ||
+            key.visibilityMask != mKey.visibilityMask) {
+        return false;
+    }
+
+    // the same renderables must be visible, in the same order and with the same primitives
+    auto const* const UTILS_RESTRICT instances = soa.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const UTILS_RESTRICT primitives = soa.data<FScene::PRIMITIVES>();
+    for (size_t i = 0, c = vr.size(); i < c; i++) {
+        if (instances[vr.first + i] != mInstances[i] ||
+                primitives[vr.first + i].begin() != mPrimitives[i].begin() ||
+                primitives[vr.first + i].size() != mPrimitives[i].size()) {
+            return false;
+        }
+    }
+
+    // ...and the same ones must pass the visibility mask
+    if (key.visibilityMask) {
+        for (size_t i = 0, c = vr.size(); i < c; i++) {
+            if ((getVisibilityMask(soa, uint32_t(vr.first + i)) & key.visibilityMask) !=
+                    mVisibility[i]) {
+                return false;
+            }
+        }
     }
+    return true;
+}
+
+bool RenderPass::CommandCache::reuse(JobSystem& js, Key const& key,
+        FScene::RenderableSoa const& soa, float3 cameraPosition, float3 cameraForward,
+        GrowingSlice<Command>& scratch) noexcept {
+    SYSTRACE_CALL();
+
+    if (!matches(key, soa)) {
+        return false;
+    }
+
+    if (cameraPosition == mCameraPosition && cameraForward == mCameraForward) {
+        return true;
+    }
+
+    if (length(cameraPosition - mCameraPosition) > MAX_CAMERA_TRANSLATION ||
+            dot(cameraForward, mCameraForward) < MIN_CAMERA_COS_ANGLE) {
+        return false;
+    }
+
+    // update the distances encoded in the keys, as generateCommandsImpl() would
+    auto const* const UTILS_RESTRICT centers = soa.data<FScene::WORLD_AABB_CENTER>();
+    const bool hasDepthPass = bool(mKey.commandTypeFlags &
+            (CommandTypeFlags::DEPTH | CommandTypeFlags::SHADOW));
+    for (Command& cmd : mCommands) {
+        uint64_t k = cmd.key;
+        if (k == uint64_t(Pass::SENTINEL)) {
+            continue;
+        }
+        const uint32_t distanceBits =
+                computeDistanceBits(centers[cmd.primitive.index], cameraPosition, cameraForward);
+        switch (Pass(k & PASS_MASK)) {
+            case Pass::DEPTH:
+                k &= ~DISTANCE_BITS_MASK;
+                k |= makeField(distanceBits, DISTANCE_BITS_MASK, DISTANCE_BITS_SHIFT);
+                break;
+            case Pass::COLOR:
+                if (!hasDepthPass) {
+                    k &= ~Z_BUCKET_MASK;
+                    k |= makeField(distanceBits >> 22, Z_BUCKET_MASK, Z_BUCKET_SHIFT);
+                }
+                break;
+            case Pass::BLENDED:
+                k &= ~BLEND_DISTANCE_MASK;
+                k |= makeField(~distanceBits, BLEND_DISTANCE_MASK, BLEND_DISTANCE_SHIFT);
+                break;
+            default:
+                break;
+        }
+        cmd.key = k;
+    }
+    mCameraPosition = cameraPosition;
+    mCameraForward = cameraForward;
+
+    // small camera moves don't change the order much, if at all
+    if (!std::is_sorted(mCommands.begin(), mCommands.end())) {
+        Command* const begin = mCommands.data();
+        Command* const end = begin + mCommands.size();
+        sortCommands(js, begin, end,
+                scratch.capacity() >= mCommands.size() ? scratch.begin() : nullptr);
+    }
+    return true;
+}
+
+void RenderPass::CommandCache::store(Key const& key, FScene::RenderableSoa const& soa,
+        float3 cameraPosition, float3 cameraForward, Slice<Command> const& commands) {
+    SYSTRACE_CALL();
+
+    // don't bother keeping the commands of a scene that changes every frame
+    const bool unchanged = key.scene == mKey.scene &&
+            key.sceneGeneration == mKey.sceneGeneration &&
+            key.primitiveGeneration == mKey.primitiveGeneration &&
+            key.materialGeneration == mKey.materialGeneration;
+    mKey = key;
+    mValid = unchanged;
+    if (!unchanged) {
+        return;
+    }
+
+    // commands are sorted, everything after the first sentinel is never executed
+    Command sentinel;
+    sentinel.key = uint64_t(Pass::SENTINEL);
+    Command const* const last = std::lower_bound(commands.begin(), commands.end(), sentinel);
+    assert(last != commands.end());
+    mCommands.assign(commands.begin(), last + 1);
+
+    const Range<uint32_t> vr = key.visibleRenderables;
+    mInstances.assign(soa.data<FScene::RENDERABLE_INSTANCE>() + vr.first,
+            soa.data<FScene::RENDERABLE_INSTANCE>() + vr.last);
+    mPrimitives.assign(soa.data<FScene::PRIMITIVES>() + vr.first,
+            soa.data<FScene::PRIMITIVES>() + vr.last);
+    mVisibility.clear();
+    if (key.visibilityMask) {
+        mVisibility.resize(vr.size());
+        for (size_t i = 0, c = vr.size(); i < c; i++) {
+            mVisibility[i] = getVisibilityMask(soa, uint32_t(vr.first + i)) & key.visibilityMask;
+        }
+    }
+    mCameraPosition = cameraPosition;
+    mCameraForward = cameraForward;
 }
 
 /* static */
@@ -206,7 +761,7 @@ void RenderPass::setupColorCommand(Command& cmdDraw, bool hasDepthPass,
 UTILS_NOINLINE
 void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const commands,
         FScene::RenderableSoa const& soa, utils::Range<uint32_t> range, RenderFlags renderFlags,
-        math::float3 cameraPosition, math::float3 cameraForward) noexcept {
+        VisibilityMask visibilityMask, math::float3 cameraPosition, math::float3 cameraForward) noexcept {
 
     // generateCommands() writes both the draw and depth commands simultaneously such that
     // we go throw the list of renderables just once.
@@ -241,15 +796,15 @@ void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const comm
         default: // squash IDE warning -- should never happen.
         case CommandTypeFlags::COLOR:
             generateCommandsImpl<CommandTypeFlags::COLOR>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
         case CommandTypeFlags::DEPTH_AND_COLOR:
             generateCommandsImpl<CommandTypeFlags::DEPTH_AND_COLOR>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
         case CommandTypeFlags::SHADOW:
             generateCommandsImpl<CommandTypeFlags::SHADOW>(commandTypeFlags, curr,
-                    soa, range, renderFlags, cameraPosition, cameraForward);
+                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
             break;
     }
 }
@@ -260,7 +815,7 @@ UTILS_NOINLINE
 void RenderPass::generateCommandsImpl(uint32_t,
         Command* UTILS_RESTRICT curr,
         FScene::RenderableSoa const& UTILS_RESTRICT soa, utils::Range<uint32_t> range,
-        RenderFlags renderFlags,
+        RenderFlags renderFlags, VisibilityMask visibilityMask,
         float3 cameraPosition, float3 cameraForward) noexcept {
 
     // generateCommands() writes both the draw and depth commands simultaneously such that
@@ -276,6 +831,8 @@ void RenderPass::generateCommandsImpl(uint32_t,
     auto const* const UTILS_RESTRICT soaVisibility      = soa.data<FScene::VISIBILITY_STATE>();
     auto const* const UTILS_RESTRICT soaPrimitives      = soa.data<FScene::PRIMITIVES>();
     auto const* const UTILS_RESTRICT soaBonesUbh        = soa.data<FScene::BONES_UBH>();
+    auto const* const UTILS_RESTRICT soaVisibleMask     = soa.data<FScene::VISIBLE_MASK>();
+    auto const* const UTILS_RESTRICT soaSpotShadowMask  = soa.data<FScene::SPOT_SHADOW_MASK>();
 
     const bool hasShadowing = renderFlags & HAS_SHADOWING;
     const bool inverseFrontFaces = renderFlags & HAS_INVERSE_FRONT_FACES;
@@ -297,35 +854,8 @@ void RenderPass::generateCommandsImpl(uint32_t,
     cmdDepth.primitive.rasterState.inverseFrontFaces = inverseFrontFaces;
 
     for (uint32_t i = range.first; i < range.last; ++i) {
-        // Signed distance from camera to object's center. Positive distances are in front of
-        // the camera. Some objects with a center behind the camera can still be visible
-        // so their distance will be negative (this happens a lot for the shadow map).
-
-        // Using the center is not very good with large AABBs. Instead we can try to use
-        // the closest point on the bounding sphere instead:
-        //      d = soaWorldAABBCenter[i] - cameraPosition;
-        //      d -= normalize(d) * length(soaWorldAABB[i].halfExtent);
-        // However this doesn't work well at all for large planes.
-
-        // Code below is equivalent to:
-        // float3 d = soaWorldAABBCenter[i] - cameraPosition;
-        // float distance = dot(d, cameraForward);
-        // but saves a couple of instruction, because part of the math is done outside of the loop.
-        float distance = dot(soaWorldAABBCenter[i], cameraForward) - dot(cameraPosition, cameraForward);
-
-
-        // We negate the distance to the camera in order to create a bit pattern that will
-        // be sorted properly, this works because:
-        // - positive distances (now negative), will still be sorted by their absolute value
-        //   due to float representation.
-        // - negative distances (now positive) will be sorted BEFORE everything else, and we
-        //   don't care too much about their order (i.e. should objects far behind the camera
-        //   be sorted first? -- unclear, and probably irrelevant).
-        //   Here, objects close to the camera (but behind) will be drawn first.
-        // An alternative that keeps the mathematical ordering is given here:
-        //   distanceBits ^= ((int32_t(distanceBits) >> 31) | 0x80000000u);
-        distance = -distance;
-        const uint32_t distanceBits = reinterpret_cast<uint32_t&>(distance);
+        const uint32_t distanceBits =
+                computeDistanceBits(soaWorldAABBCenter[i], cameraPosition, cameraForward);
 
         cmdColor.key = makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
         cmdColor.primitive.index = (uint16_t)i;
@@ -345,6 +875,11 @@ void RenderPass::generateCommandsImpl(uint32_t,
         const bool shadowCaster = soaVisibility[i].castShadows & hasShadowing;
         const bool writeDepthForShadows = shadowPass & shadowCaster;
 
+        // cancel the commands of renderables that don't pass the visibility mask
+        const VisibilityMask visibility =
+                VisibilityMask(soaVisibleMask[i]) | VisibilityMask(soaSpotShadowMask[i] << 8u);
+        const uint64_t culled = select(visibilityMask && !(visibility & visibilityMask));
+
         const Slice<FRenderPrimitive>& primitives = soaPrimitives[i];
 
         /*
@@ -401,6 +936,8 @@ void RenderPass::generateCommandsImpl(uint32_t,
                     // correct for TransparencyMode::DEFAULT -- i.e. cancel the command
                     key |= select(mode == TransparencyMode::DEFAULT);
 
+                    key |= culled;
+
                     *curr = cmdColor;
                     curr->key = key;
                     ++curr;
@@ -435,6 +972,7 @@ void RenderPass::generateCommandsImpl(uint32_t,
                 *curr = cmdColor;
                 // handle the case where this primitive is empty / no-op
                 curr->key |= select(primitive.getPrimitiveType() == PrimitiveType::NONE);
+                curr->key |= culled;
                 ++curr;
             }
 
@@ -457,6 +995,7 @@ void RenderPass::generateCommandsImpl(uint32_t,
                         (rs.depthWrite & !(colorPass & (rs.alphaToCoverage | rs.hasBlending())))
                         | writeDepthForShadows;
                 curr->key |= select(!issueDepth);
+                curr->key |= culled;
 
                 // handle the case where this primitive is empty / no-op
                 curr->key |= select(primitive.getPrimitiveType() == PrimitiveType::NONE);
@@ -554,12 +1093,8 @@ void FRenderer::ColorPass::renderColorPass(FEngine& engine,
         GrowingSlice<Command>& commands) noexcept {
 
     CameraInfo const& cameraInfo = view.getCameraInfo();
-    auto& soa = view.getScene()->getRenderableData();
     auto vr = view.getVisibleRenderables();
 
-    // populate the RenderPrimitive array with the proper LOD
-    view.updatePrimitivesLod(engine, cameraInfo, soa, vr);
-
     DriverApi& driver = engine.getDriverApi();
     view.prepareCamera(cameraInfo, scaledViewport);
     view.commitUniforms(driver);
@@ -591,30 +1126,79 @@ void FRenderer::ColorPass::renderColorPass(FEngine& engine,
     ColorPass colorPass("ColorPass", js, sync, view, rth);
     driver.pushGroupMarker("Color Pass");
     colorPass.render(engine, js, *view.getScene(), vr, commandType, flags,
-            cameraInfo, scaledViewport, commands);
+            cameraInfo, scaledViewport, commands, &view.getColorPassCommandCache(),
+            &view.getColorPassInstances());
     driver.popGroupMarker();
 }
 
 // ------------------------------------------------------------------------------------------------
 
 FRenderer::ShadowPass::ShadowPass(const char* name,
-        ShadowMap const& shadowMap) noexcept
-        : RenderPass(name), shadowMap(shadowMap) {
+        ShadowMap const& shadowMap, size_t cascade, VisibilityMask visibilityMask) noexcept
+        : RenderPass(name, visibilityMask),
+          shadowMap(shadowMap), cascade(cascade) {
 }
 
 void FRenderer::ShadowPass::beginRenderPass(driver::DriverApi& driver, Viewport const&, const CameraInfo&) noexcept {
-    shadowMap.beginRenderPass(driver);
+    shadowMap.beginRenderPass(driver, cascade);
 }
 
-void FRenderer::ShadowPass::renderShadowMap(FEngine& engine, JobSystem& js,
+size_t FRenderer::ShadowPass::renderShadowMap(FEngine& engine, JobSystem& js,
         FView& view, GrowingSlice<Command>& commands) noexcept {
 
+    SYSTRACE_CONTEXT();
+
+    driver::DriverApi& driver = engine.getDriverApi();
+
+    RenderPass::RenderFlags flags = 0;
+    if (view.hasShadowing())               flags |= RenderPass::HAS_SHADOWING;
+    if (view.hasDirectionalLight())        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
+    if (view.hasDynamicLighting())         flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
+    if (view.isFrontFaceWindingInverted()) flags |= RenderPass::HAS_INVERSE_FRONT_FACES;
+
+    // Each cascade of the directional light, and each spot light, draws its own shadow
+    // casters in its own tile of the shadow atlas, with its own commands.
+    size_t drawn = 0;
+    driver.pushGroupMarker("Shadow map Pass");
+    if (view.hasDirectionalShadows()) {
+        ShadowMap const& shadowMap = view.getShadowMap();
+        for (size_t c = 0, n = shadowMap.getCascadeCount(); c < n; c++) {
+            if (shadowMap.hasVisibleShadows(c)) {
+                drawn += renderShadowMapCascade(engine, js, view, shadowMap, c,
+                        FView::getShadowCascadeVisibleMask(c), flags,
+                        view.getShadowPassCommandCache(c), view.getShadowPassInstances(c),
+                        commands);
+            }
+        }
+    }
+    for (size_t i = 0; i < CONFIG_MAX_SHADOW_CASTING_SPOTS; i++) {
+        // only the spot lights picked for an update this frame are rendered
+        ShadowMap const* shadowMap = view.getUpdatedSpotShadowMap(i);
+        if (shadowMap) {
+            drawn += renderShadowMapCascade(engine, js, view, *shadowMap, 0,
+                    FView::getSpotShadowVisibleMask(i), flags,
+                    view.getSpotShadowPassCommandCache(i), view.getSpotShadowPassInstances(i),
+                    commands);
+        }
+    }
+    driver.popGroupMarker();
+    // trace the number of shadow maps that couldn't be reused
+    SYSTRACE_VALUE32("shadowMapsDrawn", drawn);
+    return drawn;
+}
+
+bool FRenderer::ShadowPass::renderShadowMapCascade(FEngine& engine, JobSystem& js,
+        FView& view, ShadowMap const& shadowMap, size_t cascade,
+        VisibilityMask visibilityMask, RenderFlags renderFlags,
+        RenderPass::CommandCache& cache, RenderPass::InstanceBuffer& instances,
+        GrowingSlice<Command>& commands) noexcept {
+
     auto& soa = view.getScene()->getRenderableData();
     auto vr = view.getVisibleShadowCasters();
-    ShadowMap const& shadowMap = view.getShadowMap();
-    Viewport const& viewport = shadowMap.getViewport();
-    FCamera const& camera = shadowMap.getCamera();
+    driver::DriverApi& driver = engine.getDriverApi();
 
+    Viewport const& viewport = shadowMap.getViewport(cascade);
+    FCamera const& camera = shadowMap.getCamera(cascade);
     CameraInfo cameraInfo = {
             .projection         = mat4f{ camera.getProjectionMatrix() },
             .cullingProjection  = mat4f{ camera.getCullingProjectionMatrix() },
@@ -624,23 +1208,29 @@ void FRenderer::ShadowPass::renderShadowMap(FEngine& engine, JobSystem& js,
             .zf                 = camera.getCullingFar(),
     };
 
-    // populate the RenderPrimitive array with the proper LOD
-    view.updatePrimitivesLod(engine, cameraInfo, soa, vr);
+    // A static light's shadow map is skipped entirely when it would draw the same casters,
+    // with the same commands from the same camera, as last frame: its tile still holds them.
+    ShadowPass shadowPass("ShadowPass", shadowMap, cascade, visibilityMask);
+    if (shadowMap.isCascadeReusable(cascade)) {
+        // skinned casters can move without anything else changing
+        auto const* const UTILS_RESTRICT visibility = soa.data<FScene::VISIBILITY_STATE>();
+        bool animated = false;
+        for (uint32_t i : vr) {
+            animated |= (getVisibilityMask(soa, i) & visibilityMask) && visibility[i].skinning;
+        }
+        if (!animated && shadowPass.isCached(engine, *view.getScene(), vr,
+                CommandTypeFlags::SHADOW, renderFlags, cameraInfo, cache)) {
+            return false;
+        }
+    }
 
-    driver::DriverApi& driver = engine.getDriverApi();
     view.prepareCamera(cameraInfo, viewport);
     view.commitUniforms(driver);
 
-    RenderPass::RenderFlags flags = 0;
-    if (view.hasShadowing())               flags |= RenderPass::HAS_SHADOWING;
-    if (view.hasDirectionalLight())        flags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
-    if (view.hasDynamicLighting())         flags |= RenderPass::HAS_DYNAMIC_LIGHTING;
-    if (view.isFrontFaceWindingInverted()) flags |= RenderPass::HAS_INVERSE_FRONT_FACES;
-
-    ShadowPass shadowPass("ShadowPass", shadowMap);
-    driver.pushGroupMarker("Shadow map Pass");
-    shadowPass.render(engine, js, *view.getScene(), vr, CommandTypeFlags::SHADOW, flags, cameraInfo, viewport, commands);
-    driver.popGroupMarker();
+    shadowPass.render(engine, js, *view.getScene(), vr, CommandTypeFlags::SHADOW, renderFlags,
+            cameraInfo, viewport, commands, &cache, &instances);
+    commands.clear();
+    return true;
 }
 
 void FRenderer::ShadowPass::endRenderPass(DriverApi& driver, Viewport const& viewport) noexcept {
@@ -28,8 +28,11 @@
 #include <private/filament/Variant.h>
 
 #include <utils/compiler.h>
+#include <utils/Range.h>
 #include <utils/Slice.h>
 
+#include <vector>
+
 namespace utils {
 class JobSystem;
 }
@@ -179,7 +182,7 @@ public:
         Driver::RasterState rasterState;                    // 4 bytes
         uint16_t index = 0;                                 // 2 bytes
         Variant materialVariant;                            // 1 byte
-        uint8_t reserved = { };                             // 1 byte
+        uint8_t instanceCount = 1;                          // 1 byte, see batchCommands()
     };
 
     struct alignas(8) Command {     // 32 bytes
@@ -202,17 +205,153 @@ public:
     static constexpr RenderFlags HAS_DYNAMIC_LIGHTING    = 0x04;
     static constexpr RenderFlags HAS_INVERSE_FRONT_FACES = 0x08;
 
-    explicit RenderPass(const char* name) noexcept : mName(name) { }
+    // A renderable's VISIBLE_MASK in the low byte, its SPOT_SHADOW_MASK in the high byte.
+    using VisibilityMask = uint16_t;
+
+    static inline VisibilityMask getVisibilityMask(
+            FScene::RenderableSoa const& soa, uint32_t index) noexcept {
+        return VisibilityMask(soa.elementAt<FScene::VISIBLE_MASK>(index)) |
+               VisibilityMask(soa.elementAt<FScene::SPOT_SHADOW_MASK>(index) << 8u);
+    }
+
+    /*
+     * Keeps the sorted commands of a pass from one frame to the next, so that a static scene
+     * seen from a static camera doesn't need its commands generated and sorted every frame.
+     *
+     * The commands are reused when the scene data, the primitives, the render flags and the
+     * visible renderables (including their level of detail and which of them pass the
+     * visibility mask) are the same as when they were stored. Shadow passes also require the
+     * material instances of their casters to be unchanged, since a static light's shadow map
+     * is reused as is when its commands are. If the camera moved only a little, the distances
+     * encoded in the keys are updated and the commands re-sorted if needed. Commands are only stored once the scene stayed
+     * unchanged for a frame, so that animated scenes don't pay for the copy.
+     */
+    class CommandCache {
+    public:
+        // Larger camera moves regenerate the commands, because they tend to reorder most of
+        // them, at which point updating and re-sorting them isn't much cheaper.
+        static constexpr float MAX_CAMERA_TRANSLATION = 1.0f;   // world units
+        static constexpr float MIN_CAMERA_COS_ANGLE = 0.996f;   // about 5 degrees
+
+        void invalidate() noexcept { mValid = false; }
+
+    private:
+        friend class RenderPass;
+
+        struct Key {
+            FScene const* scene = nullptr;
+            uint64_t sceneGeneration = 0;
+            uint64_t primitiveGeneration = 0;
+            uint64_t materialGeneration = 0;    // only used by shadow passes
+            utils::Range<uint32_t> visibleRenderables;
+            uint32_t commandTypeFlags = 0;
+            RenderFlags renderFlags = 0;
+            VisibilityMask visibilityMask = 0;
+        };
+
+        // whether the stored commands are those 'key' would generate, before camera updates
+        bool matches(Key const& key, FScene::RenderableSoa const& soa) const noexcept;
+
+        bool reuse(utils::JobSystem& js, Key const& key, FScene::RenderableSoa const& soa,
+                math::float3 cameraPosition, math::float3 cameraForward,
+                utils::GrowingSlice<Command>& scratch) noexcept;
+
+        void store(Key const& key, FScene::RenderableSoa const& soa,
+                math::float3 cameraPosition, math::float3 cameraForward,
+                utils::Slice<Command> const& commands);
+
+        utils::Slice<Command> getCommands() noexcept {
+            return { mCommands.data(), mCommands.data() + mCommands.size() };
+        }
+
+        Key mKey;
+        math::float3 mCameraPosition;
+        math::float3 mCameraForward;
+        std::vector<Command> mCommands;
+        std::vector<utils::EntityInstance<RenderableManager>> mInstances;
+        std::vector<utils::Slice<FRenderPrimitive>> mPrimitives;
+        std::vector<VisibilityMask> mVisibility;   // only used with a visibility mask
+        bool mValid = false;
+    };
+
+    /*
+     * Holds the per-renderable uniforms of the instanced draws of a pass.
+     *
+     * The uniforms of the renderables drawn by each instanced draw are packed in this buffer,
+     * in the order of the commands, and bound in place of the scene's per-renderable uniforms.
+     */
+    class InstanceBuffer {
+    public:
+        void terminate(FEngine::DriverApi& driver);
+
+    private:
+        friend class RenderPass;
+
+        // Merges the commands into instanced draws and uploads the uniforms of their instances.
+        // Returns a null handle if there is no instanced draw.
+        Handle<HwUniformBuffer> update(FEngine::DriverApi& driver,
+                FScene::RenderableSoa const& soa, utils::Slice<Command>& commands);
+
+        Handle<HwUniformBuffer> mUbh;
+        uint32_t mSize = 0;     // in bytes
+    };
+
+    // If 'visibilityMask' isn't 0, only the renderables with one of these bits set in their
+    // VisibilityMask are drawn, e.g. the shadow casters of a single shadow cascade.
+    explicit RenderPass(const char* name, VisibilityMask visibilityMask = 0) noexcept
+            : mName(name), mVisibilityMask(visibilityMask) { }
 
     virtual ~RenderPass() noexcept;
 
-    // appends rendering commands for the given view
+    // Sorts commands by key. Large arrays are radix-sorted in parallel, which requires
+    // 'scratch' to have room for as many commands; if it's null std::sort() is used instead.
+    static void sortCommands(utils::JobSystem& js,
+            Command* begin, Command* end, Command* scratch) noexcept;
+
+    // Finds the runs of consecutive commands that draw the same primitive with the same material
+    // instance, variant and raster state, and sets the instanceCount of the first command of
+    // each run. Skinned primitives are never merged, and runs are at most CONFIG_MAX_INSTANCES
+    // long. Returns the number of commands that belong to runs of more than one command.
+    static size_t batchCommands(Command* commands) noexcept;
+
+    // Appends the commands for the given view to 'commands' and sorts them, the last one is a
+    // sentinel. If 'cache' isn't null, it's used to reuse the commands of the previous frame,
+    // when 'commands' starts empty. Returns the sorted commands, which can be 'cache''s.
+    utils::Slice<Command> appendSortedCommands(
+            FEngine& engine, utils::JobSystem& js,
+            FScene& scene, utils::Range<uint32_t> visibleRenderables,
+            uint32_t commandTypeFlags, RenderFlags renderFlags, const CameraInfo& camera,
+            utils::GrowingSlice<Command>& commands, CommandCache* cache) const noexcept;
+
+    // Records the driver commands for 'commands'. Large passes are recorded by several jobs,
+    // each into its own CommandSegment, which are then appended to 'driver' in order.
+    static void recordDriverCommands(utils::JobSystem& js, FEngine::DriverApi& driver,
+            FScene& scene, utils::Slice<Command> const& commands,
+            Handle<HwUniformBuffer> instanceUbh) noexcept;
+
+    // Records the commands in [first, last) on the calling thread, stopping early at the
+    // sentinel. 'instanceOffset' is the offset in the instance buffer of the first instanced
+    // draw. Returns where it stopped.
+    static Command const* recordDriverCommands(FEngine::DriverApi& driver, FScene& scene,
+            Command const* first, Command const* last,
+            Handle<HwUniformBuffer> instanceUbh, size_t instanceOffset) noexcept;
+
+    // Appends rendering commands for the given view with appendSortedCommands() and records
+    // them in a render pass. If 'instances' isn't null, consecutive identical draws are merged
+    // into instanced draws.
     void render(
             FEngine& engine, utils::JobSystem& js,
             FScene& scene, utils::Range<uint32_t> visibleRenderables,
             uint32_t commandTypeFlags, RenderFlags renderFlags,
             const CameraInfo& camera, Viewport const& viewport,
-            utils::GrowingSlice<Command>& commands) noexcept;
+            utils::GrowingSlice<Command>& commands, CommandCache* cache,
+            InstanceBuffer* instances) noexcept;
+
+    // Returns true if 'cache' holds the commands render() would generate, and they were
+    // stored with the same camera, i.e. render() would draw exactly what it drew last time.
+    bool isCached(FEngine& engine, FScene& scene, utils::Range<uint32_t> visibleRenderables,
+            uint32_t commandTypeFlags, RenderFlags renderFlags, const CameraInfo& camera,
+            CommandCache const& cache) const noexcept;
 
 private:
     // Called just before rendering, make sure all needed asynchronous tasks are finished.
@@ -237,25 +376,41 @@ private:
     static_assert(JOBS_PARALLEL_FOR_COMMANDS_SIZE % utils::CACHELINE_SIZE == 0,
             "Size of Commands jobs must be multiple of a cache-line size");
 
+    // Arrays smaller than this are sorted with std::sort(). Larger arrays are split in blocks
+    // of at least RADIX_SORT_BLOCK_SIZE commands, each processed by its own job.
+    static constexpr size_t RADIX_SORT_MIN_COUNT = 4096;
+    static constexpr size_t RADIX_SORT_BLOCK_SIZE = 4096;
+    static constexpr size_t RADIX_SORT_MAX_BLOCKS = 16;
+
+    // Passes with fewer than twice RECORD_COMMANDS_PER_JOB commands are recorded on the calling
+    // thread. Larger passes are split between at most RECORD_MAX_JOBS jobs.
+    static constexpr size_t RECORD_COMMANDS_PER_JOB = 1024;
+    static constexpr size_t RECORD_MAX_JOBS = 8;
+
     static inline void generateCommands(uint32_t commandTypeFlags, Command* commands,
             FScene::RenderableSoa const& soa, utils::Range<uint32_t> range, RenderFlags renderFlags,
-            math::float3 cameraPosition, math::float3 cameraForward) noexcept;
+            VisibilityMask visibilityMask, math::float3 cameraPosition, math::float3 cameraForward) noexcept;
 
     template<uint32_t commandTypeFlags>
     static inline void generateCommandsImpl(uint32_t, Command* commands, FScene::RenderableSoa const& soa,
-            utils::Range<uint32_t> range, RenderFlags renderFlags, math::float3 cameraPosition,
-            math::float3 cameraForward) noexcept;
+            utils::Range<uint32_t> range, RenderFlags renderFlags, VisibilityMask visibilityMask,
+            math::float3 cameraPosition, math::float3 cameraForward) noexcept;
+
+    CommandCache::Key makeCacheKey(FEngine& engine, FScene& scene,
+            utils::Range<uint32_t> visibleRenderables, uint32_t commandTypeFlags,
+            RenderFlags renderFlags) const noexcept;
+
+    static inline uint32_t computeDistanceBits(math::float3 const& center,
+            math::float3 const& cameraPosition, math::float3 const& cameraForward) noexcept;
 
     static void setupColorCommand(Command& cmdDraw, bool hasDepthPass,
             FMaterialInstance const* mi) noexcept;
 
-    static void recordDriverCommands(FEngine::DriverApi& driver, FScene& scene,
-            utils::Slice<Command> const& commands) noexcept;
-
     static void updateSummedPrimitiveCounts(
             FScene::RenderableSoa& renderableData, utils::Range<uint32_t> vr) noexcept;
 
     const char* const mName;
+    const VisibilityMask mVisibilityMask;
 };
 
 } // namespace details
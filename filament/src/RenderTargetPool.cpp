@@ -21,8 +21,11 @@
 
 #include "driver/DriverApi.h"
 
+#include <utils/algorithm.h>
 #include <utils/Log.h>
 
+#include <algorithm>
+
 namespace filament {
 
 using namespace utils;
@@ -40,47 +43,67 @@ void RenderTargetPool::terminate(DriverApi& driver) noexcept {
     }
 }
 
+uint32_t RenderTargetPool::getSizeClass(uint32_t size) noexcept {
+    // the granularity is 1/8th of the largest power of two <= size, so the rounding adds
+    // at most 12.5% in each dimension
+    const uint32_t powerOfTwo = size ? (1u << (31u - utils::clz(size))) : 0u;
+    const uint32_t granularity = std::max(POOL_MIN_GRANULARITY, powerOfTwo / 8u);
+    return (size + granularity - 1u) & ~(granularity - 1u);
+}
+
 RenderTargetPool::Target const* RenderTargetPool::get(
         driver::TargetBufferFlags attachments,
         uint32_t w, uint32_t h, uint8_t samples, TextureFormat format,
-        uint8_t flags) const noexcept {
+        uint8_t flags) noexcept {
 
     // samples can't be less than 1
     samples = std::max(uint8_t(1), samples);
 
-    // round all allocations to 32x32 pixels, to avoid too many small resize
-    uint32_t target_w = (w + 31u) & ~31u;
-    uint32_t target_h = (h + 31u) & ~31u;
+    // round all allocations to their size class, to avoid too many small resize
+    const bool exact = flags & RenderTargetPool::Target::EXACT_SIZE;
+    uint32_t target_w = exact ? w : getSizeClass(w);
+    uint32_t target_h = exact ? h : getSizeClass(h);
+
     Entry entry = { attachments, target_w, target_h, samples, format, flags };
 
     FEngine& engine = *mEngine;
     DriverApi& driver = engine.getDriverApi();
-    
-    // Since we order the cache by width then by height, we can get a cached
-    // entry with a smaller height. Only reuse if both dimensions are higher.
-    auto pos = find(&entry);
-    Entry const* const it = pos != mPool.end() ? *pos : nullptr;
-    if (UTILS_LIKELY(it &&
-                     it->attachments == attachments &&
-                     it->samples == samples &&
-                     it->format == format &&
-                     it->flags == flags &&
-                     it->w >= target_w &&
-                     it->h >= target_h)) {
-        if (2 * it->w * it->h >= 3 * target_w * target_h) {
-            // the surface we found is 1.5x larger than requested
+
+    // The cache is ordered by width then by height, so we look at the entries following the
+    // requested size, while they're not too large. Only reuse if both dimensions are higher.
+    auto const pos = find(&entry);
+    for (auto it = pos, end = mPool.end(); it != end; ++it) {
+        Entry const* const candidate = *it;
+        if (candidate->attachments != attachments ||
+            candidate->samples != samples ||
+            candidate->format != format ||
+            candidate->flags != flags) {
+            break;
+        }
+        if (2 * candidate->w >= 3 * target_w || (exact && candidate->w != target_w)) {
+            // all the following surfaces are 1.5x larger than requested
             // there is a performance cost, especially on tilers, it's better to not allow
             // too much of a size difference
-            goto not_found;
+            break;
+        }
+        const bool fits = exact ? candidate->h == target_h :
+                (candidate->h >= target_h && 2 * candidate->w * candidate->h < 3 * target_w * target_h);
+        if (fits) {
+            // update last usage age, remove the entry from the pool and return it
+            candidate->age = mCacheAge;
+            mFreeSize -= getSize(candidate);
+            mPool.erase(it);
+            mStats.hits++;
+            return candidate;
         }
-
-        // update last usage age, remove the entry from the pool and return it
-        (*pos)->age = mCacheAge;
-        mPool.erase(pos);
-        return it;
     }
 
-    not_found:
+    mStats.misses++;
+
+    // make room for the new target by evicting the least recently used ones
+    const size_t size = getSize(&entry);
+    while (mPoolSize + size > mBudget && evict(driver, mCacheAge)) {
+    }
 
     if (flags & RenderTargetPool::Target::NO_TEXTURE) {
         entry.target = driver.createRenderTarget(
@@ -88,7 +111,6 @@ RenderTargetPool::Target const* RenderTargetPool::get(
     } else {
         entry.texture = driver.createTexture(Driver::SamplerType::SAMPLER_2D, 1,
                 format, samples, target_w, target_h, 1, Driver::TextureUsage::COLOR_ATTACHMENT);
-
         entry.target = driver.createRenderTarget(
                 entry.attachments, target_w, target_h, samples, format,
                 { entry.texture }, {}, {});
@@ -96,8 +118,7 @@ RenderTargetPool::Target const* RenderTargetPool::get(
 
     // update last used age
     entry.age = mCacheAge;
-
-    mPoolSize += getSize(&entry);
+    mPoolSize += size;
 
     // entry not found, create one
     return mEntryArena.make<Entry>(entry);
@@ -108,10 +129,18 @@ void RenderTargetPool::put(Target const* target) noexcept {
     Entry const* entry = static_cast<Entry const*>(target);
     auto pos = find(entry);
     mPool.insert(pos, entry);
+    mFreeSize += getSize(entry);
+}
+
+RenderTargetPool::Stats RenderTargetPool::getStats() const noexcept {
+    Stats stats = mStats;
+    stats.bytesResident = mPoolSize;
+    stats.bytesInUse = mPoolSize - mFreeSize;
+    return stats;
 }
 
 std::vector<RenderTargetPool::Entry const*>::iterator
-RenderTargetPool::find(Entry const* entry) const noexcept {
+RenderTargetPool::find(Entry const* entry) noexcept {
     auto& cache = mPool;
     auto pos = std::lower_bound(cache.begin(), cache.end(), entry,
             [](Entry const* const& l, Entry const* const& r) {
@@ -144,24 +173,13 @@ void RenderTargetPool::gc() noexcept {
 
     DriverApi& driver = mEngine->getDriverApi();
     auto& cache = mPool;
-    size_t count = cache.size();
-    while (count && (count > POOL_MAX_ENTRY_COUNT || mPoolSize > POOL_MAX_SIZE)) {
 
-        // find the least recently used entry (linear search here)
-        auto pos = std::min_element(cache.begin(), cache.end(),
-                [](const Entry* rhs, const Entry* lhs) { return rhs->age < lhs->age; });
-
-        // don't remove entries that were used in the last frame
-        if ((*pos)->age == mCacheAge) {
+    // don't remove entries that were used in the last frame
+    while (cache.size() > POOL_MAX_ENTRY_COUNT || mPoolSize > mBudget) {
+        if (!evict(driver, mCacheAge - 1)) {
             // no more entries old enough to remove
             break;
         }
-
-        // free resources
-        destroyEntry(driver, *pos);
-        // lastly, remove entry from cache
-        cache.erase(pos);
-        count--;
     }
 
     if (UTILS_UNLIKELY(mDeepPurgeCountDown-- == 0)) {
@@ -183,13 +201,38 @@ void RenderTargetPool::gc() noexcept {
     mCacheAge++;
 }
 
+bool RenderTargetPool::evict(DriverApi& driver, uint32_t age) noexcept {
+    auto& cache = mPool;
+    if (cache.empty()) {
+        return false;
+    }
+
+    // find the least recently used entry (linear search here)
+    auto pos = std::min_element(cache.begin(), cache.end(),
+            [](const Entry* rhs, const Entry* lhs) { return rhs->age < lhs->age; });
+
+    if ((*pos)->age > age) {
+        return false;
+    }
+
+    // free resources
+    destroyEntry(driver, *pos);
+
+    // lastly, remove entry from cache
+    cache.erase(pos);
+    return true;
+}
+
 void RenderTargetPool::destroyEntry(DriverApi& driver, Entry const* entry) noexcept {
     assert(entry);
     driver.destroyRenderTarget(entry->target);
     driver.destroyTexture(entry->texture);
-    mPoolSize -= getSize(entry);
+    const size_t size = getSize(entry);
+    assert(mPoolSize >= size && mFreeSize >= size);
+    mPoolSize -= size;
+    mFreeSize -= size;
+    mStats.evictions++;
     mEntryArena.destroy(entry);
-    assert(mPoolSize >= 0);
 }
 
 size_t RenderTargetPool::getSize(Entry const* entry) noexcept {
@@ -41,7 +41,11 @@ class RenderTargetPool {
     // e.g. layer sizes
     // 1440 x 2560 is ~ 29 MB for color buffer
     // 1280 x 720  is ~  7 MB for color buffer
-    static constexpr size_t POOL_MAX_SIZE = 128 * 1024 * 1024;
+    static constexpr size_t POOL_DEFAULT_BUDGET = 128 * 1024 * 1024;
+
+    // dimensions are rounded up to a multiple of this, or of 1/8th of their power of two
+    // for larger sizes, so that near sizes (e.g. with dynamic resolution) share targets.
+    static constexpr uint32_t POOL_MIN_GRANULARITY = 32;
 
     // 2 pages is way enough for the entry structures (should be about 400)
     static constexpr size_t POOL_ENTRY_ARENA_SIZE = 8192;
@@ -63,17 +67,37 @@ public:
         uint8_t samples = 1;
         uint8_t flags = 0;
         static constexpr uint8_t NO_TEXTURE = 0x1;
+        static constexpr uint8_t EXACT_SIZE = 0x2;  // not rounded to the size class
     };
 
     Target const* get(driver::TargetBufferFlags attachments,
             uint32_t width, uint32_t height, uint8_t samples, TextureFormat format,
-            uint8_t flags = 0) const noexcept;
+            uint8_t flags = 0) noexcept;
 
     void put(Target const* entry) noexcept;
 
     // remove older items in the cache. call this once per frame.
     void gc() noexcept;
 
+    // Bytes of render targets the pool tries to stay under. Targets in use are never evicted,
+    // so the budget can be exceeded temporarily.
+    void setBudget(size_t bytes) noexcept { mBudget = bytes; }
+    size_t getBudget() const noexcept { return mBudget; }
+
+    struct Stats {
+        uint32_t hits = 0;          // get() reusing a target
+        uint32_t misses = 0;        // get() creating a target
+        uint32_t evictions = 0;     // targets destroyed to stay in budget or because too old
+        size_t bytesResident = 0;   // size of all targets, free or in use
+        size_t bytesInUse = 0;      // size of the targets not returned with put()
+    };
+
+    // counters are cumulative since init()
+    Stats getStats() const noexcept;
+
+    // size class of a dimension
+    static uint32_t getSizeClass(uint32_t size) noexcept;
+
 private:
     struct Entry : public Target {
         Entry() = default;
@@ -95,17 +119,23 @@ private:
 
     static size_t getSize(Entry const* entry) noexcept;
     void destroyEntry(driver::DriverApi& driver, Entry const* entry) noexcept;
-    std::vector<Entry const*>::iterator find(Entry const* entry) const noexcept;
+    std::vector<Entry const*>::iterator find(Entry const* entry) noexcept;
+
+    // destroys the least recently used free entry not used more recently than 'age'
+    bool evict(driver::DriverApi& driver, uint32_t age) noexcept;
 
     details::FEngine* mEngine = nullptr;
-    mutable std::vector<Entry const*> mPool;
-    mutable size_t mPoolSize = 0;
+    std::vector<Entry const*> mPool;
+    size_t mPoolSize = 0;
+    size_t mFreeSize = 0;
+    size_t mBudget = POOL_DEFAULT_BUDGET;
+    Stats mStats;
     // at 60 fps, 32 bit gives us 828 days without overflow
     uint32_t mDeepPurgeCountDown = POOL_ENTRY_MAX_AGE;
     uint32_t mCacheAge = POOL_ENTRY_MAX_AGE;
 
     using PoolAllocator = utils::Arena<utils::ObjectPoolAllocator<Entry>, utils::LockingPolicy::NoLock>;
-    mutable PoolAllocator mEntryArena = { "PoolAllocator", POOL_ENTRY_ARENA_SIZE };
+    PoolAllocator mEntryArena = { "PoolAllocator", POOL_ENTRY_ARENA_SIZE };
 
 };
 
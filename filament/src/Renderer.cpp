@@ -164,7 +164,8 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
 
     Viewport const& vp = view.getViewport();
     const bool hasPostProcess = view.hasPostProcessPass();
-    float2 scale = view.updateScale(mFrameInfoManager.getLastFrameTime());
+    float2 scale = view.updateScale(mFrameInfoManager.getLastFrameTime(),
+            mFrameInfoManager.getLastGpuFrameTime(), mFrameInfoManager.getLastCpuFrameTime());
     bool useFXAA = view.getAntiAliasing() == View::AntiAliasing::FXAA;
     if (!hasPostProcess) {
         // dynamic scaling and FXAA are part of the post-process phase and can't happen if
@@ -230,90 +231,63 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
      * Post Processing...
      */
 
-
-#define USE_FRAME_GRAPH false
-
     if (UTILS_LIKELY(hasPostProcess)) {
         driver.pushGroupMarker("Post Processing");
 
         assert(colorTarget);
 
-        if (USE_FRAME_GRAPH) {
-            FrameGraph fg;
-
-            const bool translucent = mSwapChain->isTransparent();
-
-            FrameGraphResource::Descriptor colorDesc{
-                    .width = colorTarget->w,
-                    .height= colorTarget->h,
-                    .format= colorTarget->format,
-                    .samples= colorTarget->samples
-            };
-
-            FrameGraphResource::Descriptor viewRenderTargetDesc{
-                    .width = vp.width,
-                    .height= vp.height
-            };
-
-            FrameGraphResource input = fg.importResource("colorTarget", colorDesc,
-                    colorTarget->target, colorTarget->texture);
-
-            FrameGraphResource output = fg.importResource("viewRenderTarget",
-                    viewRenderTargetDesc, viewRenderTarget);
-
-            if (useMSAA > 1) {
-                input = ppm.msaa(fg, input, hdrFormat);
-            }
-            input = ppm.toneMapping(fg, input, ldrFormat, translucent);
-            if (useFXAA) {
-                input = ppm.fxaa(fg, input, ldrFormat, translucent);
-            }
-            if (scaled) {
-                input = ppm.dynamicScaling(fg, input, ldrFormat, vp);
-            }
-
-            fg.moveResource(output, input);
-            fg.present(output, FrameGraph::Builder::COLOR);
-
-            fg.compile();
-            //fg.export_graphviz(slog.d);
-            fg.execute(driver);
-
-            rtp.put(colorTarget);
-
-        } else {
-
-            ppm.start();
-
-            if (useMSAA > 1) {
-                // Note: MSAA, when used is applied before tone-mapping (which is not ideal)
-                // (tone mapping currently only works without multi-sampling)
-                // this blit does a MSAA resolve
-                ppm.blit(hdrFormat);
-            }
-
-            const bool translucent = mSwapChain->isTransparent();
-            Handle<HwProgram> toneMappingProgram = engine.getPostProcessProgram(
-                    translucent ? PostProcessStage::TONE_MAPPING_TRANSLUCENT
-                                : PostProcessStage::TONE_MAPPING_OPAQUE);
-            ppm.pass(useFXAA ? TextureFormat::RGBA8 : ldrFormat, toneMappingProgram);
-
-            if (useFXAA) {
-                Handle<HwProgram> antiAliasingProgram = engine.getPostProcessProgram(
-                        translucent ? PostProcessStage::ANTI_ALIASING_TRANSLUCENT
-                                    : PostProcessStage::ANTI_ALIASING_OPAQUE);
-                ppm.pass(ldrFormat, antiAliasingProgram);
-            }
-
-            if (scaled) {
-                // because it's the last command, the TextureFormat is not relevant
-                ppm.blit();
-            }
-            ppm.finish(view.getDiscardedTargetBuffers(), viewRenderTarget, vp, colorTarget, svp);
+        // the intermediate targets are kept in the pool from one frame to the next
+        FrameGraph fg(rtp);
+
+        const bool translucent = mSwapChain->isTransparent();
+
+        FrameGraphResource::Descriptor colorDesc{
+                .width = colorTarget->w,
+                .height= colorTarget->h,
+                .format= colorTarget->format,
+                .samples= colorTarget->samples
+        };
+
+        FrameGraphResource::Descriptor viewRenderTargetDesc{
+                .width = vp.width,
+                .height= vp.height
+        };
+
+        FrameGraphResource input = fg.importResource("colorTarget", colorDesc,
+                colorTarget->target, colorTarget->texture);
 
+        // the last pass draws into the view's viewport, and must preserve the rest
+        FrameGraphResource output = fg.importResource("viewRenderTarget",
+                viewRenderTargetDesc, viewRenderTarget, vp, view.getDiscardedTargetBuffers());
+
+        if (useMSAA > 1) {
+            // Note: MSAA, when used is applied before tone-mapping (which is not ideal)
+            // (tone mapping currently only works without multi-sampling)
+            input = ppm.msaa(fg, input, hdrFormat);
+        }
+        input = ppm.toneMapping(fg, input, ldrFormat, translucent);
+        if (useFXAA) {
+            input = ppm.fxaa(fg, input, ldrFormat, translucent);
+        }
+        if (scaled) {
+            input = ppm.dynamicScaling(fg, input, ldrFormat, svp, vp);
         }
 
+        fg.moveResource(output, input);
+        fg.present(output, FrameGraph::Builder::COLOR);
+
+        fg.compile();
+        //fg.export_graphviz(slog.d);
+        FrameGraph::MemoryStats const& memory = fg.getMemoryStats();
+        view.setPostProcessingMemoryStats(
+                { memory.peak, memory.unaliased, memory.resources, memory.allocations });
+        fg.execute(driver);
+
+        rtp.put(colorTarget);
+
         driver.popGroupMarker();
+    } else {
+        view.setPostProcessingMemoryStats({});
     }
 
     // for debugging
@@ -378,9 +352,6 @@ bool FRenderer::beginFrame(FSwapChain* swapChain) {
     assert(swapChain);
 
     mFrameId++;
-    if (UTILS_HAS_THREADING) {
-        mFrameInfoManager.beginFrame(mFrameId);
-    }
 
     { // scope for frame id trace
         char buf[64];
@@ -400,6 +371,14 @@ bool FRenderer::beginFrame(FSwapChain* swapChain) {
     int64_t monotonic_clock_ns (std::chrono::steady_clock::now().time_since_epoch().count());
     driver.beginFrame(monotonic_clock_ns, mFrameId);
 
+    // redundant state changes the DriverApi didn't record during the previous frame
+    SYSTRACE_VALUE32("elidedCommands", driver.getElidedCommands().total());
+
+    // the GPU timer query needs the context to be current
+    if (UTILS_HAS_THREADING) {
+        mFrameInfoManager.beginFrame(mFrameId);
+    }
+
     if (!mFrameSkipper.beginFrame()) {
         mFrameInfoManager.cancelFrame();
         driver.endFrame(mFrameId);
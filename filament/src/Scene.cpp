@@ -19,6 +19,7 @@
 #include "components/LightManager.h"
 #include "components/RenderableManager.h"
 
+#include <private/filament/SibGenerator.h>
 #include <private/filament/UibGenerator.h>
 
 #include "details/Culler.h"
@@ -26,9 +27,13 @@
 #include "details/IndirectLight.h"
 #include "details/Skybox.h"
 
+#include "driver/GPUBuffer.h"
+
 #include <utils/compiler.h>
 #include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
 #include <utils/Range.h>
+#include <utils/Systrace.h>
 #include <utils/Zip2Iterator.h>
 
 #include <algorithm>
@@ -49,10 +54,238 @@ FScene::FScene(FEngine& engine) :
 FScene::~FScene() noexcept = default;
 
 
-void FScene::prepare(const math::mat4f& worldOriginTransform) {
-    // TODO: can we skip this in most cases? Since we rely on indices staying the same,
-    //       we could only skip, if nothing changed in the RCM.
+// removes the slot of entity 'e' by moving the last slot into it
+template<typename SoA>
+static void removeSlot(SoA& soa, std::vector<Entity>& entities,
+        tsl::robin_map<Entity, uint32_t>& slots, Entity e) noexcept {
+    auto pos = slots.find(e);
+    if (pos != slots.end()) {
+        const uint32_t slot = pos->second;
+        const uint32_t last = uint32_t(soa.size() - 1);
+        slots.erase(pos);
+        if (slot != last) {
+            soa.swap(slot, last);
+            entities[slot] = entities[last];
+            slots[entities[slot]] = slot;
+        }
+        soa.pop_back();
+        entities.pop_back();
+    }
+}
+
+// returns the slot of entity 'e', allocating a new one if needed
+template<typename SoA>
+static uint32_t findOrAddSlot(SoA& soa, std::vector<Entity>& entities,
+        tsl::robin_map<Entity, uint32_t>& slots, Entity e) {
+    auto pos = slots.find(e);
+    if (pos != slots.end()) {
+        return pos->second;
+    }
+    const uint32_t slot = uint32_t(soa.size());
+    soa.push_back();
+    entities.push_back(e);
+    slots[e] = slot;
+    return slot;
+}
+
+static bool isSameTransform(mat4f const& lhs, mat4f const& rhs) noexcept {
+    return lhs[0] == rhs[0] && lhs[1] == rhs[1] && lhs[2] == rhs[2] && lhs[3] == rhs[3];
+}
+
+// compacts 'soa' by removing the rows that don't have an INSTANCE, and rebuilds the slots
+template<size_t INSTANCE, typename SoA>
+static void compactSlots(SoA& soa, Entity const* entities, std::vector<Entity>& slotEntities,
+        tsl::robin_map<Entity, uint32_t>& slots) {
+    slotEntities.clear();
+    slots.clear();
+    uint32_t slot = 0;
+    for (size_t i = 0, c = soa.size(); i < c; i++) {
+        if (soa.template elementAt<INSTANCE>(i)) {
+            if (slot != i) {
+                soa.swap(slot, i);
+            }
+            slotEntities.push_back(entities[i]);
+            slots[entities[i]] = slot;
+            slot++;
+        }
+    }
+    soa.resize(slot);
+}
+
+static void storeRenderable(FRenderableManager const& rcm, FRenderableManager::Instance ri,
+        affinef const& worldTransform, FScene::RenderableSoa& soa, size_t i) noexcept {
+    // compute the world AABB so we can perform culling
+    const Box worldAABB = rigidTransform(rcm.getAABB(ri), worldTransform);
+    soa.elementAt<FScene::RENDERABLE_INSTANCE>(i)  = ri;
+    soa.elementAt<FScene::WORLD_TRANSFORM>(i)      = worldTransform;
+    soa.elementAt<FScene::VISIBILITY_STATE>(i)     = rcm.getVisibility(ri);
+    soa.elementAt<FScene::BONES_UBH>(i)            = rcm.getBonesUbh(ri);
+    soa.elementAt<FScene::WORLD_AABB_CENTER>(i)    = worldAABB.center;
+    soa.elementAt<FScene::LAYERS>(i)               = rcm.getLayerMask(ri);
+    soa.elementAt<FScene::WORLD_AABB_EXTENT>(i)    = worldAABB.halfExtent;
+}
+
+static void storeLight(FLightManager const& lcm, FLightManager::Instance li,
+        affinef const& worldTransform, FScene::LightSoa& soa, size_t i) noexcept {
+    float4 positionRadius{ 0, 0, 0, std::numeric_limits<float>::infinity() };
+    float3 d = 0;
+    if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
+        d = lcm.getLocalDirection(li);
+        // using the inverse-transpose handles non-uniform scaling
+        d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
+    } else {
+        const float3 p = worldTransform.transformPoint(lcm.getLocalPosition(li));
+        positionRadius = float4{ p, lcm.getRadius(li) };
+        if (!lcm.isPointLight(li) || lcm.isIESLight(li)) {
+            d = lcm.getLocalDirection(li);
+            // using the inverse-transpose handles non-uniform scaling
+            d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
+        }
+    }
+    soa.elementAt<FScene::POSITION_RADIUS>(i)  = positionRadius;
+    soa.elementAt<FScene::DIRECTION>(i)        = d;
+    soa.elementAt<FScene::LIGHT_INSTANCE>(i)   = li;
+}
 
+void FScene::updateCachedEntity(Entity e, const math::affinef& worldOriginTransform) noexcept {
+    FEngine& engine = mEngine;
+    EntityManager& em = engine.getEntityManager();
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    FLightManager& lcm = engine.getLightManager();
+
+    mCacheGeneration++;
+
+    // getInstance() always returns null if the entity is the Null entity
+    // so we don't need to check for that, but we need to check it's alive
+    if (!em.isAlive(e)) {
+        removeCachedEntity(e);
+        return;
+    }
+
+    auto ri = rcm.getInstance(e);
+    auto li = lcm.getInstance(e);
+    if ((ri && rcm.getVisibility(ri).castShadows) || isCachedShadowCaster(e)) {
+        mShadowCasterGeneration++;
+    }
+    if (!ri & !li) {
+        removeCachedEntity(e);
+        return;
+    }
+
+    // get the world transform
+    auto ti = tcm.getInstance(e);
+    const affinef worldTransform = worldOriginTransform * tcm.getWorldTransformAffine(ti);
+
+    // don't even draw this object if it doesn't have a transform (which shouldn't happen
+    // because one is always created when creating a Renderable component).
+    const size_t renderableCount = mRenderableCache.size();
+    if (ri && ti) {
+        const uint32_t slot = findOrAddSlot(mRenderableCache,
+                mRenderableCacheEntities, mRenderableSlots, e);
+        storeRenderable(rcm, ri, worldTransform, mRenderableCache, slot);
+        if (mBvhEnabled) {
+            mMovedRenderableSlots.push_back(slot);
+        }
+    } else {
+        removeSlot(mRenderableCache, mRenderableCacheEntities, mRenderableSlots, e);
+    }
+    // the hierarchy must be rebuilt when renderables are added or removed
+    mBvhNeedsRebuild |= renderableCount != mRenderableCache.size();
+
+    if (li) {
+        const uint32_t slot = findOrAddSlot(mLightCache, mLightCacheEntities, mLightSlots, e);
+        storeLight(lcm, li, worldTransform, mLightCache, slot);
+    } else {
+        removeSlot(mLightCache, mLightCacheEntities, mLightSlots, e);
+    }
+}
+
+void FScene::gatherAllEntities(const math::affinef& worldOriginTransform) noexcept {
+    SYSTRACE_CALL();
+
+    mCacheGeneration++;
+    mShadowCasterGeneration++;
+
+    FEngine& engine = mEngine;
+    JobSystem& js = engine.getJobSystem();
+    EntityManager const& em = engine.getEntityManager();
+    FRenderableManager const& rcm = engine.getRenderableManager();
+    FTransformManager const& tcm = engine.getTransformManager();
+    FLightManager const& lcm = engine.getLightManager();
+
+    // we need the entities in an array so we can split the work in chunks
+    auto& gathered = mGatheredEntities;
+    gathered.assign(mEntities.begin(), mEntities.end());
+    const uint32_t count = uint32_t(gathered.size());
+
+    // Entity i is gathered in row i of both caches, so each chunk writes to its own range.
+    // Rows of entities lacking the corresponding component are left with a null instance and
+    // removed afterwards.
+    auto& renderableCache = mRenderableCache;
+    auto& lightCache = mLightCache;
+    renderableCache.clear();
+    renderableCache.resize(count);
+    lightCache.clear();
+    lightCache.resize(count);
+
+    auto work = [&em, &rcm, &tcm, &lcm, &worldOriginTransform, &renderableCache, &lightCache,
+            entities = gathered.data()](uint32_t startIndex, uint32_t indexCount) {
+        for (size_t i = startIndex, c = startIndex + indexCount; i < c; i++) {
+            renderableCache.elementAt<RENDERABLE_INSTANCE>(i) = {};
+            lightCache.elementAt<LIGHT_INSTANCE>(i) = {};
+
+            const Entity e = entities[i];
+            if (!em.isAlive(e)) {
+                continue;
+            }
+
+            auto ri = rcm.getInstance(e);
+            auto li = lcm.getInstance(e);
+            if (!ri & !li) {
+                continue;
+            }
+
+            auto ti = tcm.getInstance(e);
+            const affinef worldTransform = worldOriginTransform * tcm.getWorldTransformAffine(ti);
+            if (ri && ti) {
+                storeRenderable(rcm, ri, worldTransform, renderableCache, i);
+            }
+            if (li) {
+                storeLight(lcm, li, worldTransform, lightCache, i);
+            }
+        }
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, 0, count,
+            std::cref(work), jobs::CountSplitter<JOBS_PARALLEL_FOR_GATHER_COUNT, 8>());
+    js.runAndWait(job);
+
+    compactSlots<RENDERABLE_INSTANCE>(renderableCache, gathered.data(),
+            mRenderableCacheEntities, mRenderableSlots);
+    mBvhNeedsRebuild = true;
+    compactSlots<LIGHT_INSTANCE>(lightCache, gathered.data(),
+            mLightCacheEntities, mLightSlots);
+}
+
+bool FScene::isCachedShadowCaster(Entity e) const noexcept {
+    auto pos = mRenderableSlots.find(e);
+    return pos != mRenderableSlots.end() &&
+           mRenderableCache.elementAt<VISIBILITY_STATE>(pos->second).castShadows;
+}
+
+void FScene::removeCachedEntity(Entity e) noexcept {
+    mCacheGeneration++;
+    if (isCachedShadowCaster(e)) {
+        mShadowCasterGeneration++;
+    }
+    const size_t renderableCount = mRenderableCache.size();
+    removeSlot(mRenderableCache, mRenderableCacheEntities, mRenderableSlots, e);
+    mBvhNeedsRebuild |= renderableCount != mRenderableCache.size();
+    removeSlot(mLightCache, mLightCacheEntities, mLightSlots, e);
+}
+
+void FScene::prepare(const math::mat4f& worldOriginTransform) {
     FEngine& engine = mEngine;
     EntityManager& em = engine.getEntityManager();
     FRenderableManager& rcm = engine.getRenderableManager();
@@ -63,11 +296,60 @@ void FScene::prepare(const math::mat4f& worldOriginTransform) {
     auto& lightData = mLightData;
     auto const& entities = mEntities;
 
+    /*
+     * Bring our per-entity cache up to date. Only the entities added to the scene or changed in
+     * one of the component managers since the last call are updated. If we can't know what
+     * changed (first call, the change history was lost, or the world origin changed), we
+     * gather everything again.
+     */
+
+    ChangeLog const& tcmChanges = tcm.getChangeLog();
+    ChangeLog const& rcmChanges = rcm.getChangeLog();
+    ChangeLog const& lcmChanges = lcm.getChangeLog();
+    Slice<const Entity> transformChanges;
+    Slice<const Entity> renderableChanges;
+    Slice<const Entity> lightChanges;
+
+    const bool fullUpdate = !mCacheValid ||
+            !isSameTransform(worldOriginTransform, mCacheWorldOriginTransform) ||
+            !tcmChanges.getChangesSince(mTransformGeneration, transformChanges) ||
+            !rcmChanges.getChangesSince(mRenderableGeneration, renderableChanges) ||
+            !lcmChanges.getChangesSince(mLightGeneration, lightChanges);
+
+    // the world origin is an affine transform too, it is converted once for all entities
+    const affinef origin(worldOriginTransform);
+    if (UTILS_UNLIKELY(fullUpdate)) {
+        gatherAllEntities(origin);
+    } else {
+        auto update = [this, &entities, &origin](Slice<const Entity> changes) {
+            for (Entity e : changes) {
+                // the change logs cover all entities, not just ours
+                if (entities.find(e) != entities.end()) {
+                    updateCachedEntity(e, origin);
+                }
+            }
+        };
+        update({ mAddedEntities.data(), mAddedEntities.size() });
+        update(transformChanges);
+        update(renderableChanges);
+        update(lightChanges);
+    }
+
+    mAddedEntities.clear();
+    mTransformGeneration = tcmChanges.getGeneration();
+    mRenderableGeneration = rcmChanges.getGeneration();
+    mLightGeneration = lcmChanges.getGeneration();
+    mCacheWorldOriginTransform = worldOriginTransform;
+    mCacheValid = true;
+
+    /*
+     * Now copy the cache into our per-frame SoAs.
+     */
 
-    // NOTE: we can't know in advance how many entities are renderable or lights because the corresponding
-    // component can be added after the entity is added to the scene.
+    auto const& renderableCache = mRenderableCache;
+    Entity const* const renderableEntities = mRenderableCacheEntities.data();
 
-    size_t renderableDataCapacity = entities.size();
+    size_t renderableDataCapacity = renderableCache.size();
     // we need the capacity to be multiple of 16 for SIMD loops
     renderableDataCapacity = (renderableDataCapacity + 0xF) & ~0xF;
     // we need 1 extra entry at the end for the summed primitive count
@@ -78,9 +360,48 @@ void FScene::prepare(const math::mat4f& worldOriginTransform) {
         sceneData.setCapacity(renderableDataCapacity);
     }
 
+    if (mBvhEnabled) {
+        if (mBvhNeedsRebuild) {
+            mBvh.build(renderableCache.data<WORLD_AABB_CENTER>(),
+                    renderableCache.data<WORLD_AABB_EXTENT>(), renderableCache.size());
+        } else {
+            mBvh.refit(renderableCache.data<WORLD_AABB_CENTER>(),
+                    renderableCache.data<WORLD_AABB_EXTENT>(),
+                    mMovedRenderableSlots.data(), mMovedRenderableSlots.size());
+        }
+        mBvhNeedsRebuild = false;
+        mMovedRenderableSlots.clear();
+    }
+
+    // when the hierarchy is enabled, the renderables must be stored in its order
+    uint32_t const* const order = mBvhEnabled ? mBvh.getOrder() : nullptr;
+
+    for (size_t j = 0, c = renderableCache.size(); j < c; j++) {
+        const size_t i = order ? order[j] : j;
+        // Entities can be destroyed at any time, their components are only reclaimed later.
+        // We keep them so that the hierarchy matches, but they're never visible.
+        const uint8_t layers = UTILS_LIKELY(em.isAlive(renderableEntities[i])) ?
+                renderableCache.elementAt<LAYERS>(i) : uint8_t(0);
+        // we know there is enough space in the array
+        sceneData.push_back_unsafe(
+                renderableCache.elementAt<RENDERABLE_INSTANCE>(i),
+                renderableCache.elementAt<WORLD_TRANSFORM>(i),
+                renderableCache.elementAt<VISIBILITY_STATE>(i),
+                renderableCache.elementAt<BONES_UBH>(i),
+                renderableCache.elementAt<WORLD_AABB_CENTER>(i),
+                0,
+                0,
+                layers,
+                renderableCache.elementAt<WORLD_AABB_EXTENT>(i),
+                {}, {});
+    }
+
+    auto const& lightCache = mLightCache;
+    Entity const* const lightEntities = mLightCacheEntities.data();
+
     // The light data list will always contain at least one entry for the
     // dominating directional light, even if there are no entities.
-    size_t lightDataCapacity = std::max<size_t>(1, entities.size());
+    size_t lightDataCapacity = lightCache.size() + DIRECTIONAL_LIGHTS_COUNT;
     // we need the capacity to be multiple of 16 for SIMD loops
     lightDataCapacity = (lightDataCapacity + 0xF) & ~0xF;
 
@@ -91,67 +412,29 @@ void FScene::prepare(const math::mat4f& worldOriginTransform) {
     // the first entries are reserved for the directional lights (currently only one)
     lightData.resize(DIRECTIONAL_LIGHTS_COUNT);
 
-
     // find the max intensity directional light index in our local array
     float maxIntensity = 0;
 
-    for (Entity e : entities) {
-        if (!em.isAlive(e))
-            continue;
-
-        // getInstance() always returns null if the entity is the Null entity
-        // so we don't need to check for that, but we need to check it's alive
-        auto ri = rcm.getInstance(e);
-        auto li = lcm.getInstance(e);
-        if (!ri & !li)
+    for (size_t i = 0, c = lightCache.size(); i < c; i++) {
+        if (UTILS_UNLIKELY(!em.isAlive(lightEntities[i]))) {
             continue;
-
-        // get the world transform
-        auto ti = tcm.getInstance(e);
-        const mat4f worldTransform = worldOriginTransform * tcm.getWorldTransform(ti);
-
-        // don't even draw this object if it doesn't have a transform (which shouldn't happen
-        // because one is always created when creating a Renderable component).
-        if (ri && ti) {
-            // compute the world AABB so we can perform culling
-            const Box worldAABB = rigidTransform(rcm.getAABB(ri), worldTransform);
-
-            // we know there is enough space in the array
-            sceneData.push_back_unsafe(
-                    ri,
-                    worldTransform,
-                    rcm.getVisibility(ri),
-                    rcm.getBonesUbh(ri),
-                    worldAABB.center,
-                    0,
-                    rcm.getLayerMask(ri),
-                    worldAABB.halfExtent,
-                    {}, {});
         }
-
-        if (li) {
-            // find the dominant directional light
-            if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
-                // we don't store the directional lights, because we only have a single one
-                if (lcm.getIntensity(li) >= maxIntensity) {
-                    float3 d = lcm.getLocalDirection(li);
-                    // using the inverse-transpose handles non-uniform scaling
-                    d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
-                    lightData.elementAt<FScene::POSITION_RADIUS>(0) = float4{ 0, 0, 0, std::numeric_limits<float>::infinity() };
-                    lightData.elementAt<FScene::DIRECTION>(0)       = d;
-                    lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
-                }
-            } else {
-                const float4 p = worldTransform * float4{ lcm.getLocalPosition(li), 1 };
-                float3 d = 0;
-                if (!lcm.isPointLight(li) || lcm.isIESLight(li)) {
-                    d = lcm.getLocalDirection(li);
-                    // using the inverse-transpose handles non-uniform scaling
-                    d = normalize(transpose(inverse(worldTransform.upperLeft())) * d);
-                }
-                lightData.push_back_unsafe(
-                        float4{ p.xyz, lcm.getRadius(li) }, d, li, {}, {});
+        auto li = lightCache.elementAt<LIGHT_INSTANCE>(i);
+        // find the dominant directional light
+        if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
+            // we don't store the directional lights, because we only have a single one
+            const float intensity = lcm.getIntensity(li);
+            if (intensity >= maxIntensity) {
+                maxIntensity = intensity;
+                lightData.elementAt<FScene::POSITION_RADIUS>(0) = lightCache.elementAt<POSITION_RADIUS>(i);
+                lightData.elementAt<FScene::DIRECTION>(0)       = lightCache.elementAt<DIRECTION>(i);
+                lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
             }
+        } else {
+            lightData.push_back_unsafe(
+                    lightCache.elementAt<POSITION_RADIUS>(i),
+                    lightCache.elementAt<DIRECTION>(i),
+                    li, {}, {}, {});
         }
     }
 
@@ -165,36 +448,15 @@ void FScene::prepare(const math::mat4f& worldOriginTransform) {
 
 void FScene::updateUBOs(utils::Range<uint32_t> visibleRenderables, Handle<HwUniformBuffer> renderableUbh) noexcept {
     FEngine::DriverApi& driver = mEngine.getDriverApi();
-    const size_t size = visibleRenderables.size() * sizeof(PerRenderableUib);
+    const size_t size = getRenderableUniformsSize(visibleRenderables.size());
 
     // allocate space into the command stream directly
     void* const buffer = driver.allocate(size);
 
     auto& sceneData = mRenderableData;
     for (uint32_t i : visibleRenderables) {
-        mat4f const& model = sceneData.elementAt<WORLD_TRANSFORM>(i);
-        const size_t offset = i * sizeof(PerRenderableUib);
-
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelMatrix),
-                model);
-
-        // Using the inverse-transpose handles non-uniform scaling, but DOESN'T guarantee that
-        // the transformed normals will have unit-length, therefore they need to be normalized
-        // in the shader (that's already the case anyways, since normalization is needed after
-        // interpolation).
-        //
-        // We pre-scale normals by the inverse of the largest scale factor to avoid
-        // large post-transform magnitudes in the shader, especially in the fragment shader, where
-        // we use medium precision.
-        //
-        // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
-
-        mat3f m = transpose(inverse(model.upperLeft()));
-        m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
-
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+        affinef const& model = sceneData.elementAt<WORLD_TRANSFORM>(i);
+        setRenderableUniforms(buffer, i * sizeof(PerRenderableUib), model);
     }
 
     // TODO: handle static objects separately
@@ -202,19 +464,47 @@ void FScene::updateUBOs(utils::Range<uint32_t> visibleRenderables, Handle<HwUnif
     driver.updateUniformBuffer(renderableUbh, { buffer, size });
 }
 
+void FScene::setRenderableUniforms(void* buffer, size_t offset, affinef const& model) noexcept {
+    // the shaders still expect a full mat4, the constant last row is only added here
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelMatrix),
+            model.toMat4());
+
+    // Using the inverse-transpose handles non-uniform scaling, but DOESN'T guarantee that
+    // the transformed normals will have unit-length, therefore they need to be normalized
+    // in the shader (that's already the case anyways, since normalization is needed after
+    // interpolation).
+    //
+    // We pre-scale normals by the inverse of the largest scale factor to avoid
+    // large post-transform magnitudes in the shader, especially in the fragment shader, where
+    // we use medium precision.
+    //
+    // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
+
+    mat3f m = transpose(inverse(model.upperLeft()));
+    m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+}
+
+size_t FScene::getRenderableUniformsSize(size_t count) noexcept {
+    return (count + CONFIG_MAX_INSTANCES - 1) * sizeof(PerRenderableUib);
+}
+
 void FScene::terminate(FEngine& engine) {
     // DO NOT destroy this UBO, it's owned by the View
     mRenderableViewUbh.clear();
 }
 
-void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena, Handle<HwUniformBuffer> lightUbh) noexcept {
+void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena, GPUBuffer& lightBuffer) noexcept {
     FEngine::DriverApi& driver = mEngine.getDriverApi();
     FLightManager& lcm = mEngine.getLightManager();
     FScene::LightSoa& lightData = getLightData();
 
     /*
      * Here we copy our lights data into the GPU buffer, some lights might be left out if there
-     * are more than the GPU buffer allows (i.e. 256).
+     * are more than the GPU buffer allows (i.e. CONFIG_MAX_LIGHT_COUNT).
      *
      * We always sort lights by distance to the camera plane so that:
      * - we can build light trees
@@ -235,7 +525,7 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
     std::sort(b + DIRECTIONAL_LIGHTS_COUNT, b + lightData.size(),
             [](auto const& lhs, auto const& rhs) { return lhs.second < rhs.second; });
 
-    // drop excess lights
+    // drop excess lights, only the closest CONFIG_MAX_LIGHT_COUNT fit in the lights buffer
     lightData.resize(std::min(lightData.size(), CONFIG_MAX_LIGHT_COUNT + DIRECTIONAL_LIGHTS_COUNT));
 
     // number of point/spot lights
@@ -245,10 +535,18 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
     float2* const zrange = lightData.data<FScene::SCREEN_SPACE_Z_RANGE>();
     computeLightRanges(zrange, camera, spheres + DIRECTIONAL_LIGHTS_COUNT, positionalLightCount);
 
-    LightsUib* const lp = driver.allocatePod<LightsUib>(positionalLightCount);
+    if (!positionalLightCount) {
+        return;
+    }
+
+    // the lights buffer is updated by whole rows
+    const size_t rowSize = lightBuffer.getRowSizeInBytes();
+    const size_t size = (positionalLightCount * sizeof(PunctualLightData) + rowSize - 1) / rowSize * rowSize;
+    PunctualLightData* const lp = driver.allocatePod<PunctualLightData>(size / sizeof(PunctualLightData));
 
     auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
+    auto const* UTILS_RESTRICT shadowInfo   = lightData.data<FScene::SHADOW_INFO>();
     for (size_t i = DIRECTIONAL_LIGHTS_COUNT, c = lightData.size(); i < c; ++i) {
         const size_t gpuIndex = i - DIRECTIONAL_LIGHTS_COUNT;
         auto li = instances[i];
@@ -256,9 +554,13 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
         lp[gpuIndex].colorIntensity       = { lcm.getColor(li), lcm.getIntensity(li) };
         lp[gpuIndex].directionIES         = { directions[i], 0 };
         lp[gpuIndex].spotScaleOffset.xy   = { lcm.getSpotParams(li).scaleOffset };
+        // the shader moves the fragment towards the light by the constant bias
+        lp[gpuIndex].spotScaleOffset.zw   = {
+                shadowInfo[i].castsShadows ? float(shadowInfo[i].index) : -1.0f,
+                lcm.getShadowConstantBias(li) };
     }
 
-    driver.updateUniformBuffer(lightUbh, { lp, positionalLightCount * sizeof(LightsUib) });
+    lightBuffer.commit(driver, lp, (char const*)lp + size);
 }
 
 // These methods need to exist so clang honors the __restrict__ keyword, which in turn
@@ -315,10 +617,21 @@ void FScene::computeLightRanges(
 
 void FScene::addEntity(Entity entity) {
     mEntities.insert(entity);
+    mAddedEntities.push_back(entity);
 }
 
 void FScene::remove(Entity entity) {
     mEntities.erase(entity);
+    removeCachedEntity(entity);
+}
+
+void FScene::setBoundingVolumeHierarchyEnabled(bool enabled) noexcept {
+    if (mBvhEnabled != enabled) {
+        mBvhEnabled = enabled;
+        mBvhNeedsRebuild = enabled;
+        mMovedRenderableSlots.clear();
+        mBvh.clear();
+    }
 }
 
 size_t FScene::getRenderableCount() const noexcept {
@@ -408,6 +721,14 @@ void Scene::remove(Entity entity) {
     upcast(this)->remove(entity);
 }
 
+void Scene::setBoundingVolumeHierarchyEnabled(bool enabled) noexcept {
+    upcast(this)->setBoundingVolumeHierarchyEnabled(enabled);
+}
+
+bool Scene::isBoundingVolumeHierarchyEnabled() const noexcept {
+    return upcast(this)->isBoundingVolumeHierarchyEnabled();
+}
+
 size_t Scene::getRenderableCount() const noexcept {
     return upcast(this)->getRenderableCount();
 }
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/ShadowAtlas.h"
+
+#include "driver/DriverApi.h"
+
+#include <filament/driver/DriverEnums.h>
+
+#include <utils/algorithm.h>
+
+#include <algorithm>
+
+namespace filament {
+
+using namespace driver;
+
+namespace details {
+
+namespace {
+
+// keeps the even bits of x, packed in the low half
+inline uint32_t compactBits(uint32_t x) noexcept {
+    x &= 0x55555555u;
+    x = (x ^ (x >> 1u)) & 0x33333333u;
+    x = (x ^ (x >> 2u)) & 0x0F0F0F0Fu;
+    x = (x ^ (x >> 4u)) & 0x00FF00FFu;
+    x = (x ^ (x >> 8u)) & 0x0000FFFFu;
+    return x;
+}
+
+inline uint32_t roundUpPowerOfTwo(uint32_t x) noexcept {
+    return x <= 1u ? 1u : 1u << (32u - utils::clz(x - 1u));
+}
+
+} // anonymous namespace
+
+ShadowAtlas::ShadowAtlas() noexcept = default;
+
+ShadowAtlas::~ShadowAtlas() = default;
+
+void ShadowAtlas::terminate(DriverApi& driver) noexcept {
+    if (mRenderTarget) {
+        driver.destroyRenderTarget(mRenderTarget);
+    }
+    if (mTexture) {
+        driver.destroyTexture(mTexture);
+    }
+}
+
+void ShadowAtlas::allocate(Request* requests, size_t count, uint32_t maxSize) noexcept {
+    assert(count <= MAX_TILES);
+
+    // admit the requests by priority, shrinking them until they fit in what's left
+    uint8_t order[MAX_TILES];
+    size_t admitted = 0;
+    uint64_t area = 0;
+    const uint64_t maxArea = uint64_t(maxSize) * maxSize;
+    for (size_t i = 0; i < count; i++) {
+        Request& request = requests[i];
+        request.tile = {};
+        uint32_t size = std::min(uint32_t(request.size), maxSize);
+        const uint32_t minSize = std::max(1u, std::min(uint32_t(request.minSize), size));
+        while (area + uint64_t(size) * size > maxArea && size > minSize) {
+            size /= 2;
+        }
+        if (area + uint64_t(size) * size <= maxArea) {
+            area += uint64_t(size) * size;
+            request.tile.size = uint16_t(size);
+            order[admitted++] = uint8_t(i);
+        }
+    }
+
+    // Lay out the tiles from the largest to the smallest along a Z-order curve. Because all
+    // sizes are powers of two, each tile starts at a multiple of its own area along the curve,
+    // which is always an aligned square of that size.
+    std::stable_sort(order, order + admitted, [requests](uint8_t lhs, uint8_t rhs) {
+        return requests[lhs].tile.size > requests[rhs].tile.size;
+    });
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t cursor = 0;
+    for (size_t i = 0; i < admitted; i++) {
+        Tile& tile = requests[order[i]].tile;
+        const uint32_t size = tile.size;
+        const uint32_t index = uint32_t(cursor / (uint64_t(size) * size));
+        tile.x = uint16_t(compactBits(index) * size);
+        tile.y = uint16_t(compactBits(index >> 1u) * size);
+        cursor += uint64_t(size) * size;
+        width = std::max(width, uint32_t(tile.x) + size);
+        height = std::max(height, uint32_t(tile.y) + size);
+    }
+
+    // round the texture size up, so it doesn't change every time a small tile comes and goes
+    mRequiredWidth = admitted ? roundUpPowerOfTwo(width) : 0;
+    mRequiredHeight = admitted ? roundUpPowerOfTwo(height) : 0;
+}
+
+bool ShadowAtlas::prepare(DriverApi& driver, SamplerBuffer& sb, size_t samplerIndex) noexcept {
+    const uint32_t width = std::max(1u, mRequiredWidth);
+    const uint32_t height = std::max(1u, mRequiredHeight);
+    if (width == mWidth && height == mHeight) {
+        // nothing to do here.
+        assert(mTexture);
+        return false;
+    }
+
+    // destroy the current rendertarget and texture
+    terminate(driver);
+
+    // allocate new ones...
+    mWidth = width;
+    mHeight = height;
+
+    mTexture = driver.createTexture(
+            Driver::SamplerType::SAMPLER_2D, 1, Driver::TextureFormat::DEPTH16, 1, width, height, 1,
+            TextureUsage::DEPTH_ATTACHMENT);
+
+    mRenderTarget = driver.createRenderTarget(
+            TargetBufferFlags::SHADOW, width, height, 1, Driver::TextureFormat::DEPTH16,
+            {}, { mTexture }, {});
+
+    SamplerParams s;
+    s.filterMag = SamplerMagFilter::LINEAR;
+    s.filterMin = SamplerMinFilter::LINEAR;
+    s.compareFunc = SamplerCompareFunc::LE;
+    s.compareMode = SamplerCompareMode::COMPARE_TO_TEXTURE;
+    s.depthStencil = true;
+    sb.setSampler(samplerIndex, { mTexture, s });
+    return true;
+}
+
+} // namespace details
+} // namespace filament
@@ -22,8 +22,6 @@
 #include "details/ShadowMap.h"
 #include "details/Scene.h"
 
-#include <private/filament/SibGenerator.h>
-
 #include <filament/driver/DriverEnums.h>
 
 #include <limits>
@@ -45,7 +43,9 @@ static constexpr bool ENABLE_LISPSM = true;
 ShadowMap::ShadowMap(FEngine& engine) noexcept :
         mEngine(engine),
         mClipSpaceFlipped(engine.getBackend() == Backend::VULKAN) {
-    mCamera = mEngine.createCamera(EntityManager::get().create());
+    for (Cascade& cascade : mCascades) {
+        cascade.camera = mEngine.createCamera(EntityManager::get().create());
+    }
     mDebugCamera = mEngine.createCamera(EntityManager::get().create());
     FDebugRegistry& debugRegistry = engine.getDebugRegistry();
     debugRegistry.registerProperty("d.shadowmap.focus_shadowcasters", &engine.debug.shadowmap.focus_shadowcasters);
@@ -58,100 +58,116 @@ ShadowMap::ShadowMap(FEngine& engine) noexcept :
 }
 
 ShadowMap::~ShadowMap() {
-    mEngine.destroy(mCamera->getEntity());
+    for (Cascade& cascade : mCascades) {
+        mEngine.destroy(cascade.camera->getEntity());
+    }
     mEngine.destroy(mDebugCamera->getEntity());
 }
 
-void ShadowMap::prepare(DriverApi& driver, SamplerBuffer& sb) noexcept {
-    assert(mShadowMapDimension);
-
-    uint32_t dim = mShadowMapDimension;
-    uint32_t currentDimension = mViewport.width + 2;
-    if (currentDimension == dim) {
-        // nothing to do here.
-        assert(mShadowMapHandle);
-        return;
-    }
-
-    // destroy the current rendertarget and texture
-    if (mShadowMapRenderTarget) {
-        driver.destroyRenderTarget(mShadowMapRenderTarget);
-    }
-    if (mShadowMapHandle) {
-        driver.destroyTexture(mShadowMapHandle);
-    }
-
-    // allocate new ones...
-    // we set a viewport with a 1-texel border for when we index outside of the texture
-    // DON'T CHANGE this unless computeLightSpaceMatrix() is updated too.
-    // see: computeLightSpaceMatrix()
-    mViewport = { 1, 1, dim - 2, dim - 2 };
-
-    mShadowMapHandle = driver.createTexture(
-            Driver::SamplerType::SAMPLER_2D, 1, Driver::TextureFormat::DEPTH16, 1, dim, dim, 1,
-            TextureUsage::DEPTH_ATTACHMENT);
-
-    mShadowMapRenderTarget = driver.createRenderTarget(
-            TargetBufferFlags::SHADOW, dim, dim, 1, Driver::TextureFormat::DEPTH16,
-            {}, { mShadowMapHandle }, {});
-
-    SamplerParams s;
-    s.filterMag = SamplerMagFilter::LINEAR;
-    s.filterMin = SamplerMinFilter::LINEAR;
-    s.compareFunc = SamplerCompareFunc::LE;
-    s.compareMode = SamplerCompareMode::COMPARE_TO_TEXTURE;
-    s.depthStencil = true;
-    sb.setSampler(PerViewSib::SHADOW_MAP, { mShadowMapHandle, s });
-}
+void ShadowMap::setTile(size_t cascade, ShadowAtlas::Tile const& tile, ShadowAtlas const& atlas,
+        bool reallocated) noexcept {
+    assert(tile.size == mShadowMapDimension);
+
+    // each tile has a viewport with a TILE_BORDER border for when we index outside of it
+    // DON'T CHANGE this unless getTextureCoordsMapping() is updated too.
+    Cascade& c = mCascades[cascade];
+    const uint32_t dim = tile.size;
+    c.viewport = { int32_t(tile.x + TILE_BORDER), int32_t(tile.y + TILE_BORDER),
+            dim - 2 * TILE_BORDER, dim - 2 * TILE_BORDER };
+
+    // the content of the tile must be rendered again if it moved or was lost
+    c.unchanged = c.unchanged && !reallocated && c.tile == tile;
+    c.tile = tile;
+
+    mRenderTarget = atlas.getRenderTarget();
+    mAtlasWidth = atlas.getWidth();
+    mAtlasHeight = atlas.getHeight();
+
+    // The placement of the tile in the atlas, in texture coordinates. With a flipped clip
+    // space the rows of the texture are stored top to bottom, and so are the tiles.
+    const float W = mAtlasWidth;
+    const float H = mAtlasHeight;
+    const float sx = dim / W;
+    const float sy = dim / H;
+    const float ox = tile.x / W;
+    const float oy = (mClipSpaceFlipped ? float(mAtlasHeight - tile.y - dim) : float(tile.y)) / H;
+    c.tileMapping = mat4f(mat4f::row_major_init{
+            sx,  0, 0, ox,
+             0, sy, 0, oy,
+             0,  0, 1,  0,
+             0,  0, 0,  1
+    });
 
-void ShadowMap::terminate(DriverApi& driverApi) noexcept {
-    if (mShadowMapRenderTarget) {
-        driverApi.destroyRenderTarget(mShadowMapRenderTarget);
-    }
-    if (mShadowMapHandle) {
-        driverApi.destroyTexture(mShadowMapHandle);
-    }
+    // The shaders only sample inside the viewport, so that the filtering stays within the tile.
+    // 'scaleOffset' maps to the whole tile, the viewport covers [o, 1 - o] of it.
+    const float o = float(c.viewport.left - int32_t(tile.x)) / dim;
+    const float s = 1.0f - 2.0f * o;
+    float4 const& so = c.scaleOffset;
+    c.viewportScaleOffset = { so.x / s, so.y / s, (so.z - o) / s, (so.w - o) / s };
+    c.atlasScaleOffset = { sx * s, sy * s, ox + sx * o, oy + sy * o };
 }
 
-void ShadowMap::beginRenderPass(DriverApi& driver) const noexcept {
+void ShadowMap::beginRenderPass(DriverApi& driver, size_t cascade) const noexcept {
+    Cascade const& c = mCascades[cascade];
     RenderPassParams params = {};
     params.clear = TargetBufferFlags::SHADOW;
-    params.discardStart = TargetBufferFlags::DEPTH;
     params.discardEnd = TargetBufferFlags::COLOR_AND_STENCIL;
     params.clearDepth = 1.0;
-    params.width = params.height = mShadowMapDimension;
-    // Disable scissor and viewport to avoid bugs in some drivers where the GPU memory is reloaded
-    // needlessly.
-    params.clear |= RenderPassParams::IGNORE_SCISSOR | RenderPassParams::IGNORE_VIEWPORT;
-    driver.beginRenderPass(mShadowMapRenderTarget, params);
-
-    driver.viewport(mViewport.left, mViewport.bottom,
-            mViewport.width, mViewport.height);
+    if (c.tile.size == mAtlasWidth && c.tile.size == mAtlasHeight) {
+        params.discardStart = TargetBufferFlags::DEPTH;
+        params.width = mAtlasWidth;
+        params.height = mAtlasHeight;
+        // Disable scissor and viewport to avoid bugs in some drivers where the GPU memory is
+        // reloaded needlessly.
+        params.clear |= RenderPassParams::IGNORE_SCISSOR | RenderPassParams::IGNORE_VIEWPORT;
+    } else {
+        // only clear this tile (including its border), the other tiles of the atlas may
+        // be kept from the previous frame.
+        params.left = c.tile.x;
+        params.bottom = c.tile.y;
+        params.width = c.tile.size;
+        params.height = c.tile.size;
+    }
+    driver.beginRenderPass(mRenderTarget, params);
+
+    Viewport const& viewport = c.viewport;
+    driver.viewport(viewport.left, viewport.bottom, viewport.width, viewport.height);
 }
 
 void ShadowMap::update(
         const FScene::LightSoa& lightData, size_t index, FScene const* scene,
-        details::CameraInfo const& camera, uint8_t visibleLayers) noexcept {
+        details::CameraInfo const& camera, uint8_t visibleLayers,
+        uint32_t dimension, bool sharedAtlas) noexcept {
     // this is the hard part here, find a good frustum for our camera
 
     auto& lcm = mEngine.getLightManager();
 
     FLightManager::Instance li = lightData.elementAt<FScene::LIGHT_INSTANCE>(index);
-    mShadowMapDimension = std::max(1u, lcm.getShadowMapSize(li));
+    mShadowMapDimension = std::max(1u, dimension ? dimension : lcm.getShadowMapSize(li));
+    mStaticShadows = lcm.hasStaticShadows(li);
+    mSharedAtlas = sharedAtlas;
 
     FLightManager::ShadowParams params = lcm.getShadowParams(li);
     mat4f projection(camera.cullingProjection);
     if (params.shadowFar > 0.0f) {
-        float n = camera.zn;
-        float f = params.shadowFar;
-        if (std::abs(projection[2].w) <= std::numeric_limits<float>::epsilon()) {
-            // perspective projection
-            projection[2].z =     (f + n) / (n - f);
-            projection[3].z = (2 * f * n) / (n - f);
-        } else {
-            // ortho projection
-            projection[2].z =    2.0f / (n - f);
-            projection[3].z = (f + n) / (n - f);
+        projection = setNearFar(projection, camera.zn, params.shadowFar);
+    }
+
+    // view-space distance where each cascade ends, the last one covers everything behind
+    // the previous split.
+    mCascadeCount = lcm.isDirectionalLight(li) ? params.shadowCascades : 1;
+    const float shadowFar = params.shadowFar > 0.0f ? params.shadowFar : camera.zf;
+    mShadowFar = shadowFar;
+    for (size_t i = 0; i < CONFIG_MAX_SHADOW_CASCADES; i++) {
+        Cascade& cascade = mCascades[i];
+        cascade.split = std::numeric_limits<float>::infinity();
+        cascade.scaleOffset = { 1, 1, 0, 0 };
+        cascade.texelSizeWs = 0.0f;
+        cascade.hadVisibleShadows = cascade.hasVisibleShadows;
+        cascade.hasVisibleShadows = false;
+        cascade.unchanged = false;
+        if (i + 1 < mCascadeCount) {
+            cascade.split = camera.zn + (shadowFar - camera.zn) * params.cascadeSplitPositions[i];
         }
     }
 
@@ -163,6 +179,7 @@ void ShadowMap::update(
             .zf = camera.zf,
             .dzn = std::max(0.0f, params.shadowNearHint - camera.zn),
             .dzf = std::max(0.0f, camera.zf - params.shadowFarHint),
+            .shadowFar = shadowFar,
             .frustum = Frustum(projection * camera.view),
             .worldOrigin = camera.worldOrigin
     };
@@ -186,8 +203,15 @@ void ShadowMap::update(
                     visibleLayers);
             break;
         case Type::FOCUSED_SPOT:
-        case Type::SPOT:
+        case Type::SPOT: {
+            FLightManager::SpotParams const& spot = lcm.getSpotParams(li);
+            computeShadowCameraSpot(
+                    lightData.elementAt<FScene::POSITION_RADIUS>(index).xyz,
+                    lightData.elementAt<FScene::DIRECTION>(index),
+                    std::acos(std::sqrt(spot.cosOuterSquared)), spot.radius,
+                    scene, visibleLayers);
             break;
+        }
         case Type::POINT:
             break;
     }
@@ -216,7 +240,9 @@ void ShadowMap::computeShadowCameraDirectional(
 
     mHasVisibleShadows = vertexCount >= 2;
     if (mHasVisibleShadows) {
-        const bool USE_LISPSM = ENABLE_LISPSM && mEngine.debug.shadowmap.lispsm;
+        // LiSPSM warps the light space for the whole view frustum, it's not used with cascades
+        const bool USE_CASCADES = mCascadeCount > 1;
+        const bool USE_LISPSM = ENABLE_LISPSM && mEngine.debug.shadowmap.lispsm && !USE_CASCADES;
 
         /*
          * Compute the light's model matrix
@@ -296,6 +322,11 @@ void ShadowMap::computeShadowCameraDirectional(
         // lights space matrix used for finding the near and far planes
         const mat4f LMpMv(L * Mp * Mv);
 
+        if (USE_CASCADES) {
+            computeShadowCascades(wsShadowReceiversVolume, camera, LMpMv, znear, zfar);
+            return;
+        }
+
         // Compute the LiSPSM warping
         mat4f W;
         if (USE_LISPSM) {
@@ -333,9 +364,9 @@ void ShadowMap::computeShadowCameraDirectional(
 
         // For directional lights, we further constraint the light frustum to the
         // intersection of the shadow casters & receivers in light-space.
-        // However, since this relies on the 1-texel shadow map border, this wouldn't directly
-        // work if we were storing several shadow maps in a single texture.
-        if (mEngine.debug.shadowmap.focus_shadowcasters) {
+        // However, since this relies on the shadow map border, this doesn't work
+        // when other shadow maps are stored next to this one in the shadow atlas.
+        if (mEngine.debug.shadowmap.focus_shadowcasters && !mSharedAtlas) {
             intersectWithShadowCasters(lsLightFrustum, WLMpMv, wsShadowCastersVolume);
         }
 
@@ -379,16 +410,161 @@ void ShadowMap::computeShadowCameraDirectional(
         // Final shadowmap texture transform
         const mat4f St = mat4f(MbMt * S);
 
-        mTexelSizeWs = texelSizeWorldSpace(St, float3{ 0.5f });
+        Cascade& cascade = mCascades[0];
+        cascade.texelSizeWs = texelSizeWorldSpace(St, float3{ 0.5f });
+        cascade.hasVisibleShadows = true;
+        setCascadeProjection(cascade, S, znear, zfar);
         mLightSpace = St;
         mSceneRange = (zfar - znear);
-        mCamera->setCustomProjection(mat4(S), znear, zfar);
 
         // for the debug camera, we need to undo the world origin
         mDebugCamera->setCustomProjection(mat4(S * camera.worldOrigin), znear, zfar);
     }
 }
 
+void ShadowMap::computeShadowCameraSpot(math::float3 const& position, math::float3 const& dir,
+        float outerConeAngle, float radius, FScene const* scene, uint8_t visibleLayers) noexcept {
+
+    // scene bounds in world space
+    Aabb wsShadowCastersVolume, wsShadowReceiversVolume;
+    scene->computeBounds(wsShadowCastersVolume, wsShadowReceiversVolume, visibleLayers);
+    if (wsShadowCastersVolume.isEmpty() || wsShadowReceiversVolume.isEmpty()) {
+        mHasVisibleShadows = false;
+        return;
+    }
+
+    // the light's model matrix contains the light position and direction, the up vector
+    // only needs to not be parallel to the direction.
+    const float3 up = std::abs(dir.y) < 0.99f ? float3{ 0, 1, 0 } : float3{ 1, 0, 0 };
+    const mat4f M = mat4f::lookAt(position, position + dir, up);
+    const mat4f Mv = FCamera::rigidTransformInverse(M);
+
+    // The depth range is limited to the shadow casters and the light's influence. The near
+    // plane is kept away from the light so that the depth precision stays reasonable.
+    const float2 nearFar = computeNearFar(Mv, wsShadowCastersVolume);
+    const float znear = std::max(radius * 0.001f, -nearFar[0]);
+    const float zfar = std::min(radius, -nearFar[1]);
+    if (UTILS_UNLIKELY(znear >= zfar)) {
+        mHasVisibleShadows = false;
+        return;
+    }
+
+    // The light's projection covers the outer cone (up to a ~170 degrees aperture). The
+    // shadow map can't be focused like a directional light's, its size is instead picked
+    // from the light's importance on screen.
+    const float w = znear * std::tan(std::min(outerConeAngle, float(M_PI_2) * 0.95f));
+    const mat4f Mp = mat4f::frustum(-w, w, -w, w, znear, zfar);
+    const mat4f S = Mp * Mv;
+
+    Cascade& cascade = mCascades[0];
+    cascade.hasVisibleShadows = true;
+    setCascadeProjection(cascade, S, znear, zfar);
+    mHasVisibleShadows = true;
+    mLightSpace = getTextureCoordsMapping() * S;
+    mSceneRange = zfar - znear;
+}
+
+void ShadowMap::computeShadowCascades(Aabb const& wsShadowReceiversVolume,
+        CameraInfo const& camera, mat4f const& LMpMv, float znear, float zfar) noexcept {
+
+    // All cascades share the light's orientation and depth range (so that the depth bias is
+    // the same for all of them), only the focus transform differs. The shader only gets
+    // the light space of the un-focused light frustum and the scale/offset of each cascade.
+    const mat4f MbMt = getTextureCoordsMapping();
+    const mat4f MbMtInverse = inverse(MbMt);
+    const size_t cascadeCount = mCascadeCount;
+
+    mHasVisibleShadows = false;
+    float near = camera.zn;
+    for (size_t i = 0; i < cascadeCount; i++) {
+        Cascade& cascade = mCascades[i];
+        const float far = std::min(cascade.split, camera.shadowFar);
+        const mat4f projection = setNearFar(camera.projection, near, far);
+        near = far;
+
+        // intersect the shadow receivers with this cascade's slice of the view frustum
+        float3 wsCascadeFrustumCorners[8];
+        computeFrustumCorners(wsCascadeFrustumCorners,
+                camera.model * FCamera::inverseProjection(projection));
+        const size_t vertexCount = intersectFrustumWithBox(mWsClippedShadowReceiverVolume,
+                Frustum(projection * camera.view), wsCascadeFrustumCorners,
+                wsShadowReceiversVolume);
+        if (vertexCount < 2) {
+            continue;
+        }
+
+        // Focus the cascade on the receivers it covers. We can't use focus_shadowcasters here
+        // because it relies on the shadow map border, and the cascades are next to each other
+        // in the shadow atlas.
+        Aabb lsLightFrustum;
+        #pragma clang loop vectorize(disable)
+        for (size_t j = 0; j < vertexCount; ++j) {
+            const float3 v = mat4f::project(LMpMv, mWsClippedShadowReceiverVolume[j]);
+            lsLightFrustum.min.xy = min(lsLightFrustum.min.xy, v.xy);
+            lsLightFrustum.max.xy = max(lsLightFrustum.max.xy, v.xy);
+        }
+        if (UTILS_UNLIKELY((lsLightFrustum.min.x >= lsLightFrustum.max.x) ||
+                           (lsLightFrustum.min.y >= lsLightFrustum.max.y))) {
+            continue;
+        }
+
+        float2 s = 2.0f / float2(lsLightFrustum.max.xy - lsLightFrustum.min.xy);
+        float2 o =   -s * float2(lsLightFrustum.max.xy + lsLightFrustum.min.xy) * 0.5f;
+        snapLightFrustum(s, o, mShadowMapDimension);
+        const mat4f F(mat4f::row_major_init {
+                 s.x,   0,  0, o.x,
+                   0, s.y,  0, o.y,
+                   0,   0,  1,   0,
+                   0,   0,  0,   1,
+        });
+
+        const mat4f S = F * LMpMv;
+        setCascadeProjection(cascade, S, znear, zfar);
+        cascade.texelSizeWs = texelSizeWorldSpace(MbMt * S);
+        cascade.hasVisibleShadows = true;
+        mHasVisibleShadows = true;
+
+        // The focus transform expressed in texture space, setTile() then adds the placement
+        // of the cascade in the shadow atlas.
+        const mat4f T = MbMt * F * MbMtInverse;
+        cascade.scaleOffset = { T[0].x, T[1].y, T[3].x, T[3].y };
+
+        if (i == 0) {
+            // for the debug camera, we need to undo the world origin
+            mDebugCamera->setCustomProjection(mat4(S * camera.worldOrigin), znear, zfar);
+        }
+    }
+
+    mLightSpace = MbMt * LMpMv;
+    mSceneRange = (zfar - znear);
+}
+
+void ShadowMap::setCascadeProjection(Cascade& cascade, mat4f const& S,
+        float znear, float zfar) noexcept {
+    // the cascade renders the same depth as in the previous frame only if its light camera
+    // didn't move, this requires the snapped light frustum to be stable.
+    FCamera& camera = *cascade.camera;
+    mat4f const& P = cascade.projection;
+    cascade.unchanged = cascade.hadVisibleShadows &&
+            P[0] == S[0] && P[1] == S[1] && P[2] == S[2] && P[3] == S[3] &&
+            camera.getNear() == znear && camera.getCullingFar() == zfar;
+    cascade.projection = S;
+    camera.setCustomProjection(mat4(S), znear, zfar);
+}
+
+mat4f ShadowMap::setNearFar(mat4f projection, float n, float f) noexcept {
+    if (std::abs(projection[2].w) <= std::numeric_limits<float>::epsilon()) {
+        // ortho projection
+        projection[2].z =    2.0f / (n - f);
+        projection[3].z = (f + n) / (n - f);
+    } else {
+        // perspective projection
+        projection[2].z =     (f + n) / (n - f);
+        projection[3].z = (2 * f * n) / (n - f);
+    }
+    return projection;
+}
+
 mat4f ShadowMap::applyLISPSM(CameraInfo const& camera, float dzn, float dzf, mat4f const& LMpMv,
         Aabb const& wsShadowReceiversVolume, const float3 wsViewFrustumCorners[8],
         float3 const& dir) {
@@ -479,8 +655,8 @@ mat4f ShadowMap::getTextureCoordsMapping() const noexcept {
               0,    0,    0,    1
     });
 
-    // apply the 1-texel border viewport transform
-    const float o = 1.0f / mShadowMapDimension;
+    // apply the TILE_BORDER border viewport transform
+    const float o = float(TILE_BORDER) / mShadowMapDimension;
     const float s = 1.0f - 2.0f * o;
     const mat4f Mb(mat4f::row_major_init{
              s, 0, 0, o,
@@ -32,6 +32,7 @@
 #include <private/filament/UibGenerator.h>
 
 #include <utils/Allocator.h>
+#include <utils/algorithm.h>
 #include <utils/Systrace.h>
 #include <utils/Profiler.h>
 #include <utils/Slice.h>
@@ -57,6 +58,29 @@ static constexpr uint8_t VISIBLE_RENDERABLE = 1u << VISIBLE_RENDERABLE_BIT;
 static constexpr uint8_t VISIBLE_SHADOW_CASTER = 1u << VISIBLE_SHADOW_CASTER_BIT;
 static constexpr uint8_t VISIBLE_ALL = VISIBLE_RENDERABLE | VISIBLE_SHADOW_CASTER;
 
+// the following bits are set for the shadow casters of each cascade of the shadow map
+static constexpr size_t VISIBLE_SHADOW_CASCADE_BIT = 2u;
+static constexpr uint8_t VISIBLE_SHADOW_CASCADES =
+        ((1u << CONFIG_MAX_SHADOW_CASCADES) - 1u) << VISIBLE_SHADOW_CASCADE_BIT;
+static_assert(VISIBLE_SHADOW_CASCADE_BIT + CONFIG_MAX_SHADOW_CASCADES <= 8,
+        "Culler::result_type can't hold all the shadow cascades");
+
+// each bit of the 'SPOT_SHADOW_MASK' is set for the shadow casters of a spot light's shadow map
+static_assert(CONFIG_MAX_SHADOW_CASTING_SPOTS <= 8,
+        "Culler::result_type can't hold all the spot light shadow maps");
+
+// spot lights smaller than this on screen still get a shadow map this large
+static constexpr uint32_t MIN_SPOT_SHADOW_MAP_SIZE = 64u;
+
+RenderPass::VisibilityMask FView::getShadowCascadeVisibleMask(size_t cascade) noexcept {
+    return RenderPass::VisibilityMask(1u << (VISIBLE_SHADOW_CASCADE_BIT + cascade));
+}
+
+RenderPass::VisibilityMask FView::getSpotShadowVisibleMask(size_t slot) noexcept {
+    // the SPOT_SHADOW_MASK is in the high byte of the VisibilityMask
+    return RenderPass::VisibilityMask(0x100u << slot);
+}
+
 FView::FView(FEngine& engine)
     : mFroxelizer(engine),
       mPerViewUb(engine.getPerViewUib()),
@@ -67,6 +91,7 @@ FView::FView(FEngine& engine)
     // set-up samplers
     mPerViewSb.setBuffer(PerViewSib::RECORDS, mFroxelizer.getRecordBuffer());
     mPerViewSb.setBuffer(PerViewSib::FROXELS, mFroxelizer.getFroxelBuffer());
+    mPerViewSb.setBuffer(PerViewSib::LIGHTS, mFroxelizer.getLightBuffer());
     if (engine.getDFG()->isValid()) {
         TextureSampler sampler(TextureSampler::MagFilter::LINEAR);
         mPerViewSb.setSampler(PerViewSib::IBL_DFG_LUT,
@@ -77,9 +102,9 @@ FView::FView(FEngine& engine)
 
     // allocate ubos
     mPerViewUbh = driver.createUniformBuffer(mPerViewUb.getSize(), driver::BufferUsage::DYNAMIC);
-    mLightUbh = driver.createUniformBuffer(CONFIG_MAX_LIGHT_COUNT * sizeof(LightsUib), driver::BufferUsage::DYNAMIC);
 
-    mIsDynamicResolutionSupported = driver.isFrameTimeSupported();
+    mIsTimerQuerySupported = driver.isTimerQuerySupported();
+    mIsDynamicResolutionSupported = driver.isFrameTimeSupported() || mIsTimerQuerySupported;
 }
 
 FView::~FView() noexcept = default;
@@ -88,10 +113,16 @@ void FView::terminate(FEngine& engine) {
     // Here we would cleanly free resources we've allocated or we own (currently none).
     DriverApi& driver = engine.getDriverApi();
     driver.destroyUniformBuffer(mPerViewUbh);
-    driver.destroyUniformBuffer(mLightUbh);
     driver.destroySamplerBuffer(mPerViewSbh);
     driver.destroyUniformBuffer(mRenderableUbh);
-    mDirectionalShadowMap.terminate(driver);
+    mColorPassInstances.terminate(driver);
+    for (RenderPass::InstanceBuffer& instances : mShadowPassInstances) {
+        instances.terminate(driver);
+    }
+    for (SpotShadow& spot : mSpotShadows) {
+        spot.instances.terminate(driver);
+    }
+    mShadowAtlas.terminate(driver);
     mFroxelizer.terminate(driver);
 }
 
@@ -99,6 +130,21 @@ void FView::setViewport(Viewport const& viewport) noexcept {
     mViewport = viewport;
 }
 
+void FView::setLevelOfDetailOptions(LevelOfDetailOptions const& options) noexcept {
+    LevelOfDetailOptions& lod = mLevelOfDetail;
+    lod = options;
+    // a negative threshold would never select any level
+    lod.threshold = std::max(lod.threshold, 0.0f);
+    lod.hysteresis = clamp(lod.hysteresis, 0.0f, 1.0f);
+}
+
+void FView::setShadowAtlasOptions(ShadowAtlasOptions const& options) noexcept {
+    ShadowAtlasOptions& atlas = mShadowAtlasOptions;
+    atlas = options;
+    // the atlas is split in power-of-two tiles
+    atlas.maxSize = uint16_t(1u << (31u - utils::clz(std::max(uint32_t(atlas.maxSize), 16u))));
+}
+
 void FView::setDynamicResolutionOptions(DynamicResolutionOptions const& options) noexcept {
     DynamicResolutionOptions& dynamicResolution = mDynamicResolution;
     dynamicResolution = options;
@@ -136,10 +182,19 @@ void FView::setDynamicResolutionOptions(DynamicResolutionOptions const& options)
         // is not useful above that.
         dynamicResolution.maxScale = min(dynamicResolution.maxScale, float2(2.0f));
 
+        // the integral gain can't be 0, and the controller oscillates if it's too high for the
+        // delay the median filter adds (about history / 2 frames) plus the delay of the
+        // measurements (1 to 3 frames).
+        dynamicResolution.scaleRate = std::max(dynamicResolution.scaleRate, 1.0f / 1024.0f);
+        dynamicResolution.scaleRate = std::min(dynamicResolution.scaleRate,
+                1.0f / (dynamicResolution.history / 2 + 2));
+
         // reset the history, so we start from a known (and current) state
         mFrameTimeHistorySize = 0;
         mScale = 1.0f;
         mDynamicWorkloadScale = 1.0f;
+        mDynamicResolutionPid.integral = 1.0f / dynamicResolution.scaleRate;  // output is 1
+        mDynamicResolutionPid.error = 0.0f;
     }
 }
 
@@ -156,11 +211,19 @@ void move_backward(InputIterator first, InputIterator last, OutputIterator resul
     }
 }
 
-math::float2 FView::updateScale(duration frameTime) noexcept {
+math::float2 FView::updateScale(duration frameTime, duration gpuTime, duration cpuTime) noexcept {
     DynamicResolutionOptions const& options = mDynamicResolution;
     if (options.enabled) {
 
-        if (UTILS_UNLIKELY(frameTime.count() <= std::numeric_limits<float>::epsilon())) {
+        // the GPU time is only known when timer queries are supported, otherwise we use the
+        // frame time measured with fences, which also includes the time the GPU was idle.
+        if (mIsTimerQuerySupported && gpuTime.count() <= 0) {
+            // no new GPU time this frame, keep the current scale
+            return mScale;
+        }
+        const duration measuredTime = mIsTimerQuerySupported ? gpuTime : frameTime;
+
+        if (UTILS_UNLIKELY(measuredTime.count() <= std::numeric_limits<float>::epsilon())) {
             mScale = 1.0f;
             return mScale;
         }
@@ -170,7 +233,7 @@ math::float2 FView::updateScale(duration frameTime) noexcept {
 
         // this is like doing { pop_back(); push_front(); }
         details::move_backward(history.begin(), history.end() - 1, history.end());
-        history.front() = frameTime;
+        history.front() = measuredTime;
         mFrameTimeHistorySize = std::min(++mFrameTimeHistorySize, size_t(MAX_FRAMETIME_HISTORY));
 
         if (UTILS_UNLIKELY(mFrameTimeHistorySize < 3)) {
@@ -182,19 +245,45 @@ math::float2 FView::updateScale(duration frameTime) noexcept {
         // apply a median filter to get a good representation of the frame time of the last
         // N frames.
         std::array<duration, MAX_FRAMETIME_HISTORY> median; // NOLINT -- it's initialized below
-        size_t size = std::min(mFrameTimeHistorySize, median.size());
+        size_t size = std::min(mFrameTimeHistorySize, size_t(options.history));
         std::uninitialized_copy_n(history.begin(), size, median.begin());
         std::sort(median.begin(), median.begin() + size);
         duration filteredFrameTime = median[size / 2];
 
-        // how much we need to scale the current workload to fit in our target, at this instant
+        // The controller output is the workload scale (i.e. the fraction of pixels rendered),
+        // the error is how far the current workload scale is from the one that meets the
+        // target, assuming the GPU time is proportional to the workload. This keeps the loop
+        // gain independent of how heavy the scene is.
+        // The integral term converges to the workload scale that meets the target.
         const float targetWithHeadroom = options.targetFrameTimeMilli * (1 - options.headRoomRatio);
-        const float workloadScale = targetWithHeadroom / filteredFrameTime.count();
+        const float error = mDynamicWorkloadScale *
+                (targetWithHeadroom - filteredFrameTime.count()) / filteredFrameTime.count();
+
+        // When the CPU takes longer than the GPU, rendering fewer pixels won't make the frame
+        // faster, so we don't scale down (but we can scale up if the GPU has time to spare).
+        const bool cpuBound = gpuTime.count() > 0 && cpuTime >= filteredFrameTime;
+        const bool holdDown = cpuBound && error < 0;
+
+        auto& pid = mDynamicResolutionPid;
+        const float ki = options.scaleRate;
+        const float derivative = error - pid.error;
+        const float integral = holdDown ? pid.integral : pid.integral + error;
+        pid.error = error;
+
+        const float minWorkloadScale = options.minScale.x * options.minScale.y;
+        const float maxWorkloadScale = options.maxScale.x * options.maxScale.y;
+        const float output = DYNAMIC_RESOLUTION_KP * error + ki * integral + DYNAMIC_RESOLUTION_KD * derivative;
+
+        // anti-windup: stop integrating while the output is saturated
+        if (output >= minWorkloadScale && output <= maxWorkloadScale) {
+            pid.integral = integral;
+        }
 
-        // low-pass: y += b * (x - y)
-        const float oneOverTau = options.scaleRate;
-        const float x = mScale.x * mScale.y * workloadScale;
-        mDynamicWorkloadScale += (1.0f - std::exp(-oneOverTau)) * (x - mDynamicWorkloadScale);
+        float workloadScale = clamp(output, minWorkloadScale, maxWorkloadScale);
+        if (holdDown) {
+            workloadScale = std::max(workloadScale, mDynamicWorkloadScale);
+        }
+        mDynamicWorkloadScale = workloadScale;
 
         // scaling factor we need to apply on the whole surface
         const float scale = mDynamicWorkloadScale;
@@ -237,9 +326,10 @@ math::float2 FView::updateScale(duration frameTime) noexcept {
         static int sLogCounter = 15;
         if (!--sLogCounter) {
             sLogCounter = 15;
-            slog.d << frameTime.count()
+            slog.d << measuredTime.count()
                    << ", " << filteredFrameTime.count()
-                   << ", " << workloadScale
+                   << ", " << cpuTime.count()
+                   << ", " << error
                    << ", " << mDynamicWorkloadScale
                    << ", " << mScale.x
                    << ", " << mScale.y
@@ -274,45 +364,316 @@ bool FView::isSkyboxVisible() const noexcept {
     return skybox != nullptr && (skybox->getLayerMask() & mVisibleLayers);
 }
 
+size_t FView::addSpotShadowCandidate(SpotShadowCandidate* candidates, size_t count,
+        SpotShadowCandidate const& candidate) noexcept {
+    if (count < CONFIG_MAX_SHADOW_CASTING_SPOTS) {
+        candidates[count++] = candidate;
+    } else if (candidate.importance > candidates[count - 1].importance) {
+        candidates[count - 1] = candidate;
+    } else {
+        return count;
+    }
+    for (size_t j = count - 1; j > 0 &&
+            candidates[j].importance > candidates[j - 1].importance; j--) {
+        std::swap(candidates[j], candidates[j - 1]);
+    }
+    return count;
+}
+
+void FView::assignSpotShadowSlots(SpotShadow* slots,
+        SpotShadowCandidate const* candidates, size_t count, uint8_t* spots) noexcept {
+    for (size_t slot = 0; slot < CONFIG_MAX_SHADOW_CASTING_SPOTS; slot++) {
+        slots[slot].active = false;
+        slots[slot].update = false;
+    }
+
+    // lights keep their slot from the previous frame...
+    bool assigned[CONFIG_MAX_SHADOW_CASTING_SPOTS] = {};
+    for (size_t k = 0; k < count; k++) {
+        for (size_t slot = 0; slot < CONFIG_MAX_SHADOW_CASTING_SPOTS; slot++) {
+            SpotShadow& spot = slots[slot];
+            if (!spot.active && spot.light == candidates[k].light) {
+                spot.active = true;
+                spots[k] = uint8_t(slot);
+                assigned[k] = true;
+                break;
+            }
+        }
+    }
+
+    // ...the others take a free one, whose shadow map is lost
+    for (size_t k = 0; k < count; k++) {
+        for (size_t slot = 0; slot < CONFIG_MAX_SHADOW_CASTING_SPOTS && !assigned[k]; slot++) {
+            SpotShadow& spot = slots[slot];
+            if (!spot.active) {
+                spot.light = candidates[k].light;
+                spot.tile = {};
+                spot.contentValid = false;
+                spot.active = true;
+                spots[k] = uint8_t(slot);
+                assigned[k] = true;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        SpotShadow& spot = slots[spots[k]];
+        spot.importance = candidates[k].importance;
+        spot.lightIndex = candidates[k].index;
+        spot.staticShadows = candidates[k].staticShadows;
+    }
+
+    // the tiles of unused slots go to other lights
+    for (size_t slot = 0; slot < CONFIG_MAX_SHADOW_CASTING_SPOTS; slot++) {
+        slots[slot].contentValid = slots[slot].contentValid && slots[slot].active;
+    }
+}
+
+void FView::scheduleSpotShadowUpdates(SpotShadow* slots, uint8_t const* spots,
+        ShadowAtlas::Request const* requests, size_t count, bool reallocated,
+        size_t budget, uint32_t frame) noexcept {
+    // The spot lights whose tile doesn't hold their shadow map (anymore) are rendered first,
+    // by decreasing importance, within the update budget; without it they don't cast shadows
+    // this frame. Static shadows are only rendered when something changed, they don't count.
+    for (size_t i = 0; i < count; i++) {
+        SpotShadow& spot = slots[spots[i]];
+        ShadowAtlas::Tile const& tile = requests[i].tile;
+        spot.contentValid = spot.contentValid && !reallocated && tile == spot.tile;
+        spot.tile = tile;
+        if (!tile.size) {
+            // the atlas is full
+            spot.contentValid = false;
+        } else if (spot.contentValid && spot.staticShadows) {
+            spot.update = true;
+        } else if (!spot.contentValid && budget) {
+            spot.update = true;
+            budget--;
+        }
+    }
+
+    // the rest of the budget refreshes the shadow maps that are the most important and stale
+    for (; budget; budget--) {
+        SpotShadow* stalest = nullptr;
+        float stalestPriority = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            SpotShadow& spot = slots[spots[i]];
+            const float priority = spot.importance * float(frame - spot.lastUpdate);
+            if (spot.contentValid && !spot.update && priority > stalestPriority) {
+                stalest = &spot;
+                stalestPriority = priority;
+            }
+        }
+        if (!stalest) {
+            break;
+        }
+        stalest->update = true;
+    }
+}
+
+size_t FView::prepareSpotShadows(FEngine& engine, FScene::LightSoa const& lightData,
+        Viewport const& viewport, uint8_t* spots) noexcept {
+    auto& lcm = engine.getLightManager();
+    auto const* UTILS_RESTRICT spheres   = lightData.data<FScene::POSITION_RADIUS>();
+    auto const* UTILS_RESTRICT instances = lightData.data<FScene::LIGHT_INSTANCE>();
+
+    // keep the most important shadow casting spot lights, by decreasing importance
+    std::array<SpotShadowCandidate, CONFIG_MAX_SHADOW_CASTING_SPOTS> candidates;
+    size_t count = 0;
+    if (mShadowingEnabled) {
+        // the importance of a light is the diameter of its sphere of influence on screen
+        CameraInfo const& camera = mViewingCameraInfo;
+        const bool perspective = camera.projection[2][3] != 0.0f;
+        const float pixelsPerUnit = std::abs(camera.projection[1][1]) * 0.5f * viewport.height;
+        for (size_t i = FScene::DIRECTIONAL_LIGHTS_COUNT, c = lightData.size(); i < c; i++) {
+            FLightManager::Instance li = instances[i];
+            if (!lcm.isSpotLight(li) || !lcm.isShadowCaster(li)) {
+                continue;
+            }
+            const float radius = spheres[i].w;
+            const float distance = perspective ?
+                    std::max(length(spheres[i].xyz - camera.getPosition()), radius) : 1.0f;
+            const float importance = std::min(2.0f * radius * pixelsPerUnit / distance, 65536.0f);
+            if (!(importance > 0.0f)) {
+                continue;
+            }
+            count = addSpotShadowCandidate(candidates.data(), count,
+                    { importance, uint32_t(i), li, lcm.hasStaticShadows(li) });
+        }
+    }
+
+    assignSpotShadowSlots(mSpotShadows.data(), candidates.data(), count, spots);
+    return count;
+}
+
 void FView::prepareShadowing(FEngine& engine, driver::DriverApi& driver,
-        FScene::RenderableSoa& renderableData, FScene::LightSoa const& lightData) noexcept {
+        FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData,
+        Viewport const& viewport) noexcept {
     SYSTRACE_CALL();
 
-    // setup shadow mapping
-    // TODO: for now we only consider THE directional light
-
     auto& lcm = engine.getLightManager();
     UniformBuffer& u = getUb();
     FScene* const scene = mScene;
+    mShadowFrame++;
+
+    // the slots of the spot lights casting shadows, by decreasing importance
+    uint8_t spots[CONFIG_MAX_SHADOW_CASTING_SPOTS];
+    const size_t spotCount = prepareSpotShadows(engine, lightData, viewport, spots);
 
     // dominant directional light is always as index 0
     FLightManager::Instance directionalLight = lightData.elementAt<FScene::LIGHT_INSTANCE>(0);
-    mHasShadowing = mShadowingEnabled && directionalLight && lcm.isShadowCaster(directionalLight);
-    if (UTILS_UNLIKELY(mHasShadowing)) {
+    ShadowMap& shadowMap = mDirectionalShadowMap;
+    mHasDirectionalShadows = false;
+    if (mShadowingEnabled && directionalLight && lcm.isShadowCaster(directionalLight)) {
         // compute the frustum for this light
-        ShadowMap& shadowMap = mDirectionalShadowMap;
-        shadowMap.update(lightData, 0, scene, mViewingCameraInfo, mVisibleLayers);
-        if (shadowMap.hasVisibleShadows()) {
-            // Cull shadow casters
-            Frustum const& frustum = shadowMap.getCamera().getFrustum();
-            FView::prepareVisibleShadowCasters(engine.getJobSystem(), frustum, renderableData);
-
-            // allocates shadowmap driver resources
-            shadowMap.prepare(driver, getUs());
-
-            mat4f const& lightFromWorldMatrix = shadowMap.getLightSpaceMatrix();
-            u.setUniform(offsetof(PerViewUib, lightFromWorldMatrix), lightFromWorldMatrix);
-
-            // the 2x bias is needed in opengl because the depth maps to -1/1. It may not be
-            // needed with other APIs, but at least it won't worsen the acnee there.
-            const float sceneRange = shadowMap.getSceneRange();
-            const float texelSizeWorldSpace = shadowMap.getTexelSizeWorldSpace();
-            const float constantBias = lcm.getShadowConstantBias(directionalLight);
-            const float normalBias = lcm.getShadowNormalBias(directionalLight);
-            u.setUniform(offsetof(PerViewUib, shadowBias),
-                    float3{ 2 * constantBias / sceneRange, normalBias * texelSizeWorldSpace, 0 });
+        shadowMap.update(lightData, 0, scene, mViewingCameraInfo, mVisibleLayers,
+                0, spotCount > 0);
+        mHasDirectionalShadows = shadowMap.hasVisibleShadows();
+    }
+
+    mHasShadowing = mHasDirectionalShadows || spotCount > 0;
+    if (!mHasShadowing) {
+        return;
+    }
+
+    /*
+     * Allocate the tiles of the shadow atlas: first the cascades of the directional light,
+     * which are never shrunk, then the spot lights by decreasing importance.
+     */
+
+    ShadowAtlas::Request requests[ShadowAtlas::MAX_TILES];
+    const size_t cascadeCount = mHasDirectionalShadows ? shadowMap.getCascadeCount() : 0;
+    uint32_t atlasMaxSize = mShadowAtlasOptions.maxSize;
+    if (mHasDirectionalShadows) {
+        // make sure the cascades always fit
+        const uint32_t dim = lcm.getShadowMapSize(directionalLight);
+        atlasMaxSize = std::max(atlasMaxSize, dim * (cascadeCount > 1 ? 2u : 1u));
+        for (size_t c = 0; c < cascadeCount; c++) {
+            requests[c] = { uint16_t(dim), uint16_t(dim) };
+        }
+    }
+    for (size_t i = 0; i < spotCount; i++) {
+        SpotShadow const& spot = mSpotShadows[spots[i]];
+        // the smallest power of two covering the light on screen, but since the shadow map is
+        // lost when its size changes, it only shrinks once the light is well below that size.
+        uint32_t size = 1u << (32u - utils::clz(std::max(2u, uint32_t(spot.importance)) - 1u));
+        if (size < spot.tile.size && spot.importance > spot.tile.size * 0.375f) {
+            size = spot.tile.size;
+        }
+        const uint32_t mapSize = lcm.getShadowMapSize(spot.light);
+        const uint32_t minSize = std::min(MIN_SPOT_SHADOW_MAP_SIZE, mapSize);
+        size = std::min(std::max(size, minSize), mapSize);
+        requests[cascadeCount + i] = { uint16_t(size), uint16_t(minSize) };
+    }
+
+    ShadowAtlas& atlas = mShadowAtlas;
+    atlas.allocate(requests, cascadeCount + spotCount, atlasMaxSize);
+    const bool reallocated = atlas.prepare(driver, getUs(), PerViewSib::SHADOW_MAP);
+
+    /*
+     * Pick the shadow maps to render this frame
+     */
+
+    ShadowCasterCulling culling[ShadowAtlas::MAX_TILES];
+    size_t cullingCount = 0;
+    Culler::result_type* const visibleMask = renderableData.data<FScene::VISIBLE_MASK>();
+    Culler::result_type* const spotShadowMask = renderableData.data<FScene::SPOT_SHADOW_MASK>();
+
+    for (size_t c = 0; c < cascadeCount; c++) {
+        shadowMap.setTile(c, requests[c].tile, atlas, reallocated);
+        if (shadowMap.hasVisibleShadows(c)) {
+            culling[cullingCount++] = { shadowMap.getCamera(c).getFrustum(),
+                    visibleMask, VISIBLE_SHADOW_CASCADE_BIT + c };
+        }
+    }
+
+    scheduleSpotShadowUpdates(mSpotShadows.data(), spots, requests + cascadeCount, spotCount,
+            reallocated, mShadowAtlasOptions.updateBudget, mShadowFrame);
+
+    auto* const UTILS_RESTRICT shadowInfo = lightData.data<FScene::SHADOW_INFO>();
+    for (size_t i = 0; i < spotCount; i++) {
+        const size_t slot = spots[i];
+        SpotShadow& spot = mSpotShadows[slot];
+        if (spot.update) {
+            if (UTILS_UNLIKELY(!spot.shadowMap)) {
+                spot.shadowMap = std::make_unique<ShadowMap>(engine);
+            }
+            ShadowMap& spotShadowMap = *spot.shadowMap;
+            spotShadowMap.update(lightData, spot.lightIndex, scene, mViewingCameraInfo,
+                    mVisibleLayers, spot.tile.size, true);
+            spot.update = spotShadowMap.hasVisibleShadows();
+            if (!spot.update) {
+                spot.contentValid = false;
+                continue;
+            }
+            // the shadow map must be rendered if the tile doesn't hold it
+            spotShadowMap.setTile(0, spot.tile, atlas, !spot.contentValid);
+            spot.contentValid = true;
+            spot.lastUpdate = mShadowFrame;
+            culling[cullingCount++] = { spotShadowMap.getCamera(0).getFrustum(),
+                    spotShadowMask, slot };
+            u.setUniform(offsetof(PerViewUib, spotShadowMatrices) + slot * sizeof(mat4f),
+                    spotShadowMap.getAtlasLightSpaceMatrix());
+        }
+        // the others keep the shadow map and matrix of the frame they were rendered
+        if (spot.contentValid) {
+            shadowInfo[spot.lightIndex] = { true, uint8_t(slot) };
         }
     }
+
+    // Cull the shadow casters of each cascade and spot light, see prepareVisibleShadowCasters()
+    FView::prepareVisibleShadowCasters(engine.getJobSystem(), renderableData,
+            culling, cullingCount, scene->getBoundingVolumeHierarchy());
+
+    if (!mHasDirectionalShadows) {
+        // The shaders still look up the directional light's shadow map when spot lights cast
+        // shadows. A shadow far distance of 0 leaves every fragment out of it, and this light
+        // space maps every fragment to a depth of 0, which is never in shadow either.
+        mat4f lightFromWorldMatrix(0.0f);
+        lightFromWorldMatrix[3][3] = 1.0f;
+        u.setUniform(offsetof(PerViewUib, lightFromWorldMatrix), lightFromWorldMatrix);
+        u.setUniform(offsetof(PerViewUib, shadowBias), float3{ 0 });
+        u.setUniform(offsetof(PerViewUib, shadowCascades), float4{ 1, 1, 0, 0 });
+        u.setUniform(offsetof(PerViewUib, shadowCascadeViewports), float4{ 1, 1, 0, 0 });
+        u.setUniform(offsetof(PerViewUib, shadowCascadeSplits),
+                float4{ std::numeric_limits<float>::infinity() });
+        u.setUniform(offsetof(PerViewUib, shadowCascadeNormalBias), float4{ 1.0f });
+        return;
+    }
+
+    mat4f const& lightFromWorldMatrix = shadowMap.getLightSpaceMatrix();
+    u.setUniform(offsetof(PerViewUib, lightFromWorldMatrix), lightFromWorldMatrix);
+
+    // the normal bias is computed for the texels of the first cascade that has shadows, the
+    // cascades before it have no texels to bias.
+    size_t biasCascade = 0;
+    while (biasCascade + 1 < cascadeCount && !shadowMap.hasVisibleShadows(biasCascade)) {
+        biasCascade++;
+    }
+
+    // the 2x bias is needed in opengl because the depth maps to -1/1. It may not be
+    // needed with other APIs, but at least it won't worsen the acnee there.
+    const float sceneRange = shadowMap.getSceneRange();
+    const float texelSizeWorldSpace = shadowMap.getTexelSizeWorldSpace(biasCascade);
+    const float constantBias = lcm.getShadowConstantBias(directionalLight);
+    const float normalBias = lcm.getShadowNormalBias(directionalLight);
+    u.setUniform(offsetof(PerViewUib, shadowBias), float3{ 2 * constantBias / sceneRange,
+            normalBias * texelSizeWorldSpace, shadowMap.getShadowFar() });
+
+    // the normal bias of the other cascades is relative to the one the vertex shader applies
+    float4 cascadeSplits{ std::numeric_limits<float>::infinity() };
+    float4 cascadeNormalBias{ 1.0f };
+    for (size_t c = 0; c < cascadeCount; c++) {
+        u.setUniform(offsetof(PerViewUib, shadowCascades) + c * sizeof(float4),
+                shadowMap.getCascadeScaleOffset(c));
+        u.setUniform(offsetof(PerViewUib, shadowCascadeViewports) + c * sizeof(float4),
+                shadowMap.getCascadeViewportInAtlas(c));
+        cascadeSplits[c] = shadowMap.getCascadeSplit(c);
+        if (shadowMap.hasVisibleShadows(c) && texelSizeWorldSpace > 0.0f) {
+            cascadeNormalBias[c] = shadowMap.getTexelSizeWorldSpace(c) / texelSizeWorldSpace;
+        }
+    }
+    u.setUniform(offsetof(PerViewUib, shadowCascadeSplits), cascadeSplits);
+    u.setUniform(offsetof(PerViewUib, shadowCascadeNormalBias), cascadeNormalBias);
 }
 
 void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaScope& arena,
@@ -323,7 +684,7 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     const CameraInfo& camera = mViewingCameraInfo;
     FScene* const scene = mScene;
 
-    scene->prepareDynamicLights(camera, arena, mLightUbh);
+    scene->prepareDynamicLights(camera, arena, mFroxelizer.getLightBuffer());
 
     // here the array of visible lights has been shrunk to CONFIG_MAX_LIGHT_COUNT
     auto const& lightData = scene->getLightData();
@@ -391,7 +752,7 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     mHasDynamicLighting = scene->getLightData().size() > FScene::DIRECTIONAL_LIGHTS_COUNT;
     if (mHasDynamicLighting) {
         Froxelizer& froxelizer = mFroxelizer;
-        if (froxelizer.prepare(driver, arena, viewport, camera.projection, camera.zn, camera.zf)) {
+        if (froxelizer.prepare(engine, driver, arena, viewport, camera, lightData)) {
             froxelizer.updateUniforms(u); // update our uniform buffer if needed
         }
     }
@@ -479,21 +840,47 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
 
         Slice<Culler::result_type> cullingMask = renderableData.slice<FScene::VISIBLE_MASK>();
         std::uninitialized_fill(cullingMask.begin(), cullingMask.end(), 0);
+        Slice<Culler::result_type> spotShadowMask =
+                renderableData.slice<FScene::SPOT_SHADOW_MASK>();
+        std::uninitialized_fill(spotShadowMask.begin(), spotShadowMask.end(), 0);
 
         /*
          * Culling: as soon as possible we perform our camera-culling
          * (this will set the VISIBLE_RENDERABLE bit)
          */
 
-        prepareVisibleRenderables(js, mCullingFrustum, renderableData);
+        prepareVisibleRenderables(js, mCullingFrustum, renderableData,
+                scene->getBoundingVolumeHierarchy());
+
+        /*
+         * Occlusion culling: clear the VISIBLE_RENDERABLE bit of the renderables hidden
+         * behind occluders
+         */
 
+        if (mOcclusionCulling.enabled) {
+            const mat4f clipFromWorld{ mCullingCamera->getCullingProjectionMatrix() *
+                    FCamera::getViewMatrix(worldOriginScene * mCullingCamera->getModelMatrix()) };
+            const size_t width = mOcclusionCulling.resolution;
+            mOcclusionCuller.setResolution(width,
+                    (width * viewport.height) / std::max(1u, viewport.width));
+            mOcclusionCuller.cull(js, engine.getRenderableManager(), renderableData,
+                    clipFromWorld, getVisibleLayers(), VISIBLE_RENDERABLE_BIT);
+        }
 
         /*
-         * Shadowing: compute the shadow camera and cull shadow casters
-         * (this will set the VISIBLE_SHADOW_CASTER bit)
+         * Shadowing: compute the shadow cameras and cull shadow casters
+         * (this will set the VISIBLE_SHADOW_CASCADE and SPOT_SHADOW_MASK bits).
+         * The spot lights casting shadows are picked among the visible lights.
          */
 
-        prepareShadowing(engine, driver, renderableData, scene->getLightData());
+        js.waitAndRelease(prepareVisibleLightsJob);
+        prepareShadowing(engine, driver, renderableData, scene->getLightData(), viewport);
+
+        // the spot lights whose shadow map is rendered this frame
+        uint8_t spotShadows = 0;
+        for (size_t slot = 0; slot < CONFIG_MAX_SHADOW_CASTING_SPOTS; slot++) {
+            spotShadows |= uint8_t(mSpotShadows[slot].update ? 1u << slot : 0u);
+        }
 
         /*
          * partition the array of renderable w.r.t their visibility:
@@ -508,7 +895,7 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
         uint8_t const* layers = renderableData.data<FScene::LAYERS>();
         auto const* visibility = renderableData.data<FScene::VISIBILITY_STATE>();
         computeVisibilityMasks(getVisibleLayers(), layers, visibility, cullingMask.begin(),
-                renderableData.size());
+                spotShadowMask.begin(), spotShadows, renderableData.size());
 
         auto const beginRenderables = renderableData.begin();
         auto beginCasters = partition(beginRenderables, renderableData.end(), VISIBLE_RENDERABLE);
@@ -523,11 +910,11 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
         merged = Range{ 0, iEnd };
 
         // update those UBOs
-        const size_t size = merged.size() * sizeof(PerRenderableUib);
+        const size_t size = FScene::getRenderableUniformsSize(merged.size());
         if (mRenderableUBOSize < size) {
             // allocate 1/3 extra, with a minimum of 16 objects
             const size_t count = std::max(size_t(16u), (4u * merged.size() + 2u) / 3u);
-            mRenderableUBOSize = uint32_t(count * sizeof(PerRenderableUib));
+            mRenderableUBOSize = uint32_t(FScene::getRenderableUniformsSize(count));
             driver.destroyUniformBuffer(mRenderableUbh);
             mRenderableUbh = driver.createUniformBuffer(mRenderableUBOSize,
                     driver::BufferUsage::STREAM);
@@ -537,13 +924,20 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
         scene->updateUBOs(merged, mRenderableUbh);
     }
 
+    /*
+     * Levels of detail: select the primitives of the visible renderables and shadow casters.
+     * Levels are always selected from the viewing camera, so that shadows match what is drawn,
+     * and in the viewport actually rendered.
+     */
+
+    updatePrimitivesLod(engine, js, mViewingCameraInfo, viewport, renderableData, merged);
+
     /*
      * Prepare lighting -- this is where we update the lights UBOs, set-up the IBL,
      * set-up the froxelization parameters.
      * Relies on FScene::prepare() and prepareVisibleLights()
      */
 
-    js.waitAndRelease(prepareVisibleLightsJob);
     prepareLighting(engine, driver, arena, viewport);
 
     /*
@@ -562,11 +956,20 @@ void FView::prepare(FEngine& engine, driver::DriverApi& driver, ArenaScope& aren
     bindPerViewUniformsAndSamplers(driver);
 }
 
+View::OcclusionCullingStats FView::getOcclusionCullingStats() const noexcept {
+    if (!mOcclusionCulling.enabled) {
+        return {};
+    }
+    OcclusionCuller::Stats const& stats = mOcclusionCuller.getStats();
+    return { stats.occluders, stats.tested, stats.occluded };
+}
+
 void FView::computeVisibilityMasks(
         uint8_t visibleLayers,
         uint8_t const* UTILS_RESTRICT layers,
         FRenderableManager::Visibility const* UTILS_RESTRICT visibility,
-        uint8_t* UTILS_RESTRICT visibleMask, size_t count) const {
+        uint8_t* UTILS_RESTRICT visibleMask,
+        uint8_t* UTILS_RESTRICT spotShadowMask, uint8_t spotShadows, size_t count) const {
     // __restrict__ seems to only be taken into account as function parameters. This is very
     // important here, otherwise, this loop doesn't get vectorized.
     // This is vectorized 16x.
@@ -575,10 +978,15 @@ void FView::computeVisibilityMasks(
         Culler::result_type mask = visibleMask[i];
         FRenderableManager::Visibility v = visibility[i];
         bool inVisibleLayer = layers[i] & visibleLayers;
+        Culler::result_type cascades = v.culling ? (mask & VISIBLE_SHADOW_CASCADES) :
+                                                   VISIBLE_SHADOW_CASCADES;
+        Culler::result_type spots = v.culling ? (spotShadowMask[i] & spotShadows) : spotShadows;
         bool visRenderables   = (!v.culling || (mask & VISIBLE_RENDERABLE))    && inVisibleLayer;
-        bool visShadowCasters = (!v.culling || (mask & VISIBLE_SHADOW_CASTER)) && inVisibleLayer && v.castShadows;
+        bool visShadowCasters = (cascades || spots) && inVisibleLayer && v.castShadows;
         visibleMask[i] = Culler::result_type(visRenderables) |
-                         Culler::result_type(visShadowCasters << 1);
+                         Culler::result_type(visShadowCasters << 1) |
+                         Culler::result_type(cascades & -Culler::result_type(visShadowCasters));
+        spotShadowMask[i] = Culler::result_type(spots & -Culler::result_type(visShadowCasters));
     }
 }
 
@@ -588,7 +996,7 @@ UTILS_NOINLINE
         FScene::RenderableSoa::iterator end,
         uint8_t mask) noexcept {
     return std::partition(begin, end, [mask](auto it) {
-        return it.template get<FScene::VISIBLE_MASK>() == mask;
+        return (it.template get<FScene::VISIBLE_MASK>() & VISIBLE_ALL) == mask;
     });
 }
 
@@ -625,7 +1033,7 @@ void FView::froxelize(FEngine& engine) const noexcept {
 
     if (mHasDynamicLighting) {
         // froxelize lights
-        mFroxelizer.froxelizeLights(engine, mViewingCameraInfo, mScene->getLightData());
+        mFroxelizer.froxelizeLights(engine);
     }
 }
 
@@ -649,10 +1057,11 @@ void FView::commitFroxels(driver::DriverApi& driverApi) const noexcept {
 
 UTILS_NOINLINE
 void FView::prepareVisibleRenderables(JobSystem& js,
-        Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept {
+        Frustum const& frustum, FScene::RenderableSoa& renderableData,
+        BoundingVolumeHierarchy const* bvh) const noexcept {
     SYSTRACE_CALL();
     if (UTILS_LIKELY(isFrustumCullingEnabled())) {
-        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT);
+        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT, bvh);
     } else {
         std::uninitialized_fill(renderableData.begin<FScene::VISIBLE_MASK>(),
                   renderableData.end<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE);
@@ -661,18 +1070,57 @@ void FView::prepareVisibleRenderables(JobSystem& js,
 
 UTILS_NOINLINE
 void FView::prepareVisibleShadowCasters(JobSystem& js,
-        Frustum const& lightFrustum, FScene::RenderableSoa& renderableData) noexcept {
+        FScene::RenderableSoa& renderableData,
+        ShadowCasterCulling const* culling, size_t count,
+        BoundingVolumeHierarchy const* bvh) noexcept {
     SYSTRACE_CALL();
-    FView::cullRenderables(js, renderableData, lightFrustum, VISIBLE_SHADOW_CASTER_BIT);
+
+    float3 const* worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    float3 const* worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+
+    if (bvh) {
+        // each traversal is parallel, but they write to the same visibility masks
+        assert(bvh->size() == renderableData.size());
+        for (size_t i = 0; i < count; i++) {
+            bvh->cull(js, culling[i].results, culling[i].frustum,
+                    worldAABBCenter, worldAABBExtent, culling[i].bit);
+        }
+        return;
+    }
+
+    // All the light frusta are tested in a single parallel pass, each job handling all of them
+    // for its range of renderables, so that jobs never write to the same masks.
+    auto functor = [culling, count, worldAABBCenter, worldAABBExtent]
+            (uint32_t index, uint32_t c) {
+        for (size_t i = 0; i < count; i++) {
+            Culler::intersects(
+                    culling[i].results + index,
+                    culling[i].frustum,
+                    worldAABBCenter + index,
+                    worldAABBExtent + index, c, culling[i].bit);
+        }
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, 0, (uint32_t)renderableData.size(),
+            std::ref(functor), jobs::CountSplitter<Culler::MODULO * Culler::MIN_LOOP_COUNT_HINT, 8>());
+    js.runAndWait(job);
 }
 
 void FView::cullRenderables(JobSystem& js,
-        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept {
+        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit,
+        BoundingVolumeHierarchy const* bvh) noexcept {
 
     float3 const* worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
     float3 const* worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
     uint8_t     * visibleArray    = renderableData.data<FScene::VISIBLE_MASK>();
 
+    if (bvh) {
+        // the renderables are stored in the hierarchy's order
+        assert(bvh->size() == renderableData.size());
+        bvh->cull(js, visibleArray, frustum, worldAABBCenter, worldAABBExtent, bit);
+        return;
+    }
+
     // culling job (this runs on multiple threads)
     auto functor = [&frustum, worldAABBCenter, worldAABBExtent, visibleArray, bit]
             (uint32_t index, uint32_t c) {
@@ -746,14 +1194,64 @@ void FView::prepareVisibleLights(FLightManager const& lcm, utils::JobSystem&,
     lightData.resize(visibleLightCount);
 }
 
-void FView::updatePrimitivesLod(FEngine& engine, const CameraInfo&,
-        FScene::RenderableSoa& renderableData, Range visible) noexcept {
+void FView::updatePrimitivesLod(FEngine& engine, JobSystem& js, const CameraInfo& camera,
+        Viewport const& viewport, FScene::RenderableSoa& renderableData,
+        Range visible) noexcept {
+    SYSTRACE_CALL();
+
     FRenderableManager const& rcm = engine.getRenderableManager();
-    for (uint32_t index : visible) {
-        uint8_t level = 0; // TODO: pick the proper level of detail
-        auto ri = renderableData.elementAt<FScene::RENDERABLE_INSTANCE>(index);
-        renderableData.elementAt<FScene::PRIMITIVES>(index) = rcm.getRenderPrimitives(ri, level);
-    }
+    const float threshold = mLevelOfDetail.threshold;
+    const float hysteresis = mLevelOfDetail.hysteresis;
+
+    // number of pixels covered by one world-space unit, at a distance of one unit for
+    // perspective projections, at any distance for orthographic ones.
+    const float pixelsPerUnit = camera.projection[1][1] * viewport.height * 0.5f;
+    const bool isOrthographic = camera.projection[3][3] != 0.0f;
+    const float3 eye = camera.getPosition();
+    const float zn = camera.zn;
+
+    auto const* UTILS_RESTRICT instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    affinef const* UTILS_RESTRICT worldTransforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    float3 const* UTILS_RESTRICT worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    float3 const* UTILS_RESTRICT worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+    auto* UTILS_RESTRICT primitives = renderableData.data<FScene::PRIMITIVES>();
+
+    // The hysteresis depends on the level this view selected last, not on the levels other
+    // views of the same renderables selected. A renderable that gets the instance of a
+    // destroyed one starts from its level, which only changes which level is picked within
+    // the hysteresis band.
+    mSelectedLevels.resize(std::max(mSelectedLevels.size(), rcm.getComponentCount() + 1));
+    uint8_t* UTILS_RESTRICT selectedLevels = mSelectedLevels.data();
+
+    // each renderable only touches its own levels of detail, so this can run in parallel
+    auto work = [&rcm, instances, worldTransforms, worldAABBCenter, worldAABBExtent, primitives,
+            selectedLevels, eye, zn, isOrthographic, pixelsPerUnit, threshold, hysteresis]
+            (uint32_t index, uint32_t c) {
+        for (uint32_t i = index, e = index + c; i < e; i++) {
+            auto ri = instances[i];
+            if (!rcm.hasLevelsOfDetail(ri)) {
+                primitives[i] = rcm.getRenderPrimitives(ri, 0);
+                continue;
+            }
+
+            // errors are in object space, scale them by the largest scale of the transform
+            const mat3f m = worldTransforms[i].upperLeft();
+            float scale = std::sqrt(std::max(length2(m[0]),
+                    std::max(length2(m[1]), length2(m[2]))));
+
+            // use the distance to the closest point of the bounding sphere
+            if (!isOrthographic) {
+                float d = length(worldAABBCenter[i] - eye) - length(worldAABBExtent[i]);
+                scale /= std::max(d, zn);
+            }
+            primitives[i] = rcm.updateLevelOfDetail(ri, selectedLevels[ri.asValue()],
+                    pixelsPerUnit * scale, threshold, hysteresis);
+        }
+    };
+
+    auto job = jobs::parallel_for(js, nullptr, visible.first, uint32_t(visible.size()),
+            std::cref(work), jobs::CountSplitter<64, 8>());
+    js.runAndWait(job);
 }
 
 } // namespace details
@@ -863,6 +1361,38 @@ View::DynamicResolutionOptions View::getDynamicResolutionOptions() const noexcep
     return upcast(this)->getDynamicResolutionOptions();
 }
 
+void View::setOcclusionCullingOptions(OcclusionCullingOptions const& options) noexcept {
+    upcast(this)->setOcclusionCullingOptions(options);
+}
+
+View::OcclusionCullingOptions View::getOcclusionCullingOptions() const noexcept {
+    return upcast(this)->getOcclusionCullingOptions();
+}
+
+View::OcclusionCullingStats View::getOcclusionCullingStats() const noexcept {
+    return upcast(this)->getOcclusionCullingStats();
+}
+
+View::PostProcessingMemoryStats View::getPostProcessingMemoryStats() const noexcept {
+    return upcast(this)->getPostProcessingMemoryStats();
+}
+
+void View::setLevelOfDetailOptions(LevelOfDetailOptions const& options) noexcept {
+    upcast(this)->setLevelOfDetailOptions(options);
+}
+
+View::LevelOfDetailOptions View::getLevelOfDetailOptions() const noexcept {
+    return upcast(this)->getLevelOfDetailOptions();
+}
+
+void View::setShadowAtlasOptions(ShadowAtlasOptions const& options) noexcept {
+    upcast(this)->setShadowAtlasOptions(options);
+}
+
+View::ShadowAtlasOptions View::getShadowAtlasOptions() const noexcept {
+    return upcast(this)->getShadowAtlasOptions();
+}
+
 void View::setRenderQuality(const RenderQuality& renderQuality) noexcept {
     upcast(this)->setRenderQuality(renderQuality);
 }
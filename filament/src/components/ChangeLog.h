@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_CHANGELOG_H
+#define TNT_FILAMENT_DETAILS_CHANGELOG_H
+
+#include <utils/compiler.h>
+#include <utils/Entity.h>
+#include <utils/Slice.h>
+
+#include <vector>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * A ChangeLog records which entities had their component data modified, so that consumers
+ * (e.g. FScene) can update their own copy of that data incrementally instead of re-reading
+ * every component.
+ *
+ * Each recorded change advances a generation counter. A consumer remembers the generation it
+ * last synchronized with, and later asks for all the changes since then. The history is
+ * bounded: when it gets too large its oldest half is dropped, consumers that were that far
+ * behind are told so and must do a full update.
+ *
+ * Entities can appear several times in the log, consumers must handle duplicates.
+ */
+class ChangeLog {
+public:
+    using Generation = uint64_t;
+
+    // maximum number of entries kept in the history
+    static constexpr size_t MAX_ENTRIES = 65536;
+
+    ChangeLog() noexcept = default;
+    ChangeLog(ChangeLog const& rhs) = delete;
+    ChangeLog& operator=(ChangeLog const& rhs) = delete;
+
+    void add(utils::Entity e) noexcept {
+        if (UTILS_UNLIKELY(mEntries.size() >= MAX_ENTRIES)) {
+            drop(MAX_ENTRIES / 2);
+        }
+        mEntries.push_back(e);
+    }
+
+    // generation of the most recent change
+    Generation getGeneration() const noexcept {
+        return mBase + mEntries.size();
+    }
+
+    // Returns the entities changed since generation 'since'. Returns false if that history is
+    // not available anymore, in which case the caller must assume everything changed.
+    bool getChangesSince(Generation since,
+            utils::Slice<const utils::Entity>& changes) const noexcept {
+        if (UTILS_UNLIKELY(since < mBase)) {
+            return false;
+        }
+        assert(since <= getGeneration());
+        utils::Entity const* const entries = mEntries.data();
+        changes = { entries + (since - mBase), entries + mEntries.size() };
+        return true;
+    }
+
+private:
+    UTILS_NOINLINE
+    void drop(size_t count) noexcept {
+        mEntries.erase(mEntries.begin(), mEntries.begin() + count);
+        mBase += count;
+    }
+
+    std::vector<utils::Entity> mEntries;
+    Generation mBase = 0;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_CHANGELOG_H
@@ -165,6 +165,7 @@ void FLightManager::create(const FLightManager::Builder& builder, utils::Entity
         lightType.type = builder->mType;
         lightType.shadowCaster = builder->mCastShadows;
         lightType.lightCaster = builder->mCastLight;
+        lightType.staticShadows = false;
         lightType.shadowMapBits = uint8_t(std::min(15, std::ilogbf(builder->mShadowOptions.mapSize)));
 
         ShadowParams& shadowParams = manager[i].shadowParams;
@@ -173,6 +174,15 @@ void FLightManager::create(const FLightManager::Builder& builder, utils::Entity
         shadowParams.shadowFar = std::max(builder->mShadowOptions.shadowFar, 0.0f);
         shadowParams.shadowNearHint = std::max(builder->mShadowOptions.shadowNearHint, 0.0f);
         shadowParams.shadowFarHint = std::max(builder->mShadowOptions.shadowFarHint, 0.0f);
+        shadowParams.shadowCascades = uint8_t(clamp(
+                int(builder->mShadowOptions.shadowCascades), 1, int(CONFIG_MAX_SHADOW_CASCADES)));
+        float previousSplit = 0.0f;
+        for (size_t c = 0; c < CONFIG_MAX_SHADOW_CASCADES - 1; c++) {
+            // splits must be increasing, the last cascade always ends at the shadow far distance
+            previousSplit = clamp(builder->mShadowOptions.cascadeSplitPositions[c],
+                    previousSplit, 1.0f);
+            shadowParams.cascadeSplitPositions[c] = previousSplit;
+        }
 
         // set default values by calling the setters
         setLocalPosition(i, builder->mPosition);
@@ -198,6 +208,11 @@ void FLightManager::destroy(utils::Entity e) noexcept {
     if (i) {
         auto& manager = mManager;
         manager.removeComponent(e);
+        mChangeLog.add(e);
+        // the last component was moved into our slot, its Instance changed
+        if (i < Instance(manager.end())) {
+            mChangeLog.add(manager.getEntity(i));
+        }
     }
 }
 
@@ -219,12 +234,14 @@ void FLightManager::setLocalPosition(Instance i, const math::float3& position) n
     assert(i);
     auto& manager = mManager;
     manager[i].position = position;
+    mChangeLog.add(manager.getEntity(i));
 }
 
 void FLightManager::setLocalDirection(Instance i, float3 direction) noexcept {
     assert(i);
     auto& manager = mManager;
     manager[i].direction = direction;
+    mChangeLog.add(manager.getEntity(i));
 }
 
 void FLightManager::setColor(Instance i, const LinearColor& color) noexcept {
@@ -278,6 +295,7 @@ void FLightManager::setFalloff(Instance i, float falloff) noexcept {
         SpotParams& spotParams = manager[i].spotParams;
         manager[i].squaredFallOffInv = sqFalloff ? (1 / sqFalloff) : 0;
         spotParams.radius = falloff;
+        mChangeLog.add(manager.getEntity(i));
     }
 }
 
@@ -335,6 +353,14 @@ void FLightManager::setSunHaloFalloff(Instance i, float haloFalloff) noexcept {
     }
 }
 
+void FLightManager::setShadowHint(Instance i, ShadowHint hint) noexcept {
+    auto& manager = mManager;
+    if (i) {
+        LightType& lightType = manager[i].lightType;
+        lightType.staticShadows = hint == ShadowHint::STATIC;
+    }
+}
+
 } // namespace details
 
 // ------------------------------------------------------------------------------------------------
@@ -425,8 +451,47 @@ float LightManager::getSunHaloFalloff(Instance i) const noexcept {
     return upcast(this)->getSunHaloFalloff(i);
 }
 
+void LightManager::setShadowHint(Instance i, ShadowHint hint) noexcept {
+    upcast(this)->setShadowHint(i, hint);
+}
+
+LightManager::ShadowHint LightManager::getShadowHint(Instance i) const noexcept {
+    return upcast(this)->hasStaticShadows(i) ? ShadowHint::STATIC : ShadowHint::DYNAMIC;
+}
+
 LightManager::Type LightManager::getType(LightManager::Instance i) const noexcept {
     return upcast(this)->getType(i);
 }
 
+// ------------------------------------------------------------------------------------------------
+
+void LightManager::ShadowCascades::computeUniformSplits(float* splitPositions,
+        uint8_t cascades) noexcept {
+    for (size_t c = 1; c < cascades; c++) {
+        splitPositions[c - 1] = float(c) / cascades;
+    }
+}
+
+void LightManager::ShadowCascades::computeLogSplits(float* splitPositions, uint8_t cascades,
+        float near, float far) noexcept {
+    // the split distances are near * (far / near)^(c / cascades), which we return relative
+    // to the [near, far] range.
+    for (size_t c = 1; c < cascades; c++) {
+        const float d = near * std::pow(far / near, float(c) / cascades);
+        splitPositions[c - 1] = (d - near) / (far - near);
+    }
+}
+
+void LightManager::ShadowCascades::computePracticalSplits(float* splitPositions,
+        uint8_t cascades, float near, float far, float lambda) noexcept {
+    float uniformSplits[CONFIG_MAX_SHADOW_CASCADES - 1];
+    float logSplits[CONFIG_MAX_SHADOW_CASCADES - 1];
+    cascades = uint8_t(std::min(size_t(cascades), CONFIG_MAX_SHADOW_CASCADES));
+    computeUniformSplits(uniformSplits, cascades);
+    computeLogSplits(logSplits, cascades, near, far);
+    for (size_t c = 1; c < cascades; c++) {
+        splitPositions[c - 1] = mix(uniformSplits[c - 1], logSplits[c - 1], lambda);
+    }
+}
+
 } // namespace filament
@@ -19,8 +19,11 @@
 
 #include "upcast.h"
 
+#include "components/ChangeLog.h"
+
 #include "driver/DriverApiForward.h"
 
+#include <filament/EngineEnums.h>
 #include <filament/LightManager.h>
 
 #include <utils/Entity.h>
@@ -60,7 +63,14 @@ public:
     void prepare(driver::DriverApi& driver) const noexcept;
 
     void gc(utils::EntityManager& em) noexcept {
-        mManager.gc(em);
+        mManager.gc(em, 4, [this](utils::Entity e) {
+            destroy(e);
+        });
+    }
+
+    // entities whose light component (or the state FScene keeps from it) changed
+    ChangeLog const& getChangeLog() const noexcept {
+        return mChangeLog;
     }
 
     struct LightType {
@@ -68,6 +78,7 @@ public:
         uint8_t shadowMapBits : 4;
         bool shadowCaster : 1;
         bool lightCaster : 1;
+        bool staticShadows : 1;
     };
 
     struct SpotParams {
@@ -84,6 +95,8 @@ public:
         float shadowFar;
         float shadowNearHint;
         float shadowFarHint;
+        float cascadeSplitPositions[CONFIG_MAX_SHADOW_CASCADES - 1];
+        uint8_t shadowCascades;
     };
 
     UTILS_NOINLINE void setLocalPosition(Instance i, const math::float3& position) noexcept;
@@ -95,6 +108,7 @@ public:
     UTILS_NOINLINE void setSunAngularRadius(Instance i, float angularRadius) noexcept;
     UTILS_NOINLINE void setSunHaloSize(Instance i, float haloSize) noexcept;
     UTILS_NOINLINE void setSunHaloFalloff(Instance i, float haloFalloff) noexcept;
+    UTILS_NOINLINE void setShadowHint(Instance i, ShadowHint hint) noexcept;
 
     constexpr LightType const& getLightType(Instance i) const noexcept {
         return mManager[i].lightType;
@@ -112,6 +126,10 @@ public:
         return getLightType(i).lightCaster;
     }
 
+    constexpr bool hasStaticShadows(Instance i) const noexcept {
+        return getLightType(i).staticShadows;
+    }
+
     constexpr bool isPointLight(Instance i) const noexcept { 
         return getType(i) == Type::POINT; 
     }
@@ -219,12 +237,12 @@ private:
         FALLOFF,
     };
 
-    using Base = utils::SingleInstanceComponentManager<  // 120 bytes
+    using Base = utils::SingleInstanceComponentManager<  // 144 bytes
             LightType,      //  1
             math::float3,   // 12
             math::float3,   // 12
             math::float3,   // 12
-            ShadowParams,   // 12
+            ShadowParams,   // 36
             SpotParams,     // 24
             float,          //  4
             float,          //  4
@@ -268,6 +286,7 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
     FEngine& mEngine;
 };
 
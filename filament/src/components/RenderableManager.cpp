@@ -46,12 +46,21 @@ struct RenderableManager::BuilderDetails {
     bool mCulling : 1;
     bool mCastShadows : 1;
     bool mReceiveShadows : 1;
+    bool mOccluder : 1;
     size_t mSkinningBoneCount = 0;
     Bone const* mUserBones = nullptr;
     math::mat4f const* mUserBoneMatrices = nullptr;
+    struct Level {
+        size_t first = 0;
+        size_t count = 0;
+        float error = 0;
+    };
+    Level mLevels[MAX_LEVEL_COUNT];
+    size_t mLevelCount = 0;
 
     explicit BuilderDetails(size_t count)
-            : mEntriesCount(count), mCulling(true), mCastShadows(false), mReceiveShadows(true) {
+            : mEntriesCount(count), mCulling(true), mCastShadows(false), mReceiveShadows(true),
+              mOccluder(false) {
     }
     // this is only needed for the explicit instantiation below
     BuilderDetails() = default;
@@ -125,6 +134,11 @@ RenderableManager::Builder& RenderableManager::Builder::culling(bool enable) noe
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::occluder(bool enable) noexcept {
+    mImpl->mOccluder = enable;
+    return *this;
+}
+
 RenderableManager::Builder& RenderableManager::Builder::castShadows(bool enable) noexcept {
     mImpl->mCastShadows = enable;
     return *this;
@@ -161,6 +175,15 @@ RenderableManager::Builder& RenderableManager::Builder::blendOrder(size_t index,
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::levelOfDetail(uint8_t level,
+        size_t first, size_t count, float error) noexcept {
+    if (level < MAX_LEVEL_COUNT) {
+        mImpl->mLevels[level] = { first, count, error };
+        mImpl->mLevelCount = std::max(mImpl->mLevelCount, size_t(level + 1));
+    }
+    return *this;
+}
+
 RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& engine, Entity entity) {
     bool isEmpty = true;
 
@@ -169,6 +192,24 @@ RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& eng
         return Error;
     }
 
+    for (size_t i = 0, c = mImpl->mLevelCount; i < c; i++) {
+        auto const& level = mImpl->mLevels[i];
+        if (!ASSERT_PRECONDITION_NON_FATAL(level.count,
+                "[entity=%u] level of detail %u has no primitives", entity.getId(), i)) {
+            return Error;
+        }
+        if (!ASSERT_PRECONDITION_NON_FATAL(level.first + level.count <= mImpl->mEntriesCount,
+                "[entity=%u, level %u] first (%u) + count (%u) > primitive count (%u)",
+                entity.getId(), i, level.first, level.count, mImpl->mEntriesCount)) {
+            return Error;
+        }
+        if (!ASSERT_PRECONDITION_NON_FATAL(i == 0 || level.error >= mImpl->mLevels[i - 1].error,
+                "[entity=%u, level %u] error (%f) is smaller than the error of the previous level",
+                entity.getId(), i, level.error)) {
+            return Error;
+        }
+    }
+
     for (size_t i = 0, c = mImpl->mEntriesCount; i < c; i++) {
         auto& entry = mImpl->mEntries[i];
 
@@ -271,12 +312,25 @@ void FRenderableManager::create(
         }
         setPrimitives(ci, { rp, size_type(builder->mEntriesCount) });
 
+        // the levels of detail are views into the primitives
+        if (builder->mLevelCount) {
+            std::unique_ptr<LevelsOfDetail>& lods = manager[ci].lods;
+            lods = std::unique_ptr<LevelsOfDetail>(new LevelsOfDetail{});
+            lods->count = uint8_t(builder->mLevelCount);
+            for (size_t i = 0, c = builder->mLevelCount; i < c; ++i) {
+                auto const& level = builder->mLevels[i];
+                lods->primitives[i] = { rp + level.first, size_type(level.count) };
+                lods->errors[i] = level.error;
+            }
+        }
+
         setAxisAlignedBoundingBox(ci, builder->mAABB);
         setLayerMask(ci, builder->mLayerMask);
         setPriority(ci, builder->mPriority);
         setCastShadows(ci, builder->mCastShadows);
         setReceiveShadows(ci, builder->mReceiveShadows);
         setCulling(ci, builder->mCulling);
+        setOccluder(ci, builder->mOccluder);
         setSkinning(ci, false);
 
         const size_t count = builder->mSkinningBoneCount;
@@ -310,7 +364,20 @@ void FRenderableManager::destroy(utils::Entity e) noexcept {
     Instance ci = getInstance(e);
     if (ci) {
         destroyComponent(ci);
-        mManager.removeComponent(e);
+        removeComponent(e);
+    }
+}
+
+void FRenderableManager::removeComponent(utils::Entity e) noexcept {
+    auto& manager = mManager;
+    Instance ci = manager.getInstance(e);
+    if (ci) {
+        manager.removeComponent(e);
+        mChangeLog.add(e);
+        // the last component was moved into our slot, its Instance changed
+        if (ci < Instance(manager.end())) {
+            mChangeLog.add(manager.getEntity(ci));
+        }
     }
 }
 
@@ -375,12 +442,28 @@ void FRenderableManager::prepare(
     }
 }
 
-void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
+uint8_t FRenderableManager::selectLevel(LevelsOfDetail const& lods, uint8_t current,
+        float pixelsPerUnit, float threshold, float hysteresis) noexcept {
+    const float coarsen = threshold * (1.0f - hysteresis);
+    uint8_t level = std::min(current, uint8_t(lods.count - 1));
+    // refine while the error of the current level is visible...
+    while (level > 0 && lods.errors[level] * pixelsPerUnit > threshold) {
+        level--;
+    }
+    // ...and coarsen while the error of the next level is well below the threshold
+    while (level + 1 < lods.count && lods.errors[level + 1] * pixelsPerUnit <= coarsen) {
+        level++;
+    }
+    return level;
+}
+
+void FRenderableManager::setMaterialInstanceAt(Instance instance,
         size_t primitiveIndex, FMaterialInstance const* mi) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setMaterialInstance(upcast(mi));
+            mPrimitiveGeneration++;
 #ifndef NDEBUG
             AttributeBitset required = mi->getMaterial()->getRequiredAttributes();
             AttributeBitset declared = primitives[primitiveIndex].getEnabledAttributes();
@@ -395,9 +478,9 @@ void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
 }
 
 MaterialInstance* FRenderableManager::getMaterialInstanceAt(
-        Instance instance, uint8_t level, size_t primitiveIndex) const noexcept {
+        Instance instance, size_t primitiveIndex) const noexcept {
     if (instance) {
-        const Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        const Slice<FRenderPrimitive>& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             // We store the material instance as const because we don't want to change it internally
             // but when the user queries it, we want to allow them to call setParameter()
@@ -407,20 +490,21 @@ MaterialInstance* FRenderableManager::getMaterialInstanceAt(
     return nullptr;
 }
 
-void FRenderableManager::setBlendOrderAt(Instance instance, uint8_t level,
+void FRenderableManager::setBlendOrderAt(Instance instance,
         size_t primitiveIndex, uint16_t order) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setBlendOrder(order);
+            mPrimitiveGeneration++;
         }
     }
 }
 
 AttributeBitset FRenderableManager::getEnabledAttributesAt(
-        Instance instance, uint8_t level, size_t primitiveIndex) const noexcept {
+        Instance instance, size_t primitiveIndex) const noexcept {
     if (instance) {
-        Slice<FRenderPrimitive> const& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> const& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             return primitives[primitiveIndex].getEnabledAttributes();
         }
@@ -428,24 +512,26 @@ AttributeBitset FRenderableManager::getEnabledAttributesAt(
     return AttributeBitset{};
 }
 
-void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+void FRenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, FVertexBuffer* vertices, FIndexBuffer* indices,
         size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].set(mEngine, type, vertices, indices, offset,
                     0, vertices->getVertexCount() - 1, count);
+            mPrimitiveGeneration++;
         }
     }
 }
 
-void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+void FRenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive>& primitives = mManager[instance].primitives;
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].set(mEngine, type, offset, 0, 0, count);
+            mPrimitiveGeneration++;
         }
     }
 }
@@ -559,42 +645,54 @@ bool RenderableManager::isShadowReceiver(Instance instance) const noexcept {
     return upcast(this)->isShadowReceiver(instance);
 }
 
+void RenderableManager::setOccluder(Instance instance, bool enable) noexcept {
+    upcast(this)->setOccluder(instance, enable);
+}
+
+bool RenderableManager::isOccluder(Instance instance) const noexcept {
+    return upcast(this)->isOccluder(instance);
+}
+
 const Box& RenderableManager::getAxisAlignedBoundingBox(Instance instance) const noexcept {
     return upcast(this)->getAxisAlignedBoundingBox(instance);
 }
 
 size_t RenderableManager::getPrimitiveCount(Instance instance) const noexcept {
-    return upcast(this)->getPrimitiveCount(instance, 0);
+    return upcast(this)->getPrimitiveCount(instance);
+}
+
+size_t RenderableManager::getLevelCount(Instance instance) const noexcept {
+    return upcast(this)->getLevelCount(instance);
 }
 
 void RenderableManager::setMaterialInstanceAt(Instance instance,
         size_t primitiveIndex, MaterialInstance const* materialInstance) noexcept {
-    upcast(this)->setMaterialInstanceAt(instance, 0, primitiveIndex, upcast(materialInstance));
+    upcast(this)->setMaterialInstanceAt(instance, primitiveIndex, upcast(materialInstance));
 }
 
 MaterialInstance* RenderableManager::getMaterialInstanceAt(
         Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getMaterialInstanceAt(instance, 0, primitiveIndex);
+    return upcast(this)->getMaterialInstanceAt(instance, primitiveIndex);
 }
 
 void RenderableManager::setBlendOrderAt(Instance instance, size_t primitiveIndex, uint16_t order) noexcept {
-    upcast(this)->setBlendOrderAt(instance, 0, primitiveIndex, order);
+    upcast(this)->setBlendOrderAt(instance, primitiveIndex, order);
 }
 
 AttributeBitset RenderableManager::getEnabledAttributesAt(Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getEnabledAttributesAt(instance, 0, primitiveIndex);
+    return upcast(this)->getEnabledAttributesAt(instance, primitiveIndex);
 }
 
 void RenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, VertexBuffer* vertices, IndexBuffer* indices,
         size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex,
+    upcast(this)->setGeometryAt(instance, primitiveIndex,
             type, upcast(vertices), upcast(indices), offset, count);
 }
 
 void RenderableManager::setGeometryAt(RenderableManager::Instance instance, size_t primitiveIndex,
         RenderableManager::PrimitiveType type, size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex, type, offset, count);
+    upcast(this)->setGeometryAt(instance, primitiveIndex, type, offset, count);
 }
 
 void RenderableManager::setBones(Instance instance,
@@ -21,6 +21,8 @@
 
 #include "UniformBuffer.h"
 
+#include "components/ChangeLog.h"
+
 #include "driver/DriverApiForward.h"
 #include "driver/Handle.h"
 
@@ -53,6 +55,7 @@ public:
         bool receiveShadows : 1;
         bool culling        : 1;
         bool skinning       : 1;
+        bool occluder       : 1;
     };
 
     explicit FRenderableManager(FEngine& engine) noexcept;
@@ -84,7 +87,25 @@ public:
             utils::Range<uint32_t> list) const noexcept;
 
     void gc(utils::EntityManager& em) noexcept {
-        mManager.gc(em);
+        mManager.gc(em, 4, [this](utils::Entity e) {
+            removeComponent(e);
+        });
+    }
+
+    // entities whose renderable component (or the state FScene keeps from it) changed
+    ChangeLog const& getChangeLog() const noexcept {
+        return mChangeLog;
+    }
+
+    // instances are in [1, getComponentCount()]
+    size_t getComponentCount() const noexcept {
+        return mManager.getComponentCount();
+    }
+
+    // incremented each time the material instance, geometry or blend order of a primitive
+    // changes, none of which is tracked by the change log
+    uint64_t getPrimitiveGeneration() const noexcept {
+        return mPrimitiveGeneration;
     }
 
     inline void setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept;
@@ -99,6 +120,7 @@ public:
     inline void setLayerMask(Instance instance, uint8_t layerMask) noexcept;
     inline void setReceiveShadows(Instance instance, bool enable) noexcept;
     inline void setCulling(Instance instance, bool enable) noexcept;
+    inline void setOccluder(Instance instance, bool enable) noexcept;
     inline void setSkinning(Instance instance, bool enable) noexcept;
     inline void setPrimitives(Instance instance, utils::Slice<FRenderPrimitive> const& primitives) noexcept;
     inline void setBones(Instance instance, Bone const* transforms, size_t boneCount, size_t offset = 0) noexcept;
@@ -108,6 +130,7 @@ public:
     inline bool isShadowCaster(Instance instance) const noexcept;
     inline bool isShadowReceiver(Instance instance) const noexcept;
     inline bool isCullingEnabled(Instance instance) const noexcept;
+    inline bool isOccluder(Instance instance) const noexcept;
 
     inline Box const& getAABB(Instance instance) const noexcept;
     inline Box const& getAxisAlignedBoundingBox(Instance instance) const noexcept { return getAABB(instance); }
@@ -118,22 +141,43 @@ public:
     inline Handle<HwUniformBuffer> getBonesUbh(Instance instance) const noexcept;
 
 
-    inline size_t getLevelCount(Instance instance) const noexcept { return 1; }
-    inline size_t getPrimitiveCount(Instance instance, uint8_t level) const noexcept;
-    void setMaterialInstanceAt(Instance instance, uint8_t level,
+    struct LevelsOfDetail {
+        utils::Slice<FRenderPrimitive> primitives[MAX_LEVEL_COUNT];
+        float errors[MAX_LEVEL_COUNT];  // object-space error of each level
+        uint8_t count;
+    };
+
+    /*
+     * Returns the coarsest level whose error, multiplied by pixelsPerUnit, is at most
+     * 'threshold' pixels. To avoid popping when the error is close to the threshold, a coarser
+     * level than 'current', the level selected last, is only selected once its error is
+     * 'hysteresis' below it.
+     */
+    static uint8_t selectLevel(LevelsOfDetail const& lods, uint8_t current,
+            float pixelsPerUnit, float threshold, float hysteresis) noexcept;
+
+    // Selects the level of detail to draw, see selectLevel(). 'level' is the level selected
+    // last, which is owned by the caller (each view has its own), and is updated.
+    inline utils::Slice<FRenderPrimitive> const& updateLevelOfDetail(Instance instance,
+            uint8_t& level, float pixelsPerUnit, float threshold, float hysteresis) const noexcept;
+
+    inline bool hasLevelsOfDetail(Instance instance) const noexcept;
+    inline size_t getLevelCount(Instance instance) const noexcept;
+    inline size_t getPrimitiveCount(Instance instance) const noexcept;
+    void setMaterialInstanceAt(Instance instance,
             size_t primitiveIndex, FMaterialInstance const* materialInstance) noexcept;
-    MaterialInstance* getMaterialInstanceAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
-    void setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+    MaterialInstance* getMaterialInstanceAt(Instance instance, size_t primitiveIndex) const noexcept;
+    void setGeometryAt(Instance instance, size_t primitiveIndex,
             PrimitiveType type, FVertexBuffer* vertices, FIndexBuffer* indices,
             size_t offset, size_t count) noexcept;
-    void setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
+    void setGeometryAt(Instance instance, size_t primitiveIndex,
             PrimitiveType type, size_t offset, size_t count) noexcept;
-    void setBlendOrderAt(Instance instance, uint8_t level, size_t primitiveIndex, uint16_t blendOrder) noexcept;
-    AttributeBitset getEnabledAttributesAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
+    void setBlendOrderAt(Instance instance, size_t primitiveIndex, uint16_t blendOrder) noexcept;
+    AttributeBitset getEnabledAttributesAt(Instance instance, size_t primitiveIndex) const noexcept;
     inline utils::Slice<FRenderPrimitive> const& getRenderPrimitives(Instance instance, uint8_t level) const noexcept;
-    inline utils::Slice<FRenderPrimitive>& getRenderPrimitives(Instance instance, uint8_t level) noexcept;
 
 private:
+    void removeComponent(utils::Entity e) noexcept;
     void destroyComponent(Instance ci) noexcept;
     static void destroyComponentPrimitives(FEngine& engine,
             utils::Slice<FRenderPrimitive>& primitives) noexcept;
@@ -154,6 +198,7 @@ private:
         VISIBILITY,         // user data
         PRIMITIVES,         // user data
         BONES,              // filament data, UBO storing a pointer to the bones information
+        LODS,               // user data, levels of detail, null if there is only one
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -161,7 +206,8 @@ private:
             uint8_t,
             Visibility,
             utils::Slice<FRenderPrimitive>,
-            std::unique_ptr<Bones>
+            std::unique_ptr<Bones>,
+            std::unique_ptr<LevelsOfDetail>
     >;
 
     struct Sim : public Base {
@@ -181,6 +227,7 @@ private:
                 Field<VISIBILITY>   visibility;
                 Field<PRIMITIVES>   primitives;
                 Field<BONES>        bones;
+                Field<LODS>         lods;
             };
         };
 
@@ -193,6 +240,8 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
+    uint64_t mPrimitiveGeneration = 0;
     FEngine& mEngine;
 };
 
@@ -201,6 +250,7 @@ FILAMENT_UPCAST(RenderableManager)
 void FRenderableManager::setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept {
     if (instance) {
         mManager[instance].aabb = aabb;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -209,12 +259,14 @@ void FRenderableManager::setLayerMask(Instance instance,
     if (instance) {
         uint8_t& layers = mManager[instance].layers;
         layers = (layers & ~select) | (values & select);
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
 void FRenderableManager::setLayerMask(Instance instance, uint8_t layerMask) noexcept {
     if (instance) {
         mManager[instance].layers = layerMask;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -222,6 +274,7 @@ void FRenderableManager::setPriority(Instance instance, uint8_t priority) noexce
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.priority = priority;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -229,6 +282,7 @@ void FRenderableManager::setCastShadows(Instance instance, bool enable) noexcept
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.castShadows = enable;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -236,6 +290,7 @@ void FRenderableManager::setReceiveShadows(Instance instance, bool enable) noexc
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.receiveShadows = enable;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -243,6 +298,15 @@ void FRenderableManager::setCulling(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.culling = enable;
+        mChangeLog.add(mManager.getEntity(instance));
+    }
+}
+
+void FRenderableManager::setOccluder(Instance instance, bool enable) noexcept {
+    if (instance) {
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.occluder = enable;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -250,6 +314,7 @@ void FRenderableManager::setSkinning(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.skinning = enable;
+        mChangeLog.add(mManager.getEntity(instance));
     }
 }
 
@@ -277,6 +342,10 @@ bool FRenderableManager::isCullingEnabled(Instance instance) const noexcept {
     return getVisibility(instance).culling;
 }
 
+bool FRenderableManager::isOccluder(Instance instance) const noexcept {
+    return getVisibility(instance).occluder;
+}
+
 uint8_t FRenderableManager::getLayerMask(Instance instance) const noexcept {
     return mManager[instance].layers;
 }
@@ -294,18 +363,40 @@ Handle<HwUniformBuffer> FRenderableManager::getBonesUbh(Instance instance) const
     return bones ? bones->handle : Handle<HwUniformBuffer>{};
 }
 
+bool FRenderableManager::hasLevelsOfDetail(Instance instance) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    return bool(lods);
+}
+
+size_t FRenderableManager::getLevelCount(Instance instance) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    return lods ? lods->count : 1;
+}
+
 utils::Slice<FRenderPrimitive> const& FRenderableManager::getRenderPrimitives(
         Instance instance, uint8_t level) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    if (lods) {
+        assert(level < lods->count);
+        return lods->primitives[level];
+    }
+    assert(level == 0);
     return mManager[instance].primitives;
 }
 
-utils::Slice<FRenderPrimitive>& FRenderableManager::getRenderPrimitives(
-        Instance instance, uint8_t level) noexcept {
-    return mManager[instance].primitives;
+utils::Slice<FRenderPrimitive> const& FRenderableManager::updateLevelOfDetail(Instance instance,
+        uint8_t& level, float pixelsPerUnit, float threshold, float hysteresis) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& lods = mManager[instance].lods;
+    if (!lods) {
+        return mManager[instance].primitives;
+    }
+    level = selectLevel(*lods, level, pixelsPerUnit, threshold, hysteresis);
+    return lods->primitives[level];
 }
 
-size_t FRenderableManager::getPrimitiveCount(Instance instance, uint8_t level) const noexcept {
-    return getRenderPrimitives(instance, level).size();
+size_t FRenderableManager::getPrimitiveCount(Instance instance) const noexcept {
+    utils::Slice<FRenderPrimitive> const& primitives = mManager[instance].primitives;
+    return primitives.size();
 }
 
 } // namespace details
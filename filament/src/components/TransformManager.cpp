@@ -16,13 +16,19 @@
 
 #include "components/TransformManager.h"
 
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <functional>
+
 using namespace utils;
 using namespace math;
 
 namespace filament {
 namespace details {
 
-FTransformManager::FTransformManager() noexcept = default;
+FTransformManager::FTransformManager(JobSystem* js) noexcept : mJobSystem(js) {
+}
 
 FTransformManager::~FTransformManager() noexcept = default;
 
@@ -50,7 +56,14 @@ void FTransformManager::create(Entity entity, Instance parent, const mat4f& loca
         manager[i].next = 0;
         manager[i].prev = 0;
         manager[i].firstChild = 0;
+        manager[i].dirty = false;
         insertNode(i, parent);
+        // the new node comes after its parent, but it's only next to a sibling if that one is
+        // the last node created
+        Instance sibling = manager[i].next;
+        if (sibling && sibling.asValue() + 1 != i.asValue()) {
+            mNeedsSorting = true;
+        }
         setTransform(i, localTransform);
     }
 }
@@ -65,6 +78,7 @@ void FTransformManager::setParent(Instance i, Instance parent) noexcept {
             removeNode(i);
             insertNode(i, parent);
             updateNodeTransform(i);
+            mNeedsSorting = true;
         }
     }
 }
@@ -82,8 +96,10 @@ void FTransformManager::destroy(Entity e) noexcept {
         Instance child = manager[i].firstChild;
         while (child) {
             manager[child].parent = 0;
+            mChangeLog.add(manager.getEntity(child));
             child = manager[child].next;
         }
+        mChangeLog.add(e);
 
         // 2) remove the component
         Instance moved = manager.removeComponent(e);
@@ -91,6 +107,7 @@ void FTransformManager::destroy(Entity e) noexcept {
         // 3) update the references to the entry now with Instance i
         if (moved != i) {
             updateNode(i);
+            mNeedsSorting = true;
         }
     }
 }
@@ -99,8 +116,11 @@ void FTransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     validateNode(ci);
     if (ci) {
         auto& manager = mManager;
+        // only affine transforms can be stored, their last row (0, 0, 0, 1) isn't
+        UTILS_UNUSED_IN_RELEASE const float4 lastRow = transpose(model)[3];
+        assert(all(lessThanEqual(abs(lastRow - float4{ 0, 0, 0, 1 }), float4{ 1e-5f })));
         // store our local transform
-        manager[ci].local = model;
+        manager[ci].local = affinef(model);
         updateNodeTransform(ci);
     }
 }
@@ -111,14 +131,11 @@ void FTransformManager::updateNodeTransform(Instance i) noexcept {
     assert(i);
 
     if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
-        // don't update the world transform until commitLocalTransformTransaction() is called
-        Instance ci = manager[i].firstChild;
-        while (ci) {
-            Instance child = manager[ci].firstChild;
-            ci = manager[ci].next;
-            if (child) {
-                updateNodeTransform(child);
-            }
+        // don't update the world transform until commitLocalTransformTransaction() is called,
+        // which updates (and records as changed) the whole subtree.
+        if (!manager[i].dirty) {
+            manager[i].dirty = true;
+            mDirty.push_back(manager.getEntity(i));
         }
         return;
     }
@@ -126,15 +143,18 @@ void FTransformManager::updateNodeTransform(Instance i) noexcept {
     // find our parent's world transform, if any
     // note: by using the raw_array() we don't need to check that parent is valid.
     Instance parent = manager[i].parent;
-    mat4f const& pt = manager.raw_array<WORLD>()[parent];
+    affinef const& pt = manager.raw_array<WORLD>()[parent];
 
     // compute our world transform
-    manager[i].world = pt * static_cast<mat4f const&>(manager[i].local);
+    affinef const& local = manager[i].local;
+    affinef& world = manager[i].world;
+    multiply(world, pt, local);
+    mChangeLog.add(manager.getEntity(i));
 
     // update our children's world transforms
     Instance child = manager[i].firstChild;
     if (UTILS_UNLIKELY(child)) { // assume we don't have a hierarchy in the common case
-        transformChildren(manager, child);
+        transformChildren(manager, mChangeLog, child);
     }
 }
 
@@ -145,22 +165,136 @@ void FTransformManager::openLocalTransformTransaction() noexcept {
 void FTransformManager::commitLocalTransformTransaction() noexcept {
     if (mLocalTransformTransactionOpen) {
         mLocalTransformTransactionOpen = false;
-        auto& manager = mManager;
+        if (UTILS_UNLIKELY(mNeedsSorting)) {
+            mNeedsSorting = false;
+            sortBreadthFirst();
+        }
+        updateDirtySubtrees();
+    }
+}
+
+// Updates the world transforms of the subtrees whose root changed during the transaction,
+// one level at a time: all nodes of a level only depend on the level above.
+void FTransformManager::updateDirtySubtrees() noexcept {
+    SYSTRACE_CALL();
 
-        // swapNode() below needs some temporary storage which we provide here
-        auto& soa = manager.getSoA();
-        soa.ensureCapacity(soa.size() + 1);
+    auto& manager = mManager;
+    std::vector<Instance>& level = mLevel;
+    std::vector<Instance>& nextLevel = mNextLevel;
+
+    // keep only the roots of the dirty subtrees, the other dirty nodes are updated with them
+    level.clear();
+    for (Entity e : mDirty) {
+        Instance i = manager.getInstance(e);
+        if (!i) {
+            continue; // destroyed during the transaction
+        }
+        Instance parent = manager[i].parent;
+        while (parent && !manager[parent].dirty) {
+            parent = manager[parent].parent;
+        }
+        if (!parent) {
+            level.push_back(i);
+        }
+    }
+    for (Entity e : mDirty) {
+        Instance i = manager.getInstance(e);
+        if (i) {
+            manager[i].dirty = false;
+        }
+    }
+    mDirty.clear();
+
+    affinef* const UTILS_RESTRICT world = manager.data<WORLD>();
+    affinef const* const UTILS_RESTRICT local = manager.data<LOCAL>();
+    Instance const* const UTILS_RESTRICT parents = manager.data<PARENT>();
+    auto work = [world, local, parents](Instance const* instances, size_t count) {
+        for (size_t k = 0; k < count; k++) {
+            const Instance i = instances[k];
+            // note: world[0] (no parent) is the identity
+            multiply(world[i], world[parents[i]], local[i]);
+        }
+    };
+
+    JobSystem* const js = mJobSystem;
+    while (!level.empty()) {
+        // small levels are not worth waking up the worker threads for
+        if (js && level.size() >= 256) {
+            auto job = jobs::parallel_for(*js, nullptr, level.data(), uint32_t(level.size()),
+                    std::cref(work), jobs::CountSplitter<128, 8>());
+            js->runAndWait(job);
+        } else {
+            work(level.data(), level.size());
+        }
 
-        mat4f const* const UTILS_RESTRICT world = manager.raw_array<WORLD>();
-        for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
-            // Ensure that children are always sorted after their parent.
-            if (UTILS_UNLIKELY(Instance(manager[i].parent) > i)) {
-                swapNode(i, manager[i].parent);
+        nextLevel.clear();
+        for (Instance i : level) {
+            mChangeLog.add(manager.getEntity(i));
+            for (Instance child = manager[i].firstChild; child; child = manager[child].next) {
+                nextLevel.push_back(child);
             }
-            Instance parent = manager[i].parent;
-            assert(parent < i);
-            manager[i].world = world[parent] * static_cast<mat4f const&>(manager[i].local);
         }
+        std::swap(level, nextLevel);
+    }
+}
+
+// Reorders the nodes breadth-first: roots first, then each level of the hierarchy in turn.
+// Parents are stored before their children and siblings are contiguous, which keeps the
+// per-level updates of updateDirtySubtrees() mostly sequential in memory.
+// This invalidates all Instances.
+void FTransformManager::sortBreadthFirst() noexcept {
+    SYSTRACE_CALL();
+
+    auto& manager = mManager;
+    const size_t count = manager.getComponentCount();
+
+    std::vector<Instance> order;
+    order.reserve(count);
+    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+        Instance parent = manager[i].parent;
+        if (!parent) {
+            order.push_back(i);
+        }
+    }
+    for (size_t k = 0; k < order.size(); k++) {
+        for (Instance child = manager[order[k]].firstChild; child; child = manager[child].next) {
+            order.push_back(child);
+        }
+    }
+    assert(order.size() == count);
+
+    // node originally at order[k] moves to begin() + k
+    // 'position' tracks where each original node currently is, 'original' the reverse
+    std::vector<Instance> remap(count + 1);
+    std::vector<Instance> position(count + 1);
+    std::vector<Instance> original(count + 1);
+    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+        position[i] = original[i] = i;
+    }
+    for (size_t k = 0; k < count; k++) {
+        const Instance target = Instance(manager.begin() + k);
+        const Instance source = position[order[k]];
+        remap[order[k]] = target;
+        if (source != target) {
+            swapElements(target, source);
+            const Instance displaced = original[target];
+            original[source] = displaced;
+            position[displaced] = source;
+            original[target] = order[k];
+            position[order[k]] = target;
+        }
+    }
+
+    // the links still refer to the old instances
+    Instance* const UTILS_RESTRICT parents = manager.data<PARENT>();
+    Instance* const UTILS_RESTRICT firstChildren = manager.data<FIRST_CHILD>();
+    Instance* const UTILS_RESTRICT nexts = manager.data<NEXT>();
+    Instance* const UTILS_RESTRICT prevs = manager.data<PREV>();
+    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+        parents[i] = remap[parents[i]];
+        firstChildren[i] = remap[firstChildren[i]];
+        nexts[i] = remap[nexts[i]];
+        prevs[i] = remap[prevs[i]];
     }
 }
 
@@ -188,42 +322,17 @@ void FTransformManager::insertNode(Instance i, Instance parent) noexcept {
     validateNode(parent);
 }
 
-void FTransformManager::swapNode(Instance i, Instance j) noexcept {
-    validateNode(i);
-    validateNode(j);
-
+// swaps the content of two nodes, without updating the links that refer to them
+void FTransformManager::swapElements(Instance i, Instance j) noexcept {
     auto& manager = mManager;
-
-    // swap the content of the nodes directly
-    std::swap(manager.elementAt<LOCAL>(i), manager.elementAt<LOCAL>(j));
-    std::swap(manager.elementAt<WORLD>(i), manager.elementAt<WORLD>(j));
+    std::swap(manager.elementAt<LOCAL>(i),       manager.elementAt<LOCAL>(j));
+    std::swap(manager.elementAt<WORLD>(i),       manager.elementAt<WORLD>(j));
+    std::swap(manager.elementAt<PARENT>(i),      manager.elementAt<PARENT>(j));
+    std::swap(manager.elementAt<FIRST_CHILD>(i), manager.elementAt<FIRST_CHILD>(j));
+    std::swap(manager.elementAt<NEXT>(i),        manager.elementAt<NEXT>(j));
+    std::swap(manager.elementAt<PREV>(i),        manager.elementAt<PREV>(j));
+    std::swap(manager.elementAt<DIRTY>(i),       manager.elementAt<DIRTY>(j));
     manager.swap(i, j); // this swaps the data relative to SingleInstanceComponentManager
-
-    // now swap the linked-list references, to do that correctly we must use a temporary
-    // node to fix-up the linked-list pointers
-    // Here we are guaranteed to have enough capacity for our temporary storage, so we
-    // can safely use the item just past the end of the array.
-    assert(manager.getSoA().capacity() >= manager.getSoA().size() + 1);
-
-    const Instance t = manager.end();
-
-    manager[t].parent       = manager[i].parent;
-    manager[t].firstChild   = manager[i].firstChild;
-    manager[t].next         = manager[i].next;
-    manager[t].prev         = manager[i].prev;
-    updateNode(t);
-
-    manager[i].parent       = manager[j].parent;
-    manager[i].firstChild   = manager[j].firstChild;
-    manager[i].next         = manager[j].next;
-    manager[i].prev         = manager[j].prev;
-    updateNode(i);
-
-    manager[j].parent       = manager[t].parent;
-    manager[j].firstChild   = manager[t].firstChild;
-    manager[j].next         = manager[t].next;
-    manager[j].prev         = manager[t].prev;
-    updateNode(j);
 }
 
 // removes an node from the graph, but doesn't removes it or its children from the array
@@ -283,18 +392,20 @@ void FTransformManager::updateNode(Instance i) noexcept {
     validateNode(next);
 }
 
-void FTransformManager::transformChildren(Sim& manager, Instance ci) noexcept {
+void FTransformManager::transformChildren(Sim& manager, ChangeLog& log, Instance ci) noexcept {
     while (ci) {
         // update child's world transform
         Instance parent = manager[ci].parent;
-        mat4f const& pt = manager[parent].world;
-        mat4f const& local = manager[ci].local;
-        manager[ci].world = pt * local;
+        affinef const& pt = manager[parent].world;
+        affinef const& local = manager[ci].local;
+        affinef& world = manager[ci].world;
+        multiply(world, pt, local);
+        log.add(manager.getEntity(ci));
 
         // assume we don't have a deep hierarchy
         Instance child = manager[ci].firstChild;
         if (UTILS_UNLIKELY(child)) {
-            transformChildren(manager, child);
+            transformChildren(manager, log, child);
         }
 
         // process our next child
@@ -380,11 +491,11 @@ void TransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     upcast(this)->setTransform(ci, model);
 }
 
-const mat4f& TransformManager::getTransform(Instance ci) const noexcept {
+mat4f TransformManager::getTransform(Instance ci) const noexcept {
     return upcast(this)->getTransform(ci);
 }
 
-const mat4f& TransformManager::getWorldTransform(Instance ci) const noexcept {
+mat4f TransformManager::getWorldTransform(Instance ci) const noexcept {
     return upcast(this)->getWorldTransform(ci);
 }
 
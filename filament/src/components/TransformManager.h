@@ -19,6 +19,8 @@
 
 #include "upcast.h"
 
+#include "components/ChangeLog.h"
+
 #include <filament/TransformManager.h>
 
 #include <utils/compiler.h>
@@ -26,8 +28,15 @@
 #include <utils/Entity.h>
 #include <utils/Slice.h>
 
+#include <math/affine.h>
 #include <math/mat4.h>
 
+#include <vector>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
 namespace filament {
 namespace details {
 
@@ -35,7 +44,8 @@ class UTILS_PRIVATE FTransformManager : public TransformManager {
 public:
     using Instance = TransformManager::Instance;
 
-    FTransformManager() noexcept;
+    // the JobSystem, if any, is used to update the world transforms in parallel
+    explicit FTransformManager(utils::JobSystem* js = nullptr) noexcept;
     ~FTransformManager() noexcept;
 
     // free-up all resources
@@ -68,20 +78,34 @@ public:
 
     void gc(utils::EntityManager& em) noexcept;
 
-    utils::Slice<const math::mat4f> getWorldTransforms() const noexcept {
+    utils::Slice<const math::affinef> getWorldTransforms() const noexcept {
         return mManager.slice<WORLD>();
     }
 
     void setTransform(Instance ci, const math::mat4f& model) noexcept;
 
-    const math::mat4f& getTransform(Instance ci) const noexcept {
+    math::mat4f getTransform(Instance ci) const noexcept {
+        return getTransformAffine(ci).toMat4();
+    }
+
+    math::mat4f getWorldTransform(Instance ci) const noexcept {
+        return getWorldTransformAffine(ci).toMat4();
+    }
+
+    // transforms are stored as affine matrices, these avoid the conversion to mat4f
+    math::affinef const& getTransformAffine(Instance ci) const noexcept {
         return mManager[ci].local;
     }
 
-    const math::mat4f& getWorldTransform(Instance ci) const noexcept {
+    math::affinef const& getWorldTransformAffine(Instance ci) const noexcept {
         return mManager[ci].world;
     }
 
+    // entities whose world transform (or transform component) changed
+    ChangeLog const& getChangeLog() const noexcept {
+        return mChangeLog;
+    }
+
 private:
     struct Sim;
 
@@ -90,8 +114,10 @@ private:
     void updateNode(Instance i) noexcept;
     void updateNodeTransform(Instance i) noexcept;
     void insertNode(Instance i, Instance p) noexcept;
-    void swapNode(Instance i, Instance j) noexcept;
-    static void transformChildren(Sim& manager, Instance firstChild) noexcept;
+    void swapElements(Instance i, Instance j) noexcept;
+    void sortBreadthFirst() noexcept;
+    void updateDirtySubtrees() noexcept;
+    static void transformChildren(Sim& manager, ChangeLog& log, Instance firstChild) noexcept;
 
 
     enum {
@@ -101,22 +127,23 @@ private:
         FIRST_CHILD,    // instance to our first child
         NEXT,           // instance to our next sibling
         PREV,           // instance to our previous sibling
+        DIRTY,          // local transform changed during the current transaction
     };
 
     using Base = utils::SingleInstanceComponentManager<
-            math::mat4f,
-            math::mat4f,
+            math::affinef,
+            math::affinef,
             Instance,
             Instance,
             Instance,
-            Instance
+            Instance,
+            bool
     >;
 
     struct Sim : public Base {
         using Base::gc;
         using Base::swap;
-
-        typename Base::SoA& getSoA() { return mData; }
+        using Base::data;
 
         struct Proxy {
             // all of this gets inlined
@@ -132,6 +159,7 @@ private:
                 Field<FIRST_CHILD>  firstChild;
                 Field<NEXT>         next;
                 Field<PREV>         prev;
+                Field<DIRTY>        dirty;
             };
         };
 
@@ -144,7 +172,19 @@ private:
     };
 
     Sim mManager;
+    ChangeLog mChangeLog;
+    utils::JobSystem* const mJobSystem;
     bool mLocalTransformTransactionOpen = false;
+
+    // true when a node may be stored before its parent, or its siblings are not contiguous
+    bool mNeedsSorting = false;
+
+    // entities whose local transform changed during the current transaction
+    std::vector<utils::Entity> mDirty;
+
+    // scratch storage for commitLocalTransformTransaction()
+    std::vector<Instance> mLevel;
+    std::vector<Instance> mNextLevel;
 };
 
 FILAMENT_UPCAST(TransformManager)
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_BOUNDINGVOLUMEHIERARCHY_H
+#define TNT_FILAMENT_DETAILS_BOUNDINGVOLUMEHIERARCHY_H
+
+#include "details/Culler.h"
+
+#include <filament/Frustum.h>
+
+#include <utils/compiler.h>
+
+#include <math/vec3.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
+namespace filament {
+namespace details {
+
+/*
+ * A bounding volume hierarchy over an array of AABBs (the "primitives"), used to accelerate
+ * culling by accepting or rejecting whole groups of boxes at once.
+ *
+ * The hierarchy defines the order in which the boxes must be stored in the arrays given to
+ * cull(), such that each node covers a contiguous range of them. Leaves start on a multiple
+ * of Culler::MODULO and are tested with the regular Culler kernel.
+ *
+ * When boxes move, refit() updates the bounds of the nodes containing them, without changing
+ * the structure of the hierarchy.
+ */
+class BoundingVolumeHierarchy {
+public:
+    // maximum number of primitives per leaf, must be a multiple of Culler::MODULO
+    static constexpr size_t LEAF_SIZE = Culler::MODULO * 4;
+
+    BoundingVolumeHierarchy() noexcept = default;
+    BoundingVolumeHierarchy(BoundingVolumeHierarchy const& rhs) = delete;
+    BoundingVolumeHierarchy& operator=(BoundingVolumeHierarchy const& rhs) = delete;
+
+    // builds the hierarchy over 'count' primitives
+    void build(math::float3 const* center, math::float3 const* extent, size_t count);
+
+    // updates the bounds of the nodes containing the given primitives
+    void refit(math::float3 const* center, math::float3 const* extent,
+            uint32_t const* primitives, size_t count);
+
+    void clear() noexcept;
+
+    size_t size() const noexcept { return mOrder.size(); }
+
+    // returns the primitive to store at each position of the arrays given to cull()
+    uint32_t const* getOrder() const noexcept { return mOrder.data(); }
+
+    // same as Culler::intersects(), but 'center' and 'extent' are in hierarchy order
+    void cull(utils::JobSystem& js, Culler::result_type* results, Frustum const& frustum,
+            math::float3 const* center, math::float3 const* extent, size_t bit) const;
+
+private:
+    struct Node {
+        math::float3 center;
+        uint32_t first;         // position of the first primitive covered by this node
+        math::float3 extent;
+        uint32_t count;         // number of primitives covered by this node
+        uint32_t right;         // index of the right child (the left child is the next node)
+        uint32_t parent;        // index of the parent node (the root is its own parent)
+        bool isLeaf() const noexcept { return count <= LEAF_SIZE; }
+    };
+
+    uint32_t buildNode(math::float3 const* center, math::float3 const* extent,
+            uint32_t first, uint32_t count, uint32_t parent);
+
+    void computeBounds(Node& node,
+            math::float3 const* center, math::float3 const* extent) const noexcept;
+
+    std::vector<Node> mNodes;           // nodes in depth-first order
+    std::vector<uint32_t> mOrder;       // position -> primitive
+    std::vector<uint32_t> mPositions;   // primitive -> position
+    std::vector<uint32_t> mLeaves;      // position / Culler::MODULO -> leaf node
+    std::vector<uint32_t> mRefitNodes;  // scratch list used by refit()
+    std::vector<bool> mRefitMarks;      // scratch flags used by refit()
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_BOUNDINGVOLUMEHIERARCHY_H
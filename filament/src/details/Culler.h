@@ -48,6 +48,21 @@ public:
 
     using result_type = uint8_t;
 
+    // Implementations of the culling kernels. The fastest one supported by the CPU is
+    // selected the first time Culler is used.
+    enum class Kernel : uint8_t {
+        GENERIC,    // portable C++, relies on auto-vectorization
+        NEON,       // ARMv8 NEON
+        AVX2,       // x86-64 AVX2
+        AVX512,     // x86-64 AVX-512F
+    };
+
+    // returns whether the given kernel can be used on this CPU
+    static bool isSupported(Kernel kernel) noexcept;
+
+    // returns the kernel used by intersects()
+    static Kernel getKernel() noexcept;
+
     /*
      * returns whether each AABB in an array intersects with the frustum
      */
@@ -92,6 +107,18 @@ public:
                 Frustum const& frustum,
                 math::float4 const* b,
                 size_t count) noexcept;
+
+        // same as above, using a specific kernel, which must be supported
+        static void intersects(Kernel kernel, result_type* results,
+                Frustum const& frustum,
+                math::float3 const* c,
+                math::float3 const* e,
+                size_t count) noexcept;
+
+        static void intersects(Kernel kernel, result_type* results,
+                Frustum const& frustum,
+                math::float4 const* b,
+                size_t count) noexcept;
     };
 };
 
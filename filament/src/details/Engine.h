@@ -109,7 +109,8 @@ public:
 
 public:
     static FEngine* create(Backend backend = Backend::DEFAULT,
-            Platform* platform = nullptr, void* sharedGLContext = nullptr);
+            Platform* platform = nullptr, void* sharedGLContext = nullptr,
+            const char* commandCapturePath = nullptr);
 
     ~FEngine() noexcept;
 
@@ -275,7 +276,7 @@ public:
 
 private:
     FEngine(Backend backend, Platform* platform, void* sharedGLContext);
-    void init();
+    void init(const char* commandCapturePath);
 
     int loop();
     void flushCommandBuffer(CommandBufferQueue& commandBufferQueue);
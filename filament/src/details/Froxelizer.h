@@ -55,8 +55,8 @@ public:
 };
 
 //
-// Light UBO           Froxel Record Buffer     per-froxel light list texture
-// {4 x float4}         R_U8  {index into        RG_U16 {offset, point-count, spot-sount}
+// Light texture       Froxel Record Buffer     per-froxel light list texture
+// {4 x float4}         R_U16 {index into        RG_U32 {offset, point-count, spot-sount}
 // (spot/point            light texture}
 //
 //  +----+                     +-+                     +----+
@@ -69,11 +69,11 @@ public:
 //  :    :                     | |                     |    |
 //  :    :                     | |                     |    |
 //  :    :                     +-+                     |    |
-//  :    :                  65536 max                  +----+
+//  :    :                  131072 max                 +----+
 //  |....|                                          h = num froxels
 //  |....|
 //  +----+
-// 256 lights max
+// 1024 lights max
 //
 
 // Max number of froxels limited by:
@@ -81,8 +81,8 @@ public:
 // - chosen texture width [64]
 // - size of CPU-side indices [16 bits]
 // Also, increasing the number of froxels adds more pressure on the "record buffer" which stores
-// the light indices per froxel. The record buffer is limited to 65536 entries, so with
-// 8192 froxels, we can store 8 lights per froxels assuming they're all used. In practice, some
+// the light indices per froxel. The record buffer is limited to 131072 entries, so with
+// 8192 froxels, we can store 16 lights per froxels assuming they're all used. In practice, some
 // froxels are not used, so we can store more.
 static constexpr size_t FROXEL_BUFFER_ENTRY_COUNT_MAX = 8192;
 
@@ -99,22 +99,29 @@ public:
     // gpu buffer containing froxels. valid after construction.
     GPUBuffer const& getFroxelBuffer() const noexcept { return mFroxelBuffer; }
 
+    // gpu buffer containing the point and spot lights, filled by FScene::prepareDynamicLights().
+    // valid after construction.
+    GPUBuffer const& getLightBuffer() const noexcept { return mLightBuffer; }
+    GPUBuffer& getLightBuffer() noexcept { return mLightBuffer; }
+
     void setOptions(float zLightNear, float zLightFar) noexcept;
 
     /*
-     * Allocate per-frame data structures for froxelization.
+     * Allocate per-frame data structures for froxelization, and find which lights changed
+     * since the last frame. Froxelization and commit() become no-ops when nothing did.
      *
+     * engine            used to access the lights' parameters
      * driverApi         used to allocate memory in the stream
      * arena             use to allocate per-frame memory
      * viewport          viewport used to calculate froxel dimensions
-     * projection        camera projection matrix
-     * projectionNear    near plane
-     * projectionFar     far plane
+     * camera            camera projection, near/far planes and view matrix
+     * lightData         visible lights, already sorted and trimmed to CONFIG_MAX_LIGHT_COUNT
      *
      * return true if updateUniforms() needs to be called
      */
-    bool prepare(driver::DriverApi& driverApi, ArenaScope& arena, Viewport const& viewport,
-            const math::mat4f& projection, float projectionNear, float projectionFar) noexcept;
+    bool prepare(FEngine& engine, driver::DriverApi& driverApi, ArenaScope& arena,
+            Viewport const& viewport, CameraInfo const& camera,
+            const FScene::LightSoa& lightData) noexcept;
 
     Froxel getFroxelAt(size_t x, size_t y, size_t z) const noexcept;
     size_t getFroxelCountX() const noexcept { return mFroxelCountX; }
@@ -122,9 +129,8 @@ public:
     size_t getFroxelCountZ() const noexcept { return mFroxelCountZ; }
     size_t getFroxelCount() const noexcept { return mFroxelCount; }
 
-    // update Records and Froxels texture with lights data. this is thread-safe.
-    void froxelizeLights(FEngine& engine, CameraInfo const& camera,
-            const FScene::LightSoa& lightData) noexcept;
+    // update Records and Froxels texture with the lights given to prepare(). this is thread-safe.
+    void froxelizeLights(FEngine& engine) noexcept;
 
     void updateUniforms(UniformBuffer& u) {
         u.setUniform(offsetof(PerViewUib, zParams), mParamsZ);
@@ -134,7 +140,7 @@ public:
         u.setUniform(offsetof(PerViewUib, oneOverFroxelDimensionY), mOneOverDimension.y);
     }
 
-    // send froxel data to GPU
+    // send froxel data to GPU, unless it's the same as last frame's
     void commit(driver::DriverApi& driverApi);
 
 
@@ -144,27 +150,27 @@ public:
 
     struct FroxelEntry {
         union {
-            uint32_t u32;
+            uint64_t u64;
             struct {
-                uint16_t offset = 0;
+                uint32_t offset = 0;
                 union {
-                    uint8_t count[2] = { 0, 0 };
+                    uint16_t count[2] = { 0, 0 };
                     struct {
-                        uint8_t pointLightCount;
-                        uint8_t spotLightCount;
+                        uint16_t pointLightCount;
+                        uint16_t spotLightCount;
                     };
                 };
             };
         };
     };
-    // This depends on the maximum number of lights (currently 255),and can't be more than 16 bits.
+    // Light indices and per-froxel light counts are stored on 16 bits.
     static_assert(CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint16_t>::max(), "can't have more than 65536 lights");
     using RecordBufferType = std::conditional_t<CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint8_t>::max(), uint8_t, uint16_t>;
     const utils::Slice<FroxelEntry>& getFroxelBufferUser() const { return mFroxelBufferUser; }
     const utils::Slice<RecordBufferType>& getRecordBufferUser() const { return mRecordBufferUser; }
 
     // this is chosen so froxelizePointAndSpotLight() vectorizes 4 froxel tests / spotlight
-    // with 256 lights this implies 8 jobs (256 / 32) for froxelization.
+    // with 1024 lights this implies 32 jobs (1024 / 32) for froxelization.
     using LightGroupType = uint32_t;
 
 private:
@@ -187,12 +193,11 @@ private:
         float min;          // lights z-range min
         float max;          // lights z-range max
 
+        uint32_t offset;    // offset in record buffer
         uint16_t next;      // next node when range test fails
-        uint16_t offset;    // offset in record buffer
 
         uint8_t isLeaf;
         uint8_t count;      // light count in record buffer
-        uint16_t reserved;
     };
 
     // The first entry always encodes the type of light, i.e. point/spot
@@ -202,14 +207,20 @@ private:
     void setProjection(const math::mat4f& projection, float near, float far) noexcept;
     bool update() noexcept;
 
-    void froxelizeLoop(FEngine& engine,
+    void updateLightParams(FEngine& engine,
             const CameraInfo& camera, const FScene::LightSoa& lightData) noexcept;
 
+    void froxelizeLoop(FEngine& engine) noexcept;
+
     void froxelizeAssignRecordsCompress() noexcept;
 
     void froxelizePointAndSpotLight(FroxelThreadData& froxelThread, size_t bit,
             math::mat4f const& projection, const LightParams& light) const noexcept;
 
+    static void froxelizeSpotLightRow(LightGroupType* entries,
+            math::float4 const* spheres, size_t count, float rowRadius, size_t bit,
+            const LightParams& light) noexcept;
+
     static void computeLightTree(LightTreeNode* lightTree,
             utils::Slice<RecordBufferType> const& lightList,
             const FScene::LightSoa& lightData, size_t lightRecordsOffset) noexcept;
@@ -227,19 +238,26 @@ private:
             Viewport const& viewport) noexcept;
 
     // internal state dependant on the viewport and needed for froxelizing
-    LinearAllocatorArena mArena;                    // ~256 KiB
+    LinearAllocatorArena mArena;                    // ~552 KiB
 
     float* mDistancesZ = nullptr;                   // max 2.1 MiB (actual: resolution dependant)
     math::float4* mPlanesX = nullptr;
     math::float4* mPlanesY = nullptr;
     math::float4* mBoundingSpheres = nullptr;
+    float* mRowRadii = nullptr;                     // largest froxel radius of each row
+
+    // these persist across frames, so that only the groups of lights that changed are
+    // froxelized again.
+    utils::Slice<FroxelThreadData> mFroxelShardedData;  //   1 MiB w/ 1024 lights
+    utils::Slice<LightParams> mLightParams;             //  36 KiB w/ 1024 lights
+    size_t mLightCount = 0;                             // lights in mLightParams
+    utils::bitset32 mDirtyGroups;                       // groups to froxelize again
 
-    utils::Slice<FroxelThreadData> mFroxelShardedData;  // 256 KiB w/  256 lights
-    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
+    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  64 KiB w/ 8192 froxels
 
     // max 32 KiB  (actual: resolution dependant)
-    utils::Slice<RecordBufferType> mRecordBufferUser;   //  64 KiB
-    utils::Slice<LightRecord> mLightRecords;            // 256 KiB w/ 256 lights
+    utils::Slice<RecordBufferType> mRecordBufferUser;   // 256 KiB w/ 1024 lights
+    utils::Slice<LightRecord> mLightRecords;            //   1 MiB w/ 1024 lights
 
     uint16_t mFroxelCountX = 0;
     uint16_t mFroxelCountY = 0;
@@ -255,6 +273,7 @@ private:
     math::float2 mOneOverDimension = {};
     GPUBuffer mRecordsBuffer;
     GPUBuffer mFroxelBuffer;
+    GPUBuffer mLightBuffer;
 
     // needed for update()
     Viewport mViewport;
@@ -75,7 +75,11 @@ public:
 
     SamplerBuffer const& getSamplerBuffer() const noexcept { return mSamplers; }
 
+    // changes whenever the parameters seen by the GPU, the scissor or the polygon offset change
+    uint32_t getGeneration() const noexcept { return mGeneration; }
+
     void setScissor(int32_t left, int32_t bottom, uint32_t width, uint32_t height) noexcept {
+        mGeneration++;
         mScissorRect[0] = left;
         mScissorRect[1] = bottom;
         mScissorRect[2] = (int32_t)std::min(width,  (uint32_t)std::numeric_limits<int32_t>::max());
@@ -83,11 +87,13 @@ public:
     }
 
     void unsetScissor() noexcept {
+        mGeneration++;
         mScissorRect[0] = mScissorRect[1] = 0;
         mScissorRect[2] = mScissorRect[3] = std::numeric_limits<int32_t>::max();
     }
 
     void setPolygonOffset(float scale, float constant) noexcept {
+        mGeneration++;
         mPolygonOffset = { scale, constant };
     }
 
@@ -112,6 +118,7 @@ private:
     Driver::PolygonOffset mPolygonOffset;
 
     uint64_t mMaterialSortingKey = 0;
+    mutable uint32_t mGeneration = 0;
 
     // Scissor rectangle is specified as: Left Bottom Width Height.
     int32_t mScissorRect[4] = {
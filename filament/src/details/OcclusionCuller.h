@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
+#define TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
+
+#include "details/Scene.h"
+
+#include <utils/compiler.h>
+
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
+namespace filament {
+namespace details {
+
+/*
+ * A software occlusion culler.
+ *
+ * The bounding boxes of the renderables marked as occluders are rasterized into a small
+ * floating-point depth buffer, then the bounding box of each visible renderable is projected
+ * on screen and compared against that buffer. Renderables entirely hidden behind occluders
+ * are removed from the visible set before any command is generated for them.
+ *
+ * Occluders are rasterized from their local bounding box transformed by their world
+ * transform, i.e. an oriented box. Their world-space box is larger than the geometry when
+ * they're rotated, and would hide renderables that are visible. Occludees are tested with
+ * their world-space box, which can only make them more visible.
+ *
+ * Depths are stored in normalized device coordinates (smaller is closer). The depth buffer is
+ * divided into tiles, each holding the farthest depth it contains, so that most tests can be
+ * resolved without looking at individual pixels.
+ */
+class OcclusionCuller {
+public:
+    // size of the tiles of the hierarchical depth buffer, in pixels
+    static constexpr size_t TILE_SIZE = 8;
+
+    // limits of the depth buffer resolution
+    static constexpr size_t MIN_RESOLUTION = TILE_SIZE;
+    static constexpr size_t MAX_RESOLUTION = 2048;
+
+    struct Stats {
+        uint32_t occluders = 0;     // number of occluders rasterized
+        uint32_t tested = 0;        // number of renderables tested
+        uint32_t occluded = 0;      // number of renderables found to be occluded
+    };
+
+    OcclusionCuller() noexcept = default;
+    OcclusionCuller(OcclusionCuller const& rhs) = delete;
+    OcclusionCuller& operator=(OcclusionCuller const& rhs) = delete;
+
+    // Sets the size of the depth buffer, which is rounded up to a multiple of TILE_SIZE.
+    void setResolution(size_t width, size_t height);
+
+    size_t getWidth() const noexcept { return mWidth; }
+    size_t getHeight() const noexcept { return mHeight; }
+
+    /*
+     * Rasterizes the occluders and clears 'bit' in the VISIBLE_MASK of the renderables they
+     * hide. Only renderables that have 'bit' set, that belong to 'visibleLayers' and have
+     * culling enabled participate, either as occluders or as occludees. 'rcm' provides the
+     * local bounding boxes of the occluders.
+     */
+    void cull(utils::JobSystem& js, FRenderableManager const& rcm,
+            FScene::RenderableSoa& renderableData,
+            math::mat4f const& clipFromWorld, uint8_t visibleLayers, size_t bit);
+
+    Stats const& getStats() const noexcept { return mStats; }
+
+    // depth of pixel (x, y), y pointing up, for debugging
+    float getDepth(size_t x, size_t y) const noexcept { return mDepth[y * mWidth + x]; }
+
+private:
+    struct Triangle {
+        math::float3 edges[3];      // e.x * x + e.y * y + e.z >= 0 inside the triangle
+        math::float3 depth;         // z = depth.x * x + depth.y * y + depth.z
+        int32_t xmin, xmax;         // pixels covered horizontally, [xmin, xmax)
+        int32_t ymin, ymax;         // pixels covered vertically, [ymin, ymax)
+    };
+
+    // adds the box of 'extent' around 'center', in the space transformed by 'clipFromModel'
+    void addOccluder(math::mat4f const& clipFromModel,
+            math::float3 const& center, math::float3 const& extent);
+
+    void addTriangle(math::float3 p0, math::float3 p1, math::float3 p2);
+
+    void rasterize(size_t firstTileRow, size_t tileRowCount) noexcept;
+
+    bool isOccluded(math::mat4f const& clipFromWorld,
+            math::float3 const& center, math::float3 const& extent) const noexcept;
+
+    size_t mWidth = 0;
+    size_t mHeight = 0;
+    std::vector<float> mDepth;          // per-pixel depth
+    std::vector<float> mTiles;          // per-tile maximum depth
+    std::vector<Triangle> mTriangles;   // scratch list of the occluders' triangles
+    Stats mStats;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_OCCLUSIONCULLER_H
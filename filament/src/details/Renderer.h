@@ -103,18 +103,29 @@ private:
                 utils::GrowingSlice<Command>& commands) noexcept;
     };
 
-    // this class is defined in RenderPass.cpp
+public:
+    // this class is defined in RenderPass.cpp, it's public so the shadow map reuse can be tested
     class ShadowPass final : public RenderPass {
         using DriverApi = driver::DriverApi;
         ShadowMap const& shadowMap;
+        const size_t cascade;
         void beginRenderPass(driver::DriverApi& driver, Viewport const& viewport, const CameraInfo& camera) noexcept override;
         void endRenderPass(DriverApi& driver, Viewport const& viewport) noexcept override;
     public:
-        ShadowPass(const char* name, ShadowMap const& shadowMap) noexcept;
-        static void renderShadowMap(FEngine& engine, utils::JobSystem& js,
+        ShadowPass(const char* name, ShadowMap const& shadowMap, size_t cascade,
+                VisibilityMask visibilityMask) noexcept;
+        // returns the number of shadow maps (or cascades) drawn, i.e. not reused
+        static size_t renderShadowMap(FEngine& engine, utils::JobSystem& js,
                 FView& view, utils::GrowingSlice<Command>& commands) noexcept;
+        // returns false if the shadow map of the light was reused from the previous frame
+        static bool renderShadowMapCascade(FEngine& engine, utils::JobSystem& js,
+                FView& view, ShadowMap const& shadowMap, size_t cascade,
+                VisibilityMask visibilityMask, RenderFlags renderFlags,
+                RenderPass::CommandCache& cache, RenderPass::InstanceBuffer& instances,
+                utils::GrowingSlice<Command>& commands) noexcept;
     };
 
+private:
     Handle<HwRenderTarget> getRenderTarget() const noexcept { return mRenderTarget; }
 
     void recordHighWatermark(utils::Slice<Command> const& commands) noexcept {
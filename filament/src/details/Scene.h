@@ -22,6 +22,7 @@
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
 
+#include "details/BoundingVolumeHierarchy.h"
 #include "details/Culler.h"
 
 #include "Allocators.h"
@@ -36,9 +37,15 @@
 #include <utils/Range.h>
 
 #include <cstddef>
+#include <vector>
+
+#include <tsl/robin_map.h>
 #include <tsl/robin_set.h>
 
 namespace filament {
+
+class GPUBuffer;
+
 namespace details {
 
 struct CameraInfo;
@@ -65,8 +72,17 @@ public:
     void remove(utils::Entity entity);
 
     size_t getRenderableCount() const noexcept;
+
+    // incremented each time the data gathered from the renderables or lights changes
+    uint64_t getCacheGeneration() const noexcept { return mCacheGeneration; }
+
+    // incremented each time the data gathered from shadow casting renderables changes
+    uint64_t getShadowCasterGeneration() const noexcept { return mShadowCasterGeneration; }
     size_t getLightCount() const noexcept;
 
+    void setBoundingVolumeHierarchyEnabled(bool enabled) noexcept;
+    bool isBoundingVolumeHierarchyEnabled() const noexcept { return mBvhEnabled; }
+
 public:
     /*
      * Filaments-scope Public API
@@ -81,7 +97,7 @@ public:
     void terminate(FEngine& engine);
 
     void prepare(const math::mat4f& worldOriginTransform);
-    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena, Handle<HwUniformBuffer> lightUbh) noexcept;
+    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena, GPUBuffer& lightBuffer) noexcept;
     void computeBounds(Aabb& castersBox, Aabb& receiversBox, uint32_t visibleLayers) const noexcept;
 
 
@@ -95,11 +111,12 @@ public:
 
     enum {
         RENDERABLE_INSTANCE,    //  4 instance of the Renderable component
-        WORLD_TRANSFORM,        // 16 instance of the Transform component
+        WORLD_TRANSFORM,        // 12 instance of the Transform component
         VISIBILITY_STATE,       //  1 visibility data of the component
         BONES_UBH,              //  4 bones uniform buffer handle
         WORLD_AABB_CENTER,      // 12 world-space bounding box center of the renderable
         VISIBLE_MASK,           //  1 each bit represents a visibility in a pass
+        SPOT_SHADOW_MASK,       //  1 each bit represents a visibility in a spot light's shadow
 
         // These are not needed anymore after culling
         LAYERS,                 //  1 layers
@@ -112,11 +129,12 @@ public:
 
     using RenderableSoa = utils::StructureOfArrays<
             utils::EntityInstance<RenderableManager>,
-            math::mat4f,
+            math::affinef,
             FRenderableManager::Visibility,
             Handle<HwUniformBuffer>,
             math::float3,
             Culler::result_type,
+            Culler::result_type,
             uint8_t,
             math::float3,
             utils::Slice<FRenderPrimitive>,
@@ -126,6 +144,11 @@ public:
     RenderableSoa const& getRenderableData() const noexcept { return mRenderableData; }
     RenderableSoa& getRenderableData() noexcept { return mRenderableData; }
 
+    // returns the hierarchy matching the order of the renderable data, or null if disabled
+    BoundingVolumeHierarchy const* getBoundingVolumeHierarchy() const noexcept {
+        return mBvhEnabled ? &mBvh : nullptr;
+    }
+
     static inline uint32_t getPrimitiveCount(RenderableSoa const& soa,
             uint32_t first, uint32_t last) noexcept {
         // the caller must guarantee that last is dereferenceable
@@ -147,7 +170,13 @@ public:
         DIRECTION,
         LIGHT_INSTANCE,
         VISIBILITY,
-        SCREEN_SPACE_Z_RANGE
+        SCREEN_SPACE_Z_RANGE,
+        SHADOW_INFO
+    };
+
+    struct ShadowInfo {
+        bool castsShadows = false;  // whether the light's shadow map is valid this frame
+        uint8_t index = 0;          // index of the light's shadow map in the View
     };
 
     using LightSoa = utils::StructureOfArrays<
@@ -155,7 +184,8 @@ public:
             math::float3,
             FLightManager::Instance,
             Culler::result_type,
-            math::float2
+            math::float2,
+            ShadowInfo
     >;
 
     LightSoa const& getLightData() const noexcept { return mLightData; }
@@ -163,7 +193,25 @@ public:
 
     void updateUBOs(utils::Range<uint32_t> visibleRenderables, Handle<HwUniformBuffer> renderableUbh) noexcept;
 
+    // Writes the per-renderable uniforms of a renderable with the given world transform, at
+    // 'offset' bytes into 'buffer'.
+    static void setRenderableUniforms(void* buffer, size_t offset,
+            math::affinef const& model) noexcept;
+
+    // Size of the buffer needed for the per-renderable uniforms of 'count' renderables. The
+    // shaders declare these uniforms as an array of CONFIG_MAX_INSTANCES entries for instanced
+    // draws, so the range bound for the last renderables extends past the end of their data.
+    static size_t getRenderableUniformsSize(size_t count) noexcept;
+
 private:
+    // number of entities gathered per job when the whole scene is gathered
+    static constexpr size_t JOBS_PARALLEL_FOR_GATHER_COUNT = 64;
+
+    void updateCachedEntity(utils::Entity e, math::affinef const& worldOriginTransform) noexcept;
+    void gatherAllEntities(math::affinef const& worldOriginTransform) noexcept;
+    void removeCachedEntity(utils::Entity e) noexcept;
+    bool isCachedShadowCaster(utils::Entity e) const noexcept;
+
     static inline void computeLightRanges(math::float2* zrange,
             CameraInfo const& camera, const math::float4* spheres, size_t count) noexcept;
 
@@ -181,6 +229,40 @@ private:
      */
     tsl::robin_set<utils::Entity> mEntities;
 
+    /*
+     * Per-entity data gathered from the component managers (world transform, world AABB, etc...)
+     * This is kept across frames and only updated for the entities that were added to the scene
+     * or changed in a component manager. Each entity keeps the same slot until it's removed,
+     * at which point the last slot is moved into it, or until the whole scene is gathered again
+     * (in parallel), which reassigns all slots.
+     * prepare() copies this into mRenderableData and mLightData, which get reordered by culling.
+     */
+    RenderableSoa mRenderableCache;
+    std::vector<utils::Entity> mRenderableCacheEntities;
+    tsl::robin_map<utils::Entity, uint32_t> mRenderableSlots;
+    LightSoa mLightCache;
+    std::vector<utils::Entity> mLightCacheEntities;
+    tsl::robin_map<utils::Entity, uint32_t> mLightSlots;
+    std::vector<utils::Entity> mAddedEntities;
+    std::vector<utils::Entity> mGatheredEntities;
+    ChangeLog::Generation mTransformGeneration = 0;
+    ChangeLog::Generation mRenderableGeneration = 0;
+    ChangeLog::Generation mLightGeneration = 0;
+    math::mat4f mCacheWorldOriginTransform;
+    uint64_t mCacheGeneration = 0;
+    uint64_t mShadowCasterGeneration = 0;
+    bool mCacheValid = false;
+
+    /*
+     * Optional hierarchy over the renderable cache. It's rebuilt when renderables are added or
+     * removed, and refit when they move. When enabled, mRenderableData is stored in the order
+     * of the hierarchy.
+     */
+    BoundingVolumeHierarchy mBvh;
+    std::vector<uint32_t> mMovedRenderableSlots;
+    bool mBvhEnabled = false;
+    bool mBvhNeedsRebuild = false;
+
 
     /*
      * The data below is valid only during a view pass. i.e. if a scene is used in multiple
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_SHADOWATLAS_H
+#define TNT_FILAMENT_DETAILS_SHADOWATLAS_H
+
+#include "driver/DriverApiForward.h"
+#include "driver/Handle.h"
+#include "driver/SamplerBuffer.h"
+
+#include <filament/EngineEnums.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+namespace details {
+
+/*
+ * The depth texture shared by all the shadow maps of a View.
+ *
+ * Each shadow map (a cascade of the directional light or a spot light) is a square,
+ * power-of-two tile of the atlas. Tiles are allocated in order of priority, a tile that
+ * doesn't fit is shrunk down to its minimum size, or not allocated at all. Allocated tiles
+ * are then laid out by decreasing size along a Z-order curve, which packs power-of-two squares
+ * without any gap. The same requests always produce the same layout, so that shadow maps
+ * can be kept from one frame to the next.
+ *
+ * The texture is only as large as the tiles allocated in a frame, it's reallocated when
+ * that size changes.
+ */
+class ShadowAtlas {
+public:
+    // one tile per cascade of the directional light and per shadow casting spot light
+    static constexpr size_t MAX_TILES = CONFIG_MAX_SHADOW_CASCADES + CONFIG_MAX_SHADOW_CASTING_SPOTS;
+
+    struct Tile {
+        uint16_t x = 0;         // position of the tile in the atlas, in texels
+        uint16_t y = 0;
+        uint16_t size = 0;      // width and height of the tile, 0 if not allocated
+        bool operator==(Tile const& rhs) const noexcept {
+            return x == rhs.x && y == rhs.y && size == rhs.size;
+        }
+        bool operator!=(Tile const& rhs) const noexcept { return !operator==(rhs); }
+    };
+
+    struct Request {
+        uint16_t size = 0;      // desired size, a power of two
+        uint16_t minSize = 0;   // smallest acceptable size, a power of two
+        Tile tile;              // set by allocate()
+    };
+
+    ShadowAtlas() noexcept;
+    ~ShadowAtlas();
+
+    void terminate(driver::DriverApi& driver) noexcept;
+
+    // Allocates the tiles of the given requests, sorted by decreasing priority, in an atlas
+    // of at most maxSize x maxSize texels. maxSize must be a power of two and count at most
+    // MAX_TILES.
+    void allocate(Request* requests, size_t count, uint32_t maxSize) noexcept;
+
+    // (Re)creates the texture if allocate() changed its size, and sets it in the sampler
+    // buffer. Returns true if the texture was recreated, its content is then undefined.
+    bool prepare(driver::DriverApi& driver, SamplerBuffer& sb, size_t samplerIndex) noexcept;
+
+    // Valid after prepare()
+    uint32_t getWidth() const noexcept { return mWidth; }
+    uint32_t getHeight() const noexcept { return mHeight; }
+    Handle<HwRenderTarget> getRenderTarget() const noexcept { return mRenderTarget; }
+
+private:
+    Handle<HwTexture> mTexture;
+    Handle<HwRenderTarget> mRenderTarget;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+
+    // set-up in allocate()
+    uint32_t mRequiredWidth = 0;
+    uint32_t mRequiredHeight = 0;
+};
+
+} // namespace details
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_SHADOWATLAS_H
@@ -21,55 +21,114 @@
 
 #include "details/Camera.h"
 #include "details/Scene.h"
+#include "details/ShadowAtlas.h"
 
 #include "driver/DriverApiForward.h"
-#include "driver/SamplerBuffer.h"
 
 #include <filament/Viewport.h>
 
 #include <math/mat4.h>
 #include <math/vec4.h>
 
+#include <array>
+#include <limits>
+
 namespace filament {
 namespace details {
 
 class ShadowMap {
 public:
+    // Texels around the viewport of each tile of the shadow atlas. They're cleared and never
+    // rendered to, so the shadow filtering doesn't read the neighbouring tiles. This must
+    // cover the footprint of SHADOW_SAMPLING_METHOD in shadowing.fs: 2 texels for PCF_LOW,
+    // 3 for PCF_MEDIUM and 4 for PCF_HIGH.
+    static constexpr uint32_t TILE_BORDER = 2;
+
     explicit ShadowMap(FEngine& engine) noexcept;
     ~ShadowMap();
 
-    void terminate(driver::DriverApi& driverApi) noexcept;
-
     // Call once per frame if the light, scene (or visible layers) or camera changes.
-    // This computes the light's camera.
+    // This computes the light's camera. 'dimension' is the size of the shadow map in texels,
+    // 0 to use the light's shadow map size. 'sharedAtlas' must be set if other shadow maps
+    // can be next to this one in the shadow atlas.
     void update(
             const FScene::LightSoa& lightData, size_t index, FScene const* scene,
-            details::CameraInfo const& camera, uint8_t visibleLayers) noexcept;
+            details::CameraInfo const& camera, uint8_t visibleLayers,
+            uint32_t dimension = 0, bool sharedAtlas = false) noexcept;
 
     // Do we have visible shadows. Valid after calling update().
     bool hasVisibleShadows() const noexcept { return mHasVisibleShadows; }
 
-    // Allocates shadow texture based on user parameters (e.g. dimensions)
-    void prepare(driver::DriverApi& driver, SamplerBuffer& buffer) noexcept;
-
-    // Returns the shadow map's viewport. Valid after prepare().
-    Viewport const& getViewport() const noexcept { return mViewport; }
-
-    // Computes the transform to use in the shader to access the shadow map.
+    // Number of cascades of the shadow map, 1 unless the light uses cascaded shadow maps.
     // Valid after calling update().
+    size_t getCascadeCount() const noexcept { return mCascadeCount; }
+
+    // Does the given cascade have visible shadows. Valid after calling update().
+    bool hasVisibleShadows(size_t cascade) const noexcept {
+        return mCascades[cascade].hasVisibleShadows;
+    }
+
+    // Places the given cascade in its tile of the shadow atlas. The tile must be the size of the
+    // shadow map. 'reallocated' tells whether the atlas texture was recreated this frame.
+    // Call after update().
+    void setTile(size_t cascade, ShadowAtlas::Tile const& tile, ShadowAtlas const& atlas,
+            bool reallocated) noexcept;
+
+    // Returns the viewport of the given cascade in the shadow atlas. Valid after setTile().
+    Viewport const& getViewport(size_t cascade) const noexcept {
+        return mCascades[cascade].viewport;
+    }
+
+    // Computes the transform to use in the shader to access the shadow map, this doesn't
+    // include the scale and offset of the cascades. Valid after calling update().
     math::mat4f const& getLightSpaceMatrix() const noexcept { return mLightSpace; }
 
-    // return the size of a texel in world space (pre-warping)
-    float getTexelSizeWorldSpace() const noexcept { return mTexelSizeWs; }
+    // Returns the transform from world space to the shadow atlas texture, of lights that don't
+    // use cascades. Valid after setTile().
+    math::mat4f getAtlasLightSpaceMatrix() const noexcept {
+        return mCascades[0].tileMapping * mLightSpace;
+    }
+
+    // Returns the scale (xy) and offset (zw) that map the light space xy coordinates to the
+    // viewport of the given cascade, which covers [0, 1]. Valid after setTile().
+    math::float4 const& getCascadeScaleOffset(size_t cascade) const noexcept {
+        return mCascades[cascade].viewportScaleOffset;
+    }
+
+    // Returns the scale (xy) and offset (zw) that map the viewport of the given cascade to the
+    // shadow atlas texture. Valid after setTile().
+    math::float4 const& getCascadeViewportInAtlas(size_t cascade) const noexcept {
+        return mCascades[cascade].atlasScaleOffset;
+    }
+
+    // Returns the view-space distance where the given cascade ends, infinity for the last one.
+    // Valid after calling update().
+    float getCascadeSplit(size_t cascade) const noexcept { return mCascades[cascade].split; }
+
+    // Returns the view-space distance where the shadows end. Valid after calling update().
+    float getShadowFar() const noexcept { return mShadowFar; }
+
+    // return the size of a texel of the given cascade in world space (pre-warping)
+    float getTexelSizeWorldSpace(size_t cascade) const noexcept {
+        return mCascades[cascade].texelSizeWs;
+    }
 
     // Returns the shadow map's depth range. Valid after init().
     float getSceneRange() const noexcept { return mSceneRange; }
 
-    // Returns the light's projection. Valid after calling update().
-    FCamera const& getCamera() const noexcept { return *mCamera; }
+    // Returns the light's projection for the given cascade. Valid after calling update().
+    FCamera const& getCamera(size_t cascade) const noexcept { return *mCascades[cascade].camera; }
+
+    // Can the content of the given cascade be kept from the previous frame. This is the case
+    // if the light has static shadows and the cascade's light camera and the shadow map
+    // didn't change, the caller must also check the shadow casters. Valid after setTile().
+    bool isCascadeReusable(size_t cascade) const noexcept {
+        return mStaticShadows && mCascades[cascade].unchanged;
+    }
 
-    // Set-up the render target, call before rendering the shadow map.
-    void beginRenderPass(driver::DriverApi& driverApi) const noexcept;
+    // Set-up the render target, call before rendering each cascade of the shadow map.
+    // This clears the cascade's tile of the shadow atlas.
+    void beginRenderPass(driver::DriverApi& driverApi, size_t cascade) const noexcept;
 
     // use only for debugging
     FCamera const& getDebugCamera() const noexcept { return *mDebugCamera; }
@@ -84,6 +143,7 @@ private:
         float zf = 0;
         float dzn = 0;
         float dzf = 0;
+        float shadowFar = 0;    // far distance of the shadows, i.e. of the last cascade
         Frustum frustum;
         float getNear() const noexcept { return zn; }
         float getFar() const noexcept { return zf; }
@@ -104,10 +164,38 @@ private:
     // 8 corners, 12 segments w/ 2 intersection max -- all of this twice (8 + 12 * 2) * 2 (768 bytes)
     using FrustumBoxIntersection = std::array<math::float3, 64>;
 
+    struct Cascade {
+        FCamera* camera = nullptr;
+        math::float4 scaleOffset = { 1, 1, 0, 0 };        // within the cascade's tile
+        math::float4 viewportScaleOffset = { 1, 1, 0, 0 }; // within the tile's viewport
+        math::float4 atlasScaleOffset = { 1, 1, 0, 0 };   // of the viewport within the atlas
+        math::mat4f tileMapping;                            // tile to atlas texture coordinates
+        ShadowAtlas::Tile tile;
+        float split = std::numeric_limits<float>::infinity();
+        float texelSizeWs = 0.0f;
+        Viewport viewport;
+        math::mat4f projection;
+        bool hasVisibleShadows = false;
+        bool hadVisibleShadows = false;     // in the previous frame
+        bool unchanged = false;             // same light camera as in the previous frame
+    };
+
     void computeShadowCameraDirectional(
             math::float3 const& direction, FScene const* scene, CameraInfo const& camera,
             uint8_t visibleLayers) noexcept;
 
+    void computeShadowCameraSpot(math::float3 const& position, math::float3 const& dir,
+            float outerConeAngle, float radius, FScene const* scene,
+            uint8_t visibleLayers) noexcept;
+
+    void computeShadowCascades(Aabb const& wsShadowReceiversVolume, CameraInfo const& camera,
+            math::mat4f const& LMpMv, float znear, float zfar) noexcept;
+
+    static math::mat4f setNearFar(math::mat4f projection, float n, float f) noexcept;
+
+    static void setCascadeProjection(Cascade& cascade, math::mat4f const& S,
+            float znear, float zfar) noexcept;
+
     static math::mat4f applyLISPSM(
             CameraInfo const& camera, float dzn, float dzf, const math::mat4f& LMpMv,
             Aabb const& wsShadowReceiversVolume, const math::float3 wsViewFrustumCorners[8],
@@ -167,20 +255,23 @@ private:
             { 2, 6, 7, 3 },  // top
     };
 
-    FCamera* mCamera = nullptr;
     FCamera* mDebugCamera = nullptr;
     math::mat4f mLightSpace;
     float mSceneRange = 0.0f;
-    float mTexelSizeWs = 0.0f;
+    float mShadowFar = 0.0f;
+    std::array<Cascade, CONFIG_MAX_SHADOW_CASCADES> mCascades;
 
-    // set-up in prepare()
-    Viewport mViewport;
-    Handle<HwTexture> mShadowMapHandle;
-    Handle<HwRenderTarget> mShadowMapRenderTarget;
+    // set-up in setTile()
+    Handle<HwRenderTarget> mRenderTarget;
+    uint32_t mAtlasWidth = 0;
+    uint32_t mAtlasHeight = 0;
 
     // set-up in update()
     uint32_t mShadowMapDimension = 0;
+    size_t mCascadeCount = 1;
     bool mHasVisibleShadows = false;
+    bool mStaticShadows = false;
+    bool mSharedAtlas = false;
 
     // use a member here (instead of stack) because we don't want to pay the
     // initialization of the float3 each time
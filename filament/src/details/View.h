@@ -21,11 +21,14 @@
 
 #include "upcast.h"
 
+#include "RenderPass.h"
 #include "UniformBuffer.h"
 
 #include "details/Allocators.h"
 #include "details/Camera.h"
 #include "details/Froxelizer.h"
+#include "details/OcclusionCuller.h"
+#include "details/ShadowAtlas.h"
 #include "details/ShadowMap.h"
 #include "details/Scene.h"
 
@@ -39,6 +42,8 @@
 #include <utils/Range.h>
 
 #include <array>
+#include <memory>
+#include <vector>
 
 namespace utils {
 class JobSystem;
@@ -119,7 +124,8 @@ public:
 
     void prepareCamera(const CameraInfo& camera, const Viewport& viewport) const noexcept;
     void prepareShadowing(FEngine& engine, driver::DriverApi& driver,
-            FScene::RenderableSoa& renderableData, FScene::LightSoa const& lightData) noexcept;
+            FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData,
+            Viewport const& viewport) noexcept;
     void prepareLighting(
             FEngine& engine, FEngine::DriverApi& driver, ArenaScope& arena, Viewport const& viewport) noexcept;
     void froxelize(FEngine& engine) const noexcept;
@@ -128,16 +134,26 @@ public:
 
     bool hasDirectionalLight() const noexcept { return mHasDirectionalLight; }
     bool hasDynamicLighting() const noexcept { return mHasDynamicLighting; }
-    bool hasShadowing() const noexcept { return mHasShadowing & mDirectionalShadowMap.hasVisibleShadows(); }
+    bool hasShadowing() const noexcept { return mHasShadowing; }
+    bool hasDirectionalShadows() const noexcept { return mHasDirectionalShadows; }
 
-    void updatePrimitivesLod(
-            FEngine& engine, const CameraInfo& camera,
-            FScene::RenderableSoa& renderableData, Range visible) noexcept;
+    // Selects the level of detail of the renderables in 'visible', as seen by 'camera' in
+    // 'viewport', which must be the viewport actually rendered, i.e. after dynamic resolution.
+    void updatePrimitivesLod(FEngine& engine, utils::JobSystem& js, const CameraInfo& camera,
+            Viewport const& viewport, FScene::RenderableSoa& renderableData,
+            Range visible) noexcept;
 
     void setShadowsEnabled(bool enabled) noexcept { mShadowingEnabled = enabled; }
 
     ShadowMap const& getShadowMap() const { return mDirectionalShadowMap; }
 
+    // Returns the shadow map of the spot light in the given slot if it must be rendered this
+    // frame, null otherwise.
+    ShadowMap const* getUpdatedSpotShadowMap(size_t slot) const noexcept {
+        SpotShadow const& spot = mSpotShadows[slot];
+        return spot.update ? spot.shadowMap.get() : nullptr;
+    }
+
     FCamera const* getDirectionalLightCamera() const noexcept {
         return &mDirectionalShadowMap.getDebugCamera();
     }
@@ -168,7 +184,11 @@ public:
         return mHasPostProcessPass;
     }
 
-    math::float2 updateScale(std::chrono::duration<float, std::milli> frameTime) noexcept;
+    // frameTime is measured with fences, gpuTime with timer queries (0 when no new result is
+    // available) and cpuTime is the time spent by the main thread on the frame.
+    math::float2 updateScale(std::chrono::duration<float, std::milli> frameTime,
+            std::chrono::duration<float, std::milli> gpuTime,
+            std::chrono::duration<float, std::milli> cpuTime) noexcept;
 
     void setDynamicResolutionOptions(View::DynamicResolutionOptions const& options) noexcept;
 
@@ -176,6 +196,36 @@ public:
         return mDynamicResolution;
     }
 
+    void setOcclusionCullingOptions(OcclusionCullingOptions const& options) noexcept {
+        mOcclusionCulling = options;
+    }
+
+    OcclusionCullingOptions getOcclusionCullingOptions() const noexcept {
+        return mOcclusionCulling;
+    }
+
+    OcclusionCullingStats getOcclusionCullingStats() const noexcept;
+
+    void setPostProcessingMemoryStats(PostProcessingMemoryStats const& stats) noexcept {
+        mPostProcessingMemoryStats = stats;
+    }
+
+    PostProcessingMemoryStats getPostProcessingMemoryStats() const noexcept {
+        return mPostProcessingMemoryStats;
+    }
+
+    void setShadowAtlasOptions(ShadowAtlasOptions const& options) noexcept;
+
+    ShadowAtlasOptions getShadowAtlasOptions() const noexcept {
+        return mShadowAtlasOptions;
+    }
+
+    void setLevelOfDetailOptions(LevelOfDetailOptions const& options) noexcept;
+
+    LevelOfDetailOptions getLevelOfDetailOptions() const noexcept {
+        return mLevelOfDetail;
+    }
+
     void setRenderQuality(RenderQuality const& renderQuality) noexcept {
         mRenderQuality = renderQuality;
     }
@@ -214,33 +264,117 @@ public:
         return mVisibleShadowCasters;
     }
 
+    RenderPass::CommandCache& getColorPassCommandCache() noexcept { return mColorPassCommandCache; }
+    RenderPass::CommandCache& getShadowPassCommandCache(size_t cascade) noexcept {
+        return mShadowPassCommandCache[cascade];
+    }
+    RenderPass::InstanceBuffer& getColorPassInstances() noexcept { return mColorPassInstances; }
+    RenderPass::InstanceBuffer& getShadowPassInstances(size_t cascade) noexcept {
+        return mShadowPassInstances[cascade];
+    }
+    RenderPass::CommandCache& getSpotShadowPassCommandCache(size_t slot) noexcept {
+        return mSpotShadows[slot].commandCache;
+    }
+    RenderPass::InstanceBuffer& getSpotShadowPassInstances(size_t slot) noexcept {
+        return mSpotShadows[slot].instances;
+    }
+
+    // visibility mask bit of the shadow casters of the given cascade
+    static RenderPass::VisibilityMask getShadowCascadeVisibleMask(size_t cascade) noexcept;
+
+    // visibility mask bit of the shadow casters of the spot light in the given slot
+    static RenderPass::VisibilityMask getSpotShadowVisibleMask(size_t slot) noexcept;
+
+    // sets 'bit' in the VISIBLE_MASK of the renderables intersecting 'frustum', the renderables
+    // are in the order of 'bvh' if it's not null
+    static void cullRenderables(utils::JobSystem& js,
+            FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit,
+            BoundingVolumeHierarchy const* bvh) noexcept;
+
+    /*
+     * Shadow casting spot lights. A light keeps its slot, and therefore its shadow map and
+     * bit in the SPOT_SHADOW_MASK, for as long as it's among the most important ones.
+     */
+    struct SpotShadow {
+        std::unique_ptr<ShadowMap> shadowMap;   // allocated the first time the slot is used
+        FLightManager::Instance light;
+        uint32_t lightIndex = 0;                // in the scene's light data, this frame
+        float importance = 0.0f;                // diameter of the light's sphere on screen
+        uint32_t lastUpdate = 0;                // frame of the last update of the shadow map
+        ShadowAtlas::Tile tile;
+        bool active = false;                    // the light casts shadows this frame
+        bool contentValid = false;              // the tile holds the light's shadow map
+        bool update = false;                    // the shadow map is rendered this frame
+        bool staticShadows = false;             // the shadow map only changes with the tile
+        RenderPass::CommandCache commandCache;
+        RenderPass::InstanceBuffer instances;
+    };
+
+    // a spot light that can cast shadows this frame
+    struct SpotShadowCandidate {
+        float importance;                       // diameter of the light's sphere on screen
+        uint32_t index;                         // in the scene's light data
+        FLightManager::Instance light;
+        bool staticShadows;
+    };
+
+    // inserts a candidate in the 'count' most important ones, sorted by decreasing importance,
+    // keeping at most CONFIG_MAX_SHADOW_CASTING_SPOTS of them. Returns the new count.
+    static size_t addSpotShadowCandidate(SpotShadowCandidate* candidates, size_t count,
+            SpotShadowCandidate const& candidate) noexcept;
+
+    // gives a slot to each candidate, returned in 'spots'. Lights keep their slot from the
+    // previous frame, the others take a free slot whose shadow map is lost.
+    static void assignSpotShadowSlots(SpotShadow* slots,
+            SpotShadowCandidate const* candidates, size_t count, uint8_t* spots) noexcept;
+
+    // sets the tile of the spot lights from the atlas 'requests' and picks the shadow maps to
+    // render this frame: the invalid ones within 'budget', then the most important and stale
+    static void scheduleSpotShadowUpdates(SpotShadow* slots, uint8_t const* spots,
+            ShadowAtlas::Request const* requests, size_t count, bool reallocated,
+            size_t budget, uint32_t frame) noexcept;
+
     FCamera& getCameraUser() noexcept { return *mCullingCamera; }
     void setCameraUser(FCamera* camera) noexcept { setCullingCamera(camera); }
 
 private:
     static constexpr size_t MAX_FRAMETIME_HISTORY = 32u;
 
+    // gains of the dynamic resolution controller, the integral gain is the scaleRate option
+    static constexpr float DYNAMIC_RESOLUTION_KP = 0.25f;
+    static constexpr float DYNAMIC_RESOLUTION_KD = 0.05f;
+
     void prepareVisibleRenderables(utils::JobSystem& js,
-            Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept;
+            Frustum const& frustum, FScene::RenderableSoa& renderableData,
+            BoundingVolumeHierarchy const* bvh) const noexcept;
+
+    // a light frustum and the bit it sets in one of the renderables' visibility masks
+    struct ShadowCasterCulling {
+        Frustum frustum;
+        Culler::result_type* results;   // VISIBLE_MASK or SPOT_SHADOW_MASK
+        size_t bit;
+    };
 
     static void prepareVisibleShadowCasters(utils::JobSystem& js,
-            Frustum const& lightFrustum, FScene::RenderableSoa& renderableData) noexcept;
+            FScene::RenderableSoa& renderableData,
+            ShadowCasterCulling const* culling, size_t count,
+            BoundingVolumeHierarchy const* bvh) noexcept;
+
+    // picks the spot lights casting shadows and assigns them a slot, returns how many
+    size_t prepareSpotShadows(FEngine& engine, FScene::LightSoa const& lightData,
+            Viewport const& viewport, uint8_t* spots) noexcept;
 
     static void prepareVisibleLights(
             FLightManager const& lcm, utils::JobSystem& js, Frustum const& frustum,
             FScene::LightSoa& lightData) noexcept;
 
-    static void cullRenderables(utils::JobSystem& js,
-            FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept;
-
     void computeVisibilityMasks(
             uint8_t visibleLayers, uint8_t const* layers,
             FRenderableManager::Visibility const* visibility, uint8_t* visibleMask,
-            size_t count) const;
+            uint8_t* spotShadowMask, uint8_t spotShadows, size_t count) const;
 
     void bindPerViewUniformsAndSamplers(FEngine::DriverApi& driver) const noexcept {
         driver.bindUniformBuffer(BindingPoints::PER_VIEW, mPerViewUbh);
-        driver.bindUniformBuffer(BindingPoints::LIGHTS, mLightUbh);
         driver.bindSamplers(BindingPoints::PER_VIEW, mPerViewSbh);
     }
 
@@ -252,12 +386,10 @@ private:
     // these are accessed in the render loop, keep together
     Handle<HwSamplerBuffer> mPerViewSbh;
     Handle<HwUniformBuffer> mPerViewUbh;
-    Handle<HwUniformBuffer> mLightUbh;
     Handle<HwUniformBuffer> mRenderableUbh;
 
     Handle<HwSamplerBuffer> getUsh() const noexcept { return mPerViewSbh; }
     Handle<HwUniformBuffer> getUbh() const noexcept { return mPerViewUbh; }
-    Handle<HwUniformBuffer> getLightUbh() const noexcept { return mLightUbh; }
 
     FScene* mScene = nullptr;
     FCamera* mCullingCamera = nullptr;
@@ -290,10 +422,34 @@ private:
 
     math::float2 mScale = 1.0f;
     float mDynamicWorkloadScale = 1.0f;
+    struct {
+        float integral = 0.0f;  // sum of the errors
+        float error = 0.0f;     // last error, for the derivative term
+    } mDynamicResolutionPid;
     bool mIsDynamicResolutionSupported = false;
+    bool mIsTimerQuerySupported = false;
 
     RenderQuality mRenderQuality;
 
+    OcclusionCullingOptions mOcclusionCulling;
+    OcclusionCuller mOcclusionCuller;
+
+    PostProcessingMemoryStats mPostProcessingMemoryStats;
+
+    LevelOfDetailOptions mLevelOfDetail;
+    // level of detail selected last for each renderable, indexed by instance, for hysteresis
+    std::vector<uint8_t> mSelectedLevels;
+
+    ShadowAtlasOptions mShadowAtlasOptions;
+
+    // sorted commands of the previous frame
+    RenderPass::CommandCache mColorPassCommandCache;
+    std::array<RenderPass::CommandCache, CONFIG_MAX_SHADOW_CASCADES> mShadowPassCommandCache;
+
+    // uniforms of the instanced draws
+    RenderPass::InstanceBuffer mColorPassInstances;
+    std::array<RenderPass::InstanceBuffer, CONFIG_MAX_SHADOW_CASCADES> mShadowPassInstances;
+
     mutable UniformBuffer mPerViewUb;
     mutable SamplerBuffer mPerViewSb;
 
@@ -309,7 +465,13 @@ private:
     mutable bool mHasDirectionalLight = false;
     mutable bool mHasDynamicLighting = false;
     mutable bool mHasShadowing = false;
+    bool mHasDirectionalShadows = false;
     mutable ShadowMap mDirectionalShadowMap;
+
+    // the slots of the shadow casting spot lights, see SpotShadow
+    std::array<SpotShadow, CONFIG_MAX_SHADOW_CASTING_SPOTS> mSpotShadows;
+    ShadowAtlas mShadowAtlas;
+    uint32_t mShadowFrame = 0;
 };
 
 FILAMENT_UPCAST(View)
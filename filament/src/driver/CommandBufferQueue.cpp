@@ -18,7 +18,10 @@
 
 #include <assert.h>
 
+#include <chrono>
+
 #include <utils/Log.h>
+#include <utils/EventCount.h>
 #include <utils/Systrace.h>
 
 #include "driver/CommandStream.h"
@@ -35,13 +38,18 @@ CommandBufferQueue::CommandBufferQueue(size_t requiredSize, size_t bufferSize)
 }
 
 CommandBufferQueue::~CommandBufferQueue() {
-    assert(mCommandBuffersToExecute.empty());
+    assert(mReadIndex.load() == mWriteIndex.load());
 }
 
 void CommandBufferQueue::requestExit() {
-    std::unique_lock<utils::Mutex> lock(mLock);
-    mExitRequested = true;
-    mCondition.notify_one();
+    mExitRequested.store(true, std::memory_order_release);
+    mCommandsAvailable.notify_all();
+}
+
+bool CommandBufferQueue::hasRoomForSlice(uint32_t writeIndex) const noexcept {
+    // acquire: the consumer is done with the memory it released
+    return mFreeSpace.load(std::memory_order_acquire) >= mRequiredSize &&
+           writeIndex - mReadIndex.load(std::memory_order_acquire) < MAX_SLICE_COUNT;
 }
 
 void CommandBufferQueue::flush() noexcept {
@@ -67,56 +75,76 @@ void CommandBufferQueue::flush() noexcept {
 
     circularBuffer.circularize();
 
-    std::unique_lock<utils::Mutex> lock(mLock);
-    mCommandBuffersToExecute.push_back({ tail, head });
+    // the previous flush() made sure there is room in the ring for this slice
+    const uint32_t writeIndex = mWriteIndex.load(std::memory_order_relaxed);
+    mSlices[writeIndex & SLICE_INDEX_MASK] = { tail, head };
+
+    const size_t freeSpace = mFreeSpace.fetch_sub(used, std::memory_order_relaxed);
 
     // circular buffer is too small, we corrupted the stream
-    assert(used <= mFreeSpace);
+    assert(used <= freeSpace);
 
-    // wait until there is enough space in the buffer
-    mFreeSpace -= used;
-    const size_t requiredSize = mRequiredSize;
+    // release: the slice and its commands are visible to the consumer
+    mWriteIndex.store(writeIndex + 1, std::memory_order_release);
+    mCommandsAvailable.notify_all();
 
 #ifndef NDEBUG
-    size_t totalUsed = circularBuffer.size() - mFreeSpace;
+    size_t totalUsed = circularBuffer.size() - (freeSpace - used);
     mHighWatermark = std::max(mHighWatermark, totalUsed);
-    if (UTILS_UNLIKELY(totalUsed > requiredSize)) {
+    if (UTILS_UNLIKELY(totalUsed > mRequiredSize)) {
         slog.d << "CommandStream used too much space: " << totalUsed
-            << ", out of " << requiredSize << " (will block)" << io::endl;
+            << ", out of " << mRequiredSize << " (will block)" << io::endl;
     }
+#else
+    (void)freeSpace;
 #endif
 
-    if (UTILS_LIKELY(mFreeSpace >= requiredSize)) {
-        // ideally (and usually) we don't have to wait, this is the common case, so special case
-        // the unlock-before-notify, optimization.
-        lock.unlock();
-        mCondition.notify_one();
-    } else {
+    // ideally (and usually) we don't have to wait, this is the common case
+    if (UTILS_UNLIKELY(!hasRoomForSlice(writeIndex + 1))) {
         // unfortunately, there is not enough space left, we'll have to wait.
-        mCondition.notify_one(); // too bad there isn't a notify-and-wait
         SYSTRACE_NAME("waiting: CircularBuffer::flush()");
-        mCondition.wait(lock, [this, requiredSize]() -> bool {
-            return mFreeSpace >= requiredSize;
-        });
+        const auto start = std::chrono::steady_clock::now();
+        while (true) {
+            const EventCount::Key key = mSpaceAvailable.prepareWait();
+            if (hasRoomForSlice(writeIndex + 1)) {
+                break;
+            }
+            mSpaceAvailable.wait(key);
+        }
+        const auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        mBackPressure.waitCount++;
+        mBackPressure.waitTimeNs += uint64_t(waited);
+        SYSTRACE_VALUE32("CommandBufferQueue wait (us)", uint32_t(waited / 1000));
     }
 }
 
-std::vector<CommandBufferQueue::Slice> CommandBufferQueue::waitForCommands() const {
-    if (!UTILS_HAS_THREADING) {
-        return std::move(mCommandBuffersToExecute);
-    }
-    std::unique_lock<utils::Mutex> lock(mLock);
-    while (mCommandBuffersToExecute.empty() && !mExitRequested) {
-        mCondition.wait(lock);
+utils::Range<uint32_t> CommandBufferQueue::waitForCommands() const {
+    // only the consumer writes mReadIndex
+    const uint32_t readIndex = mReadIndex.load(std::memory_order_relaxed);
+    uint32_t writeIndex;
+    while (true) {
+        const EventCount::Key key = mCommandsAvailable.prepareWait();
+        // acquire: the slices and their commands are visible to us
+        writeIndex = mWriteIndex.load(std::memory_order_acquire);
+        if (writeIndex != readIndex || mExitRequested.load(std::memory_order_acquire)) {
+            break;
+        }
+        if (!UTILS_HAS_THREADING) {
+            break;
+        }
+        mCommandsAvailable.wait(key);
     }
-    return std::move(mCommandBuffersToExecute);
+    return { readIndex, writeIndex };
 }
 
 void CommandBufferQueue::releaseBuffer(CommandBufferQueue::Slice const& buffer) {
-    std::unique_lock<utils::Mutex> lock(mLock);
-    mFreeSpace += uintptr_t(buffer.end) - uintptr_t(buffer.begin);
-    lock.unlock();
-    mCondition.notify_one();
+    // release: we're done with this memory, the producer can reuse it
+    mFreeSpace.fetch_add(uintptr_t(buffer.end) - uintptr_t(buffer.begin),
+            std::memory_order_release);
+    mReadIndex.store(mReadIndex.load(std::memory_order_relaxed) + 1,
+            std::memory_order_release);
+    mSpaceAvailable.notify_all();
 }
 
 } // namespace filament
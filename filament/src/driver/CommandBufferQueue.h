@@ -19,37 +19,37 @@
 
 #include "driver/CircularBuffer.h"
 
+#include <utils/architecture.h>
 #include <utils/compiler.h>
-#include <utils/Condition.h>
-#include <utils/Mutex.h>
+#include <utils/EventCount.h>
+#include <utils/Range.h>
 
-#include <vector>
+#include <atomic>
+
+#include <stdint.h>
 
 namespace filament {
 
 /*
- * A producer-consumer command queue that uses a CircularBuffer as main storage
+ * A producer-consumer command queue that uses a CircularBuffer as main storage.
+ *
+ * The slices of the CircularBuffer are handed from the producer (flush()) to the consumer
+ * (waitForCommands()) through a lock-free single-producer/single-consumer ring, threads only
+ * park when the queue is empty or full.
  */
 class CommandBufferQueue {
+public:
     struct Slice {
         void* begin;
         void* end;
     };
 
-    const size_t mRequiredSize;
-
-    CircularBuffer mCircularBuffer;
-
-    // space available in the circular buffer
-
-    mutable utils::Mutex mLock;
-    mutable utils::Condition mCondition;
-    mutable std::vector<Slice> mCommandBuffersToExecute;
-    size_t mFreeSpace = 0;
-    size_t mHighWatermark = 0;
-    bool mExitRequested = false;
+    // how long flush() waited for the consumer to free space, since the queue was created
+    struct BackPressureStats {
+        uint64_t waitCount;
+        uint64_t waitTimeNs;
+    };
 
-public:
     // requiredSize: guaranteed available space after flush()
     CommandBufferQueue(size_t requiredSize, size_t bufferSize);
     ~CommandBufferQueue();
@@ -58,8 +58,16 @@ public:
 
     size_t getHigWatermark() noexcept { return mHighWatermark; }
 
-    // wait for commands to be available and returns an array containing these commands
-    std::vector<Slice> waitForCommands() const;
+    // must be called from the thread calling flush()
+    BackPressureStats getBackPressureStats() const noexcept { return mBackPressure; }
+
+    // wait for commands to be available and returns the indices of these commands, to be
+    // used with getSlice(). The returned range is empty when exit was requested.
+    utils::Range<uint32_t> waitForCommands() const;
+
+    Slice const& getSlice(uint32_t index) const noexcept {
+        return mSlices[index & SLICE_INDEX_MASK];
+    }
 
     // return the memory used by this command buffer to the circular buffer
     // WARNING: releaseBuffer() must be called in sequence of the Slices returned by
@@ -72,6 +80,41 @@ public:
 
     // returns from waitForCommands() immediately.
     void requestExit();
+
+    // maximum number of slices waiting to be executed, flush() blocks when it's reached
+    static constexpr uint32_t MAX_SLICE_COUNT = 256;
+
+private:
+    static constexpr uint32_t SLICE_INDEX_MASK = MAX_SLICE_COUNT - 1;
+    static_assert((MAX_SLICE_COUNT & SLICE_INDEX_MASK) == 0,
+            "MAX_SLICE_COUNT must be a power of two");
+
+    bool hasRoomForSlice(uint32_t writeIndex) const noexcept;
+
+    const size_t mRequiredSize;
+
+    CircularBuffer mCircularBuffer;
+
+    Slice mSlices[MAX_SLICE_COUNT];
+
+    // indices only ever increase, they're wrapped when accessing mSlices.
+    // written by the producer
+    alignas(utils::CACHELINE_SIZE) std::atomic<uint32_t> mWriteIndex = { 0 };
+    // written by the consumer
+    alignas(utils::CACHELINE_SIZE) std::atomic<uint32_t> mReadIndex = { 0 };
+
+    // space available in the circular buffer
+    alignas(utils::CACHELINE_SIZE) std::atomic<size_t> mFreeSpace = { 0 };
+    std::atomic<bool> mExitRequested = { false };
+
+    // signaled by the producer when slices are added, or exit is requested
+    mutable utils::EventCount mCommandsAvailable;
+    // signaled by the consumer when slices are released
+    utils::EventCount mSpaceAvailable;
+
+    // only used by the producer
+    size_t mHighWatermark = 0;
+    BackPressureStats mBackPressure = {};
 };
 
 } // namespace filament
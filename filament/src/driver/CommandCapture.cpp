@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "driver/CommandCapture.h"
+
+#include <utils/Log.h>
+
+#include <tuple>
+#include <utility>
+
+#include <assert.h>
+#include <string.h>
+
+namespace filament {
+
+using namespace trace;
+using namespace utils;
+
+// ------------------------------------------------------------------------------------------------
+// Encoding of the command arguments. CommandReplay must read them back the same way.
+// ------------------------------------------------------------------------------------------------
+
+template<typename T>
+static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+write(Writer& w, T v) {
+    w.writeVarint(v);
+}
+
+template<typename T>
+static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+write(Writer& w, T v) {
+    w.writeSigned(v);
+}
+
+template<typename T>
+static typename std::enable_if<std::is_enum<T>::value>::type
+write(Writer& w, T v) {
+    write(w, static_cast<typename std::underlying_type<T>::type>(v));
+}
+
+// handles are stored as their id + 1, so that a null handle is 0
+template<typename T>
+static void write(Writer& w, Handle<T> const& h) {
+    w.writeVarint(h ? uint64_t(h.getId()) + 1 : 0);
+}
+
+// strings are stored as their length + 1 followed by their characters and the terminating null,
+// so they can be used in place by the replay, 0 is a null string
+static void write(Writer& w, const char* s) {
+    if (!s) {
+        w.writeVarint(0);
+        return;
+    }
+    const size_t length = strlen(s);
+    w.writeVarint(length + 1);
+    w.writeBytes(s, length + 1);
+}
+
+static void write(Writer& w, CString const& s) {
+    w.writeVarint(s.size() + 1);
+    w.writeBytes(s.c_str_safe(), s.size() + 1);
+}
+
+// pointers to native objects don't make sense in another process
+static void write(Writer& w, void*) {
+    w.writeVarint(0);
+}
+
+static void write(Writer& w, Driver::AttributeArray const& attributes) {
+    w.writeRaw(attributes);
+}
+
+static void write(Writer& w, Driver::RenderPassParams const& params) {
+    w.writeRaw(params);
+}
+
+static void write(Writer& w, Driver::FaceOffsets const& offsets) {
+    for (size_t offset : offsets.offsets) {
+        write(w, offset);
+    }
+}
+
+static void write(Writer& w, Driver::TargetBufferInfo const& info) {
+    write(w, info.handle);
+    write(w, info.level);
+    write(w, info.layer);   // also the face of cubemaps
+}
+
+static void write(Writer& w, Driver::PipelineState const& state) {
+    write(w, state.program);
+    w.writeRaw(state.rasterState.u);
+    w.writeRaw(state.polygonOffset);
+}
+
+static void write(Writer& w, Driver::BufferDescriptor const& data) {
+    write(w, data.size);
+    if (data.size) {
+        w.writeBytes(data.buffer, data.size);
+    }
+}
+
+static void write(Writer& w, Driver::PixelBufferDescriptor const& data) {
+    write(w, data.left);
+    write(w, data.top);
+    write(w, data.type);
+    if (data.type == Driver::PixelDataType::COMPRESSED) {
+        write(w, data.imageSize);
+        write(w, data.compressedFormat);
+    } else {
+        write(w, data.stride);
+        write(w, data.format);
+    }
+    write(w, data.alignment);
+    write(w, static_cast<Driver::BufferDescriptor const&>(data));
+}
+
+static void write(Writer& w, SamplerBuffer const& samplers) {
+    write(w, samplers.getSize());
+    for (size_t i = 0, c = samplers.getSize(); i < c; i++) {
+        SamplerBuffer::Sampler const& sampler = samplers.getBuffer()[i];
+        write(w, sampler.t);
+        w.writeRaw(sampler.s);
+    }
+}
+
+static void write(Writer& w, UniformInterfaceBlock const* uib) {
+    write(w, bool(uib));
+    if (uib) {
+        write(w, uib->getName());
+        auto const& list = uib->getUniformInfoList();
+        write(w, list.size());
+        for (auto const& info : list) {
+            write(w, info.name);
+            write(w, info.size);
+            write(w, info.type);
+            write(w, info.precision);
+        }
+    }
+}
+
+static void write(Writer& w, SamplerInterfaceBlock const* sib) {
+    write(w, bool(sib));
+    if (sib) {
+        write(w, sib->getName());
+        auto const& list = sib->getSamplerInfoList();
+        write(w, list.size());
+        for (auto const& info : list) {
+            write(w, info.name);
+            write(w, info.type);
+            write(w, info.format);
+            write(w, info.precision);
+            write(w, info.multisample);
+        }
+    }
+}
+
+static void write(Writer& w, Program const& program) {
+    write(w, program.getName());
+    write(w, program.getVariant());
+    for (CString const& source : program.getShadersSource()) {
+        write(w, source);
+    }
+    for (UniformInterfaceBlock const* uib : program.getUniformInterfaceBlocks()) {
+        write(w, uib);
+    }
+    for (SamplerInterfaceBlock const* sib : program.getSamplerInterfaceBlocks()) {
+        write(w, sib);
+    }
+    SamplerBindingMap const* const bindings = program.getSamplerBindings();
+    write(w, bool(bindings));
+    if (bindings) {
+        auto const& list = bindings->getBindingList();
+        write(w, list.size());
+        for (SamplerBindingInfo const& info : list) {
+            write(w, info.blockIndex);
+            write(w, info.localOffset);
+            write(w, info.globalOffset);
+            write(w, info.groupIndex);
+        }
+    }
+}
+
+template<typename T, std::size_t... I>
+static void writeArguments(Writer& w, T const& args, std::index_sequence<I...>) {
+    using expand = int[];
+    (void)expand{ 0, (write(w, std::get<I>(args)), 0)... };
+}
+
+template<typename... ARGS>
+static void writeArguments(Writer& w, std::tuple<ARGS...> const& args) {
+    writeArguments(w, args, std::make_index_sequence<sizeof...(ARGS)>{});
+}
+
+// ------------------------------------------------------------------------------------------------
+
+std::atomic<CommandCapture*> CommandCapture::sCapture = { nullptr };
+
+struct CommandCapture::Trampolines {
+    template<typename Cmd>
+    static inline CommandCapture& record(CommandId id, CommandBase* base) noexcept {
+        CommandCapture& capture = *sCapture.load(std::memory_order_relaxed);
+        capture.mWriter.clear();
+        writeArguments(capture.mWriter, static_cast<Cmd*>(base)->getArguments());
+        capture.write(id, capture.mWriter);
+        return capture;
+    }
+
+#define CAPTURE_COMMAND(methodName)                                                             \
+    static void methodName(Driver& driver, CommandBase* base, intptr_t* next) {                 \
+        using Cmd = CommandType<decltype(&Driver::methodName)>::Command<&Driver::methodName>;   \
+        CommandCapture& capture = record<Cmd>(CommandId::methodName, base);                     \
+        capture.mDriverDispatcher.methodName##_(driver, base, next);                            \
+    }
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                 CAPTURE_COMMAND(methodName)
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params) CAPTURE_COMMAND(methodName)
+#include "driver/DriverAPI.inc"
+#undef CAPTURE_COMMAND
+};
+
+CommandCapture* CommandCapture::create(Dispatcher& dispatcher, const char* path) noexcept {
+    // don't truncate the trace of the capture in progress, if it's the same file
+    if (sCapture.load()) {
+        slog.e << "A command capture is already in progress" << io::endl;
+        return nullptr;
+    }
+
+    FILE* const file = fopen(path, "wb");
+    if (!file) {
+        slog.e << "Cannot create command trace " << path << io::endl;
+        return nullptr;
+    }
+
+    const Header header = { MAGIC, VERSION, uint32_t(CommandId::COUNT), 0 };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        slog.e << "Cannot write command trace " << path << io::endl;
+        fclose(file);
+        return nullptr;
+    }
+
+    CommandCapture* const capture = new CommandCapture(dispatcher, file);
+    CommandCapture* expected = nullptr;
+    if (!sCapture.compare_exchange_strong(expected, capture)) {
+        slog.e << "A command capture is already in progress" << io::endl;
+        delete capture;
+        return nullptr;
+    }
+    return capture;
+}
+
+void CommandCapture::destroy(CommandCapture* capture) noexcept {
+    assert(sCapture.load() == capture);
+    delete capture;
+    sCapture.store(nullptr);
+}
+
+CommandCapture::CommandCapture(Dispatcher& dispatcher, FILE* file) noexcept
+        : mDriverDispatcher(dispatcher), mFile(file) {
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                                         \
+    mDispatcher.methodName##_ = Trampolines::methodName;
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params)                         \
+    mDispatcher.methodName##_ = Trampolines::methodName;
+#include "driver/DriverAPI.inc"
+}
+
+CommandCapture::~CommandCapture() noexcept {
+    if (fclose(mFile) != 0) {
+        mError = true;
+    }
+    if (mError) {
+        slog.e << "Command trace incomplete, write error" << io::endl;
+    } else {
+        slog.i << "Command trace: " << mCommandCount << " commands captured" << io::endl;
+    }
+}
+
+void CommandCapture::write(CommandId id, Writer const& payload) noexcept {
+    if (UTILS_UNLIKELY(mError)) {
+        return;
+    }
+    const uint16_t command = uint16_t(id);
+    const uint32_t size = uint32_t(payload.size());
+    if (fwrite(&command, sizeof(command), 1, mFile) != 1 ||
+        fwrite(&size, sizeof(size), 1, mFile) != 1 ||
+        fwrite(payload.data(), 1, size, mFile) != size) {
+        mError = true;
+        return;
+    }
+    mCommandCount++;
+}
+
+} // namespace filament
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DRIVER_COMMANDCAPTURE_H
+#define TNT_FILAMENT_DRIVER_COMMANDCAPTURE_H
+
+#include "driver/CommandStream.h"
+#include "driver/CommandTrace.h"
+
+#include <atomic>
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace filament {
+
+/*
+ * CommandCapture writes the commands executed by a Driver into a trace file (see CommandTrace.h),
+ * which CommandReplay can later feed to any Driver.
+ *
+ * Commands are recorded on the thread executing them, just before they're executed, through a
+ * Dispatcher that forwards to the Driver's: a CommandStream using getDispatcher() is captured,
+ * other streams are not affected. This captures the commands in the order the driver sees
+ * them, including the ones recorded into CommandSegments, and the content of the buffers
+ * they reference.
+ *
+ * Synchronous commands and commands queued with CommandStream::queueCommand() are not
+ * captured. Only one capture can be in progress at a time.
+ */
+class CommandCapture {
+public:
+    // Creates a capture writing into the file at 'path', forwarding the commands to 'dispatcher'.
+    // Returns null if the file can't be created or if a capture is already in progress.
+    static CommandCapture* create(Dispatcher& dispatcher, const char* path) noexcept;
+
+    // Closes the trace file. This must be called from the thread executing the commands, after
+    // the last command using getDispatcher() was executed.
+    static void destroy(CommandCapture* capture) noexcept;
+
+    // Dispatcher to use in place of the Driver's to capture the commands.
+    Dispatcher& getDispatcher() noexcept { return mDispatcher; }
+
+private:
+    CommandCapture(Dispatcher& dispatcher, FILE* file) noexcept;
+    ~CommandCapture() noexcept;
+
+    struct Trampolines;
+
+    // appends a command to the trace
+    void write(trace::CommandId id, trace::Writer const& payload) noexcept;
+
+    // the capture used by the trampolines, which are plain functions
+    static std::atomic<CommandCapture*> sCapture;
+
+    Dispatcher mDispatcher;
+    Dispatcher& mDriverDispatcher;
+    FILE* mFile;
+    trace::Writer mWriter;
+    uint32_t mCommandCount = 0;
+    bool mError = false;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_DRIVER_COMMANDCAPTURE_H
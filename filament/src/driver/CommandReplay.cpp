@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "driver/CommandReplay.h"
+
+#include "driver/CommandStream.h"
+
+#include <filament/EngineEnums.h>
+
+#include <utils/Log.h>
+#include <utils/Systrace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace filament {
+
+using namespace trace;
+using namespace utils;
+
+#define COMMAND(methodName) \
+    CommandType<decltype(&Driver::methodName)>::Command<&Driver::methodName>
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+ * Decoder reads the arguments of a command back, as they're written by CommandCapture, and
+ * executes the command with them.
+ */
+class CommandReplay::Decoder {
+public:
+    explicit Decoder(CommandReplay& replay) noexcept : mReplay(replay) { }
+
+    void begin(CommandId command, Reader const& payload) noexcept {
+        mCommand = command;
+        mReader = payload;
+        mMissingHandle = false;
+    }
+
+    // id in the trace of the handle at the current position, which is not consumed
+    HandleBase::HandleId peekHandleId() const noexcept {
+        Reader reader = mReader;
+        const uint64_t id = reader.readVarint();
+        return id ? HandleBase::HandleId(id - 1) : HandleBase::nullid;
+    }
+
+    // Reads the arguments of Cmd and executes it. Returns false if the command can't be replayed,
+    // because it's corrupted or references an object the replay doesn't know.
+    template<typename Cmd>
+    bool execute(Driver& driver, Dispatcher::Execute fn) noexcept {
+        return run<Cmd>(driver, fn, static_cast<typename Cmd::Arguments*>(nullptr));
+    }
+
+    // executes Cmd with the given arguments
+    template<typename Cmd, typename... A>
+    static void invoke(Driver& driver, Dispatcher::Execute fn, A&&... args) noexcept {
+        Storage storage;
+        static_cast<CommandBase*>(new(&storage) Cmd(fn, std::forward<A>(args)...))
+                ->execute(driver);
+    }
+
+private:
+    template<typename T>
+    struct Type { };
+
+    using Storage = std::aligned_storage<1024, alignof(std::max_align_t)>::type;
+
+    template<typename Cmd, typename... ARGS>
+    bool run(Driver& driver, Dispatcher::Execute fn, std::tuple<ARGS...>*) noexcept {
+        static_assert(sizeof(Cmd) <= sizeof(Storage), "Command too large");
+        Storage storage;
+        // the arguments are decoded in order because they're in a braced-init-list
+        Cmd* const cmd = new(&storage) Cmd{ fn, read(Type<ARGS>{})... };
+        if (UTILS_UNLIKELY(mMissingHandle || mReader.hasError())) {
+            cmd->~Cmd();
+            return false;
+        }
+        static_cast<CommandBase*>(cmd)->execute(driver);
+        return true;
+    }
+
+    static void freeBuffer(void* buffer, size_t, void*) noexcept {
+        free(buffer);
+    }
+
+    // number of elements of a list, which can't be more than the bytes left
+    size_t readCount() noexcept {
+        const uint64_t count = mReader.readVarint();
+        if (UTILS_UNLIKELY(count > mReader.remaining())) {
+            mReader.setError();
+            return 0;
+        }
+        return size_t(count);
+    }
+
+    // copies the next buffer of the trace, which is freed by the BufferDescriptor using it
+    void* readBuffer(size_t* size) noexcept {
+        *size = size_t(mReader.readVarint());
+        uint8_t const* const data = mReader.readBytes(*size);
+        if (!data || !*size) {
+            *size = 0;
+            return nullptr;
+        }
+        void* const buffer = malloc(*size);
+        memcpy(buffer, data, *size);
+        return buffer;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, T>::type
+    read(Type<T>) noexcept {
+        return T(mReader.readVarint());
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, T>::type
+    read(Type<T>) noexcept {
+        return T(mReader.readSigned());
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_enum<T>::value, T>::type
+    read(Type<T>) noexcept {
+        return T(read(Type<typename std::underlying_type<T>::type>{}));
+    }
+
+    float read(Type<float>) noexcept {
+        return mReader.readRaw<float>();
+    }
+
+    template<typename T>
+    Handle<T> read(Type<Handle<T>>) noexcept {
+        const uint64_t id = mReader.readVarint();
+        if (!id) {
+            return {};
+        }
+        auto const pos = mReplay.mHandles.find(HandleBase::HandleId(id - 1));
+        if (UTILS_UNLIKELY(pos == mReplay.mHandles.end())) {
+            mMissingHandle = true;
+            return {};
+        }
+        return Handle<T>(pos->second.id);
+    }
+
+    const char* read(Type<const char*>) noexcept {
+        const uint64_t length = mReader.readVarint();
+        if (!length) {
+            return nullptr;
+        }
+        // the trace outlives the command
+        return reinterpret_cast<const char*>(readString(length));
+    }
+
+    CString read(Type<CString>) noexcept {
+        const uint64_t length = mReader.readVarint();
+        uint8_t const* const s = length ? readString(length) : nullptr;
+        return s ? CString(reinterpret_cast<const char*>(s), size_t(length - 1)) : CString();
+    }
+
+    // the characters of a string, including its terminating null
+    uint8_t const* readString(uint64_t length) noexcept {
+        uint8_t const* const s = mReader.readBytes(size_t(length));
+        if (s && s[length - 1] != '\0') {
+            mReader.setError();
+            return nullptr;
+        }
+        return s;
+    }
+
+    void* read(Type<void*>) noexcept {
+        mReader.readVarint();
+        return mCommand == CommandId::createSwapChain ? mReplay.mNativeWindow : nullptr;
+    }
+
+    Driver::AttributeArray read(Type<Driver::AttributeArray>) noexcept {
+        return mReader.readRaw<Driver::AttributeArray>();
+    }
+
+    Driver::RenderPassParams read(Type<Driver::RenderPassParams>) noexcept {
+        return mReader.readRaw<Driver::RenderPassParams>();
+    }
+
+    Driver::FaceOffsets read(Type<Driver::FaceOffsets>) noexcept {
+        Driver::FaceOffsets offsets;
+        for (size_t& offset : offsets.offsets) {
+            offset = read(Type<size_t>{});
+        }
+        return offsets;
+    }
+
+    Driver::TargetBufferInfo read(Type<Driver::TargetBufferInfo>) noexcept {
+        Driver::TextureHandle handle = read(Type<Driver::TextureHandle>{});
+        const uint8_t level = read(Type<uint8_t>{});
+        const uint16_t layer = read(Type<uint16_t>{});
+        return { handle, level, layer };
+    }
+
+    Driver::PipelineState read(Type<Driver::PipelineState>) noexcept {
+        Driver::PipelineState state;
+        state.program = read(Type<Driver::ProgramHandle>{});
+        state.rasterState.u = mReader.readRaw<uint32_t>();
+        state.polygonOffset = mReader.readRaw<Driver::PolygonOffset>();
+        return state;
+    }
+
+    Driver::BufferDescriptor read(Type<Driver::BufferDescriptor>) noexcept {
+        size_t size;
+        void* const buffer = readBuffer(&size);
+        return { buffer, size, freeBuffer };
+    }
+
+    Driver::PixelBufferDescriptor read(Type<Driver::PixelBufferDescriptor>) noexcept {
+        const uint32_t left = read(Type<uint32_t>{});
+        const uint32_t top = read(Type<uint32_t>{});
+        const auto type = read(Type<Driver::PixelDataType>{});
+        if (type == Driver::PixelDataType::COMPRESSED) {
+            const uint32_t imageSize = read(Type<uint32_t>{});
+            const auto format = read(Type<driver::CompressedPixelDataType>{});
+            read(Type<uint8_t>{});  // alignment
+            size_t size;
+            void* const buffer = readBuffer(&size);
+            Driver::PixelBufferDescriptor data(buffer, size, format, imageSize, freeBuffer);
+            data.left = left;
+            data.top = top;
+            return data;
+        }
+        const uint32_t stride = read(Type<uint32_t>{});
+        const auto format = read(Type<Driver::PixelDataFormat>{});
+        const uint8_t alignment = read(Type<uint8_t>{});
+        size_t size;
+        void* const buffer = readBuffer(&size);
+        return { buffer, size, format, type, std::max(alignment, uint8_t(1)),
+                 left, top, stride, freeBuffer };
+    }
+
+    SamplerBuffer read(Type<SamplerBuffer>) noexcept {
+        const size_t count = readCount();
+        SamplerBuffer samplers(std::min(count, MAX_SAMPLER_COUNT));
+        for (size_t i = 0; i < count; i++) {
+            Driver::TextureHandle t = read(Type<Driver::TextureHandle>{});
+            Driver::SamplerParams s = mReader.readRaw<Driver::SamplerParams>();
+            if (i < samplers.getSize()) {
+                samplers.setSampler(i, { t, s });
+            }
+        }
+        return samplers;
+    }
+
+    UniformInterfaceBlock const* readUniformBlock() noexcept {
+        if (!read(Type<bool>{})) {
+            return nullptr;
+        }
+        UniformInterfaceBlock::Builder builder;
+        builder.name(read(Type<CString>{}));
+        for (size_t i = 0, c = readCount(); i < c; i++) {
+            CString name = read(Type<CString>{});
+            const uint32_t size = read(Type<uint32_t>{});
+            const auto type = read(Type<UniformInterfaceBlock::Type>{});
+            const auto precision = read(Type<UniformInterfaceBlock::Precision>{});
+            if (UTILS_UNLIKELY(name.empty() || type > UniformInterfaceBlock::Type::MAT4 ||
+                    mReader.hasError())) {
+                mReader.setError();
+                return nullptr;
+            }
+            builder.add(std::move(name), size, type, precision);
+        }
+        mReplay.mUniformBlocks.emplace_back(new UniformInterfaceBlock(builder.build()));
+        return mReplay.mUniformBlocks.back().get();
+    }
+
+    SamplerInterfaceBlock const* readSamplerBlock() noexcept {
+        if (!read(Type<bool>{})) {
+            return nullptr;
+        }
+        SamplerInterfaceBlock::Builder builder;
+        builder.name(read(Type<CString>{}));
+        for (size_t i = 0, c = readCount(); i < c; i++) {
+            CString name = read(Type<CString>{});
+            const auto type = read(Type<SamplerInterfaceBlock::Type>{});
+            const auto format = read(Type<SamplerInterfaceBlock::Format>{});
+            const auto precision = read(Type<SamplerInterfaceBlock::Precision>{});
+            const bool multisample = read(Type<bool>{});
+            if (UTILS_UNLIKELY(name.empty() || mReader.hasError())) {
+                mReader.setError();
+                return nullptr;
+            }
+            builder.add(std::move(name), type, format, precision, multisample);
+        }
+        mReplay.mSamplerBlocks.emplace_back(new SamplerInterfaceBlock(builder.build()));
+        return mReplay.mSamplerBlocks.back().get();
+    }
+
+    Program read(Type<Program>) noexcept {
+        Program program;
+        CString name = read(Type<CString>{});
+        const uint8_t variant = read(Type<uint8_t>{});
+        program.diagnostics(std::move(name), variant);
+        for (size_t i = 0; i < Program::NUM_SHADER_TYPES; i++) {
+            program.shader(Program::Shader(i), read(Type<CString>{}));
+        }
+        for (size_t i = 0; i < Program::NUM_UNIFORM_BINDINGS; i++) {
+            UniformInterfaceBlock const* const uib = readUniformBlock();
+            if (uib) {
+                program.addUniformBlock(i, uib);
+            }
+        }
+        for (size_t i = 0; i < Program::NUM_SAMPLER_BINDINGS; i++) {
+            SamplerInterfaceBlock const* const sib = readSamplerBlock();
+            if (sib) {
+                program.addSamplerBlock(i, sib);
+            }
+        }
+        if (read(Type<bool>{})) {
+            SamplerBindingMap* const bindings = new SamplerBindingMap();
+            mReplay.mSamplerBindings.emplace_back(bindings);
+            for (size_t i = 0, c = readCount(); i < c; i++) {
+                SamplerBindingInfo info;
+                info.blockIndex = read(Type<uint8_t>{});
+                info.localOffset = read(Type<uint8_t>{});
+                info.globalOffset = read(Type<uint8_t>{});
+                info.groupIndex = read(Type<uint8_t>{});
+                if (UTILS_UNLIKELY(info.blockIndex >= BindingPoints::COUNT)) {
+                    mReader.setError();
+                    break;
+                }
+                bindings->addSampler(info);
+            }
+            program.withSamplerBindings(bindings);
+        }
+        return program;
+    }
+
+    CommandReplay& mReplay;
+    CommandId mCommand = CommandId::COUNT;
+    Reader mReader;
+    bool mMissingHandle = false;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+CommandReplay::CommandReplay(Driver& driver, void* nativeWindow) noexcept
+        : mDriver(driver), mNativeWindow(nativeWindow) {
+}
+
+CommandReplay::~CommandReplay() noexcept = default;
+
+bool CommandReplay::replay(const char* path) noexcept {
+    SYSTRACE_CALL();
+
+    mStats = {};
+
+    // the whole trace is loaded first, so that reading the file is not timed
+    std::vector<uint8_t> trace;
+    FILE* const file = fopen(path, "rb");
+    if (file) {
+        uint8_t buffer[64 * 1024];
+        size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            trace.insert(trace.end(), buffer, buffer + size);
+        }
+        fclose(file);
+    } else {
+        slog.e << "Cannot open command trace " << path << io::endl;
+        return false;
+    }
+
+    Reader reader(trace.data(), trace.size());
+    const Header header = reader.readRaw<Header>();
+    if (reader.hasError() || header.magic != MAGIC) {
+        slog.e << path << " is not a command trace" << io::endl;
+        return false;
+    }
+    if (header.version != VERSION || header.commandCount != uint32_t(CommandId::COUNT)) {
+        slog.e << path << " was captured by an incompatible version" << io::endl;
+        return false;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto const recordFrame = [this](clock::duration duration) {
+        const uint64_t ns = uint64_t(std::chrono::nanoseconds(duration).count());
+        mStats.minFrameNs = mStats.frames > 1 ? std::min(mStats.minFrameNs, ns) : ns;
+        mStats.maxFrameNs = std::max(mStats.maxFrameNs, ns);
+    };
+
+    Decoder decoder(*this);
+    const clock::time_point start = clock::now();
+    clock::time_point frameStart = start;
+    while (reader.remaining()) {
+        const uint16_t id = reader.readRaw<uint16_t>();
+        const uint32_t size = reader.readRaw<uint32_t>();
+        uint8_t const* const payload = reader.readBytes(size);
+        if (UTILS_UNLIKELY(!payload || id >= uint16_t(CommandId::COUNT))) {
+            slog.e << path << " is truncated or corrupted" << io::endl;
+            break;
+        }
+
+        const CommandId command = CommandId(id);
+        if (command == CommandId::beginFrame) {
+            const clock::time_point now = clock::now();
+            if (mStats.frames) {
+                recordFrame(now - frameStart);
+            }
+            frameStart = now;
+            mStats.frames++;
+        }
+
+        decoder.begin(command, Reader(payload, size));
+        execute(decoder, command);
+    }
+    const clock::time_point end = clock::now();
+    if (mStats.frames) {
+        recordFrame(end - frameStart);
+    }
+    mStats.totalNs = uint64_t(std::chrono::nanoseconds(end - start).count());
+
+    destroyLiveHandles();
+    return true;
+}
+
+void CommandReplay::execute(Decoder& decoder, CommandId id) noexcept {
+    // these reference objects of the capturing process
+    if (id == CommandId::setExternalImage || id == CommandId::createStreamFromTextureId) {
+        mStats.skipped++;
+        return;
+    }
+
+    Driver& driver = mDriver;
+    Dispatcher& dispatcher = driver.getDispatcher();
+
+    // the handle destroyed by the command, if any
+    HandleBase::HandleId destroyed = HandleBase::nullid;
+    switch (id) {
+        case CommandId::destroyVertexBuffer:
+        case CommandId::destroyIndexBuffer:
+        case CommandId::destroyRenderPrimitive:
+        case CommandId::destroyProgram:
+        case CommandId::destroySamplerBuffer:
+        case CommandId::destroyUniformBuffer:
+        case CommandId::destroyTexture:
+        case CommandId::destroyRenderTarget:
+        case CommandId::destroySwapChain:
+        case CommandId::destroyStream:
+        case CommandId::destroyTimerQuery:
+            destroyed = decoder.peekHandleId();
+            break;
+        default:
+            break;
+    }
+
+    // the handle created by the command, if any
+    HandleBase::HandleId created = HandleBase::nullid;
+
+    bool executed = false;
+    switch (id) {
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                                         \
+        case CommandId::methodName:                                                             \
+            executed = decoder.execute<COMMAND(methodName)>(driver, dispatcher.methodName##_);  \
+            break;
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params)                         \
+        case CommandId::methodName:                                                             \
+            created = decoder.peekHandleId();                                                   \
+            if (created != HandleBase::nullid) {                                                \
+                mHandles[created] = { driver.methodName##Synchronous().getId(), id };           \
+            }                                                                                   \
+            executed = decoder.execute<COMMAND(methodName)>(driver, dispatcher.methodName##_);  \
+            break;
+#include "driver/DriverAPI.inc"
+        case CommandId::COUNT:
+            break;
+    }
+
+    if (executed) {
+        mStats.commands++;
+        if (destroyed != HandleBase::nullid) {
+            mHandles.erase(destroyed);
+        }
+    } else {
+        mStats.skipped++;
+        if (created != HandleBase::nullid) {
+            // the handle was never initialized, it can't be used or destroyed
+            mHandles.erase(created);
+        }
+    }
+}
+
+void CommandReplay::destroyLiveHandles() noexcept {
+    Driver& driver = mDriver;
+    Dispatcher& dispatcher = driver.getDispatcher();
+
+    // the swap chains go last, the other objects might need them to be destroyed
+    for (bool swapChains : { false, true }) {
+        for (auto const& item : mHandles) {
+            LiveHandle const& h = item.second;
+            if ((h.createdBy == CommandId::createSwapChain) != swapChains) {
+                continue;
+            }
+            switch (h.createdBy) {
+#define DESTROY(HandleType, destroyMethod)                                                      \
+                Decoder::invoke<COMMAND(destroyMethod)>(driver, dispatcher.destroyMethod##_,    \
+                        Driver::HandleType(h.id));                                              \
+                break;
+                case CommandId::createVertexBuffer:
+                    DESTROY(VertexBufferHandle, destroyVertexBuffer)
+                case CommandId::createIndexBuffer:
+                    DESTROY(IndexBufferHandle, destroyIndexBuffer)
+                case CommandId::createTexture:
+                    DESTROY(TextureHandle, destroyTexture)
+                case CommandId::createSamplerBuffer:
+                    DESTROY(SamplerBufferHandle, destroySamplerBuffer)
+                case CommandId::createUniformBuffer:
+                    DESTROY(UniformBufferHandle, destroyUniformBuffer)
+                case CommandId::createRenderPrimitive:
+                    DESTROY(RenderPrimitiveHandle, destroyRenderPrimitive)
+                case CommandId::createProgram:
+                    DESTROY(ProgramHandle, destroyProgram)
+                case CommandId::createDefaultRenderTarget:
+                case CommandId::createRenderTarget:
+                    DESTROY(RenderTargetHandle, destroyRenderTarget)
+                case CommandId::createSwapChain:
+                    DESTROY(SwapChainHandle, destroySwapChain)
+                case CommandId::createStreamFromTextureId:
+                    DESTROY(StreamHandle, destroyStream)
+                case CommandId::createTimerQuery:
+                    DESTROY(TimerQueryHandle, destroyTimerQuery)
+                case CommandId::createFence:
+                    driver.destroyFence(Driver::FenceHandle(h.id));
+                    break;
+                default:
+                    break;
+#undef DESTROY
+            }
+        }
+    }
+    mHandles.clear();
+    mUniformBlocks.clear();
+    mSamplerBlocks.clear();
+    mSamplerBindings.clear();
+}
+
+#undef COMMAND
+
+} // namespace filament
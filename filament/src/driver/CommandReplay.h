@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DRIVER_COMMANDREPLAY_H
+#define TNT_FILAMENT_DRIVER_COMMANDREPLAY_H
+
+#include "driver/CommandTrace.h"
+#include "driver/Driver.h"
+
+#include <tsl/robin_map.h>
+
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * CommandReplay executes the commands of a trace written by CommandCapture on a Driver, which
+ * doesn't need to be the kind of Driver the trace was captured from.
+ *
+ * The handles of the trace are mapped to the ones created by the replay. A few commands can't
+ * be replayed because they reference objects of the capturing process (external images and
+ * textures), they're skipped along with the commands using the objects they would create.
+ * The swap chains are all created for the native window given to the replay.
+ */
+class CommandReplay {
+public:
+    struct Stats {
+        uint32_t commands = 0;      // commands executed
+        uint32_t skipped = 0;       // commands that couldn't be replayed
+        uint32_t frames = 0;        // number of beginFrame() in the trace
+        uint64_t totalNs = 0;       // time spent executing the commands
+        uint64_t minFrameNs = 0;    // shortest frame, from a beginFrame() to the next one
+        uint64_t maxFrameNs = 0;    // longest frame
+    };
+
+    explicit CommandReplay(Driver& driver, void* nativeWindow = nullptr) noexcept;
+    ~CommandReplay() noexcept;
+
+    CommandReplay(CommandReplay const& rhs) = delete;
+    CommandReplay& operator=(CommandReplay const& rhs) = delete;
+
+    // Replays the trace at 'path'. This must be called from the Driver's thread. The objects
+    // left alive by the trace are destroyed at the end. Returns false if 'path' can't be read
+    // or isn't a trace compatible with this Driver, true otherwise.
+    bool replay(const char* path) noexcept;
+
+    // statistics of the last replay()
+    Stats const& getStats() const noexcept { return mStats; }
+
+private:
+    class Decoder;
+
+    struct LiveHandle {
+        HandleBase::HandleId id;
+        trace::CommandId createdBy;
+    };
+
+    void execute(Decoder& decoder, trace::CommandId id) noexcept;
+    void destroyLiveHandles() noexcept;
+
+    Driver& mDriver;
+    void* const mNativeWindow;
+
+    // Handles created by the trace, indexed by their id in the trace. All the Drivers allocate
+    // the handles of all types from a single pool of ids.
+    tsl::robin_map<HandleBase::HandleId, LiveHandle> mHandles;
+
+    // the programs of the trace reference these
+    std::vector<std::unique_ptr<UniformInterfaceBlock>> mUniformBlocks;
+    std::vector<std::unique_ptr<SamplerInterfaceBlock>> mSamplerBlocks;
+    std::vector<std::unique_ptr<SamplerBindingMap>> mSamplerBindings;
+
+    Stats mStats;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_DRIVER_COMMANDREPLAY_H
@@ -16,11 +16,15 @@
 
 #include "driver/CommandStream.h"
 
+#include "driver/CommandCapture.h"
+
 #include <utils/CallStack.h>
 #include <utils/Log.h>
+#include <utils/memalign.h>
 #include <utils/Profiler.h>
 #include <utils/Systrace.h>
 
+#include <algorithm>
 #include <functional>
 
 namespace filament {
@@ -60,6 +64,41 @@ CommandStream::CommandStream(Driver& driver, CircularBuffer& buffer) noexcept
 {
 }
 
+CommandStream::CommandStream(CommandStream const& stream, CommandSegment& segment) noexcept
+        : mDispatcher(stream.mDispatcher),
+          mDriver(stream.mDriver),
+          mSegment(&segment)
+#ifndef NDEBUG
+          , mThreadId(std::this_thread::get_id())
+#endif
+{
+}
+
+CommandStream::~CommandStream() noexcept {
+    if (mSegment) {
+        mSegment->mFilterStats += mStateFilter.getStats();
+    }
+}
+
+void CommandStream::append(CommandSegment&& segment) noexcept {
+    mStateFilter.addStats(segment.mFilterStats);
+    segment.mFilterStats = {};
+    if (segment.empty()) {
+        return;
+    }
+
+    // the segment leaves the driver in a state we don't know
+    mStateFilter.invalidate();
+
+    // jump to the segment, which jumps back to the command freeing its memory
+    const size_t jumpSize = CommandBase::align(sizeof(NoopCommand));
+    const size_t releaseSize = CommandBase::align(sizeof(CommandSegment::ReleaseCommand));
+    char* const p = static_cast<char*>(allocateCommand(jumpSize + releaseSize));
+    CommandSegment::Chunk* chunks = nullptr;
+    new(p) NoopCommand(segment.link(p + jumpSize, &chunks));
+    new(p + jumpSize) CommandSegment::ReleaseCommand(chunks);
+}
+
 void CommandStream::execute(void* buffer) {
     SYSTRACE_CALL();
 
@@ -93,9 +132,34 @@ void CommandStream::execute(void* buffer) {
 }
 
 void CommandStream::queueCommand(std::function<void()> command) {
+    mStateFilter.invalidate();
     new(allocateCommand(CustomCommand::align(sizeof(CustomCommand)))) CustomCommand(std::move(command));
 }
 
+bool CommandStream::startCapture(const char* path) noexcept {
+    assert(!mSegment);
+    if (mCapture) {
+        return false;
+    }
+    mCapture = CommandCapture::create(mDriver->getDispatcher(), path);
+    if (!mCapture) {
+        return false;
+    }
+    mDispatcher = &mCapture->getDispatcher();
+    return true;
+}
+
+void CommandStream::stopCapture() noexcept {
+    if (!mCapture) {
+        return;
+    }
+    // the commands already recorded still go through the capture, it's closed after them
+    mDispatcher = &mDriver->getDispatcher();
+    CommandCapture* const capture = mCapture;
+    mCapture = nullptr;
+    queueCommand([capture]() { CommandCapture::destroy(capture); });
+}
+
 template<typename... ARGS>
 template<void (Driver::*METHOD)(ARGS...)>
 template<std::size_t... I>
@@ -137,6 +201,95 @@ void CustomCommand::execute(Driver&, CommandBase* base, intptr_t* next) noexcept
     static_cast<CustomCommand*>(base)->~CustomCommand();
 }
 
+// ------------------------------------------------------------------------------------------------
+
+CommandSegment::CommandSegment(CommandSegment&& rhs) noexcept
+        : mFirst(rhs.mFirst), mLast(rhs.mLast), mHead(rhs.mHead), mEnd(rhs.mEnd),
+          mBuffer(rhs.mBuffer), mBufferSize(rhs.mBufferSize),
+          mFilterStats(rhs.mFilterStats) {
+    rhs.mFirst = rhs.mLast = nullptr;
+    rhs.mHead = rhs.mEnd = nullptr;
+    rhs.mBuffer = nullptr;
+    rhs.mBufferSize = 0;
+    rhs.mFilterStats = {};
+}
+
+CommandSegment& CommandSegment::operator=(CommandSegment&& rhs) noexcept {
+    if (this != &rhs) {
+        std::swap(mFirst, rhs.mFirst);
+        std::swap(mLast, rhs.mLast);
+        std::swap(mHead, rhs.mHead);
+        std::swap(mEnd, rhs.mEnd);
+        std::swap(mBuffer, rhs.mBuffer);
+        std::swap(mBufferSize, rhs.mBufferSize);
+        std::swap(mFilterStats, rhs.mFilterStats);
+    }
+    return *this;
+}
+
+CommandSegment::~CommandSegment() noexcept {
+    // the segment was never appended, its commands are dropped without being executed
+    release(mFirst);
+}
+
+void* CommandSegment::grow(size_t size) noexcept {
+    const size_t headerSize = CommandBase::align(sizeof(Chunk));
+    const size_t jumpSize = CommandBase::align(sizeof(NoopCommand));
+    Chunk* chunk;
+    size_t capacity;
+    if (mBuffer && headerSize + size + jumpSize <= mBufferSize) {
+        // use the caller's buffer first
+        capacity = mBufferSize;
+        chunk = static_cast<Chunk*>(mBuffer);
+        chunk->heap = false;
+        mBuffer = nullptr;
+        mBufferSize = 0;
+    } else {
+        capacity = std::max(CHUNK_SIZE, headerSize + size + jumpSize);
+        chunk = static_cast<Chunk*>(utils::aligned_alloc(capacity, alignof(std::max_align_t)));
+        chunk->heap = true;
+    }
+    chunk->next = nullptr;
+
+    char* const begin = reinterpret_cast<char*>(chunk) + headerSize;
+    if (mLast) {
+        // the current chunk continues in the new one
+        new(mHead) NoopCommand(begin);
+        mLast->next = chunk;
+    } else {
+        mFirst = chunk;
+    }
+    mLast = chunk;
+    mHead = begin + size;
+    mEnd = reinterpret_cast<char*>(chunk) + capacity - jumpSize;
+    return begin;
+}
+
+void* CommandSegment::link(void* next, Chunk** chunks) noexcept {
+    assert(mFirst);
+    new(mHead) NoopCommand(next);
+    void* const first = reinterpret_cast<char*>(mFirst) + CommandBase::align(sizeof(Chunk));
+    *chunks = mFirst;
+    mFirst = mLast = nullptr;
+    mHead = mEnd = nullptr;
+    return first;
+}
+
+void CommandSegment::release(Chunk* chunks) noexcept {
+    while (chunks) {
+        Chunk* const next = chunks->next;
+        if (chunks->heap) {
+            utils::aligned_free(chunks);
+        }
+        chunks = next;
+    }
+}
+
+void CommandSegment::ReleaseCommand::execute(Driver&, CommandBase* base, intptr_t* next) noexcept {
+    *next = CommandBase::align(sizeof(ReleaseCommand));
+    CommandSegment::release(static_cast<ReleaseCommand*>(base)->mChunks);
+}
+
 } // namespace filament
 
 
@@ -21,6 +21,7 @@
 
 #include "driver/CircularBuffer.h"
 #include "driver/Driver.h"
+#include "driver/DriverStateFilter.h"
 
 #include <utils/compiler.h>
 
@@ -39,6 +40,7 @@
 namespace filament {
 
 class CommandBase;
+class CommandCapture;
 
 /*
  * Dispatcher is a data structure containing only function pointers.
@@ -130,6 +132,11 @@ struct CommandType<void (Driver::*)(ARGS...)> {
         template<std::size_t... I> void log(std::index_sequence<I...>) noexcept;
 
     public:
+        using Arguments = SavedParameters;
+
+        // the arguments the command will be executed with, e.g. for CommandCapture
+        Arguments const& getArguments() const noexcept { return mArgs; }
+
         template<typename M, typename D>
         static inline void execute(M&& method, D&& driver, CommandBase* base, intptr_t* next) noexcept {
             Command* self = static_cast<Command*>(base);
@@ -183,6 +190,85 @@ public:
 
 // ------------------------------------------------------------------------------------------------
 
+/*
+ * A CommandSegment stores the commands recorded by a CommandStream outside of the driver's
+ * CircularBuffer, which allows recording commands on other threads than the one writing to the
+ * driver's CommandStream. Segments are then linked into the driver's CommandStream with
+ * CommandStream::append(), which doesn't copy them: the driver thread executes the commands
+ * where they were recorded, then frees the segment's memory.
+ *
+ * A segment's memory is a list of chunks, each ending with a NoopCommand that jumps to the
+ * next one. The first chunk can be memory given by the caller, the others are allocated on the
+ * heap.
+ */
+class CommandSegment {
+public:
+    CommandSegment() noexcept = default;
+
+    // A segment recording into 'buffer' until it's full. 'buffer' isn't freed by the segment and
+    // must stay valid until the driver executed the segment's commands, e.g. memory returned by
+    // CommandStream::allocate() on the stream the segment is appended to.
+    CommandSegment(void* buffer, size_t size) noexcept : mBuffer(buffer), mBufferSize(size) { }
+
+    CommandSegment(CommandSegment const& rhs) = delete;
+    CommandSegment& operator=(CommandSegment const& rhs) = delete;
+    CommandSegment(CommandSegment&& rhs) noexcept;
+    CommandSegment& operator=(CommandSegment&& rhs) noexcept;
+    ~CommandSegment() noexcept;
+
+    bool empty() const noexcept { return !mFirst; }
+
+    inline void* allocate(size_t size) noexcept {
+        char* const cur = mHead;
+        if (UTILS_UNLIKELY(size_t(mEnd - cur) < size)) {
+            return grow(size);
+        }
+        mHead = cur + size;
+        return cur;
+    }
+
+private:
+    friend class CommandStream;
+
+    struct Chunk {
+        Chunk* next;
+        bool heap;      // false for the caller's buffer
+    };
+
+    // frees a list of chunks once the driver executed them
+    class ReleaseCommand : public CommandBase {
+        Chunk* mChunks;
+        static void execute(Driver&, CommandBase* base, intptr_t* next) noexcept;
+    public:
+        inline explicit ReleaseCommand(Chunk* chunks) noexcept
+                : CommandBase(execute), mChunks(chunks) { }
+    };
+
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    void* grow(size_t size) noexcept;
+
+    // ends the segment with a jump to 'next' and returns its first command. The segment is
+    // empty afterwards, and its chunks must be released with a ReleaseCommand.
+    void* link(void* next, Chunk** chunks) noexcept;
+
+    static void release(Chunk* chunks) noexcept;
+
+    Chunk* mFirst = nullptr;
+    Chunk* mLast = nullptr;
+    char* mHead = nullptr;
+    char* mEnd = nullptr;   // always leaves room for the NoopCommand ending the chunk
+
+    // the caller's buffer, until it's used as a chunk
+    void* mBuffer = nullptr;
+    size_t mBufferSize = 0;
+
+    // commands dropped by the DriverStateFilter of the stream recording this segment
+    DriverStateFilter::Stats mFilterStats;
+};
+
+// ------------------------------------------------------------------------------------------------
+
 #ifdef NDEBUG
     #define DEBUG_COMMAND(methodName, params...)
 #else
@@ -196,6 +282,9 @@ public:
 #define DECL_DRIVER_API(methodName, paramsDecl, params)                                         \
     inline void methodName(paramsDecl) {                                                        \
         DEBUG_COMMAND(methodName, params);                                                      \
+        if (!mStateFilter.methodName(params)) {                                                 \
+            return;                                                                             \
+        }                                                                                       \
         using CmdType = CommandType<decltype(&Driver::methodName)>;                             \
         using Cmd = CmdType::Command<&Driver::methodName>;                                      \
         void* const p = allocateCommand(CommandBase::align(sizeof(Cmd)));                       \
@@ -232,6 +321,15 @@ public:
     CommandStream() noexcept = default;
     CommandStream(Driver& driver, CircularBuffer& buffer) noexcept;
 
+    // A CommandStream recording into 'segment', for the same driver as 'stream'. It can be used
+    // from any thread, but only from the one that created it.
+    CommandStream(CommandStream const& stream, CommandSegment& segment) noexcept;
+
+    ~CommandStream() noexcept;
+
+    // Links 'segment' at the current position of this stream, its commands execute here.
+    void append(CommandSegment&& segment) noexcept;
+
     // This is for debugging only. Currently CircularBuffer can only be written from a
     // single thread. In debug builds we assert this condition.
     // Call this first in the render loop.
@@ -249,6 +347,23 @@ public:
      */
     void queueCommand(std::function<void()> command);
 
+    // Commands that didn't change the driver's state, and weren't recorded, during the previous
+    // frame. See DriverStateFilter.
+    DriverStateFilter::Stats const& getElidedCommands() const noexcept {
+        return mStateFilter.getLastFrameStats();
+    }
+
+    /*
+     * Starts writing the commands recorded from now on into a trace file, as they're executed
+     * by the driver. See CommandCapture. Returns false if the trace file can't be created.
+     */
+    bool startCapture(const char* path) noexcept;
+
+    // Stops the capture once the commands recorded so far are executed.
+    void stopCapture() noexcept;
+
+    bool isCapturing() const noexcept { return mCapture != nullptr; }
+
     /*
      * Allocates memory associated to the current CommandStreamBuffer.
      * This memory will be automatically freed after this command buffer is processed.
@@ -270,6 +385,9 @@ private:
     Dispatcher* mDispatcher = nullptr;
     Driver* mDriver = nullptr;
     CircularBuffer* UTILS_RESTRICT mCurrentBuffer = nullptr;
+    CommandSegment* mSegment = nullptr;
+    DriverStateFilter mStateFilter;
+    CommandCapture* mCapture = nullptr;
 
 #ifndef NDEBUG
     // just for debugging...
@@ -278,6 +396,9 @@ private:
 
     inline void* allocateCommand(size_t size) {
         assert(mThreadId == std::this_thread::get_id());
+        if (UTILS_UNLIKELY(mSegment)) {
+            return mSegment->allocate(size);
+        }
         return mCurrentBuffer->allocate(size);
     }
 };
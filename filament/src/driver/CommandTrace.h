@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DRIVER_COMMANDTRACE_H
+#define TNT_FILAMENT_DRIVER_COMMANDTRACE_H
+
+#include <utils/compiler.h>
+
+#include <type_traits>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace filament {
+
+/*
+ * A command trace is a binary file recording the commands executed by a Driver, written by
+ * CommandCapture and read by CommandReplay.
+ *
+ * The file starts with a Header, followed by one record per command:
+ *      uint16_t    command id (CommandId)
+ *      uint32_t    payload size in bytes
+ *      payload     the command's arguments, in order
+ *
+ * Integers and enums are stored as LEB128 varints (zigzag encoded when signed), which makes
+ * the trace independent of the size of size_t. Other types are stored as described in
+ * CommandCapture.cpp. Fixed size fields are in the byte order of the capturing machine.
+ */
+namespace trace {
+
+static constexpr uint32_t MAGIC = 0x434D4446;    // 'FDMC'
+
+// must be bumped when DriverAPI.inc or the encoding of an argument changes
+static constexpr uint32_t VERSION = 1;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t commandCount;      // CommandId::COUNT of the Driver that wrote the trace
+    uint32_t reserved;
+};
+
+// one id per asynchronous command of DriverAPI.inc, in declaration order
+enum class CommandId : uint16_t {
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                     methodName,
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params)     methodName,
+#include "driver/DriverAPI.inc"
+    COUNT
+};
+
+static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint16_t) + sizeof(uint32_t);
+
+// Appends encoded values to a byte buffer
+class Writer {
+public:
+    void clear() noexcept { mData.clear(); }
+    uint8_t const* data() const noexcept { return mData.data(); }
+    size_t size() const noexcept { return mData.size(); }
+
+    void writeVarint(uint64_t v) {
+        while (v >= 0x80) {
+            mData.push_back(uint8_t(v | 0x80));
+            v >>= 7;
+        }
+        mData.push_back(uint8_t(v));
+    }
+
+    void writeSigned(int64_t v) {
+        writeVarint((uint64_t(v) << 1) ^ uint64_t(v >> 63));
+    }
+
+    void writeBytes(void const* p, size_t size) {
+        uint8_t const* const b = static_cast<uint8_t const*>(p);
+        mData.insert(mData.end(), b, b + size);
+    }
+
+    template<typename T>
+    void writeRaw(T const& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+        writeBytes(&v, sizeof(T));
+    }
+
+private:
+    std::vector<uint8_t> mData;
+};
+
+// Decodes values from a byte buffer. Reading past the end returns zeros and sets an error.
+class Reader {
+public:
+    Reader() noexcept = default;
+    Reader(void const* data, size_t size) noexcept
+            : mCurrent(static_cast<uint8_t const*>(data)), mEnd(mCurrent + size) { }
+
+    bool hasError() const noexcept { return mError; }
+    void setError() noexcept { mError = true; }
+    size_t remaining() const noexcept { return size_t(mEnd - mCurrent); }
+    uint8_t const* current() const noexcept { return mCurrent; }
+
+    uint64_t readVarint() noexcept {
+        uint64_t v = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (UTILS_UNLIKELY(mCurrent == mEnd)) {
+                mError = true;
+                return 0;
+            }
+            const uint8_t b = *mCurrent++;
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        return v;
+    }
+
+    int64_t readSigned() noexcept {
+        const uint64_t v = readVarint();
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+
+    // returns a pointer to the next 'size' bytes, or null if there are not enough of them
+    uint8_t const* readBytes(size_t size) noexcept {
+        if (UTILS_UNLIKELY(remaining() < size)) {
+            mCurrent = mEnd;
+            mError = true;
+            return nullptr;
+        }
+        uint8_t const* const p = mCurrent;
+        mCurrent += size;
+        return p;
+    }
+
+    template<typename T>
+    T readRaw() noexcept {
+        static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+        T v{};
+        uint8_t const* const p = readBytes(sizeof(T));
+        if (p) {
+            memcpy(&v, p, sizeof(T));
+        }
+        return v;
+    }
+
+private:
+    uint8_t const* mCurrent = nullptr;
+    uint8_t const* mEnd = nullptr;
+    bool mError = false;
+};
+
+} // namespace trace
+} // namespace filament
+
+#endif // TNT_FILAMENT_DRIVER_COMMANDTRACE_H
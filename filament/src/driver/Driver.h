@@ -97,6 +97,7 @@ public:
     using FenceHandle           = Handle<HwFence>;
     using SwapChainHandle       = Handle<HwSwapChain>;
     using StreamHandle          = Handle<HwStream>;
+    using TimerQueryHandle      = Handle<HwTimerQuery>;
 
     struct Attribute {
         static constexpr uint8_t FLAG_NORMALIZED     = 0x1;
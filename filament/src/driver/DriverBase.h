@@ -125,6 +125,9 @@ struct HwFence : public HwBase {
     driver::Platform::Fence* fence = nullptr;
 };
 
+struct HwTimerQuery : public HwBase {
+};
+
 struct HwSwapChain : public HwBase {
     driver::Platform::SwapChain* swapChain = nullptr;
 };
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DRIVER_DRIVERSTATEFILTER_H
+#define TNT_FILAMENT_DRIVER_DRIVERSTATEFILTER_H
+
+#include "driver/Driver.h"
+
+#include <filament/EngineEnums.h>
+
+#include <utils/compiler.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * DriverStateFilterBase has a method for each command of the DriverApi, taking the same
+ * parameters (by reference), returning whether the command must be recorded. By default all
+ * commands are recorded and forget the state that was tracked: we don't know how they affect it.
+ */
+class DriverStateFilterBase {
+public:
+    // forgets the tracked state, the next state changes are always recorded
+    void invalidate() noexcept { mValid = 0; }
+
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                                         \
+    template<typename... ARGS>                                                                  \
+    inline bool methodName(ARGS&&...) noexcept { invalidate(); return true; }
+#include "driver/DriverAPI.inc"
+
+protected:
+    // one bit per tracked state, set when the state below is known
+    enum : uint32_t {
+        VALID_UNIFORM_BUFFERS   = (1u << BindingPoints::COUNT) - 1,
+        VALID_SAMPLERS          = VALID_UNIFORM_BUFFERS << BindingPoints::COUNT,
+        VALID_SCISSOR           = 1u << (2 * BindingPoints::COUNT)
+    };
+    uint32_t mValid = 0;
+};
+
+/*
+ * DriverStateFilter drops the commands that set a state to the value it already has, before
+ * they're written into a CommandStream. It only tracks the buffer and sampler bindings and the
+ * scissor, which are set before each draw. Pipeline states are part of the draw commands
+ * themselves and are left to the backends.
+ *
+ * The tracked state is reset by all other commands, except draws and debug markers.
+ */
+class DriverStateFilter : public DriverStateFilterBase {
+public:
+    // number of commands dropped
+    struct Stats {
+        uint32_t uniformBuffers = 0;
+        uint32_t samplers = 0;
+        uint32_t scissors = 0;
+
+        uint32_t total() const noexcept { return uniformBuffers + samplers + scissors; }
+
+        Stats& operator+=(Stats const& rhs) noexcept {
+            uniformBuffers += rhs.uniformBuffers;
+            samplers += rhs.samplers;
+            scissors += rhs.scissors;
+            return *this;
+        }
+    };
+
+    // commands dropped since the last beginFrame()
+    Stats const& getStats() const noexcept { return mStats; }
+
+    // commands dropped between the last two beginFrame()
+    Stats const& getLastFrameStats() const noexcept { return mLastFrameStats; }
+
+    // adds commands dropped by another filter, e.g. one recording a CommandSegment
+    void addStats(Stats const& stats) noexcept { mStats += stats; }
+
+    inline bool beginFrame(int64_t, uint32_t) noexcept {
+        invalidate();
+        mLastFrameStats = mStats;
+        mStats = {};
+        return true;
+    }
+
+    inline bool bindUniformBuffer(size_t index, Driver::UniformBufferHandle ubh) noexcept {
+        // the whole buffer is bound
+        return bindUniformBufferRange(index, ubh, 0, SIZE_MAX);
+    }
+
+    inline bool bindUniformBufferRange(size_t index, Driver::UniformBufferHandle ubh,
+            size_t offset, size_t size) noexcept {
+        if (UTILS_UNLIKELY(index >= BindingPoints::COUNT)) {
+            return true;
+        }
+        UniformBufferBinding& binding = mUniformBuffers[index];
+        const uint32_t bit = 1u << index;
+        if ((mValid & bit) &&
+                binding.ubh == ubh && binding.offset == offset && binding.size == size) {
+            mStats.uniformBuffers++;
+            return false;
+        }
+        binding = { ubh, offset, size };
+        mValid |= bit;
+        return true;
+    }
+
+    inline bool bindSamplers(size_t index, Driver::SamplerBufferHandle sbh) noexcept {
+        if (UTILS_UNLIKELY(index >= BindingPoints::COUNT)) {
+            return true;
+        }
+        const uint32_t bit = 1u << (BindingPoints::COUNT + index);
+        if ((mValid & bit) && mSamplers[index] == sbh) {
+            mStats.samplers++;
+            return false;
+        }
+        mSamplers[index] = sbh;
+        mValid |= bit;
+        return true;
+    }
+
+    inline bool setViewportScissor(int32_t left, int32_t bottom,
+            uint32_t width, uint32_t height) noexcept {
+        if ((mValid & VALID_SCISSOR) &&
+                mScissor.left == left && mScissor.bottom == bottom &&
+                mScissor.width == width && mScissor.height == height) {
+            mStats.scissors++;
+            return false;
+        }
+        mScissor = { left, bottom, width, height };
+        mValid |= VALID_SCISSOR;
+        return true;
+    }
+
+    // these don't change the state we track
+    inline bool draw(Driver::PipelineState, Driver::RenderPrimitiveHandle) noexcept {
+        return true;
+    }
+    inline bool drawInstanced(Driver::PipelineState, Driver::RenderPrimitiveHandle,
+            uint32_t) noexcept {
+        return true;
+    }
+    inline bool insertEventMarker(const char*, size_t = 0) noexcept { return true; }
+    inline bool pushGroupMarker(const char*, size_t = 0) noexcept { return true; }
+    inline bool popGroupMarker(int = 0) noexcept { return true; }
+
+private:
+    struct UniformBufferBinding {
+        Driver::UniformBufferHandle ubh;
+        size_t offset;
+        size_t size;
+    };
+
+    struct Scissor {
+        int32_t left;
+        int32_t bottom;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    UniformBufferBinding mUniformBuffers[BindingPoints::COUNT];
+    Driver::SamplerBufferHandle mSamplers[BindingPoints::COUNT];
+    Scissor mScissor = {};
+    Stats mStats;
+    Stats mLastFrameStats;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_DRIVER_DRIVERSTATEFILTER_H
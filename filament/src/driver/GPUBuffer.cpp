@@ -122,7 +122,9 @@ void GPUBuffer::terminate(driver::DriverApi& driverApi) noexcept {
 void GPUBuffer::commitSlow(driver::DriverApi& driverApi, void const* begin, void const* end) noexcept {
     const uintptr_t sizeInBytes = uintptr_t(end) - uintptr_t(begin);
     assert(sizeInBytes <= mRowSizeInBytes * mHeight);
-    driverApi.update2DImage(mTexture, 0, 0, 0, mWidth, mHeight,
+    assert(sizeInBytes % mRowSizeInBytes == 0);
+    const uint32_t height = uint32_t(sizeInBytes / mRowSizeInBytes);
+    driverApi.update2DImage(mTexture, 0, 0, 0, mWidth, height,
             { begin, sizeInBytes, mFormat, mType });
 }
 
@@ -60,7 +60,11 @@ public:
 
     size_t getSize() const noexcept { return mSize; }
 
-    // source data isn't copied and must stay valid until the command-buffer is executed
+    size_t getRowSizeInBytes() const noexcept { return mRowSizeInBytes; }
+
+    // source data isn't copied and must stay valid until the command-buffer is executed.
+    // only the first rows are updated when the data is smaller than the buffer, the data size
+    // must be a multiple of getRowSizeInBytes().
     void commit(driver::DriverApi& driverApi, void const* begin, void const* end) noexcept {
         commitSlow(driverApi, begin, end);
     }
@@ -39,6 +39,7 @@ struct HwTexture;
 struct HwUniformBuffer;
 struct HwSwapChain;
 struct HwStream;
+struct HwTimerQuery;
 
 /*
  * A type handle to a h/w resource
@@ -78,8 +79,8 @@ public:
 
     explicit operator bool() const noexcept { return object != nullid; }
 
-    bool operator==(const HandleBase& rhs) noexcept { return object == rhs.object; }
-    bool operator!=(const HandleBase& rhs) noexcept { return object != rhs.object; }
+    bool operator==(const HandleBase& rhs) const noexcept { return object == rhs.object; }
+    bool operator!=(const HandleBase& rhs) const noexcept { return object != rhs.object; }
 
     // get this handle's handleId
     HandleId getId() const noexcept { return object; }
@@ -127,6 +127,10 @@ void MetalDriver::createFence(Driver::FenceHandle, int dummy) {
 
 }
 
+void MetalDriver::createTimerQuery(Driver::TimerQueryHandle, int dummy) {
+
+}
+
 void MetalDriver::createSwapChain(Driver::SwapChainHandle sch, void* nativeWindow, uint64_t flags) {
 
 }
@@ -176,6 +180,10 @@ Driver::FenceHandle MetalDriver::createFenceSynchronous() noexcept {
     return Driver::FenceHandle {};
 }
 
+Driver::TimerQueryHandle MetalDriver::createTimerQuerySynchronous() noexcept {
+    return Driver::TimerQueryHandle {};
+}
+
 Driver::SwapChainHandle MetalDriver::createSwapChainSynchronous() noexcept {
     return Driver::SwapChainHandle {1};
 }
@@ -253,6 +261,18 @@ Driver::FenceStatus MetalDriver::wait(Driver::FenceHandle fh, uint64_t timeout)
     return FenceStatus::ERROR;
 }
 
+void MetalDriver::destroyTimerQuery(Driver::TimerQueryHandle tqh) {
+
+}
+
+bool MetalDriver::isTimerQuerySupported() {
+    return false;
+}
+
+uint64_t MetalDriver::getTimerQueryValue(Driver::TimerQueryHandle tqh) {
+    return 0;
+}
+
 bool MetalDriver::isTextureFormatSupported(Driver::TextureFormat format) {
     return true;
 }
@@ -375,6 +395,14 @@ void MetalDriver::popGroupMarker(int dummy) {
 
 }
 
+void MetalDriver::beginTimerQuery(Driver::TimerQueryHandle tqh) {
+
+}
+
+void MetalDriver::endTimerQuery(Driver::TimerQueryHandle tqh) {
+
+}
+
 void MetalDriver::readPixels(Driver::RenderTargetHandle src, uint32_t x, uint32_t y, uint32_t width,
         uint32_t height, Driver::PixelBufferDescriptor&& data) {
 
@@ -396,6 +424,11 @@ void MetalDriver::draw(Driver::PipelineState ps, Driver::RenderPrimitiveHandle r
 
 }
 
+void MetalDriver::drawInstanced(Driver::PipelineState ps, Driver::RenderPrimitiveHandle rph,
+        uint32_t instanceCount) {
+
+}
+
 } // namespace metal
 } // namespace driver
 
@@ -14,10 +14,6 @@
  * limitations under the License.
  */
 
-// The noop driver is only useful for ensuring we don't have certain build issues.
-// Remove it from release builds, since it uses some space needlessly.
-#ifndef NDEBUG
-
 #include "driver/noop/NoopDriver.h"
 #include "driver/CommandStreamDispatcher.h"
 
@@ -45,5 +41,3 @@ driver::ShaderModel NoopDriver::getShaderModel() const noexcept {
 template class ConcreteDispatcher<NoopDriver>;
 
 } // namespace filament
-
-#endif
@@ -22,6 +22,8 @@
 
 #include <utils/compiler.h>
 
+#include <atomic>
+
 namespace filament {
 
 class NoopDriver final : public DriverBase {
@@ -44,18 +46,38 @@ private:
 #define DECL_DRIVER_API(methodName, paramsDecl, params) \
     UTILS_ALWAYS_INLINE void methodName(paramsDecl) { }
 
+    // timer queries are not supported, isTimerQuerySupported() and getTimerQueryValue() return
+    // false and 0
+    static constexpr bool isTimerQueryMethod(const char* name) noexcept {
+        constexpr char const suffix[] = "TimerQuery";
+        for (; *name; ++name) {
+            size_t i = 0;
+            while (suffix[i] && name[i] == suffix[i]) {
+                i++;
+            }
+            if (!suffix[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     // The only reason we return a non-zero value is so that "isTextureFormatSupported"
     // returns true, which is necessary because Engine creates an internal 1x1 texture
     // during its initialization phase.
 #define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params) \
-    RetType methodName(paramsDecl) override { return RetType(true); }
+    RetType methodName(paramsDecl) override { return RetType(!isTimerQueryMethod(#methodName)); }
 
+    // Each object gets its own handle, so that a trace captured with this driver can tell them
+    // apart when it's replayed.
 #define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params) \
     RetType methodName##Synchronous() noexcept override { \
-        return RetType((RetType::HandleId)0xDEAD0000); } \
+        return RetType(mNextHandleId++); } \
     UTILS_ALWAYS_INLINE void methodName(RetType, paramsDecl) { }
 
 #include "driver/DriverAPI.inc"
+
+    std::atomic<HandleBase::HandleId> mNextHandleId = { 0xDEAD0000 };
 };
 
 } // namespace filament
@@ -16,6 +16,7 @@
 
 #include "driver/opengl/OpenGLDriver.h"
 
+#include <algorithm>
 #include <set>
 
 #include <utils/compiler.h>
@@ -251,6 +252,9 @@ void OpenGLDriver::initExtensionsGLES(GLint major, GLint minor, ExtentionSet con
     ext.EXT_color_buffer_half_float = hasExtension(exts, "GL_EXT_color_buffer_half_float");
     ext.texture_compression_s3tc = hasExtension(exts, "WEBGL_compressed_texture_s3tc");
     ext.EXT_multisampled_render_to_texture = hasExtension(exts, "GL_EXT_multisampled_render_to_texture");
+#ifdef GL_EXT_disjoint_timer_query
+    ext.EXT_disjoint_timer_query = hasExtension(exts, "GL_EXT_disjoint_timer_query");
+#endif
 }
 
 void OpenGLDriver::initExtensionsGL(GLint major, GLint minor, ExtentionSet const& exts) {
@@ -260,6 +264,7 @@ void OpenGLDriver::initExtensionsGL(GLint major, GLint minor, ExtentionSet const
     ext.OES_EGL_image_external_essl3 = hasExtension(exts, "GL_OES_EGL_image_external_essl3");
     ext.EXT_debug_marker = hasExtension(exts, "GL_EXT_debug_marker");
     ext.EXT_color_buffer_half_float = true;  // Assumes core profile.
+    ext.EXT_disjoint_timer_query = true;     // Timer queries are core since GL 3.3.
 }
 
 void OpenGLDriver::terminate() {
@@ -718,6 +723,7 @@ default_case:
 //    GLFence                   :  8
 //    GLIndexBuffer             : 12        moderate
 //    GLSamplerBuffer           : 16        moderate
+//    GLTimerQuery              : 16        few
 // -- less than 16 bytes
 
 //    GLRenderPrimitive         : 40        many
@@ -751,6 +757,7 @@ OpenGLDriver::HandleAllocator::HandleAllocator(const utils::HeapArea& area)
     slog.d << "GLVertexBuffer: " << sizeof(GLVertexBuffer) << io::endl;
     slog.d << "GLUniformBuffer: " << sizeof(GLUniformBuffer) << io::endl;
     slog.d << "GLStream: " << sizeof(GLStream) << io::endl;
+    slog.d << "GLTimerQuery: " << sizeof(GLTimerQuery) << io::endl;
 #endif
 }
 
@@ -857,6 +864,10 @@ Handle<HwStream> OpenGLDriver::createStreamFromTextureIdSynchronous() noexcept {
     return Handle<HwStream>( allocateHandle(sizeof(GLStream)) );
 }
 
+Handle<HwTimerQuery> OpenGLDriver::createTimerQuerySynchronous() noexcept {
+    return Handle<HwTimerQuery>( allocateHandle(sizeof(GLTimerQuery)) );
+}
+
 void OpenGLDriver::createVertexBuffer(
     Driver::VertexBufferHandle vbh,
     uint8_t bufferCount,
@@ -1230,6 +1241,15 @@ void OpenGLDriver::createFence(Driver::FenceHandle fh, int) {
     f->fence = mPlatform.createFence();
 }
 
+void OpenGLDriver::createTimerQuery(Driver::TimerQueryHandle tqh, int) {
+    DEBUG_MARKER()
+
+    GLTimerQuery* tq = construct<GLTimerQuery>(tqh);
+    if (ext.EXT_disjoint_timer_query) {
+        glGenQueries(1, &tq->gl.query);
+    }
+}
+
 void OpenGLDriver::createSwapChain(Driver::SwapChainHandle sch, void* nativeWindow, uint64_t flags) {
     DEBUG_MARKER()
 
@@ -1493,6 +1513,20 @@ void OpenGLDriver::destroyFence(Driver::FenceHandle fh) {
     }
 }
 
+void OpenGLDriver::destroyTimerQuery(Driver::TimerQueryHandle tqh) {
+    DEBUG_MARKER()
+
+    if (tqh) {
+        GLTimerQuery* tq = handle_cast<GLTimerQuery*>(tqh);
+        auto& pending = mPendingTimerQueries;
+        pending.erase(std::remove(pending.begin(), pending.end(), tq), pending.end());
+        if (tq->gl.query) {
+            glDeleteQueries(1, &tq->gl.query);
+        }
+        destruct(tqh, tq);
+    }
+}
+
 Driver::FenceStatus OpenGLDriver::wait(Driver::FenceHandle fh, uint64_t timeout) {
     if (fh) {
         HwFence* f = handle_cast<HwFence*>(fh);
@@ -1578,6 +1612,18 @@ bool OpenGLDriver::isFrameTimeSupported() {
     return mPlatform.canCreateFence();
 }
 
+bool OpenGLDriver::isTimerQuerySupported() {
+    return ext.EXT_disjoint_timer_query;
+}
+
+uint64_t OpenGLDriver::getTimerQueryValue(Driver::TimerQueryHandle tqh) {
+    if (tqh) {
+        GLTimerQuery const* tq = handle_cast<GLTimerQuery*>(tqh);
+        return tq->elapsed.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Swap chains
 // ------------------------------------------------------------------------------------------------
@@ -2602,6 +2648,64 @@ void OpenGLDriver::endFrame(uint32_t frameId) {
     //SYSTRACE_NAME("glFinish");
     //glFinish();
     insertEventMarker("endFrame");
+    if (UTILS_UNLIKELY(!mPendingTimerQueries.empty())) {
+        updateTimerQueries();
+    }
+}
+
+void OpenGLDriver::beginTimerQuery(Driver::TimerQueryHandle tqh) {
+    DEBUG_MARKER()
+
+    if (ext.EXT_disjoint_timer_query) {
+        GLTimerQuery* tq = handle_cast<GLTimerQuery*>(tqh);
+        tq->elapsed.store(0, std::memory_order_relaxed);
+        glBeginQuery(GL_TIME_ELAPSED, tq->gl.query);
+    }
+}
+
+void OpenGLDriver::endTimerQuery(Driver::TimerQueryHandle tqh) {
+    DEBUG_MARKER()
+
+    if (ext.EXT_disjoint_timer_query) {
+        GLTimerQuery* tq = handle_cast<GLTimerQuery*>(tqh);
+        glEndQuery(GL_TIME_ELAPSED);
+        mPendingTimerQueries.push_back(tq);
+    }
+}
+
+void OpenGLDriver::updateTimerQueries() noexcept {
+    // results become available in order, so we can stop at the first one that isn't
+    auto& pending = mPendingTimerQueries;
+    auto pos = pending.begin();
+    for (; pos != pending.end(); ++pos) {
+        GLTimerQuery* const tq = *pos;
+        GLuint available = 0;
+        glGetQueryObjectuiv(tq->gl.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 elapsed = 0;
+#if GL41_HEADERS
+        glGetQueryObjectui64v(tq->gl.query, GL_QUERY_RESULT, &elapsed);
+#elif defined(GL_EXT_disjoint_timer_query)
+        glGetQueryObjectui64vEXT(tq->gl.query, GL_QUERY_RESULT, &elapsed);
+#endif
+        // 0 means "no result"
+        tq->elapsed.store(std::max(GLuint64(1), elapsed), std::memory_order_relaxed);
+    }
+
+#ifdef GL_GPU_DISJOINT_EXT
+    // the results are meaningless if something disturbed the GPU clock (e.g. a power event)
+    GLint disjoint = GL_FALSE;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        std::for_each(pending.begin(), pos, [](GLTimerQuery* tq) {
+            tq->elapsed.store(0, std::memory_order_relaxed);
+        });
+    }
+#endif
+
+    pending.erase(pending.begin(), pos);
 }
 
 void OpenGLDriver::flush(int) {
@@ -2767,6 +2871,28 @@ void OpenGLDriver::draw(
     CHECK_GL_ERROR(utils::slog.e)
 }
 
+void OpenGLDriver::drawInstanced(
+        Driver::PipelineState state,
+        Driver::RenderPrimitiveHandle rph,
+        uint32_t instanceCount) {
+    DEBUG_MARKER()
+
+    OpenGLProgram* p = handle_cast<OpenGLProgram*>(state.program);
+    useProgram(p);
+
+    const GLRenderPrimitive* rp = handle_cast<const GLRenderPrimitive *>(rph);
+    bindVertexArray(rp);
+
+    setRasterState(state.rasterState);
+
+    polygonOffset(state.polygonOffset.slope, state.polygonOffset.constant);
+
+    glDrawElementsInstanced(GLenum(rp->type), rp->count,
+            rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset), GLsizei(instanceCount));
+
+    CHECK_GL_ERROR(utils::slog.e)
+}
+
 // explicit instantiation of the Dispatcher
 template class ConcreteDispatcher<OpenGLDriver>;
 
@@ -28,7 +28,9 @@
 
 #include <tsl/robin_map.h>
 
+#include <atomic>
 #include <set>
+#include <vector>
 
 #include <assert.h>
 
@@ -164,6 +166,14 @@ public:
         } user_thread;
     };
 
+    struct GLTimerQuery : public HwTimerQuery {
+        struct {
+            GLuint query = 0;
+        } gl;
+        // written by the GL thread, read by any thread
+        std::atomic<uint64_t> elapsed{ 0 };
+    };
+
     struct GLRenderTarget : public HwRenderTarget {
         using HwRenderTarget::HwRenderTarget;
         struct GL {
@@ -515,6 +525,10 @@ private:
     mutable tsl::robin_map<uint32_t, GLuint> mSamplerMap;
     mutable std::vector<GLTexture*> mExternalStreams;
 
+    // timer queries ended but whose result hasn't been read yet
+    std::vector<GLTimerQuery*> mPendingTimerQueries;
+    void updateTimerQueries() noexcept;
+
     // glGet*() values
     struct {
         GLint max_renderbuffer_size = 0;
@@ -537,6 +551,7 @@ private:
         bool EXT_debug_marker = false;
         bool EXT_color_buffer_half_float = false;
         bool EXT_multisampled_render_to_texture = false;
+        bool EXT_disjoint_timer_query = false;
     } ext;
 
     struct {
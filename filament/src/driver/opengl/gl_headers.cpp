@@ -36,6 +36,9 @@ PFNGLPOPGROUPMARKEREXTPROC glPopGroupMarkerEXT;
 #if GL_EXT_multisampled_render_to_texture
 PFNGLFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC glFramebufferTexture2DMultisampleEXT;
 #endif
+#ifdef GL_EXT_disjoint_timer_query
+PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+#endif
 }
 
 using namespace glext;
@@ -77,6 +80,11 @@ public:
         glFramebufferTexture2DMultisampleEXT =
                 (PFNGLFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC)eglGetProcAddress(
                         "glFramebufferTexture2DMultisampleEXT");
+#endif
+#ifdef GL_EXT_disjoint_timer_query
+        glGetQueryObjectui64vEXT =
+                (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress(
+                        "glGetQueryObjectui64vEXT");
 #endif
     }
 } instance;
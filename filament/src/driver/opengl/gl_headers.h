@@ -38,6 +38,9 @@
 #endif
 #if GL_EXT_multisampled_render_to_texture
         extern PFNGLFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC glFramebufferTexture2DMultisampleEXT;
+#endif
+#ifdef GL_EXT_disjoint_timer_query
+        extern PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 #endif
     }
 
@@ -72,6 +75,11 @@
 #define GL_TEXTURE_EXTERNAL_OES           0x8D65
 #endif
 
+// GL_EXT_disjoint_timer_query uses the same value as desktop GL
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED                   0x88BF
+#endif
+
 #include "driver/opengl/NullGLES.h"
 
 #if (!defined(GL_ES_VERSION_3_1) && !defined(GL_VERSION_4_1))
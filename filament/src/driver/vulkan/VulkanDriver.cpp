@@ -318,6 +318,9 @@ void VulkanDriver::createRenderTarget(Driver::RenderTargetHandle rth,
 void VulkanDriver::createFence(Driver::FenceHandle fh, int) {
 }
 
+void VulkanDriver::createTimerQuery(Driver::TimerQueryHandle tqh, int) {
+}
+
 void VulkanDriver::createSwapChain(Driver::SwapChainHandle sch, void* nativeWindow,
         uint64_t flags) {
     auto* swapChain = construct_handle<VulkanSwapChain>(mHandleMap, sch);
@@ -389,6 +392,10 @@ Handle<HwStream> VulkanDriver::createStreamFromTextureIdSynchronous() noexcept {
     return {};
 }
 
+Handle<HwTimerQuery> VulkanDriver::createTimerQuerySynchronous() noexcept {
+    return {};
+}
+
 void VulkanDriver::destroyVertexBuffer(Driver::VertexBufferHandle vbh) {
     if (vbh) {
         waitForIdle(mContext);
@@ -491,6 +498,17 @@ Driver::FenceStatus VulkanDriver::wait(Driver::FenceHandle fh, uint64_t timeout)
     return FenceStatus::ERROR;
 }
 
+void VulkanDriver::destroyTimerQuery(Driver::TimerQueryHandle tqh) {
+}
+
+bool VulkanDriver::isTimerQuerySupported() {
+    return false;
+}
+
+uint64_t VulkanDriver::getTimerQueryValue(Driver::TimerQueryHandle tqh) {
+    return 0;
+}
+
 // We create all textures using VK_IMAGE_TILING_OPTIMAL, so our definition of "supported" is that
 // the GPU supports the given texture format with non-zero optimal tiling features.
 bool VulkanDriver::isTextureFormatSupported(Driver::TextureFormat format) {
@@ -794,6 +812,12 @@ void VulkanDriver::popGroupMarker(int) {
     }
 }
 
+void VulkanDriver::beginTimerQuery(Driver::TimerQueryHandle tqh) {
+}
+
+void VulkanDriver::endTimerQuery(Driver::TimerQueryHandle tqh) {
+}
+
 void VulkanDriver::readPixels(Driver::RenderTargetHandle src,
         uint32_t x, uint32_t y, uint32_t width, uint32_t height,
         PixelBufferDescriptor&& p) {
@@ -813,6 +837,11 @@ void VulkanDriver::blit(TargetBufferFlags buffers,
 }
 
 void VulkanDriver::draw(Driver::PipelineState pipelineState, Driver::RenderPrimitiveHandle rph) {
+    drawInstanced(pipelineState, rph, 1);
+}
+
+void VulkanDriver::drawInstanced(Driver::PipelineState pipelineState,
+        Driver::RenderPrimitiveHandle rph, uint32_t instanceCount) {
     VkCommandBuffer cmdbuffer = mContext.cmdbuffer;
     ASSERT_POSTCONDITION(cmdbuffer, "Draw calls can occur only within a beginFrame / endFrame.");
     const VulkanRenderPrimitive& prim = *handle_cast<VulkanRenderPrimitive>(mHandleMap, rph);
@@ -935,10 +964,10 @@ void VulkanDriver::draw(Driver::PipelineState pipelineState, Driver::RenderPrimi
 
     // Finally, make the actual draw call. TODO: support subranges
     const uint32_t indexCount = prim.count;
-    const uint32_t instanceCount = 1;
     const uint32_t firstIndex = prim.offset / prim.indexBuffer->elementSize;
     const int32_t vertexOffset = 0;
-    const uint32_t firstInstId = 1;
+    // gl_InstanceIndex includes the first instance, the shaders expect instances to start at 0
+    const uint32_t firstInstId = 0;
     vkCmdDrawIndexed(cmdbuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstId);
 }
 
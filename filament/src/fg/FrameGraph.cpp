@@ -18,15 +18,21 @@
 
 #include "FrameGraphPassResources.h"
 
+#include "RenderTargetPool.h"
+
 #include "driver/Driver.h"
 #include "driver/Handle.h"
 #include "driver/CommandStream.h"
 
+#include "details/Texture.h"
+
 #include <filament/driver/DriverEnums.h>
 
 #include <utils/Panic.h>
 #include <utils/Log.h>
 
+#include <algorithm>
+
 using namespace utils;
 
 namespace filament {
@@ -59,12 +65,25 @@ struct Resource {
     FrameGraphResource::Descriptor desc;
     FrameGraph::Builder::RWFlags readFlags = 0;
     FrameGraph::Builder::RWFlags writeFlags = 0;
+    uint8_t discardStart = TargetBufferFlags::ALL;  // buffers that can be discarded on first write
+    Resource* storage = nullptr;    // resource owning the textures and render target we use
+    PassNode* storageLast = nullptr;// last pass using our textures and render target
+
+    // whether two resources can share the same textures and render target
+    bool isCompatible(Resource const& rhs) const noexcept;
+
+    // approximate size of the textures and render target, in bytes
+    size_t getSize() const noexcept;
+
+    // whether the textures and render target can come from a RenderTargetPool
+    bool isPoolable() const noexcept;
 
     // concrete resource -- set when the resource is created
-    void create(DriverApi& driver) noexcept;
-    void destroy(DriverApi& driver) noexcept;
+    void create(DriverApi& driver, RenderTargetPool* pool) noexcept;
+    void destroy(DriverApi& driver, RenderTargetPool* pool) noexcept;
     Handle<HwTexture> textures[2] = {};  // color, depth
     FrameGraphPassResources::RenderTarget target;
+    RenderTargetPool::Target const* pooled = nullptr;
 };
 
 struct ResourceNode {
@@ -236,11 +255,47 @@ Resource::Resource(const char* name, bool imported) noexcept
         : name(name), imported(imported) {
 }
 
-void Resource::create(DriverApi& driver) noexcept {
+bool Resource::isCompatible(Resource const& rhs) const noexcept {
+    return desc.width == rhs.desc.width &&
+           desc.height == rhs.desc.height &&
+           desc.depth == rhs.desc.depth &&
+           desc.levels == rhs.desc.levels &&
+           desc.samples == rhs.desc.samples &&
+           desc.type == rhs.desc.type &&
+           desc.format == rhs.desc.format &&
+           readFlags == rhs.readFlags &&
+           writeFlags == rhs.writeFlags;
+}
+
+size_t Resource::getSize() const noexcept {
+    // drivers may pad or compress the buffers, this is only an estimate
+    const uint8_t flags = readFlags | writeFlags;
+    size_t texelSize = 0;
+    if (flags & FrameGraph::Builder::COLOR) {
+        texelSize += details::FTexture::getFormatSize(desc.format);
+    }
+    if (flags & FrameGraph::Builder::DEPTH) {
+        texelSize += details::FTexture::getFormatSize(TextureFormat::DEPTH24);
+    }
+    return texelSize * desc.width * desc.height * desc.depth * desc.samples;
+}
+
+bool Resource::isPoolable() const noexcept {
+    // the pool holds 2D render targets with at most a single-sampled color texture
+    return desc.type == SamplerType::SAMPLER_2D &&
+           desc.levels == 1 && desc.depth == 1 && desc.samples == 1 &&
+           (writeFlags & FrameGraph::Builder::COLOR) &&
+           !((readFlags | writeFlags) & FrameGraph::Builder::DEPTH);
+}
+
+void Resource::create(DriverApi& driver, RenderTargetPool* pool) noexcept {
     // some sanity check
     if (readerCount)    assert(readFlags);
     if (writerCount)    assert(writeFlags);
 
+    // imported resources are set-up by importResource()
+    if (imported) return;
+
     // technically this doesn't need to be initialized if we're not a rendertarget.
     target.params = {};
     target.params.left = 0;
@@ -248,43 +303,76 @@ void Resource::create(DriverApi& driver) noexcept {
     target.params.width = desc.width;
     target.params.height = desc.height;
 
-    if (!imported) {
-        if (readFlags & FrameGraph::Builder::COLOR) {
-            textures[0] = driver.createTexture(desc.type, desc.levels,
-                    desc.format, 1,
-                    desc.width, desc.height, desc.depth,
-                    TextureUsage::COLOR_ATTACHMENT);
-        }
-        if (readFlags & FrameGraph::Builder::DEPTH) {
-            textures[1] = driver.createTexture(desc.type, desc.levels,
-                    TextureFormat::DEPTH24, 1,
-                    desc.width, desc.height, desc.depth,
-                    TextureUsage::DEPTH_ATTACHMENT);
+    if (storage != this) {
+        // the resource we share with isn't used anymore, its content is undefined
+        assert(storage && isCompatible(*storage));
+        textures[0] = storage->textures[0];
+        textures[1] = storage->textures[1];
+        target.target = storage->target.target;
+        return;
+    }
+
+    if (pool && isPoolable()) {
+        // passes sample and draw the whole texture, it must have the exact size requested
+        uint8_t flags = RenderTargetPool::Target::EXACT_SIZE;
+        if (!(readFlags & FrameGraph::Builder::COLOR)) {
+            flags |= RenderTargetPool::Target::NO_TEXTURE;
         }
+        pooled = pool->get(TargetBufferFlags::COLOR,
+                desc.width, desc.height, desc.samples, desc.format, flags);
+        textures[0] = pooled->texture;
+        target.target = pooled->target;
+        return;
+    }
+
+    if (readFlags & FrameGraph::Builder::COLOR) {
+        textures[0] = driver.createTexture(desc.type, desc.levels,
+                desc.format, 1,
+                desc.width, desc.height, desc.depth,
+                TextureUsage::COLOR_ATTACHMENT);
+    }
+    if (readFlags & FrameGraph::Builder::DEPTH) {
+        textures[1] = driver.createTexture(desc.type, desc.levels,
+                TextureFormat::DEPTH24, 1,
+                desc.width, desc.height, desc.depth,
+                TextureUsage::DEPTH_ATTACHMENT);
+    }
 
-        // Note: if the resource is a source of a blit, it needs a rendertarget (because that's how
-        // blits work) -- in that case, the resource would have been declared with Builder::blit()
-        // access, and its write flags here would be set.
+    // Note: if the resource is a source of a blit, it needs a rendertarget (because that's how
+    // blits work) -- in that case, the resource would have been declared with Builder::blit()
+    // access, and its write flags here would be set.
 
-        uint32_t attachments = 0;
-        if (writeFlags & FrameGraph::Builder::COLOR) {
-            attachments |= uint32_t(TargetBufferFlags::COLOR);
-        }
-        if (writeFlags & FrameGraph::Builder::DEPTH) {
-            attachments |= TargetBufferFlags::DEPTH;
-        }
-        if (attachments) {
-            target.target = driver.createRenderTarget(TargetBufferFlags(attachments),
-                    desc.width, desc.height, desc.samples, desc.format,
-                    { textures[0] }, { textures[1] }, {});
-        }
+    uint32_t attachments = 0;
+    if (writeFlags & FrameGraph::Builder::COLOR) {
+        attachments |= uint32_t(TargetBufferFlags::COLOR);
+    }
+    if (writeFlags & FrameGraph::Builder::DEPTH) {
+        attachments |= TargetBufferFlags::DEPTH;
+    }
+    if (attachments) {
+        target.target = driver.createRenderTarget(TargetBufferFlags(attachments),
+                desc.width, desc.height, desc.samples, desc.format,
+                { textures[0] }, { textures[1] }, {});
     }
 }
 
-void Resource::destroy(DriverApi& driver) noexcept {
+void Resource::destroy(DriverApi& driver, RenderTargetPool* pool) noexcept {
     // we don't own the handles of imported resources
     if (imported) return;
 
+    if (storage != this || pooled) {
+        // the resource we share with destroys them, or the pool keeps them for later frames
+        if (pooled) {
+            pool->put(pooled);
+            pooled = nullptr;
+        }
+        for (auto& texture : textures) {
+            texture.clear();
+        }
+        target.target.clear();
+        return;
+    }
+
     for (auto& texture : textures) {
         if (texture) {
             driver.destroyTexture(texture);
@@ -459,8 +547,15 @@ FrameGraphResource::Descriptor const& FrameGraphPassResources::getDescriptor(
 
 // ------------------------------------------------------------------------------------------------
 
-FrameGraph::FrameGraph()
-        : mArena("FrameGraph Arena", 16384), // TODO: the Area will eventually come from outside
+FrameGraph::FrameGraph() : FrameGraph(nullptr) {
+}
+
+FrameGraph::FrameGraph(RenderTargetPool& pool) : FrameGraph(&pool) {
+}
+
+FrameGraph::FrameGraph(RenderTargetPool* pool)
+        : mRenderTargetPool(pool),
+          mArena("FrameGraph Arena", 16384), // TODO: the Area will eventually come from outside
           mPassNodes(mArena),
           mResourceNodes(mArena),
           mResourceRegistry(mArena),
@@ -543,7 +638,22 @@ FrameGraphResource::Descriptor* FrameGraph::getDescriptor(FrameGraphResource r)
 FrameGraphResource FrameGraph::importResource(
         const char* name, FrameGraphResource::Descriptor const& descriptor,
         Handle <HwRenderTarget> target) {
-    return importResource(name, descriptor, target, {}, {});
+    return importResource(name, descriptor, target, Handle<HwTexture>{}, Handle<HwTexture>{});
+}
+
+FrameGraphResource FrameGraph::importResource(
+        const char* name, FrameGraphResource::Descriptor const& descriptor,
+        Handle<HwRenderTarget> target, Viewport const& viewport,
+        TargetBufferFlags discardStart) {
+    FrameGraphResource r = importResource(name, descriptor, target,
+            Handle<HwTexture>{}, Handle<HwTexture>{});
+    Resource& resource = mResourceRegistry[mResourceNodes[r.index].offset];
+    resource.target.params.left = viewport.left;
+    resource.target.params.bottom = viewport.bottom;
+    resource.target.params.width = viewport.width;
+    resource.target.params.height = viewport.height;
+    resource.discardStart = discardStart;
+    return r;
 }
 
 FrameGraphResource FrameGraph::importResource(
@@ -565,6 +675,8 @@ FrameGraphResource FrameGraph::importResource(
     resource.textures[0] = color;
     resource.textures[1] = depth;
     resource.target.target = target;
+    resource.target.params.width = descriptor.width;
+    resource.target.params.height = descriptor.height;
 
     // we store the offset into the array (instead of the pointer) because the storage might
     // move between now and compile().
@@ -703,7 +815,7 @@ FrameGraph& FrameGraph::compile() noexcept {
             PassNode::TargetFlags& targetFlags = pass.targetFlags[i];
 
             // FIXME: the discard flags must be updated for each attachement
-            uint8_t discardStart = TargetBufferFlags::ALL;
+            uint8_t discardStart = subResource->discardStart;
             uint8_t discardEnd = TargetBufferFlags::ALL;
             // does anyone reads this resource after us...
             auto curr = first;
@@ -765,15 +877,71 @@ FrameGraph& FrameGraph::compile() noexcept {
         ++first;
     }
 
-    // add resource to devirtualize or destroy to the corresponding list for each active pass
-    for (size_t index = 0, c = resourceRegistry.size() ; index < c ; index++) {
-        auto& resource = resourceRegistry[index];
+    // gather the resources of active passes, in the order they're first needed
+    Vector<Resource*> resources(mArena);
+    resources.reserve(resourceRegistry.size());
+    for (Resource& resource : resourceRegistry) {
         assert(!resource.first == !resource.last);
         if (resource.readerCount && resource.first && resource.last) {
-            resource.first->devirtualize.push_back((uint16_t)index);
-            resource.last->destroy.push_back((uint16_t)index);
+            resource.storage = &resource;
+            resource.storageLast = resource.last;
+            resources.push_back(&resource);
+        }
+    }
+    std::stable_sort(resources.begin(), resources.end(),
+            [](Resource const* lhs, Resource const* rhs) {
+                return lhs->first->id < rhs->first->id;
+            });
+
+    // A resource takes the textures and render target of a compatible resource whose last
+    // pass is done by the time it's needed, otherwise it gets its own.
+    MemoryStats stats;
+    Vector<Resource*> storages(mArena);
+    storages.reserve(resources.size());
+    for (Resource* resource : resources) {
+        if (resource->imported) {
+            continue;
+        }
+        stats.resources++;
+        stats.unaliased += resource->getSize();
+        auto pos = std::find_if(storages.begin(), storages.end(),
+                [resource](Resource const* storage) {
+                    return storage->storageLast->id < resource->first->id &&
+                           storage->isCompatible(*resource);
+                });
+        if (pos != storages.end()) {
+            resource->storage = *pos;
+            (*pos)->storageLast = resource->last;
+        } else {
+            storages.push_back(resource);
+        }
+    }
+
+    // add resource to devirtualize or destroy to the corresponding list for each active pass,
+    // shared textures and render targets are destroyed after their last user.
+    for (Resource* resource : resources) {
+        const uint16_t index = uint16_t(resource - resourceRegistry.data());
+        resource->first->devirtualize.push_back(index);
+        resource->storageLast->destroy.push_back(index);
+    }
+
+    // the peak memory is reached when the most concrete resources are alive
+    size_t allocated = 0;
+    for (PassNode const& pass : passNodes) {
+        for (uint16_t index : pass.devirtualize) {
+            Resource const& resource = resourceRegistry[index];
+            allocated += (!resource.imported && resource.storage == &resource) ?
+                    resource.getSize() : 0;
+        }
+        stats.peak = std::max(stats.peak, allocated);
+        for (uint16_t index : pass.destroy) {
+            Resource const& resource = resourceRegistry[index];
+            allocated -= (!resource.imported && resource.storage == &resource) ?
+                    resource.getSize() : 0;
         }
     }
+    stats.allocations = uint32_t(storages.size());
+    mMemoryStats = stats;
 
     return *this;
 }
@@ -786,7 +954,7 @@ void FrameGraph::execute(DriverApi& driver) noexcept {
 
         // create concrete resources
         for (size_t id : node.devirtualize) {
-            resourceRegistry[id].create(driver);
+            resourceRegistry[id].create(driver, mRenderTargetPool);
         }
 
         // execute the pass
@@ -795,11 +963,14 @@ void FrameGraph::execute(DriverApi& driver) noexcept {
 
         // destroy concrete resources
         for (uint32_t id : node.destroy) {
-            resourceRegistry[id].destroy(driver);
+            resourceRegistry[id].destroy(driver, mRenderTargetPool);
         }
     }
 
-    // reset the frame graph state
+    reset();
+}
+
+void FrameGraph::reset() noexcept {
     mPassNodes.clear();
     mResourceNodes.clear();
     mResourceRegistry.clear();
@@ -26,6 +26,8 @@
 
 #include "details/Allocators.h"
 
+#include <filament/Viewport.h>
+
 #include <utils/Log.h>
 
 #include <vector>
@@ -48,6 +50,7 @@ struct Alias;
 } // namespace fg
 
 class FrameGraphPassResources;
+class RenderTargetPool;
 
 class FrameGraph {
 public:
@@ -91,7 +94,11 @@ public:
         fg::PassNode& mPass;
     };
 
+    // Without a RenderTargetPool, the concrete resources are created and destroyed with
+    // each execute(). With one, those it can hold are taken from and returned to the pool,
+    // so that a graph executed every frame doesn't reallocate them.
     FrameGraph();
+    explicit FrameGraph(RenderTargetPool& pool);
     FrameGraph(FrameGraph const&) = delete;
     FrameGraph& operator = (FrameGraph const&) = delete;
     ~FrameGraph();
@@ -138,6 +145,13 @@ public:
             const char* name, FrameGraphResource::Descriptor const& descriptor,
             Handle<HwRenderTarget> target);
 
+    // Import a write-only render target, of which passes only draw into 'viewport'. Only the
+    // buffers in 'discardStart' are discarded before the first pass writing to it.
+    FrameGraphResource importResource(
+            const char* name, FrameGraphResource::Descriptor const& descriptor,
+            Handle<HwRenderTarget> target, Viewport const& viewport,
+            driver::TargetBufferFlags discardStart);
+
     // Import a read-only render target from outside the framegraph and returns a handle to it.
     FrameGraphResource importResource(
             const char* name, FrameGraphResource::Descriptor const& descriptor,
@@ -158,9 +172,21 @@ public:
     // Returns true on success, false if one of the handle was invalid.
     bool moveResource(FrameGraphResource from, FrameGraphResource to);
 
-    // allocates concrete resources and culls unreferenced passes
+    // Culls unreferenced passes and assigns concrete resources. Resources that are not used
+    // at the same time and have the same description share their textures and render target.
     FrameGraph& compile() noexcept;
 
+    // GPU memory used by the resources created by the framegraph (i.e. not imported)
+    struct MemoryStats {
+        size_t peak = 0;            // largest amount allocated at any time, in bytes
+        size_t unaliased = 0;       // amount that would be needed without sharing, in bytes
+        uint32_t resources = 0;     // number of resources used
+        uint32_t allocations = 0;   // number of concrete resources created
+    };
+
+    // valid after compile()
+    MemoryStats const& getMemoryStats() const noexcept { return mMemoryStats; }
+
     // execute all referenced passes
     void execute(driver::DriverApi& driver) noexcept;
 
@@ -171,6 +197,8 @@ private:
     friend class FrameGraphPassResources;
     friend struct fg::PassNode;
 
+    explicit FrameGraph(RenderTargetPool* pool);
+
     template <typename T>
     using Allocator = utils::STLAllocator<T, details::LinearAllocatorArena>;
 
@@ -179,17 +207,22 @@ private:
 
     auto& getArena() noexcept { return mArena; }
 
+    // clears the state of this frame
+    void reset() noexcept;
+
     fg::PassNode& createPass(const char* name, FrameGraphPassExecutor* base) noexcept;
     fg::ResourceNode& createResource(const char* name,
             FrameGraphResource::Descriptor const& desc, bool imported) noexcept;
     fg::ResourceNode* getResource(FrameGraphResource r);
 
+    RenderTargetPool* const mRenderTargetPool;
     details::LinearAllocatorArena mArena;
 
     Vector<fg::PassNode> mPassNodes;           // list of frame graph passes
     Vector<fg::ResourceNode> mResourceNodes;
     Vector<fg::Resource> mResourceRegistry;    // frame graph concrete resources
     Vector<fg::Alias> mAliases;
+    MemoryStats mMemoryStats;
 };
 
 } // namespace filament
@@ -427,3 +427,198 @@ TEST(FrameGraphTest, MoveResource) {
     //fg.export_graphviz(utils::slog.d);
     fg.execute(driverApi);
 }
+
+TEST(FrameGraphTest, ResourceAliasing) {
+
+    /*
+     * A0 -> (P0) -> A
+     * A  -> (P1) -> B
+     * B  -> (P2) -> C, D (different format)
+     * C,D-> (P3) -> E -> (Present)
+     *
+     * C can use the storage of A, whose last pass is P1, and E that of B.
+     * B overlaps A, and D has another format, they can't share.
+     */
+
+    FrameGraph fg;
+
+    FrameGraphResource::Descriptor ldr{
+            .width = 256, .height = 256, .format = driver::TextureFormat::RGBA8 };
+    FrameGraphResource::Descriptor hdr{
+            .width = 256, .height = 256, .format = driver::TextureFormat::RGBA16F };
+    const size_t ldrSize = 256 * 256 * 4;
+    const size_t hdrSize = 256 * 256 * 8;
+
+    struct PassData {
+        FrameGraphResource input[2];
+        FrameGraphResource output[2];
+    };
+    auto noop = [](FrameGraphPassResources const&, PassData const&, driver::DriverApi&) {};
+
+    auto& p0 = fg.addPass<PassData>("P0",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.output[0] = builder.write(builder.createResource("A", ldr));
+            }, noop);
+
+    auto& p1 = fg.addPass<PassData>("P1",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.input[0] = builder.read(p0.getData().output[0]);
+                data.output[0] = builder.write(builder.createResource("B", ldr));
+            }, noop);
+
+    auto& p2 = fg.addPass<PassData>("P2",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.input[0] = builder.read(p1.getData().output[0]);
+                data.output[0] = builder.write(builder.createResource("C", ldr));
+                data.output[1] = builder.write(builder.createResource("D", hdr));
+            }, noop);
+
+    auto& p3 = fg.addPass<PassData>("P3",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.input[0] = builder.read(p2.getData().output[0]);
+                data.input[1] = builder.read(p2.getData().output[1]);
+                data.output[0] = builder.write(builder.createResource("E", ldr));
+            }, noop);
+
+    fg.present(p3.getData().output[0], FrameGraph::Builder::COLOR);
+
+    fg.compile();
+
+    FrameGraph::MemoryStats const& stats = fg.getMemoryStats();
+    EXPECT_EQ(5, stats.resources);
+    EXPECT_EQ(3, stats.allocations);    // A and C, B and E, D
+    EXPECT_EQ(4 * ldrSize + hdrSize, stats.unaliased);
+    EXPECT_EQ(2 * ldrSize + hdrSize, stats.peak);  // during P2 and P3
+
+    fg.execute(driverApi);
+}
+
+TEST(FrameGraphTest, NoAliasingOfOverlappingResources) {
+
+    // the three resources are all alive in the last pass, they can't share anything
+    FrameGraph fg;
+
+    FrameGraphResource::Descriptor desc{ .width = 64, .height = 64 };
+    const size_t size = 64 * 64 * 4;
+
+    struct PassData {
+        FrameGraphResource input[3];
+        FrameGraphResource output;
+    };
+    auto noop = [](FrameGraphPassResources const&, PassData const&, driver::DriverApi&) {};
+
+    FrameGraphResource outputs[3];
+    for (size_t i = 0; i < 3; i++) {
+        auto& pass = fg.addPass<PassData>("Render",
+                [&](FrameGraph::Builder& builder, PassData& data) {
+                    data.output = builder.write(builder.createResource("target", desc));
+                }, noop);
+        outputs[i] = pass.getData().output;
+    }
+
+    auto& resolve = fg.addPass<PassData>("Resolve",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                for (size_t i = 0; i < 3; i++) {
+                    data.input[i] = builder.read(outputs[i]);
+                }
+                data.output = builder.write(builder.createResource("resolved", desc));
+            }, noop);
+
+    fg.present(resolve.getData().output, FrameGraph::Builder::COLOR);
+
+    fg.compile();
+
+    FrameGraph::MemoryStats const& stats = fg.getMemoryStats();
+    EXPECT_EQ(4, stats.resources);
+    EXPECT_EQ(4, stats.allocations);
+    EXPECT_EQ(4 * size, stats.unaliased);
+    EXPECT_EQ(4 * size, stats.peak);
+
+    fg.execute(driverApi);
+}
+
+TEST(FrameGraphTest, PostProcessIntoView) {
+
+    /*
+     * The post-processing chain of FRenderer::renderJob(): the passes work at the scaled
+     * viewport size, the last one draws into the viewport of the view's render target and
+     * only discards the buffers of the view, as PostProcessManager::finish() used to do.
+     */
+
+    FrameGraph fg;
+
+    const Viewport vp{ 16, 32, 400, 300 };
+    const Viewport svp{ 0, 0, 200, 150 };
+    const Handle<HwRenderTarget> viewRenderTarget(0x1234);
+    const auto discarded = driver::TargetBufferFlags::DEPTH_AND_STENCIL;
+
+    FrameGraphResource input = fg.importResource("colorTarget",
+            { .width = svp.width, .height = svp.height, .format = driver::TextureFormat::RGBA16F },
+            Handle<HwRenderTarget>(0x10), Handle<HwTexture>(0x11));
+
+    FrameGraphResource output = fg.importResource("viewRenderTarget",
+            { .width = vp.width, .height = vp.height },
+            viewRenderTarget, vp, discarded);
+
+    struct PassData {
+        FrameGraphResource input;
+        FrameGraphResource output;
+    };
+
+    bool executed[2] = {};
+
+    auto& toneMapping = fg.addPass<PassData>("tonemapping",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.input = builder.read(input);
+                data.output = builder.write(builder.createResource("tonemapping output",
+                        { .width = svp.width, .height = svp.height }));
+            },
+            [=, &executed](FrameGraphPassResources const& resources, PassData const& data,
+                    driver::DriverApi&) {
+                executed[0] = true;
+                auto const& out = resources.getRenderTarget(data.output);
+                EXPECT_TRUE(out.target);
+                EXPECT_EQ(0, out.params.left);
+                EXPECT_EQ(0, out.params.bottom);
+                EXPECT_EQ(svp.width, out.params.width);
+                EXPECT_EQ(svp.height, out.params.height);
+                EXPECT_EQ(driver::TargetBufferFlags::ALL, out.params.discardStart);
+                // the next pass reads the color buffer
+                EXPECT_EQ(driver::TargetBufferFlags::DEPTH_AND_STENCIL, out.params.discardEnd);
+            });
+
+    auto& fxaa = fg.addPass<PassData>("fxaa",
+            [&](FrameGraph::Builder& builder, PassData& data) {
+                data.input = builder.read(toneMapping.getData().output);
+                data.output = builder.write(builder.createResource("fxaa output",
+                        { .width = svp.width, .height = svp.height }));
+            },
+            [=, &executed](FrameGraphPassResources const& resources, PassData const& data,
+                    driver::DriverApi&) {
+                executed[1] = true;
+                auto const& out = resources.getRenderTarget(data.output);
+                EXPECT_EQ(viewRenderTarget, out.target);
+                EXPECT_EQ(vp.left, out.params.left);
+                EXPECT_EQ(vp.bottom, out.params.bottom);
+                EXPECT_EQ(vp.width, out.params.width);
+                EXPECT_EQ(vp.height, out.params.height);
+                EXPECT_EQ(discarded, out.params.discardStart);
+                EXPECT_EQ(driver::TargetBufferFlags::DEPTH_AND_STENCIL, out.params.discardEnd);
+            });
+
+    fg.moveResource(output, fxaa.getData().output);
+    fg.present(output, FrameGraph::Builder::COLOR);
+
+    fg.compile();
+
+    // only the output of the tone mapping is allocated by the framegraph
+    FrameGraph::MemoryStats const& stats = fg.getMemoryStats();
+    EXPECT_EQ(1, stats.resources);
+    EXPECT_EQ(1, stats.allocations);
+    EXPECT_EQ(svp.width * svp.height * 4, stats.peak);
+
+    fg.execute(driverApi);
+
+    EXPECT_TRUE(executed[0]);
+    EXPECT_TRUE(executed[1]);
+}
@@ -14,8 +14,16 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -26,20 +34,50 @@
 #include <filament/Camera.h>
 #include <filament/Color.h>
 #include <filament/Frustum.h>
+#include <filament/IndexBuffer.h>
+#include <filament/LightManager.h>
 #include <filament/Material.h>
 #include <filament/Engine.h>
+#include <filament/RenderableManager.h>
+#include <filament/Renderer.h>
+#include <filament/Scene.h>
+#include <filament/TransformManager.h>
+#include <filament/VertexBuffer.h>
+#include <filament/View.h>
+
+#include <utils/JobSystem.h>
 
 #include <private/filament/UniformInterfaceBlock.h>
 #include <private/filament/UibGenerator.h>
 
 #include "details/Allocators.h"
+#include "details/BoundingVolumeHierarchy.h"
 #include "details/Material.h"
 #include "details/Camera.h"
+#include "details/Culler.h"
 #include "details/Froxelizer.h"
+#include "details/IndexBuffer.h"
+#include "details/OcclusionCuller.h"
+#include "details/Renderer.h"
+#include "details/ShadowAtlas.h"
+#include "details/VertexBuffer.h"
+#include "details/View.h"
 #include "details/Engine.h"
+#include "components/ChangeLog.h"
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
+#include "fg/FrameGraph.h"
+#include "fg/FrameGraphPassResources.h"
+#include "RenderPass.h"
+#include "RenderTargetPool.h"
 #include "UniformBuffer.h"
+#include "driver/CircularBuffer.h"
+#include "driver/CommandBufferQueue.h"
+#include "driver/CommandReplay.h"
+#include "driver/CommandStream.h"
+#include "driver/CommandTrace.h"
+#include "driver/DriverStateFilter.h"
+#include "driver/noop/NoopDriver.h"
 
 using namespace filament;
 using namespace math;
@@ -86,30 +124,30 @@ TEST(FilamentTest, TransformManager) {
     EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 1 }});
 
     // test setting a transform
-    tcm.setTransform(parent, mat4f{ float4{ 2 }});
+    tcm.setTransform(parent, mat4f::scale(2.0f));
 
     // test local and world transform propagation
-    EXPECT_EQ(tcm.getTransform(parent), mat4f{ float4{ 2 }});
-    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f{ float4{ 2 }});
+    EXPECT_EQ(tcm.getTransform(parent), mat4f::scale(2.0f));
+    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f::scale(2.0f));
     EXPECT_EQ(tcm.getTransform(child), mat4f{ float4{ 1 }});
-    EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 2 }});
+    EXPECT_EQ(tcm.getWorldTransform(child), mat4f::scale(2.0f));
 
     // test local transaction
     tcm.openLocalTransformTransaction();
-    tcm.setTransform(parent, mat4f{ float4{ 4 }});
+    tcm.setTransform(parent, mat4f::scale(4.0f));
 
     // check the transforms ARE NOT propagated
-    EXPECT_EQ(tcm.getTransform(parent), mat4f{ float4{ 4 }});
-    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f{ float4{ 2 }});
+    EXPECT_EQ(tcm.getTransform(parent), mat4f::scale(4.0f));
+    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f::scale(2.0f));
     EXPECT_EQ(tcm.getTransform(child), mat4f{ float4{ 1 }});
-    EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 2 }});
+    EXPECT_EQ(tcm.getWorldTransform(child), mat4f::scale(2.0f));
 
     tcm.commitLocalTransformTransaction();
     // test propagation after closing the transaction
-    EXPECT_EQ(tcm.getTransform(parent), mat4f{ float4{ 4 }});
-    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f{ float4{ 4 }});
+    EXPECT_EQ(tcm.getTransform(parent), mat4f::scale(4.0f));
+    EXPECT_EQ(tcm.getWorldTransform(parent), mat4f::scale(4.0f));
     EXPECT_EQ(tcm.getTransform(child), mat4f{ float4{ 1 }});
-    EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 4 }});
+    EXPECT_EQ(tcm.getWorldTransform(child), mat4f::scale(4.0f));
 
     //
     // test out-of-order parent/child
@@ -128,7 +166,7 @@ TEST(FilamentTest, TransformManager) {
 
     // local transaction reorders parent/child
     tcm.openLocalTransformTransaction();
-    tcm.setTransform(newParent, mat4f{ float4{ 8 }});
+    tcm.setTransform(newParent, mat4f::scale(8.0f));
     tcm.commitLocalTransformTransaction();
 
     // local transaction invalidates Instances
@@ -140,10 +178,316 @@ TEST(FilamentTest, TransformManager) {
     EXPECT_GT(child, newParent);
 
     // check transform propagation
-    EXPECT_EQ(tcm.getTransform(newParent), mat4f{ float4{ 8 }});
-    EXPECT_EQ(tcm.getWorldTransform(newParent), mat4f{ float4{ 8 }});
+    EXPECT_EQ(tcm.getTransform(newParent), mat4f::scale(8.0f));
+    EXPECT_EQ(tcm.getWorldTransform(newParent), mat4f::scale(8.0f));
     EXPECT_EQ(tcm.getTransform(child), mat4f{ float4{ 1 }});
-    EXPECT_EQ(tcm.getWorldTransform(child), mat4f{ float4{ 8 }});
+    EXPECT_EQ(tcm.getWorldTransform(child), mat4f::scale(8.0f));
+}
+
+TEST(FilamentTest, TransformManagerDirtySubtrees) {
+    filament::details::FTransformManager tcm;
+    EntityManager& em = EntityManager::get();
+    std::array<Entity, 4> entities;
+    em.create(entities.size(), entities.data());
+
+    // root -> { a -> { leaf }, b }
+    tcm.create(entities[0], {}, mat4f::translate(float3{ 1, 0, 0 }));
+    auto root = tcm.getInstance(entities[0]);
+    tcm.create(entities[1], root, mat4f::translate(float3{ 0, 1, 0 }));
+    tcm.create(entities[2], root, mat4f::translate(float3{ 0, 0, 1 }));
+    tcm.create(entities[3], tcm.getInstance(entities[1]), mat4f::translate(float3{ 2, 0, 0 }));
+
+    // only the subtree of 'a' is updated and recorded as changed
+    auto generation = tcm.getChangeLog().getGeneration();
+    tcm.openLocalTransformTransaction();
+    tcm.setTransform(tcm.getInstance(entities[1]), mat4f::translate(float3{ 0, 3, 0 }));
+    tcm.setTransform(tcm.getInstance(entities[3]), mat4f::translate(float3{ 4, 0, 0 }));
+    EXPECT_EQ(tcm.getChangeLog().getGeneration(), generation);
+    tcm.commitLocalTransformTransaction();
+
+    Slice<const Entity> changes;
+    EXPECT_TRUE(tcm.getChangeLog().getChangesSince(generation, changes));
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0], entities[1]);
+    EXPECT_EQ(changes[1], entities[3]);
+
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(entities[3])),
+            mat4f::translate(float3{ 5, 3, 0 }));
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(entities[2])),
+            mat4f::translate(float3{ 1, 0, 1 }));
+
+    em.destroy(entities.size(), entities.data());
+}
+
+TEST(FilamentTest, TransformManagerSortBreadthFirst) {
+    filament::details::FTransformManager tcm;
+    EntityManager& em = EntityManager::get();
+    std::array<Entity, 6> e;
+    em.create(e.size(), e.data());
+    auto instance = [&tcm, &e](size_t k) { return tcm.getInstance(e[k]).asValue(); };
+
+    for (Entity entity : e) {
+        tcm.create(entity);
+    }
+
+    // e2, e3 -> { e4, e0 -> { e1, e5 } }, with each child stored before its parent
+    tcm.setParent(tcm.getInstance(e[0]), tcm.getInstance(e[3]));
+    tcm.setParent(tcm.getInstance(e[4]), tcm.getInstance(e[3]));
+    tcm.setParent(tcm.getInstance(e[5]), tcm.getInstance(e[0]));
+    tcm.setParent(tcm.getInstance(e[1]), tcm.getInstance(e[0]));
+    tcm.setTransform(tcm.getInstance(e[3]), mat4f::translate(float3{ 1, 0, 0 }));
+    tcm.setTransform(tcm.getInstance(e[0]), mat4f::translate(float3{ 0, 1, 0 }));
+    tcm.setTransform(tcm.getInstance(e[5]), mat4f::translate(float3{ 0, 0, 1 }));
+
+    // the roots come first, then each level, children in the order of their parent's list
+    tcm.openLocalTransformTransaction();
+    tcm.commitLocalTransformTransaction();
+    EXPECT_EQ(instance(2), 1u);
+    EXPECT_EQ(instance(3), 2u);
+    EXPECT_EQ(instance(4), 3u);
+    EXPECT_EQ(instance(0), 4u);
+    EXPECT_EQ(instance(1), 5u);
+    EXPECT_EQ(instance(5), 6u);
+
+    // the links follow the nodes
+    tcm.openLocalTransformTransaction();
+    tcm.setTransform(tcm.getInstance(e[3]), mat4f::translate(float3{ 2, 0, 0 }));
+    tcm.commitLocalTransformTransaction();
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(e[5])), mat4f::translate(float3{ 2, 1, 1 }));
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(e[1])), mat4f::translate(float3{ 2, 1, 0 }));
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(e[4])), mat4f::translate(float3{ 2, 0, 0 }));
+    EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(e[2])), mat4f{});
+
+    // a child created away from its siblings makes them contiguous again at the next commit
+    Entity child;
+    em.create(1, &child);
+    tcm.create(child, tcm.getInstance(e[4]), mat4f{});
+    Entity sibling;
+    em.create(1, &sibling);
+    tcm.create(sibling, tcm.getInstance(e[3]), mat4f{});
+    EXPECT_EQ(tcm.getInstance(sibling).asValue(), 8u);
+    tcm.openLocalTransformTransaction();
+    tcm.commitLocalTransformTransaction();
+    EXPECT_EQ(tcm.getInstance(sibling).asValue(), 3u);
+    EXPECT_EQ(tcm.getInstance(child).asValue(), 6u);
+
+    em.destroy(1, &sibling);
+    em.destroy(1, &child);
+    em.destroy(e.size(), e.data());
+}
+
+TEST(FilamentTest, ChangeLog) {
+    filament::details::ChangeLog log;
+    EntityManager& em = EntityManager::get();
+    std::array<Entity, 2> entities;
+    em.create(entities.size(), entities.data());
+
+    Slice<const Entity> changes;
+    EXPECT_EQ(log.getGeneration(), 0u);
+    EXPECT_TRUE(log.getChangesSince(0, changes));
+    EXPECT_EQ(changes.size(), 0u);
+
+    // test recording changes
+    log.add(entities[0]);
+    log.add(entities[1]);
+    EXPECT_EQ(log.getGeneration(), 2u);
+    EXPECT_TRUE(log.getChangesSince(0, changes));
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0], entities[0]);
+    EXPECT_EQ(changes[1], entities[1]);
+
+    // test changes since a given generation
+    EXPECT_TRUE(log.getChangesSince(1, changes));
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_EQ(changes[0], entities[1]);
+
+    // test history overflow: old generations become unavailable, recent ones are kept
+    filament::details::ChangeLog::Generation recent = 0;
+    for (size_t i = 0; i < filament::details::ChangeLog::MAX_ENTRIES; i++) {
+        recent = log.getGeneration();
+        log.add(entities[0]);
+    }
+    EXPECT_EQ(log.getGeneration(), filament::details::ChangeLog::MAX_ENTRIES + 2);
+    EXPECT_FALSE(log.getChangesSince(0, changes));
+    EXPECT_TRUE(log.getChangesSince(recent, changes));
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_EQ(changes[0], entities[0]);
+
+    em.destroy(entities.size(), entities.data());
+}
+
+TEST(FilamentTest, SceneIncrementalUpdate) {
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FTransformManager& tcm = engine->getTransformManager();
+    FLightManager& lcm = engine->getLightManager();
+
+    // renderables, point lights, and a single directional light so that the dominant one
+    // doesn't depend on the order of the entities
+    const size_t renderableCount = 48;
+    const size_t lightCount = 8;
+    std::vector<Entity> entities(renderableCount + lightCount + 1);
+    EntityManager::get().create(entities.size(), entities.data());
+    auto buildRenderable = [engine](Entity e) {
+        RenderableManager::Builder(1)
+                .boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }})
+                .build(*engine, e);
+    };
+    for (size_t i = 0; i < entities.size(); i++) {
+        tcm.create(entities[i]);
+        if (i < renderableCount) {
+            buildRenderable(entities[i]);
+        } else if (i < renderableCount + lightCount) {
+            LightManager::Builder(LightManager::Type::POINT).falloff(4).build(*engine, entities[i]);
+        } else {
+            LightManager::Builder(LightManager::Type::DIRECTIONAL).build(*engine, entities[i]);
+        }
+    }
+
+    FScene* scene = engine->createScene();
+    std::vector<bool> inScene(entities.size());
+    for (size_t i = 0; i < entities.size(); i += 2) {
+        scene->addEntity(entities[i]);
+        inScene[i] = true;
+    }
+
+    // compares the SoAs of the incrementally updated scene with the ones of a scene prepared
+    // from scratch, row by row, matched by component instance since the orders differ
+    auto check = [&](size_t frame) {
+        FScene* fresh = engine->createScene();
+        for (size_t i = 0; i < entities.size(); i++) {
+            if (inScene[i]) {
+                fresh->addEntity(entities[i]);
+            }
+        }
+        fresh->prepare({});
+
+        auto same = [](auto const& lhs, auto const& rhs) {
+            return !memcmp(&lhs, &rhs, sizeof(lhs));
+        };
+
+        auto const& actual = scene->getRenderableData();
+        auto const& expected = fresh->getRenderableData();
+        ASSERT_EQ(expected.size(), actual.size()) << "frame " << frame;
+        std::map<uint32_t, size_t> rows;
+        for (size_t i = 0; i < expected.size(); i++) {
+            rows[expected.elementAt<FScene::RENDERABLE_INSTANCE>(i).asValue()] = i;
+        }
+        for (size_t i = 0; i < actual.size(); i++) {
+            auto pos = rows.find(actual.elementAt<FScene::RENDERABLE_INSTANCE>(i).asValue());
+            ASSERT_NE(pos, rows.end()) << "frame " << frame;
+            const size_t j = pos->second;
+            EXPECT_TRUE(same(actual.elementAt<FScene::WORLD_TRANSFORM>(i),
+                    expected.elementAt<FScene::WORLD_TRANSFORM>(j))) << "frame " << frame;
+            EXPECT_TRUE(same(actual.elementAt<FScene::VISIBILITY_STATE>(i),
+                    expected.elementAt<FScene::VISIBILITY_STATE>(j))) << "frame " << frame;
+            EXPECT_EQ(actual.elementAt<FScene::BONES_UBH>(i),
+                    expected.elementAt<FScene::BONES_UBH>(j)) << "frame " << frame;
+            EXPECT_TRUE(same(actual.elementAt<FScene::WORLD_AABB_CENTER>(i),
+                    expected.elementAt<FScene::WORLD_AABB_CENTER>(j))) << "frame " << frame;
+            EXPECT_EQ(actual.elementAt<FScene::LAYERS>(i),
+                    expected.elementAt<FScene::LAYERS>(j)) << "frame " << frame;
+            EXPECT_TRUE(same(actual.elementAt<FScene::WORLD_AABB_EXTENT>(i),
+                    expected.elementAt<FScene::WORLD_AABB_EXTENT>(j))) << "frame " << frame;
+        }
+
+        auto const& actualLights = scene->getLightData();
+        auto const& expectedLights = fresh->getLightData();
+        ASSERT_EQ(expectedLights.size(), actualLights.size()) << "frame " << frame;
+        rows.clear();
+        for (size_t i = 0; i < expectedLights.size(); i++) {
+            rows[expectedLights.elementAt<FScene::LIGHT_INSTANCE>(i).asValue()] = i;
+        }
+        for (size_t i = 0; i < actualLights.size(); i++) {
+            auto pos = rows.find(actualLights.elementAt<FScene::LIGHT_INSTANCE>(i).asValue());
+            ASSERT_NE(pos, rows.end()) << "frame " << frame;
+            const size_t j = pos->second;
+            EXPECT_TRUE(same(actualLights.elementAt<FScene::POSITION_RADIUS>(i),
+                    expectedLights.elementAt<FScene::POSITION_RADIUS>(j))) << "frame " << frame;
+            EXPECT_TRUE(same(actualLights.elementAt<FScene::DIRECTION>(i),
+                    expectedLights.elementAt<FScene::DIRECTION>(j))) << "frame " << frame;
+        }
+
+        engine->destroy(fresh);
+    };
+
+    scene->prepare({});
+    check(0);
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<size_t> entity(0, entities.size() - 1);
+    std::uniform_int_distribution<int> change(0, 5);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> angle(0.0f, float(2 * M_PI));
+    for (size_t frame = 1; frame <= 30; frame++) {
+        // the hierarchy is refit or rebuilt incrementally too
+        scene->setBoundingVolumeHierarchyEnabled(frame > 15);
+
+        for (size_t k = 0; k < 10; k++) {
+            const size_t i = entity(gen);
+            const Entity e = entities[i];
+            auto ri = rcm.getInstance(e);
+            switch (change(gen)) {
+                case 0:
+                    if (inScene[i]) {
+                        scene->remove(e);
+                    } else {
+                        scene->addEntity(e);
+                    }
+                    inScene[i] = !inScene[i];
+                    break;
+                case 1:
+                    tcm.setTransform(tcm.getInstance(e),
+                            mat4f::translate(float3{ position(gen), position(gen), position(gen) }) *
+                            mat4f::rotate(angle(gen), float3{ 0, 1, 1 }));
+                    break;
+                case 2: {
+                    // parent to an entity with a lower index, so there is no cycle
+                    const size_t parent = entity(gen) % (i + 1);
+                    tcm.setParent(tcm.getInstance(e),
+                            parent < i ? tcm.getInstance(entities[parent]) : TransformManager::Instance{});
+                    break;
+                }
+                case 3:
+                    if (ri) {
+                        rcm.setCastShadows(ri, !rcm.getVisibility(ri).castShadows);
+                        rcm.setLayerMask(ri, uint8_t(1u << (k % 8)));
+                    }
+                    break;
+                case 4:
+                    if (i < renderableCount) {
+                        if (ri) {
+                            rcm.destroy(e);
+                        } else {
+                            buildRenderable(e);
+                        }
+                    }
+                    break;
+                case 5: {
+                    auto li = lcm.getInstance(e);
+                    if (li && !lcm.isDirectionalLight(li)) {
+                        lcm.setLocalPosition(li, { position(gen), position(gen), position(gen) });
+                    }
+                    break;
+                }
+            }
+        }
+
+        scene->prepare({});
+        check(frame);
+    }
+
+    engine->destroy(scene);
+    for (Entity e : entities) {
+        rcm.destroy(e);
+        lcm.destroy(e);
+        tcm.destroy(e);
+    }
+    EntityManager::get().destroy(entities.size(), entities.data());
+    engine->shutdown();
+    delete engine;
 }
 
 TEST(FilamentTest, UniformInterfaceBlock) {
@@ -410,6 +754,1256 @@ TEST(FilamentTest, SphereCulling) {
     EXPECT_TRUE(frustum.intersects({ 0, 200 }));
 }
 
+TEST(FilamentTest, CullingKernels) {
+    using filament::details::Culler;
+
+    const size_t count = 1000;
+    const size_t capacity = Culler::round(count);
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 20.0f);
+    std::vector<float3> centers(capacity);
+    std::vector<float3> extents(capacity);
+    std::vector<float4> spheres(capacity);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+        spheres[i] = { centers[i], size(gen) };
+    }
+
+    Frustum frustum(mat4f::perspective(60, 1, 1, 100) *
+            inverse(mat4f::lookAt(float3{ 0 }, float3{ 1, 0.5f, -1 }, float3{ 0, 1, 0 })));
+
+    // boxes results are or'ed with the existing content
+    std::vector<Culler::result_type> expectedBoxes(capacity, 0x80);
+    std::vector<Culler::result_type> expectedSpheres(capacity, 0);
+    Culler::Test::intersects(Culler::Kernel::GENERIC, expectedBoxes.data(), frustum,
+            centers.data(), extents.data(), count);
+    Culler::Test::intersects(Culler::Kernel::GENERIC, expectedSpheres.data(), frustum,
+            spheres.data(), count);
+
+    // all kernels must return the same results as the generic one
+    for (Culler::Kernel kernel : { Culler::Kernel::NEON,
+            Culler::Kernel::AVX2, Culler::Kernel::AVX512 }) {
+        if (!Culler::isSupported(kernel)) {
+            continue;
+        }
+        std::vector<Culler::result_type> boxes(capacity, 0x80);
+        std::vector<Culler::result_type> results(capacity, 0);
+        Culler::Test::intersects(kernel, boxes.data(), frustum,
+                centers.data(), extents.data(), count);
+        Culler::Test::intersects(kernel, results.data(), frustum,
+                spheres.data(), count);
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(boxes[i], expectedBoxes[i]);
+            EXPECT_EQ(bool(results[i]), bool(expectedSpheres[i]));
+        }
+    }
+}
+
+TEST(FilamentTest, BoundingVolumeHierarchyCulling) {
+    using filament::details::BoundingVolumeHierarchy;
+    using filament::details::Culler;
+
+    JobSystem js;
+    js.adopt();
+
+    // random boxes, with some padding at the end for the culling kernel
+    const size_t count = 1000;
+    const size_t capacity = Culler::round(count);
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    std::vector<float3> centers(capacity);
+    std::vector<float3> extents(capacity);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+    }
+
+    Frustum frustum(mat4f::perspective(60, 1, 1, 100) *
+            inverse(mat4f::lookAt(float3{ 0 }, float3{ 1, 0.5f, -1 }, float3{ 0, 1, 0 })));
+
+    auto check = [&](BoundingVolumeHierarchy const& bvh) {
+        // the hierarchy expects the boxes in its order
+        uint32_t const* order = bvh.getOrder();
+        std::vector<float3> orderedCenters(capacity);
+        std::vector<float3> orderedExtents(capacity);
+        for (size_t i = 0; i < count; i++) {
+            orderedCenters[i] = centers[order[i]];
+            orderedExtents[i] = extents[order[i]];
+        }
+
+        std::vector<Culler::result_type> expected(capacity, 0);
+        std::vector<Culler::result_type> results(capacity, 0);
+        Culler::Test::intersects(expected.data(), frustum,
+                centers.data(), extents.data(), count);
+        bvh.cull(js, results.data(), frustum,
+                orderedCenters.data(), orderedExtents.data(), 0);
+
+        size_t visible = 0;
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(bool(results[i]), bool(expected[order[i]]));
+            visible += expected[order[i]] ? 1 : 0;
+        }
+        // make sure the test is meaningful
+        EXPECT_GT(visible, 0u);
+        EXPECT_LT(visible, count);
+    };
+
+    BoundingVolumeHierarchy bvh;
+    bvh.build(centers.data(), extents.data(), count);
+    EXPECT_EQ(bvh.size(), count);
+    check(bvh);
+
+    // move some boxes and refit the hierarchy
+    std::vector<uint32_t> moved;
+    for (uint32_t i = 0; i < count; i += 7) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        moved.push_back(i);
+    }
+    bvh.refit(centers.data(), extents.data(), moved.data(), moved.size());
+    check(bvh);
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, OcclusionCulling) {
+    using filament::details::FEngine;
+    using filament::details::FRenderableManager;
+    using filament::details::FScene;
+    using filament::details::OcclusionCuller;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FRenderableManager& rcm = engine->getRenderableManager();
+
+    const mat4f clipFromWorld = mat4f::perspective(60, 1, 1, 100) *
+            inverse(mat4f::lookAt(float3{ 0 }, float3{ 0, 0, -1 }, float3{ 0, 1, 0 }));
+
+    struct Box {
+        float3 center;
+        float3 extent;
+        mat4f transform;
+        bool occluder;
+        bool culling;
+        bool hidden;
+    };
+
+    // culls the boxes, their local bounding box is the given one, and checks the results
+    auto cull = [&](Box const* boxes, size_t count) {
+        std::vector<Entity> entities(count);
+        EntityManager::get().create(count, entities.data());
+        FScene::RenderableSoa soa;
+        soa.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const filament::Box localBox{ boxes[i].center, boxes[i].extent };
+            RenderableManager::Builder(1).boundingBox(localBox).build(*engine, entities[i]);
+            const filament::Box worldBox = rigidTransform(localBox, boxes[i].transform);
+            FRenderableManager::Visibility visibility{};
+            visibility.culling = boxes[i].culling;
+            visibility.occluder = boxes[i].occluder;
+            soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = rcm.getInstance(entities[i]);
+            soa.elementAt<FScene::WORLD_TRANSFORM>(i) = affinef(boxes[i].transform);
+            soa.elementAt<FScene::VISIBILITY_STATE>(i) = visibility;
+            soa.elementAt<FScene::WORLD_AABB_CENTER>(i) = worldBox.center;
+            soa.elementAt<FScene::WORLD_AABB_EXTENT>(i) = worldBox.halfExtent;
+            soa.elementAt<FScene::LAYERS>(i) = 0x1;
+            soa.elementAt<FScene::VISIBLE_MASK>(i) = 0x1;
+        }
+
+        OcclusionCuller culler;
+        culler.setResolution(64, 64);
+        culler.cull(engine->getJobSystem(), rcm, soa, clipFromWorld, 0x1, 0);
+
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(soa.elementAt<FScene::VISIBLE_MASK>(i), boxes[i].hidden ? 0 : 1) << i;
+        }
+
+        for (Entity e : entities) {
+            rcm.destroy(e);
+        }
+        EntityManager::get().destroy(count, entities.data());
+        return culler.getStats();
+    };
+
+    const Box boxes[] = {
+            { { 0, 0, -10 }, { 4, 4, 0.5f }, {}, true,  true,  false },  // a wall facing the camera
+            { { 0, 0, -20 }, { 1, 1, 1 },    {}, false, true,  true  },  // behind the wall
+            { { 8, 0, -12 }, { 1, 1, 1 },    {}, false, true,  false },  // next to the wall
+            { { 0, 0, -5 },  { 1, 1, 1 },    {}, false, true,  false },  // in front of the wall
+            { { 0, 0, -9 },  { 1, 1, 2 },    {}, false, true,  false },  // through the wall
+            { { 0, 0, -30 }, { 1, 1, 1 },    {}, false, false, false },  // behind, but can't be culled
+    };
+    OcclusionCuller::Stats stats = cull(boxes, sizeof(boxes) / sizeof(boxes[0]));
+    EXPECT_EQ(stats.occluders, 1u);
+    EXPECT_EQ(stats.tested, 5u);
+    EXPECT_EQ(stats.occluded, 1u);
+
+    // A bar along the diagonal of the screen, its world-space box covers the middle of the
+    // screen, but only the boxes behind the bar itself are hidden.
+    const mat4f bar = mat4f::translate(float3{ 0, 0, -10 }) *
+            mat4f::rotate(float(M_PI / 4), float3{ 0, 0, 1 });
+    const Box rotated[] = {
+            { { 0, 0, 0 },    { 4, 1, 0.5f },          bar, true,  true, false },
+            { { 3, -3, -20 }, { 0.25f, 0.25f, 0.25f }, {},  false, true, false },  // beside
+            { { 2, 2, -20 },  { 0.25f, 0.25f, 0.25f }, {},  false, true, true  },  // behind
+    };
+    stats = cull(rotated, sizeof(rotated) / sizeof(rotated[0]));
+    EXPECT_EQ(stats.occluders, 1u);
+    EXPECT_EQ(stats.tested, 3u);
+    EXPECT_EQ(stats.occluded, 1u);
+
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, SortCommands) {
+    using filament::details::RenderPass;
+    using Command = RenderPass::Command;
+
+    JobSystem js;
+    js.adopt();
+
+    // large enough to use the radix sort
+    const size_t count = 20000;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<uint32_t> distance;
+    std::uniform_int_distribution<uint32_t> pass(0, 9);
+    std::vector<Command> commands(count);
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t p = pass(gen);
+        commands[i].key = p == 0 ? uint64_t(RenderPass::Pass::SENTINEL) :
+                (uint64_t(p % 3) << RenderPass::PASS_SHIFT) | (distance(gen) & 0xFFF0F);
+        commands[i].primitive.index = uint16_t(i);
+    }
+
+    std::vector<Command> expected(commands);
+    std::stable_sort(expected.begin(), expected.end());
+
+    std::vector<Command> scratch(count);
+    RenderPass::sortCommands(js, commands.data(), commands.data() + count, scratch.data());
+
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(commands[i].key, expected[i].key);
+        // the radix sort is stable
+        EXPECT_EQ(commands[i].primitive.index, expected[i].primitive.index);
+    }
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, BatchCommands) {
+    using filament::details::RenderPass;
+    using Command = RenderPass::Command;
+
+    // the material instance is only compared, never dereferenced
+    auto mi = reinterpret_cast<filament::details::FMaterialInstance const*>(uintptr_t(0x100));
+    const Handle<HwRenderPrimitive> a(1);
+    const Handle<HwRenderPrimitive> b(2);
+    const Handle<HwUniformBuffer> bones(3);
+
+    std::vector<Command> commands;
+    auto add = [&](size_t count, Handle<HwRenderPrimitive> primitive, bool inverseFrontFaces,
+            Handle<HwUniformBuffer> boneUbh) {
+        for (size_t i = 0; i < count; i++) {
+            Command cmd;
+            cmd.key = uint64_t(RenderPass::Pass::COLOR);
+            cmd.primitive.mi = mi;
+            cmd.primitive.primitiveHandle = primitive;
+            cmd.primitive.perRenderableBones = boneUbh;
+            cmd.primitive.rasterState.inverseFrontFaces = inverseFrontFaces;
+            cmd.primitive.index = uint16_t(commands.size());
+            commands.push_back(cmd);
+        }
+    };
+    add(150, a, false, {});
+    add(2, b, false, {});
+    add(2, b, false, bones);    // skinned primitives are never instanced
+    add(3, b, true, {});
+    add(1, a, false, {});
+    commands.push_back({});
+    commands.back().key = uint64_t(RenderPass::Pass::SENTINEL);
+
+    EXPECT_EQ(CONFIG_MAX_INSTANCES * 2 + 22 + 2 + 3, RenderPass::batchCommands(commands.data()));
+
+    std::vector<size_t> runs;
+    for (Command const* c = commands.data(); c->key != uint64_t(RenderPass::Pass::SENTINEL);
+            c += c->primitive.instanceCount) {
+        runs.push_back(c->primitive.instanceCount);
+    }
+    std::vector<size_t> expected = {
+            CONFIG_MAX_INSTANCES, CONFIG_MAX_INSTANCES, 150 - 2 * CONFIG_MAX_INSTANCES,
+            2, 1, 1, 3, 1 };
+    EXPECT_EQ(expected, runs);
+}
+
+TEST(FilamentTest, CommandCache) {
+    using namespace filament::details;
+    using Command = RenderPass::Command;
+
+    struct TestPass : public RenderPass {
+        TestPass() noexcept : RenderPass("CommandCache") { }
+        void beginRenderPass(driver::DriverApi&, Viewport const&, const CameraInfo&) noexcept override { }
+        void endRenderPass(driver::DriverApi&, Viewport const&) noexcept override { }
+    };
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    JobSystem& js = engine->getJobSystem();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FTransformManager& tcm = engine->getTransformManager();
+
+    FVertexBuffer* vb = upcast(VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine));
+    FIndexBuffer* ib = upcast(IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+
+    // A material instance per renderable gives all commands distinct keys, so that the order
+    // of the sorted commands is fully defined. The renderables are closer to each other in
+    // depth than the camera moves below, so that these moves reorder them. Their materials
+    // sort in the opposite order, so that moving between distance buckets reorders them too.
+    const size_t count = 64;
+    std::vector<Entity> entities(count);
+    std::vector<FMaterialInstance*> instances(count);
+    EntityManager::get().create(count, entities.data());
+    for (size_t i = count; i-- > 0;) {
+        instances[i] = engine->getDefaultMaterial()->createInstance();
+    }
+    FScene* scene = engine->createScene();
+    for (size_t i = 0; i < count; i++) {
+        tcm.create(entities[i]);
+        tcm.setTransform(tcm.getInstance(entities[i]),
+                mat4f::translate(float3{ float(i % 8) - 3.5f, float(i / 8) - 3.5f,
+                        -5.0f - 0.25f * i }));
+        RenderableManager::Builder(1)
+                .boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }})
+                .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+                .material(0, instances[i])
+                .build(*engine, entities[i]);
+        scene->addEntity(entities[i]);
+    }
+
+    // does what FView::prepare() does with a view that sees everything
+    auto prepare = [&]() {
+        scene->prepare({});
+        FScene::RenderableSoa& soa = scene->getRenderableData();
+        for (size_t i = 0, c = soa.size(); i < c; i++) {
+            soa.elementAt<FScene::PRIMITIVES>(i) =
+                    rcm.getRenderPrimitives(soa.elementAt<FScene::RENDERABLE_INSTANCE>(i), 0);
+            soa.elementAt<FScene::VISIBLE_MASK>(i) = 1;
+        }
+    };
+
+    auto camera = [](float3 position, float yaw) {
+        CameraInfo info{};
+        info.model = mat4f::translate(position) * mat4f::rotate(yaw, float3{ 0, 1, 0 });
+        return info;
+    };
+
+    // Returns the commands up to the first sentinel, and whether they're the cache's
+    std::vector<Command> storage(4096);
+    auto generate = [&](RenderPass const& pass, Range<uint32_t> vr, uint32_t commandTypeFlags,
+            RenderPass::RenderFlags renderFlags, CameraInfo const& info,
+            RenderPass::CommandCache* cache, bool* reused) {
+        GrowingSlice<Command> commands(storage.data(), storage.size());
+        Slice<Command> sorted = pass.appendSortedCommands(*engine, js, *scene, vr,
+                commandTypeFlags, renderFlags, info, commands, cache);
+        if (reused) {
+            *reused = sorted.begin() != commands.begin();
+        }
+        Command* last = sorted.begin();
+        while (last->key != uint64_t(RenderPass::Pass::SENTINEL)) {
+            last++;
+        }
+        return std::vector<Command>(sorted.begin(), last + 1);
+    };
+
+    auto same = [](std::vector<Command> const& lhs, std::vector<Command> const& rhs) {
+        return lhs.size() == rhs.size() &&
+                !memcmp(lhs.data(), rhs.data(), lhs.size() * sizeof(Command));
+    };
+
+    auto order = [](std::vector<Command> const& commands) {
+        std::vector<uint16_t> indices;
+        for (Command const& cmd : commands) {
+            indices.push_back(cmd.primitive.index);
+        }
+        return indices;
+    };
+
+    prepare();
+    const Range<uint32_t> all{ 0, uint32_t(count) };
+    const float3 eye{ 0, 0, 0 };
+
+    // with a depth pass only the depth commands encode distances, without one the color
+    // commands are bucketed by distance
+    const uint32_t passes[] = {
+            RenderPass::CommandTypeFlags::DEPTH | RenderPass::CommandTypeFlags::COLOR,
+            RenderPass::CommandTypeFlags::COLOR };
+    size_t moved = 0;
+    for (uint32_t flags : passes) {
+        TestPass pass;
+        RenderPass::CommandCache cache;
+        const RenderPass::RenderFlags renderFlags = RenderPass::HAS_DIRECTIONAL_LIGHT;
+        bool reused = false;
+
+        // commands are only kept once the scene stayed the same for a frame
+        const CameraInfo a = camera(eye, 0.0f);
+        generate(pass, all, flags, renderFlags, a, &cache, &reused);
+        EXPECT_FALSE(reused);
+        generate(pass, all, flags, renderFlags, a, &cache, &reused);
+        EXPECT_FALSE(reused);
+        std::vector<Command> cached = generate(pass, all, flags, renderFlags, a, &cache, &reused);
+        EXPECT_TRUE(reused);
+        EXPECT_TRUE(same(generate(pass, all, flags, renderFlags, a, nullptr, nullptr), cached));
+
+        // small camera moves re-patch the distances, and re-sort the commands they reorder
+        const CameraInfo b = camera(eye + float3{ 0.3f, 0.0f, -0.4f }, -0.05f);
+        std::vector<Command> fresh = generate(pass, all, flags, renderFlags, b, nullptr, nullptr);
+        EXPECT_NE(order(cached), order(fresh));
+        cached = generate(pass, all, flags, renderFlags, b, &cache, &reused);
+        EXPECT_TRUE(reused);
+        EXPECT_TRUE(same(fresh, cached));
+
+        // larger ones regenerate them
+        const CameraInfo c = camera(eye + float3{ 0.0f, 0.0f, -3.0f }, -0.05f);
+        cached = generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        EXPECT_FALSE(reused);
+        EXPECT_TRUE(same(generate(pass, all, flags, renderFlags, c, nullptr, nullptr), cached));
+        generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        EXPECT_TRUE(reused);
+
+        // so does any change of the key: the render flags...
+        const RenderPass::RenderFlags otherFlags = renderFlags | RenderPass::HAS_DYNAMIC_LIGHTING;
+        cached = generate(pass, all, flags, otherFlags, c, &cache, &reused);
+        EXPECT_FALSE(reused);
+        EXPECT_TRUE(same(generate(pass, all, flags, otherFlags, c, nullptr, nullptr), cached));
+
+        // ...the visible renderables...
+        const Range<uint32_t> some{ 0, uint32_t(count / 2) };
+        generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        EXPECT_TRUE(reused);
+        cached = generate(pass, some, flags, renderFlags, c, &cache, &reused);
+        EXPECT_FALSE(reused);
+        EXPECT_TRUE(same(generate(pass, some, flags, renderFlags, c, nullptr, nullptr), cached));
+
+        // ...and the scene
+        generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        EXPECT_TRUE(reused);
+        tcm.setTransform(tcm.getInstance(entities[moved++]),
+                mat4f::translate(float3{ 0.0f, 0.0f, -30.0f }));
+        prepare();
+        cached = generate(pass, all, flags, renderFlags, c, &cache, &reused);
+        EXPECT_FALSE(reused);
+        EXPECT_TRUE(same(generate(pass, all, flags, renderFlags, c, nullptr, nullptr), cached));
+    }
+
+    engine->destroy(scene);
+    for (size_t i = 0; i < count; i++) {
+        engine->destroy(entities[i]);
+        engine->destroy(instances[i]);
+    }
+    engine->destroy(vb);
+    engine->destroy(ib);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, RecordCommandsInParallel) {
+    using namespace filament::details;
+    using Command = RenderPass::Command;
+    using trace::CommandId;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    JobSystem& js = engine->getJobSystem();
+    FScene* scene = engine->createScene();
+    FMaterialInstance const* mi = engine->getDefaultMaterial()->getDefaultInstance();
+    const Handle<HwUniformBuffer> instanceUbh(1);
+
+    // runs of 1 to 4 commands drawing the same primitive, which are drawn instanced, and enough
+    // of them to be recorded by several jobs
+    std::vector<Command> commands;
+    size_t drawCount = 0;
+    for (uint16_t i = 0; commands.size() < 6000; i++, drawCount++) {
+        Command cmd;
+        cmd.key = uint64_t(RenderPass::Pass::COLOR);
+        cmd.primitive.mi = mi;
+        cmd.primitive.primitiveHandle = Handle<HwRenderPrimitive>(i + 1);
+        cmd.primitive.index = i;
+        cmd.primitive.instanceCount = uint8_t(i % 4 + 1);
+        commands.insert(commands.end(), cmd.primitive.instanceCount, cmd);
+    }
+    commands.push_back({});
+    commands.back().key = uint64_t(RenderPass::Pass::SENTINEL);
+
+    // Records the commands, captures what the driver executes and returns the draws in order,
+    // each with the state it's executed with.
+    Driver* driver = NoopDriver::create();
+    auto record = [&](bool parallel, const char* path) {
+        CircularBuffer buffer(FEngine::CONFIG_MIN_COMMAND_BUFFERS_SIZE);
+        CommandStream stream(*driver, buffer);
+        EXPECT_TRUE(stream.startCapture(path));
+        if (parallel) {
+            RenderPass::recordDriverCommands(js, stream, *scene,
+                    { commands.data(), commands.size() }, instanceUbh);
+        } else {
+            RenderPass::recordDriverCommands(stream, *scene,
+                    commands.data(), commands.data() + commands.size(), instanceUbh, 0);
+        }
+        stream.stopCapture();
+        new(buffer.allocate(sizeof(NoopCommand))) NoopCommand(nullptr);
+        stream.execute(buffer.getTail());
+
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+        file.close();
+        std::remove(path);
+
+        trace::Reader reader(data.data(), data.size());
+        reader.readBytes(sizeof(trace::Header));
+        std::map<std::pair<CommandId, uint64_t>, std::string> state;
+        std::vector<std::string> draws;
+        while (reader.remaining() && !reader.hasError()) {
+            const CommandId id = CommandId(reader.readRaw<uint16_t>());
+            const uint32_t size = reader.readRaw<uint32_t>();
+            uint8_t const* const payload = reader.readBytes(size);
+            const std::string command = std::to_string(int(id)) + ":" +
+                    std::string(reinterpret_cast<char const*>(payload), size);
+            trace::Reader binding(payload, size);
+            switch (id) {
+                case CommandId::bindUniformBuffer:
+                case CommandId::bindUniformBufferRange:
+                    state[{ CommandId::bindUniformBuffer, binding.readVarint() }] = command;
+                    break;
+                case CommandId::bindSamplers:
+                    state[{ id, binding.readVarint() }] = command;
+                    break;
+                case CommandId::setViewportScissor:
+                    state[{ id, 0 }] = command;
+                    break;
+                case CommandId::draw:
+                case CommandId::drawInstanced: {
+                    std::string draw = command;
+                    for (auto const& s : state) {
+                        draw += s.second;
+                    }
+                    draws.push_back(draw);
+                    break;
+                }
+                default:
+                    ADD_FAILURE() << "unexpected command " << int(id);
+                    break;
+            }
+        }
+        EXPECT_FALSE(reader.hasError());
+        return draws;
+    };
+
+    std::vector<std::string> serial = record(false, "RecordCommandsInParallel_serial.trace");
+    std::vector<std::string> parallel = record(true, "RecordCommandsInParallel_parallel.trace");
+    EXPECT_EQ(drawCount, serial.size());
+    EXPECT_TRUE(serial == parallel);
+
+    delete driver;
+    engine->destroy(scene);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, CommandCaptureReplay) {
+    using trace::CommandId;
+    const char* path = "CommandCaptureReplay.trace";
+
+    // render a few frames with post-processing, which uses the objects created by the Engine
+    // and the Renderer before the application issues any command
+    Engine* engine = Engine::createWithCommandCapture(path, Engine::Backend::NOOP);
+    ASSERT_NE(nullptr, engine);
+
+    SwapChain* swapChain = engine->createSwapChain(nullptr);
+    Renderer* renderer = engine->createRenderer();
+    Scene* scene = engine->createScene();
+    Camera* camera = engine->createCamera();
+    View* view = engine->createView();
+    view->setScene(scene);
+    view->setCamera(camera);
+    view->setViewport({ 0, 0, 640, 360 });
+    for (size_t i = 0; i < 3; i++) {
+        if (renderer->beginFrame(swapChain)) {
+            renderer->render(view);
+            renderer->endFrame();
+        }
+    }
+    engine->destroy(view);
+    engine->destroy(camera);
+    engine->destroy(scene);
+    engine->destroy(renderer);
+    engine->destroy(swapChain);
+    Engine::destroy(&engine);
+
+    size_t captured = 0;
+    size_t frames = 0;
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+        trace::Reader reader(data.data(), data.size());
+        reader.readBytes(sizeof(trace::Header));
+        while (reader.remaining() && !reader.hasError()) {
+            const CommandId id = CommandId(reader.readRaw<uint16_t>());
+            reader.readBytes(reader.readRaw<uint32_t>());
+            frames += id == CommandId::beginFrame ? 1 : 0;
+            captured++;
+        }
+        EXPECT_FALSE(reader.hasError());
+    }
+    EXPECT_GT(frames, 0u);
+
+    // every command finds the objects it uses
+    Driver* driver = NoopDriver::create();
+    CommandReplay replay(*driver);
+    EXPECT_TRUE(replay.replay(path));
+    EXPECT_EQ(captured, replay.getStats().commands);
+    EXPECT_EQ(0u, replay.getStats().skipped);
+    EXPECT_EQ(frames, replay.getStats().frames);
+    delete driver;
+    std::remove(path);
+}
+
+TEST(FilamentTest, LevelOfDetail) {
+    using filament::details::FRenderableManager;
+
+    FRenderableManager::LevelsOfDetail lods{};
+    lods.count = 3;
+    lods.errors[0] = 0.0f;
+    lods.errors[1] = 0.01f;
+    lods.errors[2] = 0.1f;
+
+    uint8_t current = 0;
+    auto select = [&lods, &current](float pixelsPerUnit) {
+        current = FRenderableManager::selectLevel(lods, current, pixelsPerUnit, 1.0f, 0.25f);
+        return current;
+    };
+
+    // close: even the error of level 1 is visible
+    EXPECT_EQ(0, select(200.0f));
+
+    // moving away, coarser levels are only used once their error is well below the threshold
+    EXPECT_EQ(0, select(90.0f));
+    EXPECT_EQ(1, select(70.0f));
+    EXPECT_EQ(1, select(9.0f));
+    EXPECT_EQ(2, select(7.0f));
+
+    // moving back, finer levels are used as soon as the error reaches the threshold
+    EXPECT_EQ(2, select(9.0f));
+    EXPECT_EQ(2, select(9.5f));
+    EXPECT_EQ(1, select(11.0f));
+    EXPECT_EQ(1, select(90.0f));
+    EXPECT_EQ(0, select(101.0f));
+
+    // large jumps skip levels
+    EXPECT_EQ(2, select(1.0f));
+    EXPECT_EQ(0, select(1000.0f));
+}
+
+TEST(FilamentTest, LevelOfDetailPerView) {
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    JobSystem& js = engine->getJobSystem();
+    FRenderableManager& rcm = engine->getRenderableManager();
+
+    // same levels as above, at the origin
+    Entity e = EntityManager::get().create();
+    RenderableManager::Builder(3)
+            .boundingBox({{ 0, 0, 0 }, { 0, 0, 0 }})
+            .levelOfDetail(0, 0, 1, 0.0f)
+            .levelOfDetail(1, 1, 1, 0.01f)
+            .levelOfDetail(2, 2, 1, 0.1f)
+            .build(*engine, e);
+    auto ri = rcm.getInstance(e);
+    FScene* scene = engine->createScene();
+    scene->addEntity(e);
+    scene->prepare({});
+    FScene::RenderableSoa& soa = scene->getRenderableData();
+
+    // with a viewport 200 pixels high, one unit is 100 pixels at a distance of one unit
+    FView* a = engine->createView();
+    FView* b = engine->createView();
+    a->setViewport({ 0, 0, 200, 200 });
+    b->setViewport({ 0, 0, 200, 200 });
+    auto select = [&](FView* view, float distance, Viewport const& viewport) {
+        CameraInfo camera{};
+        camera.projection[3][3] = 0.0f;
+        camera.model = mat4f::translate(float3{ 0, 0, distance });
+        camera.zn = 0.1f;
+        view->updatePrimitivesLod(*engine, js, camera, viewport, soa, { 0, 1 });
+        for (uint8_t level = 0; level < 3; level++) {
+            if (soa.elementAt<FScene::PRIMITIVES>(0).begin() ==
+                    rcm.getRenderPrimitives(ri, level).begin()) {
+                return int(level);
+            }
+        }
+        return -1;
+    };
+
+    // at 1.2 units, level 1 is within the hysteresis band: a view keeps the level it selected
+    // last, whatever the other views selected
+    EXPECT_EQ(0, select(a, 1.0f, a->getViewport()));
+    EXPECT_EQ(2, select(b, 20.0f, b->getViewport()));
+    EXPECT_EQ(0, select(a, 1.2f, a->getViewport()));
+    EXPECT_EQ(2, select(b, 20.0f, b->getViewport()));
+
+    // levels are selected for the viewport actually rendered, e.g. with dynamic resolution
+    EXPECT_EQ(1, select(a, 1.2f, a->getViewport().scale(float2(0.5f))));
+
+    engine->destroy(a);
+    engine->destroy(b);
+    engine->destroy(scene);
+    engine->destroy(e);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, ShadowCascadeSplits) {
+    using ShadowCascades = LightManager::ShadowCascades;
+    float splits[3];
+
+    ShadowCascades::computeUniformSplits(splits, 4);
+    EXPECT_FLOAT_EQ(0.25f, splits[0]);
+    EXPECT_FLOAT_EQ(0.50f, splits[1]);
+    EXPECT_FLOAT_EQ(0.75f, splits[2]);
+
+    // the distances are 1000^(1/4), 1000^(2/4) and 1000^(3/4)
+    ShadowCascades::computeLogSplits(splits, 4, 1.0f, 1000.0f);
+    EXPECT_NEAR((5.6234f - 1.0f) / 999.0f, splits[0], 1e-5f);
+    EXPECT_NEAR((31.623f - 1.0f) / 999.0f, splits[1], 1e-5f);
+    EXPECT_NEAR((177.83f - 1.0f) / 999.0f, splits[2], 1e-5f);
+
+    float logSplits[3];
+    ShadowCascades::computeLogSplits(logSplits, 3, 0.5f, 100.0f);
+    ShadowCascades::computePracticalSplits(splits, 3, 0.5f, 100.0f, 1.0f);
+    EXPECT_FLOAT_EQ(logSplits[0], splits[0]);
+    EXPECT_FLOAT_EQ(logSplits[1], splits[1]);
+    ShadowCascades::computePracticalSplits(splits, 3, 0.5f, 100.0f, 0.0f);
+    EXPECT_FLOAT_EQ(1.0f / 3.0f, splits[0]);
+    EXPECT_FLOAT_EQ(2.0f / 3.0f, splits[1]);
+    ShadowCascades::computePracticalSplits(splits, 3, 0.5f, 100.0f, 0.5f);
+    EXPECT_FLOAT_EQ((logSplits[0] + 1.0f / 3.0f) * 0.5f, splits[0]);
+    EXPECT_FLOAT_EQ((logSplits[1] + 2.0f / 3.0f) * 0.5f, splits[1]);
+}
+
+TEST(FilamentTest, ShadowAtlasAllocate) {
+    using filament::details::ShadowAtlas;
+    ShadowAtlas atlas;
+
+    auto overlap = [](ShadowAtlas::Tile const& a, ShadowAtlas::Tile const& b) {
+        return a.x < b.x + b.size && b.x < a.x + a.size &&
+               a.y < b.y + b.size && b.y < a.y + a.size;
+    };
+
+    // everything fits, the tiles are laid out from the largest to the smallest
+    ShadowAtlas::Request requests[ShadowAtlas::MAX_TILES];
+    requests[0] = { 1024, 1024 };
+    requests[1] = { 2048, 2048 };
+    requests[2] = {  512,  512 };
+    requests[3] = { 1024, 1024 };
+    atlas.allocate(requests, 4, 4096);
+    EXPECT_EQ((ShadowAtlas::Tile{    0,    0, 2048 }), requests[1].tile);
+    EXPECT_EQ((ShadowAtlas::Tile{ 2048,    0, 1024 }), requests[0].tile);
+    EXPECT_EQ((ShadowAtlas::Tile{ 3072,    0, 1024 }), requests[3].tile);
+    EXPECT_EQ((ShadowAtlas::Tile{ 2048, 1024,  512 }), requests[2].tile);
+
+    // the same requests give the same layout
+    ShadowAtlas::Request again[4] = { requests[0], requests[1], requests[2], requests[3] };
+    atlas.allocate(again, 4, 4096);
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_EQ(requests[i].tile, again[i].tile);
+    }
+
+    // requests are admitted by priority and shrunk down to their minimum size to fit
+    requests[0] = {  512,  512 };
+    requests[1] = {  256,  256 };
+    requests[2] = { 1024,  256 };   // 512
+    requests[3] = { 4096,  128 };   // clamped to the atlas, then 512
+    requests[4] = {  512,  128 };   // 256
+    requests[5] = {  512,  512 };   // doesn't fit
+    atlas.allocate(requests, 6, 1024);
+    EXPECT_EQ(512, requests[0].tile.size);
+    EXPECT_EQ(256, requests[1].tile.size);
+    EXPECT_EQ(512, requests[2].tile.size);
+    EXPECT_EQ(512, requests[3].tile.size);
+    EXPECT_EQ(256, requests[4].tile.size);
+    EXPECT_EQ(0, requests[5].tile.size);
+
+    for (size_t i = 0; i < 5; i++) {
+        ShadowAtlas::Tile const& tile = requests[i].tile;
+        EXPECT_LE(tile.x + tile.size, 1024);
+        EXPECT_LE(tile.y + tile.size, 1024);
+        for (size_t j = 0; j < i; j++) {
+            EXPECT_FALSE(overlap(tile, requests[j].tile));
+        }
+    }
+}
+
+TEST(FilamentTest, SpotShadowSlots) {
+    using filament::details::FView;
+    std::array<FView::SpotShadow, CONFIG_MAX_SHADOW_CASTING_SPOTS> slots;
+    std::array<FView::SpotShadowCandidate, CONFIG_MAX_SHADOW_CASTING_SPOTS> candidates;
+    uint8_t spots[CONFIG_MAX_SHADOW_CASTING_SPOTS];
+
+    // only the most important lights are kept, by decreasing importance
+    const size_t lightCount = CONFIG_MAX_SHADOW_CASTING_SPOTS + 2;
+    size_t count = 0;
+    for (uint32_t i = 1; i <= lightCount; i++) {
+        count = FView::addSpotShadowCandidate(candidates.data(), count,
+                { float(i * 10), i, i, false });
+    }
+    ASSERT_EQ(CONFIG_MAX_SHADOW_CASTING_SPOTS, count);
+    for (size_t k = 0; k < count; k++) {
+        EXPECT_EQ(lightCount - k, candidates[k].index);
+    }
+
+    FView::assignSpotShadowSlots(slots.data(), candidates.data(), count, spots);
+    for (size_t k = 0; k < count; k++) {
+        FView::SpotShadow const& spot = slots[spots[k]];
+        EXPECT_TRUE(spot.active);
+        EXPECT_FALSE(spot.contentValid);
+        EXPECT_EQ(candidates[k].light, spot.light);
+        EXPECT_EQ(candidates[k].index, spot.lightIndex);
+        EXPECT_EQ(candidates[k].importance, spot.importance);
+    }
+
+    // the shadow maps are rendered
+    uint8_t slotOfLight[lightCount + 1];
+    for (size_t k = 0; k < count; k++) {
+        slotOfLight[candidates[k].light] = spots[k];
+        slots[spots[k]].contentValid = true;
+    }
+
+    // The least important light is replaced by a new one and the others change order: they
+    // keep their slot and shadow map, the new light takes the free slot.
+    candidates[count - 1] = { 1000.0f, 1, 1, false };
+    std::reverse(candidates.begin(), candidates.begin() + count);
+    FView::assignSpotShadowSlots(slots.data(), candidates.data(), count, spots);
+    for (size_t k = 1; k < count; k++) {
+        EXPECT_EQ(slotOfLight[candidates[k].light], spots[k]);
+        EXPECT_TRUE(slots[spots[k]].contentValid);
+    }
+    EXPECT_EQ(slotOfLight[lightCount - CONFIG_MAX_SHADOW_CASTING_SPOTS + 1], spots[0]);
+    EXPECT_EQ(1, slots[spots[0]].light.asValue());
+    EXPECT_FALSE(slots[spots[0]].contentValid);
+
+    // a light that doesn't cast shadows anymore frees its slot
+    const uint8_t freed = spots[count - 1];
+    FView::assignSpotShadowSlots(slots.data(), candidates.data(), count - 1, spots);
+    EXPECT_FALSE(slots[freed].active);
+    EXPECT_FALSE(slots[freed].contentValid);
+}
+
+TEST(FilamentTest, SpotShadowBudget) {
+    using filament::details::FView;
+    using filament::details::ShadowAtlas;
+    std::array<FView::SpotShadow, CONFIG_MAX_SHADOW_CASTING_SPOTS> slots;
+    FView::SpotShadowCandidate candidates[3] = {
+            { 300.0f, 1, 1, false },
+            { 200.0f, 2, 2, false },
+            { 100.0f, 3, 3, true },     // static shadows
+    };
+    ShadowAtlas::Request requests[3];
+    requests[0].tile = {   0, 0, 512 };
+    requests[1].tile = { 512, 0, 256 };
+    requests[2].tile = { 768, 0, 256 };
+    uint8_t spots[3];
+    uint32_t frame = 0;
+
+    // runs a frame and returns which lights are rendered, the way FView::prepareShadowing() does
+    auto update = [&](size_t budget, bool reallocated) {
+        frame++;
+        FView::assignSpotShadowSlots(slots.data(), candidates, 3, spots);
+        FView::scheduleSpotShadowUpdates(slots.data(), spots, requests, 3, reallocated,
+                budget, frame);
+        std::array<bool, 3> updated{};
+        for (size_t i = 0; i < 3; i++) {
+            FView::SpotShadow& spot = slots[spots[i]];
+            updated[i] = spot.update;
+            if (spot.update) {
+                spot.contentValid = true;
+                spot.lastUpdate = frame;
+            }
+        }
+        return updated;
+    };
+
+    // the shadow maps are missing, the most important ones are rendered within the budget
+    EXPECT_EQ((std::array<bool, 3>{ true, true, false }), update(2, false));
+
+    // the missing one takes one update, the stalest by importance takes the other
+    EXPECT_EQ((std::array<bool, 3>{ true, false, true }), update(2, false));
+    EXPECT_EQ((std::array<bool, 3>{ false, true, true }), update(1, false));
+
+    // static shadows are always refreshed, they don't count in the budget
+    EXPECT_EQ((std::array<bool, 3>{ false, false, true }), update(0, false));
+
+    // a light whose tile moved loses its shadow map
+    requests[1].tile = { 512, 256, 256 };
+    EXPECT_EQ((std::array<bool, 3>{ false, true, true }), update(1, false));
+
+    // a reallocated atlas loses all of them
+    EXPECT_EQ((std::array<bool, 3>{ true, false, false }), update(1, true));
+    EXPECT_FALSE(slots[spots[1]].contentValid);
+    EXPECT_FALSE(slots[spots[2]].contentValid);
+
+    // a light without a tile doesn't cast shadows
+    requests[0].tile = {};
+    EXPECT_EQ((std::array<bool, 3>{ false, true, true }), update(3, false));
+    EXPECT_FALSE(slots[spots[0]].contentValid);
+}
+
+TEST(FilamentTest, StaticShadowReuse) {
+    using namespace filament::details;
+    using Command = RenderPass::Command;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    JobSystem& js = engine->getJobSystem();
+    FEngine::DriverApi& driver = engine->getDriverApi();
+    LightManager& lcm = engine->getLightManager();
+    FTransformManager& tcm = engine->getTransformManager();
+
+    FVertexBuffer* vb = upcast(VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine));
+    FIndexBuffer* ib = upcast(IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+
+    // a caster above the ground, in front of the camera
+    Entity entities[5];
+    EntityManager::get().create(5, entities);
+    const Entity caster = entities[0], ground = entities[1], skinned = entities[2];
+    const Entity light = entities[3], eye = entities[4];
+    FMaterialInstance* mi = engine->getSkyboxMaterial(false)->createInstance();
+    tcm.create(caster);
+    tcm.setTransform(tcm.getInstance(caster), mat4f::translate(float3{ 0, 1, -8 }));
+    RenderableManager::Builder(1)
+            .boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }})
+            .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+            .material(0, mi)
+            .castShadows(true)
+            .build(*engine, caster);
+    RenderableManager::Builder(1)
+            .boundingBox({{ -20, -0.1f, -40 }, { 20, 0, 0 }})
+            .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+            .castShadows(false)
+            .build(*engine, ground);
+
+    LightManager::ShadowOptions options;
+    options.shadowCascades = 2;
+    options.cascadeSplitPositions[0] = 0.25f;
+    auto buildLight = [&]() {
+        LightManager::Builder(LightManager::Type::DIRECTIONAL)
+                .direction({ 0, -1, -0.5f })
+                .castShadows(true)
+                .shadowOptions(options)
+                .build(*engine, light);
+        lcm.setShadowHint(lcm.getInstance(light), LightManager::ShadowHint::STATIC);
+    };
+    buildLight();
+
+    FScene* scene = engine->createScene();
+    scene->addEntity(caster);
+    scene->addEntity(ground);
+    scene->addEntity(light);
+    Camera& camera = *engine->createCamera(eye);
+    camera.setProjection(45.0, 640.0 / 480.0, 0.1, 50.0);
+    camera.lookAt({ 0, 2, 0 }, { 0, 0, -8 }, { 0, 1, 0 });
+    FView* view = engine->createView();
+    view->setScene(scene);
+    view->setCamera(&camera);
+    view->setViewport({ 0, 0, 640, 480 });
+
+    // runs a frame the way FRenderer does, up to the shadow pass, and returns how many
+    // shadow maps were drawn rather than reused
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+    auto frame = [&]() -> size_t {
+        engine->prepare();
+        utils::ArenaScope<LinearAllocatorArena> scope(arena);
+        view->prepare(*engine, driver, scope, view->getViewport(), float4{});
+        size_t drawn = 0;
+        if (view->hasShadowing()) {
+            const size_t count = 1024;
+            GrowingSlice<Command> commands(scope.allocate<Command>(count, CACHELINE_SIZE), count);
+            drawn = FRenderer::ShadowPass::renderShadowMap(*engine, js, *view, commands);
+        }
+        engine->flush();
+        return drawn;
+    };
+
+    // the commands are only cached once they stayed the same for a frame, so a change can
+    // take two frames to settle, after which the shadow maps are reused
+    auto settle = [&]() {
+        frame();
+        return frame();
+    };
+
+    // nothing changed
+    ASSERT_GT(frame(), 0u);
+    ASSERT_TRUE(view->hasDirectionalShadows());
+    EXPECT_EQ(0u, settle());
+    EXPECT_EQ(0u, frame());
+
+    // a caster moved
+    tcm.setTransform(tcm.getInstance(caster), mat4f::translate(float3{ 0.5f, 1, -8 }));
+    EXPECT_GT(frame(), 0u);
+    EXPECT_EQ(0u, settle());
+
+    // the light moved
+    lcm.setDirection(lcm.getInstance(light), { 0.2f, -1, -0.5f });
+    EXPECT_GT(frame(), 0u);
+    EXPECT_EQ(0u, settle());
+
+    // the cascade splits changed
+    options.cascadeSplitPositions[0] = 0.5f;
+    lcm.destroy(light);
+    buildLight();
+    EXPECT_GT(frame(), 0u);
+    EXPECT_EQ(0u, settle());
+
+    // a parameter of a caster's material changed
+    static_cast<MaterialInstance*>(mi)->setParameter("showSun", true);
+    EXPECT_GT(frame(), 0u);
+    EXPECT_EQ(0u, settle());
+
+    // a skinned caster can move without anything else changing, it's never reused
+    RenderableManager::Builder(1)
+            .boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }})
+            .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+            .castShadows(true)
+            .skinning(1)
+            .build(*engine, skinned);
+    tcm.create(skinned);
+    tcm.setTransform(tcm.getInstance(skinned), mat4f::translate(float3{ -1, 1, -6 }));
+    scene->addEntity(skinned);
+    EXPECT_GT(frame(), 0u);
+    EXPECT_GT(settle(), 0u);
+    EXPECT_GT(frame(), 0u);
+
+    engine->destroy(view);
+    engine->destroy(scene);
+    for (Entity e : entities) {
+        engine->destroy(e);
+    }
+    engine->destroy(mi);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, RenderTargetPool) {
+    using namespace filament::details;
+    using driver::TargetBufferFlags;
+    using TextureFormat = RenderTargetPool::TextureFormat;
+
+    // dimensions are rounded up to 32, or 1/8th of their power of two
+    EXPECT_EQ(0, RenderTargetPool::getSizeClass(0));
+    EXPECT_EQ(32, RenderTargetPool::getSizeClass(1));
+    EXPECT_EQ(32, RenderTargetPool::getSizeClass(32));
+    EXPECT_EQ(64, RenderTargetPool::getSizeClass(33));
+    EXPECT_EQ(256, RenderTargetPool::getSizeClass(255));
+    EXPECT_EQ(1024, RenderTargetPool::getSizeClass(1000));
+    EXPECT_EQ(1152, RenderTargetPool::getSizeClass(1080));
+    EXPECT_EQ(1920, RenderTargetPool::getSizeClass(1920));
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    RenderTargetPool pool;
+    pool.init(*engine);
+
+    const TargetBufferFlags COLOR = TargetBufferFlags::COLOR;
+    const size_t sizeA = 1024 * 512 * 4;    // 1000 x 500 RGBA8
+    const size_t sizeC = 1024 * 512 * 8;    // 1000 x 500 RGBA16F
+    const size_t sizeD = 640 * 320 * 4;     // 600 x 300 RGBA8
+    const size_t sizeE = 256 * 256 * 4;     // 256 x 256 RGBA8
+
+    // a target of the same size class is reused, not one of another format or much larger
+    auto a = pool.get(COLOR, 1000, 500, 1, TextureFormat::RGBA8);
+    EXPECT_EQ(1024, a->w);
+    EXPECT_EQ(512, a->h);
+    pool.put(a);
+    EXPECT_EQ(a, pool.get(COLOR, 990, 490, 1, TextureFormat::RGBA8));
+    auto c = pool.get(COLOR, 1000, 500, 1, TextureFormat::RGBA16F);
+    EXPECT_NE(a, c);
+    pool.put(a);
+    auto d = pool.get(COLOR, 600, 300, 1, TextureFormat::RGBA8);
+    EXPECT_NE(a, d);
+    EXPECT_EQ(640, d->w);
+    EXPECT_EQ(320, d->h);
+
+    RenderTargetPool::Stats stats = pool.getStats();
+    EXPECT_EQ(1, stats.hits);
+    EXPECT_EQ(3, stats.misses);
+    EXPECT_EQ(0, stats.evictions);
+    EXPECT_EQ(sizeA + sizeC + sizeD, stats.bytesResident);
+    EXPECT_EQ(sizeC + sizeD, stats.bytesInUse);
+    pool.put(c);
+    pool.put(d);
+    pool.gc();
+
+    // the next frame only uses 'a' and 'd', which makes 'c' the least recently used
+    EXPECT_EQ(a, pool.get(COLOR, 1000, 500, 1, TextureFormat::RGBA8));
+    EXPECT_EQ(d, pool.get(COLOR, 600, 300, 1, TextureFormat::RGBA8));
+    pool.put(a);
+    pool.put(d);
+    pool.gc();
+
+    // a new target that doesn't fit in the budget evicts 'c' only
+    pool.setBudget(pool.getStats().bytesResident);
+    auto e = pool.get(COLOR, 256, 256, 1, TextureFormat::RGBA8);
+    stats = pool.getStats();
+    EXPECT_EQ(3, stats.hits);
+    EXPECT_EQ(4, stats.misses);
+    EXPECT_EQ(1, stats.evictions);
+    EXPECT_EQ(sizeA + sizeD + sizeE, stats.bytesResident);
+    EXPECT_EQ(sizeE, stats.bytesInUse);
+    EXPECT_EQ(a, pool.get(COLOR, 1000, 500, 1, TextureFormat::RGBA8));
+    pool.put(a);
+
+    // gc() evicts free targets to get under the budget, but not the ones in use or used
+    // during this frame
+    pool.setBudget(0);
+    pool.gc();
+    stats = pool.getStats();
+    EXPECT_EQ(2, stats.evictions);
+    EXPECT_EQ(sizeA + sizeE, stats.bytesResident);
+    EXPECT_EQ(sizeE, stats.bytesInUse);
+
+    pool.put(e);
+    pool.terminate(engine->getDriverApi());
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, FrameGraphRenderTargetPool) {
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    RenderTargetPool pool;
+    pool.init(*engine);
+
+    // sizes that aren't size classes, the graph's targets must not be rounded up
+    const FrameGraphResource::Descriptor hdr{
+            .width = 200, .height = 150, .format = driver::TextureFormat::RGBA16F };
+    const FrameGraphResource::Descriptor ldr{
+            .width = 200, .height = 150, .format = driver::TextureFormat::RGBA8 };
+    const size_t size = 200 * 150 * (8 + 4);
+
+    // a post-processing chain as executed every frame by FRenderer::renderJob()
+    auto frame = [&]() {
+        FrameGraph fg(pool);
+        struct PassData {
+            FrameGraphResource input;
+            FrameGraphResource output;
+        };
+        auto noop = [](FrameGraphPassResources const&, PassData const&, driver::DriverApi&) {};
+        auto& render = fg.addPass<PassData>("render",
+                [&](FrameGraph::Builder& builder, PassData& data) {
+                    data.output = builder.write(builder.createResource("hdr", hdr));
+                }, noop);
+        auto& toneMapping = fg.addPass<PassData>("tonemapping",
+                [&](FrameGraph::Builder& builder, PassData& data) {
+                    data.input = builder.read(render.getData().output);
+                    data.output = builder.write(builder.createResource("ldr", ldr));
+                }, noop);
+        fg.present(toneMapping.getData().output, FrameGraph::Builder::COLOR);
+        fg.compile();
+        fg.execute(engine->getDriverApi());
+        pool.gc();
+    };
+
+    // the first frame allocates the targets, they're back in the pool once it's executed
+    frame();
+    RenderTargetPool::Stats stats = pool.getStats();
+    EXPECT_EQ(0, stats.hits);
+    EXPECT_EQ(2, stats.misses);
+    EXPECT_EQ(size, stats.bytesResident);
+    EXPECT_EQ(0, stats.bytesInUse);
+
+    // the next frames reuse them
+    frame();
+    frame();
+    stats = pool.getStats();
+    EXPECT_EQ(4, stats.hits);
+    EXPECT_EQ(2, stats.misses);
+    EXPECT_EQ(0, stats.evictions);
+    EXPECT_EQ(size, stats.bytesResident);
+
+    pool.terminate(engine->getDriverApi());
+    engine->shutdown();
+    delete engine;
+}
+
+TEST(FilamentTest, DynamicResolution) {
+    using namespace filament::details;
+    using duration = std::chrono::duration<float, std::milli>;
+
+    // the noop backend doesn't support timer queries, so the frame time is used
+    FEngine* engine = FEngine::create(Engine::Backend::NOOP);
+    FView* view = engine->createView();
+    view->setViewport({ 0, 0, 1280, 720 });
+
+    // Simulates a GPU whose frame time is proportional to the number of pixels rendered,
+    // measured two frames late, and returns the workload scale of each frame.
+    auto simulate = [view](View::DynamicResolutionOptions const& options,
+            float fullResolutionTime) {
+        view->setDynamicResolutionOptions(options);
+        std::vector<float> workloadScales = { 1.0f, 1.0f };
+        for (size_t i = 0; i < 300; i++) {
+            const float measured = fullResolutionTime * workloadScales[workloadScales.size() - 2];
+            float2 scale = view->updateScale(duration(measured), duration(0), duration(1));
+            workloadScales.push_back(scale.x * scale.y);
+        }
+        return workloadScales;
+    };
+
+    View::DynamicResolutionOptions options;
+    options.enabled = true;
+    options.minScale = float2(0.5f);
+    options.maxScale = float2(1.0f);
+    options.targetFrameTimeMilli = 16.0f;
+
+    for (uint8_t history : { 9, 32 }) {
+        for (float fullResolutionTime : { 20.0f, 32.0f, 48.0f }) {
+            options.history = history;
+            std::vector<float> workloadScales = simulate(options, fullResolutionTime);
+
+            // the scale settles where the frame time meets the target, without oscillating
+            const float expected = std::max(0.25f, 16.0f / fullResolutionTime);
+            auto last = std::minmax_element(workloadScales.end() - 100, workloadScales.end());
+            EXPECT_NEAR(expected, *last.first, expected * 0.05f) << int(history);
+            EXPECT_NEAR(expected, *last.second, expected * 0.05f) << int(history);
+        }
+    }
+
+    // scaleRate is limited so that a long history doesn't cause oscillations
+    options.history = 32;
+    options.scaleRate = 1.0f;
+    view->setDynamicResolutionOptions(options);
+    EXPECT_GE(1.0f / 16.0f, view->getDynamicResolutionOptions().scaleRate);
+
+    engine->destroy(view);
+    engine->shutdown();
+    delete engine;
+}
+
 TEST(FilamentTest, ColorConversion) {
     // Linear to Gamma
     // 0.0 stays 0.0
@@ -470,9 +2064,17 @@ TEST(FilamentTest, FroxelData) {
     Viewport vp(0, 0, 1280, 640);
     mat4f p = mat4f::perspective(90, 1.0f, 0.1, 100, mat4f::Fov::HORIZONTAL);
 
+    CameraInfo camera;
+    camera.projection = p;
+    camera.zn = 0.1f;
+    camera.zf = 100.0f;
+
+    FScene::LightSoa lights;
+    lights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+
     Froxelizer froxelData(*engine);
     froxelData.setOptions(5, 100);
-    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100);
+    froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
 
     Froxel f = froxelData.getFroxelAt(0,0,0);
 
@@ -518,12 +2120,11 @@ TEST(FilamentTest, FroxelData) {
     LightManager::Builder(LightManager::Type::POINT).build(*engine, e);
     LightManager::Instance instance = engine->getLightManager().getInstance(e);
 
-    FScene::LightSoa lights;
-    lights.push_back({}, {}, {}, {}, {});   // first one is always skipped
-    lights.push_back(float4{ 0, 0, -5, 1 }, {}, instance, 1, {});
+    lights.push_back(float4{ 0, 0, -5, 1 }, {}, instance, 1, {}, {});
 
     {
-        froxelData.froxelizeLights(*engine, {}, lights);
+        froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
+        froxelData.froxelizeLights(*engine);
         auto const& froxelBuffer = froxelData.getFroxelBufferUser();
         auto const& recordBuffer = froxelData.getRecordBufferUser();
         // light straddles the "light near" plane
@@ -543,7 +2144,8 @@ TEST(FilamentTest, FroxelData) {
         auto pos = lights.elementAt<FScene::POSITION_RADIUS>(1);
         EXPECT_TRUE(pos == float4( 0, 0, -3, 1 ));
 
-        froxelData.froxelizeLights(*engine, {}, lights);
+        froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
+        froxelData.froxelizeLights(*engine);
         auto const& froxelBuffer = froxelData.getFroxelBufferUser();
         auto const& recordBuffer = froxelData.getRecordBufferUser();
         size_t pointCount = 0;
@@ -555,11 +2157,133 @@ TEST(FilamentTest, FroxelData) {
         EXPECT_GT(pointCount, 0);
     }
 
+    {
+        // nothing changed, last frame's froxels are still valid and nothing is uploaded
+        froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
+        froxelData.froxelizeLights(*engine);
+        EXPECT_TRUE(froxelData.getFroxelBufferUser().empty());
+        EXPECT_TRUE(froxelData.getRecordBufferUser().empty());
+    }
+
+    {
+        // moving the camera moves the light in view-space
+        camera.view = mat4f::translate(float3{ 0, 0, -1 });
+
+        froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
+        froxelData.froxelizeLights(*engine);
+        auto const& froxelBuffer = froxelData.getFroxelBufferUser();
+        EXPECT_FALSE(froxelBuffer.empty());
+        size_t pointCount = 0;
+        for (const auto& entry : froxelBuffer) {
+            EXPECT_LE(entry.pointLightCount, 1);
+            EXPECT_EQ(entry.spotLightCount, 0);
+            pointCount += entry.pointLightCount;
+        }
+        EXPECT_GT(pointCount, 0);
+    }
+
     froxelData.terminate(engine->getDriverApi());
     engine->shutdown();
     delete engine;
 }
 
+TEST(FilamentTest, FroxelManyLights) {
+    using namespace filament;
+    using namespace filament::details;
+
+    FEngine* engine = FEngine::create();
+
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", FEngine::CONFIG_PER_RENDER_PASS_ARENA_SIZE);
+    utils::ArenaScope<LinearAllocatorArena> scope(arena);
+
+    Viewport vp(0, 0, 1280, 640);
+    CameraInfo camera;
+    camera.projection = mat4f::perspective(90, 1.0f, 0.1, 100, mat4f::Fov::HORIZONTAL);
+    camera.zn = 0.1f;
+    camera.zf = 100.0f;
+
+    Entity point = engine->getEntityManager().create();
+    Entity spot = engine->getEntityManager().create();
+    LightManager::Builder(LightManager::Type::POINT).build(*engine, point);
+    LightManager::Builder(LightManager::Type::SPOT)
+            .direction({ 0, 0, -1 })
+            .spotLightCone(1.4f, 1.5f)
+            .build(*engine, spot);
+    FLightManager& lcm = engine->getLightManager();
+
+    // more lights than 8-bits light indices or per-froxel light counts can hold, half of them
+    // spot lights, all overlapping the same froxel
+    constexpr size_t count = CONFIG_MAX_LIGHT_COUNT;
+    static_assert(count / 2 > 255, "not enough lights");
+    FScene::LightSoa lights;
+    lights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+    for (size_t i = 0; i < count; i++) {
+        const bool isSpot = (i & 1u) != 0;
+        lights.push_back(float4{ 0.3f, 0.3f, -10, 0.1f }, float3{ 0, 0, -1 },
+                lcm.getInstance(isSpot ? spot : point), 1, {}, {});
+    }
+
+    Froxelizer froxelData(*engine);
+    froxelData.setOptions(5, 100);
+
+    // froxelizes the lights and returns, for each froxel, the sorted list of its lights
+    auto froxelize = [&]() {
+        froxelData.prepare(*engine, engine->getDriverApi(), scope, vp, camera, lights);
+        froxelData.froxelizeLights(*engine);
+        auto const& froxelBuffer = froxelData.getFroxelBufferUser();
+        auto const& recordBuffer = froxelData.getRecordBufferUser();
+        std::vector<std::vector<size_t>> result(froxelData.getFroxelCount());
+        for (size_t i = 0, c = froxelData.getFroxelCount(); i < c; i++) {
+            auto const& entry = froxelBuffer[i];
+            // point lights are listed first, then spot lights
+            for (size_t j = 0; j < entry.pointLightCount + entry.spotLightCount; j++) {
+                const size_t l = recordBuffer[entry.offset + j];
+                EXPECT_LT(l, count);
+                EXPECT_EQ(j >= entry.pointLightCount, (l & 1u) != 0);
+                result[i].push_back(l);
+            }
+            std::sort(result[i].begin(), result[i].end());
+        }
+        return result;
+    };
+
+    std::vector<size_t> all(count);
+    std::iota(all.begin(), all.end(), 0);
+
+    {
+        auto froxels = froxelize();
+        size_t found = 0;
+        for (auto const& froxel : froxels) {
+            EXPECT_TRUE(froxel.empty() || froxel == all || froxel.size() == count / 2);
+            found += froxel == all ? 1 : 0;
+        }
+        EXPECT_GT(found, 0);
+    }
+
+    {
+        // moving one light past the first 256 only changes its froxels
+        lights.elementAt<FScene::POSITION_RADIUS>(1 + 300) = float4{ -5, -5, -10, 0.1f };
+        std::vector<size_t> others(all);
+        others.erase(others.begin() + 300);
+
+        auto froxels = froxelize();
+        size_t found = 0;
+        size_t moved = 0;
+        for (auto const& froxel : froxels) {
+            found += froxel == others ? 1 : 0;
+            moved += froxel == std::vector<size_t>{ 300 } ? 1 : 0;
+        }
+        EXPECT_GT(found, 0);
+        EXPECT_GT(moved, 0);
+    }
+
+    froxelData.terminate(engine->getDriverApi());
+    engine->destroy(point);
+    engine->destroy(spot);
+    engine->shutdown();
+    delete engine;
+}
+
 TEST(FilamentTest, Bones) {
     using namespace ::filament::details;
 
@@ -694,6 +2418,124 @@ TEST(FilamentTest, Bones) {
     }
 }
 
+TEST(FilamentTest, CommandBufferQueue) {
+    constexpr uint32_t MAX_SLICE_COUNT = CommandBufferQueue::MAX_SLICE_COUNT;
+
+    // the circular buffer is large enough for the ring to fill up first
+    CommandBufferQueue queue(CircularBuffer::BLOCK_SIZE * 4, CircularBuffer::BLOCK_SIZE * 16);
+    CircularBuffer& buffer = queue.getCircularBuffer();
+
+    // each slice holds its sequence number, followed by the NoopCommand added by flush()
+    uint32_t produced = 0;
+    auto produce = [&]() {
+        *static_cast<uint32_t*>(buffer.allocate(CommandBase::align(sizeof(uint32_t)))) = produced++;
+        queue.flush();
+    };
+    uint32_t consumed = 0;
+    auto consume = [&](Range<uint32_t> range) {
+        for (uint32_t i : range) {
+            CommandBufferQueue::Slice const& slice = queue.getSlice(i);
+            EXPECT_EQ(consumed++, *static_cast<uint32_t const*>(slice.begin));
+            queue.releaseBuffer(slice);
+        }
+    };
+
+    // The slice indices keep increasing past the size of the ring, while the slices wrap
+    // around it. The consumer gets every slice once and in order, whenever it wakes up.
+    const uint32_t total = 4 * MAX_SLICE_COUNT + 3;
+    std::thread consumer([&]() {
+        while (consumed < total) {
+            Range<uint32_t> range = queue.waitForCommands();
+            EXPECT_EQ(consumed, range.first);
+            EXPECT_LE(range.size(), MAX_SLICE_COUNT);
+            consume(range);
+        }
+    });
+    for (uint32_t i = 0; i < total; i++) {
+        produce();
+    }
+    consumer.join();
+    EXPECT_EQ(total, consumed);
+    const uint64_t waitCount = queue.getBackPressureStats().waitCount;
+
+    // Without a consumer, the flush() filling the ring blocks until a slice is released. It
+    // can't return before, so its slice being visible means it blocked.
+    std::atomic<uint32_t> flushes = { 0 };
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < MAX_SLICE_COUNT; i++) {
+            produce();
+            flushes++;
+        }
+    });
+    Range<uint32_t> range;
+    do {
+        range = queue.waitForCommands();
+    } while (range.size() < MAX_SLICE_COUNT);
+    EXPECT_EQ(total, range.first);
+    EXPECT_EQ(total + MAX_SLICE_COUNT, range.last);
+    EXPECT_EQ(MAX_SLICE_COUNT - 1, flushes.load());
+    consume(range);
+    producer.join();
+    EXPECT_EQ(MAX_SLICE_COUNT, flushes.load());
+    EXPECT_EQ(waitCount + 1, queue.getBackPressureStats().waitCount);
+    EXPECT_GT(queue.getBackPressureStats().waitTimeNs, 0u);
+
+    // Exit doesn't drop the pending slices, and once they're consumed waitForCommands()
+    // returns right away instead of waiting for more.
+    for (uint32_t i = 0; i < 3; i++) {
+        produce();
+    }
+    queue.requestExit();
+    consumer = std::thread([&]() {
+        Range<uint32_t> pending = queue.waitForCommands();
+        EXPECT_EQ(3u, pending.size());
+        consume(pending);
+        EXPECT_TRUE(queue.waitForCommands().empty());
+    });
+    consumer.join();
+    EXPECT_EQ(total + MAX_SLICE_COUNT + 3, consumed);
+}
+
+TEST(FilamentTest, DriverStateFilter) {
+    DriverStateFilter filter;
+    Driver::UniformBufferHandle ubh0(1);
+    Driver::UniformBufferHandle ubh1(2);
+    Driver::SamplerBufferHandle sbh(3);
+
+    // the first state changes are always recorded
+    EXPECT_TRUE(filter.bindUniformBufferRange(1, ubh0, 0, 256));
+    EXPECT_TRUE(filter.bindSamplers(5, sbh));
+    EXPECT_TRUE(filter.setViewportScissor(0, 0, 640, 480));
+
+    // redundant ones are not, even across draws
+    filter.draw({}, {});
+    EXPECT_FALSE(filter.bindUniformBufferRange(1, ubh0, 0, 256));
+    EXPECT_FALSE(filter.bindSamplers(5, sbh));
+    EXPECT_FALSE(filter.setViewportScissor(0, 0, 640, 480));
+
+    // but changes are
+    EXPECT_TRUE(filter.bindUniformBufferRange(1, ubh0, 256, 256));
+    EXPECT_TRUE(filter.bindUniformBufferRange(1, ubh1, 256, 256));
+    EXPECT_TRUE(filter.bindUniformBuffer(1, ubh1));
+    EXPECT_FALSE(filter.bindUniformBuffer(1, ubh1));
+    EXPECT_TRUE(filter.bindUniformBuffer(2, ubh1));
+    EXPECT_TRUE(filter.setViewportScissor(0, 0, 640, 240));
+
+    // other commands forget the state
+    filter.endRenderPass();
+    EXPECT_TRUE(filter.bindUniformBuffer(1, ubh1));
+    EXPECT_TRUE(filter.bindSamplers(5, sbh));
+
+    EXPECT_EQ(2, filter.getStats().uniformBuffers);
+    EXPECT_EQ(1, filter.getStats().samplers);
+    EXPECT_EQ(1, filter.getStats().scissors);
+
+    // stats are per frame
+    filter.beginFrame(0, 1);
+    EXPECT_EQ(4, filter.getLastFrameStats().total());
+    EXPECT_EQ(0, filter.getStats().total());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -40,7 +40,7 @@ namespace BindingPoints {
     constexpr uint8_t PER_VIEW                = 0;    // uniforms/samplers updated per view
     constexpr uint8_t PER_RENDERABLE          = 1;    // uniforms/samplers updated per renderable
     constexpr uint8_t PER_RENDERABLE_BONES    = 2;    // bones data, per renderable
-    constexpr uint8_t LIGHTS                  = 3;    // lights data array
+    constexpr uint8_t LIGHTS                  = 3;    // unused, lights data is a per-view sampler
     constexpr uint8_t POST_PROCESS            = 4;    // samplers for the post process pass
     constexpr uint8_t PER_MATERIAL_INSTANCE   = 5;    // uniforms/samplers updates per material
     constexpr uint8_t COUNT                   = 6;
@@ -53,15 +53,30 @@ constexpr uint32_t ATTRIBUTE_INDEX_COUNT = 7;
 constexpr size_t MAX_ATTRIBUTE_BUFFERS_COUNT = 8; // FIXME: should match Driver::MAX_ATTRIBUTE_BUFFER_COUNT
 constexpr size_t MAX_SAMPLER_COUNT = 16; // Matches the Adreno Vulkan driver.
 
-// This value is limited by UBO size, ES3.0 only guarantees 16 KiB.
+// Maximum number of point and spot lights shaded by a View. The lights data is stored in a
+// texture (64 bytes per light), this is limited by the froxelizer, which tracks one bit per light
+// and per froxel, and froxelizes 32 lights per job with at most 32 jobs.
 // Values <= 256, use less CPU and GPU resources.
-constexpr size_t CONFIG_MAX_LIGHT_COUNT = 256;
+constexpr size_t CONFIG_MAX_LIGHT_COUNT = 1024;
 constexpr size_t CONFIG_MAX_LIGHT_INDEX = CONFIG_MAX_LIGHT_COUNT - 1;
 
 // This value is also limited by UBO size, ES3.0 only guarantees 16 KiB.
 // We store 64 bytes per bone.
 constexpr size_t CONFIG_MAX_BONE_COUNT = 256;
 
+// Maximum number of instances drawn by a single instanced draw call. The per-renderable
+// uniforms are declared as an array of that many entries, so this is also limited by UBO size.
+// We store 256 bytes per instance.
+constexpr size_t CONFIG_MAX_INSTANCES = 64;
+
+// Maximum number of cascades of the directional light's shadow map. Each cascade uses its own
+// region of the shadow map texture and its own per-view uniforms.
+constexpr size_t CONFIG_MAX_SHADOW_CASCADES = 4;
+
+// Maximum number of spot lights casting shadows in a View. Each one uses a region of the shadow
+// atlas and a matrix in the per-view uniforms, and a bit of the renderables' spot shadow mask.
+constexpr size_t CONFIG_MAX_SHADOW_CASTING_SPOTS = 8;
+
 // can't really use std::underlying_type<AttributeIndex>::type because the driver takes a uint32_t
 using AttributeBitset = utils::bitset32;
 
@@ -17,6 +17,8 @@
 #ifndef TNT_FILABRIDGE_SIBGENERATOR_H
 #define TNT_FILABRIDGE_SIBGENERATOR_H
 
+#include <math/vec4.h>
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -41,7 +43,15 @@ struct PerViewSib {
     static constexpr size_t FROXELS        = 2;
     static constexpr size_t IBL_DFG_LUT    = 3;
     static constexpr size_t IBL_SPECULAR   = 4;
-    static constexpr size_t IBL_IRRADIANCE = 5;
+    static constexpr size_t LIGHTS         = 5;
+};
+
+// A point or spot light in the PerViewSib::LIGHTS buffer, each field is one RGBA32F texel
+struct PunctualLightData {
+    math::float4 positionFalloff;   // { float3(pos), 1/falloff^2 }
+    math::float4 colorIntensity;    // { float3(col), intensity }
+    math::float4 directionIES;      // { float3(dir), IES index }
+    math::float4 spotScaleOffset;   // { scale, offset, shadow index or -1, shadow bias }
 };
 
 struct PostProcessSib {
@@ -17,6 +17,7 @@
 #ifndef TNT_FILABRIDGE_UIBGENERATOR_H
 #define TNT_FILABRIDGE_UIBGENERATOR_H
 
+#include <filament/EngineEnums.h>
 
 #include <math/mat4.h>
 #include <math/vec4.h>
@@ -29,7 +30,6 @@ class UibGenerator {
 public:
     static UniformInterfaceBlock const& getPerViewUib() noexcept;
     static UniformInterfaceBlock const& getPerRenderableUib() noexcept;
-    static UniformInterfaceBlock const& getLightsUib() noexcept;
     static UniformInterfaceBlock const& getPostProcessingUib() noexcept;
     static UniformInterfaceBlock const& getPerRenderableBonesUib() noexcept;
 };
@@ -64,7 +64,7 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     math::float3 lightDirection;
     uint32_t fParamsX; // stride-x
 
-    math::float3 shadowBias; // constant bias, normal bias, unused
+    math::float3 shadowBias; // constant bias, normal bias, view-space shadow far distance
     float oneOverFroxelDimensionY;
 
     math::float4 zParams; // froxel Z parameters
@@ -80,6 +80,16 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     alignas(16) math::float4 iblSH[9]; // actually float3 entries (std140 requires float4 alignment)
 
     math::float4 userTime;  // time(s), (double)time - (float)time, 0, 0
+
+    // light-space to viewport mapping of each cascade: xy scale, zw offset
+    math::float4 shadowCascades[CONFIG_MAX_SHADOW_CASCADES];
+    // viewport to shadow map texture mapping of each cascade: xy scale, zw offset
+    math::float4 shadowCascadeViewports[CONFIG_MAX_SHADOW_CASCADES];
+    math::float4 shadowCascadeSplits;       // view-space far distance of each cascade
+    math::float4 shadowCascadeNormalBias;   // normal bias of each cascade relative to the first
+
+    // world space to shadow atlas texture mapping of each shadow casting spot light
+    math::mat4f spotShadowMatrices[CONFIG_MAX_SHADOW_CASTING_SPOTS];
 };
 
 
@@ -89,16 +99,6 @@ struct alignas(256) PerRenderableUib {
     math::mat3f worldFromModelNormalMatrix;
 };
 
-struct LightsUib {
-    static const UniformInterfaceBlock& getUib() noexcept {
-        return UibGenerator::getLightsUib();
-    }
-    math::float4 positionFalloff;   // { float3(pos), 1/falloff^2 }
-    math::float4 colorIntensity;    // { float3(col), intensity }
-    math::float4 directionIES;      // { float3(dir), IES index }
-    math::float4 spotScaleOffset;   // { scale, offset, unused, unused }
-};
-
 struct PostProcessingUib {
     static const UniformInterfaceBlock& getUib() noexcept {
         return UibGenerator::getPostProcessingUib();
@@ -31,9 +31,10 @@ SamplerInterfaceBlock const& SibGenerator::getPerViewSib() noexcept {
             .name("Light")
             .add("shadowMap",     Type::SAMPLER_2D,      Format::SHADOW,Precision::LOW)
             .add("records",       Type::SAMPLER_2D,      Format::UINT,  Precision::MEDIUM)
-            .add("froxels",       Type::SAMPLER_2D,      Format::UINT,  Precision::MEDIUM)
+            .add("froxels",       Type::SAMPLER_2D,      Format::UINT,  Precision::HIGH)
             .add("iblDFG",        Type::SAMPLER_2D,      Format::FLOAT, Precision::MEDIUM)
             .add("iblSpecular",   Type::SAMPLER_CUBEMAP, Format::FLOAT, Precision::MEDIUM)
+            .add("lights",        Type::SAMPLER_2D,      Format::FLOAT, Precision::HIGH)
             .build();
     return sib;
 }
@@ -73,6 +73,13 @@ UniformInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
             .add("iblSH",                   9, UniformInterfaceBlock::Type::FLOAT3)
             // user time
             .add("userTime",                1, UniformInterfaceBlock::Type::FLOAT4)
+            // shadow cascades
+            .add("shadowCascades",          CONFIG_MAX_SHADOW_CASCADES, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .add("shadowCascadeViewports",  CONFIG_MAX_SHADOW_CASCADES, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .add("shadowCascadeSplits",     1, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .add("shadowCascadeNormalBias", 1, UniformInterfaceBlock::Type::FLOAT4)
+            // spot light shadows
+            .add("spotShadowMatrices",      CONFIG_MAX_SHADOW_CASTING_SPOTS, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .build();
     return uib;
 }
@@ -86,14 +93,6 @@ UniformInterfaceBlock const& UibGenerator::getPerRenderableUib() noexcept {
     return uib;
 }
 
-UniformInterfaceBlock const& UibGenerator::getLightsUib() noexcept {
-    static UniformInterfaceBlock uib = UniformInterfaceBlock::Builder()
-            .name("LightsUniforms")
-            .add("lights", CONFIG_MAX_LIGHT_COUNT, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
-            .build();
-    return uib;
-}
-
 UniformInterfaceBlock const& UibGenerator::getPostProcessingUib() noexcept {
     static UniformInterfaceBlock uib =  UniformInterfaceBlock::Builder()
             .name("PostProcessUniforms")
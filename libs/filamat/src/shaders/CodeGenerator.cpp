@@ -273,6 +273,55 @@ std::ostream& CodeGenerator::generateUniforms(std::ostream& out, ShaderType shad
     return out;
 }
 
+std::ostream& CodeGenerator::generateInstancedUniforms(std::ostream& out, ShaderType shaderType,
+        uint8_t binding, const UniformInterfaceBlock& uib, size_t count, size_t stride) const {
+    auto const& infos = uib.getUniformInfoList();
+    if (infos.empty()) {
+        return out;
+    }
+
+    const CString& blockName = uib.getName();
+    std::string instanceName(uib.getName().c_str());
+    instanceName.front() = char(std::tolower((unsigned char)instanceName.front()));
+
+    Precision uniformPrecision = getDefaultUniformPrecision();
+    Precision defaultPrecision = getDefaultPrecision(shaderType);
+
+    // std140 rounds the size of structures to a multiple of 16 bytes, we pad the structure
+    // to 'stride' explicitly so that it matches the layout of the buffer.
+    assert(stride >= uib.getSize() && (stride - uib.getSize()) % 16 == 0);
+    const size_t padding = (stride - uib.getSize()) / 16;
+
+    out << "\nstruct " << blockName.c_str() << "Instance {\n";
+    for (auto const& info : infos) {
+        char const* const type = getUniformTypeName(info.type);
+        char const* const precision = getUniformPrecisionQualifier(info.type, info.precision,
+                uniformPrecision, defaultPrecision);
+        out << "    " << precision;
+        if (precision[0] != '\0') out << " ";
+        out << type << " " << info.name.c_str();
+        if (info.size > 1) {
+            out << "[" << info.size << "]";
+        }
+        out << ";\n";
+    }
+    if (padding) {
+        out << "    vec4 reserved[" << padding << "];\n";
+    }
+    out << "};\n";
+
+    out << "\nlayout(";
+    if (mCodeGenTargetApi == TargetApi::VULKAN) {
+        uint32_t bindingIndex = (uint32_t) binding; // avoid char output
+        out << "binding = " << bindingIndex << ", ";
+    }
+    out << "std140) uniform " << blockName.c_str() << " {\n";
+    out << "    " << blockName.c_str() << "Instance instances[" << count << "];\n";
+    out << "} " << instanceName << ";\n";
+
+    return out;
+}
+
 std::ostream& CodeGenerator::generateSamplers(
         std::ostream& out, uint8_t firstBinding, const SamplerInterfaceBlock& sib) const {
     auto const& infos = sib.getSamplerInfoList();
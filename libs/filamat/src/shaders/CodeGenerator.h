@@ -90,6 +90,10 @@ public:
     std::ostream& generateUniforms(std::ostream& out, ShaderType type, uint8_t binding,
             const filament::UniformInterfaceBlock& uib) const;
 
+    // generate uniforms as an array of 'count' structures of 'stride' bytes, one per instance
+    std::ostream& generateInstancedUniforms(std::ostream& out, ShaderType type, uint8_t binding,
+            const filament::UniformInterfaceBlock& uib, size_t count, size_t stride) const;
+
     // generate samplers
     std::ostream& generateSamplers(
         std::ostream& out, uint8_t firstBinding, const filament::SamplerInterfaceBlock& sib) const;
@@ -182,8 +182,9 @@ const std::string ShaderGenerator::createVertexProgram(filament::driver::ShaderM
     // uniforms
     cg.generateUniforms(vs, ShaderType::VERTEX,
             BindingPoints::PER_VIEW, UibGenerator::getPerViewUib());
-    cg.generateUniforms(vs, ShaderType::VERTEX,
-            BindingPoints::PER_RENDERABLE, UibGenerator::getPerRenderableUib());
+    cg.generateInstancedUniforms(vs, ShaderType::VERTEX,
+            BindingPoints::PER_RENDERABLE, UibGenerator::getPerRenderableUib(),
+            CONFIG_MAX_INSTANCES, sizeof(PerRenderableUib));
     if (variant.hasSkinning()) {
         cg.generateUniforms(vs, ShaderType::VERTEX,
                 BindingPoints::PER_RENDERABLE_BONES,
@@ -291,8 +292,6 @@ const std::string ShaderGenerator::createFragmentProgram(filament::driver::Shade
     // uniforms and samplers
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::PER_VIEW, UibGenerator::getPerViewUib());
-    cg.generateUniforms(fs, ShaderType::FRAGMENT,
-            BindingPoints::LIGHTS, UibGenerator::getLightsUib());
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::PER_MATERIAL_INSTANCE, material.uib);
     cg.generateSeparator(fs);
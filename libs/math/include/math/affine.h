@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MATH_AFFINE_H_
+#define MATH_AFFINE_H_
+
+#include <math/compiler.h>
+#include <math/mat3.h>
+#include <math/mat4.h>
+#include <math/vec3.h>
+#include <math/vec4.h>
+
+#include <stddef.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+// -------------------------------------------------------------------------------------
+namespace details {
+template <typename T> class TAffine;
+} // namespace details
+
+template <typename T>
+inline void multiply(details::TAffine<T>& out,
+        details::TAffine<T> const& lhs, details::TAffine<T> const& rhs) noexcept;
+
+namespace details {
+
+/**
+ * An affine transform, that is a 4x4 matrix whose last row is (0, 0, 0, 1), stored as its
+ * first three rows only.
+ *
+ * This uses 25% less memory than a TMat44<>, and each row can be processed with a single
+ * SIMD register when T is float:
+ *
+ *      \f$
+ *      \left(
+ *      \begin{array}{cccc}
+ *      a[0][0] & a[0][1] & a[0][2] & a[0][3] \\
+ *      a[1][0] & a[1][1] & a[1][2] & a[1][3] \\
+ *      a[2][0] & a[2][1] & a[2][2] & a[2][3] \\
+ *      0 & 0 & 0 & 1 \\
+ *      \end{array}
+ *      \right)
+ *      \f$
+ *
+ * Note that, unlike TMat44<>, a[i] is the i-th ROW, and a[i][3] is the translation.
+ */
+template <typename T>
+class MATH_EMPTY_BASES TAffine {
+public:
+    typedef T value_type;
+    typedef TVec4<T> row_type;
+    typedef size_t size_type;
+    static constexpr size_t ROW_COUNT = 3;
+
+    // identity
+    constexpr TAffine() noexcept
+            : m_value{ row_type(1, 0, 0, 0), row_type(0, 1, 0, 0), row_type(0, 0, 1, 0) } {
+    }
+
+    // from a 4x4 matrix, whose last row is ignored
+    constexpr explicit TAffine(TMat44<T> const& m) noexcept
+            : m_value{
+                    row_type(m[0][0], m[1][0], m[2][0], m[3][0]),
+                    row_type(m[0][1], m[1][1], m[2][1], m[3][1]),
+                    row_type(m[0][2], m[1][2], m[2][2], m[3][2]) } {
+    }
+
+    constexpr row_type const& operator[](size_t row) const noexcept {
+        return m_value[row];
+    }
+
+    row_type& operator[](size_t row) noexcept {
+        return m_value[row];
+    }
+
+    // the equivalent 4x4 matrix
+    constexpr TMat44<T> toMat4() const noexcept {
+        return TMat44<T>(
+                m_value[0][0], m_value[1][0], m_value[2][0], T(0),
+                m_value[0][1], m_value[1][1], m_value[2][1], T(0),
+                m_value[0][2], m_value[1][2], m_value[2][2], T(0),
+                m_value[0][3], m_value[1][3], m_value[2][3], T(1));
+    }
+
+    // the linear part (rotation, scale and shear) of this transform
+    constexpr TMat33<T> upperLeft() const noexcept {
+        return TMat33<T>(
+                m_value[0][0], m_value[1][0], m_value[2][0],
+                m_value[0][1], m_value[1][1], m_value[2][1],
+                m_value[0][2], m_value[1][2], m_value[2][2]);
+    }
+
+    TVec3<T> getTranslation() const noexcept {
+        return { m_value[0][3], m_value[1][3], m_value[2][3] };
+    }
+
+    // transforms a point, i.e. applies the translation
+    TVec3<T> transformPoint(TVec3<T> const& p) const noexcept {
+        return {
+                dot(m_value[0].xyz, p) + m_value[0][3],
+                dot(m_value[1].xyz, p) + m_value[1][3],
+                dot(m_value[2].xyz, p) + m_value[2][3] };
+    }
+
+    friend TAffine MATH_PURE operator*(TAffine const& lhs, TAffine const& rhs) noexcept {
+        TAffine result{ NO_INIT };
+        multiply(result, lhs, rhs);
+        return result;
+    }
+
+    friend constexpr bool MATH_PURE operator==(TAffine const& lhs, TAffine const& rhs) noexcept {
+        return lhs[0] == rhs[0] && lhs[1] == rhs[1] && lhs[2] == rhs[2];
+    }
+
+    friend constexpr bool MATH_PURE operator!=(TAffine const& lhs, TAffine const& rhs) noexcept {
+        return !(lhs == rhs);
+    }
+
+private:
+    enum NoInit { NO_INIT };
+    explicit TAffine(NoInit) noexcept { } // NOLINT
+
+    row_type m_value[ROW_COUNT];
+};
+
+} // namespace details
+
+// ----------------------------------------------------------------------------------------
+
+typedef details::TAffine<double> affine;
+typedef details::TAffine<float> affinef;
+
+/**
+ * Computes out = lhs * rhs. 'out' can alias 'lhs' or 'rhs'.
+ *
+ * Each row of the result is lhs[i][0] * rhs[0] + lhs[i][1] * rhs[1] + lhs[i][2] * rhs[2],
+ * plus lhs[i][3] in the translation column, which only needs 3 broadcasts and 3
+ * multiply-adds per row.
+ */
+template <typename T>
+void multiply(details::TAffine<T>& out,
+        details::TAffine<T> const& lhs, details::TAffine<T> const& rhs) noexcept {
+    using row_type = typename details::TAffine<T>::row_type;
+    const row_type r0 = rhs[0];
+    const row_type r1 = rhs[1];
+    const row_type r2 = rhs[2];
+    for (size_t i = 0; i < details::TAffine<T>::ROW_COUNT; i++) {
+        const row_type l = lhs[i];
+        row_type r = l[0] * r0 + l[1] * r1 + l[2] * r2;
+        r[3] += l[3];
+        out[i] = r;
+    }
+}
+
+#if defined(__ARM_NEON) || defined(__SSE__)
+
+template <>
+inline void multiply(affinef& out, affinef const& lhs, affinef const& rhs) noexcept {
+    static_assert(sizeof(affinef) == 12 * sizeof(float), "affinef must be tightly packed");
+    float const* const l = &lhs[0][0];
+    float const* const r = &rhs[0][0];
+    float* const o = &out[0][0];
+#if defined(__ARM_NEON)
+    const float32x4_t r0 = vld1q_f32(r);
+    const float32x4_t r1 = vld1q_f32(r + 4);
+    const float32x4_t r2 = vld1q_f32(r + 8);
+    float32x4_t result[3];
+    for (size_t i = 0; i < 3; i++) {
+        const float32x4_t li = vld1q_f32(l + i * 4);
+        float32x4_t ri = vmulq_n_f32(r0, vgetq_lane_f32(li, 0));
+        ri = vmlaq_n_f32(ri, r1, vgetq_lane_f32(li, 1));
+        ri = vmlaq_n_f32(ri, r2, vgetq_lane_f32(li, 2));
+        // (0, 0, 0, l[3])
+        const float32x4_t t = vsetq_lane_f32(vgetq_lane_f32(li, 3), vdupq_n_f32(0.0f), 3);
+        result[i] = vaddq_f32(ri, t);
+    }
+    vst1q_f32(o, result[0]);
+    vst1q_f32(o + 4, result[1]);
+    vst1q_f32(o + 8, result[2]);
+#else
+    const __m128 r0 = _mm_loadu_ps(r);
+    const __m128 r1 = _mm_loadu_ps(r + 4);
+    const __m128 r2 = _mm_loadu_ps(r + 8);
+    const __m128 w = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    __m128 result[3];
+    for (size_t i = 0; i < 3; i++) {
+        const __m128 li = _mm_loadu_ps(l + i * 4);
+        __m128 ri = _mm_mul_ps(_mm_shuffle_ps(li, li, _MM_SHUFFLE(0, 0, 0, 0)), r0);
+        ri = _mm_add_ps(ri, _mm_mul_ps(_mm_shuffle_ps(li, li, _MM_SHUFFLE(1, 1, 1, 1)), r1));
+        ri = _mm_add_ps(ri, _mm_mul_ps(_mm_shuffle_ps(li, li, _MM_SHUFFLE(2, 2, 2, 2)), r2));
+        // (0, 0, 0, l[3])
+        ri = _mm_add_ps(ri, _mm_mul_ps(_mm_shuffle_ps(li, li, _MM_SHUFFLE(3, 3, 3, 3)), w));
+        result[i] = ri;
+    }
+    _mm_storeu_ps(o, result[0]);
+    _mm_storeu_ps(o + 4, result[1]);
+    _mm_storeu_ps(o + 8, result[2]);
+#endif
+}
+
+#endif
+
+}  // namespace math
+
+#endif  // MATH_AFFINE_H_
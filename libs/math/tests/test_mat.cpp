@@ -20,6 +20,7 @@
 #include <random>
 #include <functional>
 
+#include <math/affine.h>
 #include <math/mat2.h>
 #include <math/mat4.h>
 #include <math/mat3.h>
@@ -716,3 +717,53 @@ TYPED_TEST(MatTestT, ToQuaternionPointTransformation44) {
 }
 
 #undef TEST_MATRIX_INVERSE
+
+//------------------------------------------------------------------------------
+// Affine transforms
+
+TEST_F(MatTest, Affine) {
+    EXPECT_EQ(sizeof(affinef), sizeof(float) * 12);
+    EXPECT_EQ(affinef{}.toMat4(), mat4f{});
+
+    mat4f t = mat4f::translate(float3{ 1, 2, 3 }) * mat4f::rotate(0.5f, float3{ 0, 1, 0 });
+    affinef a(t);
+    EXPECT_EQ(a.toMat4(), t);
+    EXPECT_EQ(a.getTranslation(), (float3{ 1, 2, 3 }));
+    EXPECT_EQ(a.upperLeft(), t.upperLeft());
+}
+
+TEST_F(MatTest, AffineMultiply) {
+    std::default_random_engine generator(82828); // NOLINT
+    std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+    auto rand_gen = std::bind(distribution, generator);
+
+    for (size_t n = 0; n < 100; ++n) {
+        mat4f lhs;
+        mat4f rhs;
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t j = 0; j < 3; j++) {
+                lhs[i][j] = rand_gen();
+                rhs[i][j] = rand_gen();
+            }
+        }
+        const mat4f expected = lhs * rhs;
+        const mat4f result = (affinef(lhs) * affinef(rhs)).toMat4();
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t j = 0; j < 4; j++) {
+                EXPECT_NEAR(expected[i][j], result[i][j], 1e-3f);
+            }
+        }
+
+        // the result can alias the operands
+        affinef a(lhs);
+        multiply(a, a, affinef(rhs));
+        EXPECT_EQ(a, affinef(lhs) * affinef(rhs));
+
+        const float3 p{ rand_gen(), rand_gen(), rand_gen() };
+        const float4 q = lhs * float4{ p, 1 };
+        const float3 r = affinef(lhs).transformPoint(p);
+        EXPECT_NEAR(q.x, r.x, 1e-3f);
+        EXPECT_NEAR(q.y, r.y, 1e-3f);
+        EXPECT_NEAR(q.z, r.z, 1e-3f);
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UTILS_GENERIC_EVENTCOUNT_H
+#define UTILS_GENERIC_EVENTCOUNT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <stdint.h>
+
+#include <utils/compiler.h>
+
+namespace utils {
+
+/*
+ * See utils/linux/EventCount.h, this version parks threads with a std::condition_variable.
+ */
+
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount() noexcept = default;
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    Key prepareWait() const noexcept {
+        return mState.load(std::memory_order_seq_cst);
+    }
+
+    void wait(Key key) noexcept {
+        mWaiters.fetch_add(1, std::memory_order_seq_cst);
+        std::unique_lock<std::mutex> lock(mLock);
+        while (mState.load(std::memory_order_seq_cst) == key) {
+            mCondition.wait(lock);
+        }
+        lock.unlock();
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_all() noexcept {
+        mState.fetch_add(1, std::memory_order_seq_cst);
+        if (UTILS_UNLIKELY(mWaiters.load(std::memory_order_seq_cst))) {
+            // taking the lock guarantees the waiter is either before its check or waiting
+            std::unique_lock<std::mutex> lock(mLock);
+            lock.unlock();
+            mCondition.notify_all();
+        }
+    }
+
+private:
+    std::atomic<uint32_t> mState = { 0 };
+    std::atomic<uint32_t> mWaiters = { 0 };
+    std::mutex mLock;
+    std::condition_variable mCondition;
+};
+
+} // namespace utils
+
+#endif // UTILS_GENERIC_EVENTCOUNT_H
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UTILS_LINUX_EVENTCOUNT_H
+#define UTILS_LINUX_EVENTCOUNT_H
+
+#include <atomic>
+
+#include <stdint.h>
+
+#include <utils/compiler.h>
+
+namespace utils {
+
+/*
+ * An EventCount lets a thread wait for a condition that other threads make true without a
+ * lock, e.g. the state of a lock-free queue:
+ *
+ *  waiter:
+ *      while (true) {
+ *          EventCount::Key key = ec.prepareWait();
+ *          if (condition()) break;
+ *          ec.wait(key);
+ *      }
+ *
+ *  notifier:
+ *      makeConditionTrue();
+ *      ec.notify_all();
+ *
+ * notify_all() doesn't make a system call when nobody is waiting.
+ */
+
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount() noexcept = default;
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    // must be called before checking the condition
+    Key prepareWait() const noexcept {
+        return mState.load(std::memory_order_seq_cst);
+    }
+
+    // blocks until notify_all() is called after prepareWait() returned 'key'.
+    // This can return spuriously, the condition must be checked again.
+    void wait(Key key) noexcept {
+        mWaiters.fetch_add(1, std::memory_order_seq_cst);
+        if (mState.load(std::memory_order_seq_cst) == key) {
+            wait_slow(key);
+        }
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_all() noexcept {
+        mState.fetch_add(1, std::memory_order_seq_cst);
+        if (UTILS_UNLIKELY(mWaiters.load(std::memory_order_seq_cst))) {
+            wake();
+        }
+    }
+
+private:
+    std::atomic<uint32_t> mState = { 0 };
+    std::atomic<uint32_t> mWaiters = { 0 };
+
+    void wait_slow(Key key) noexcept;
+    void wake() noexcept;
+};
+
+} // namespace utils
+
+#endif // UTILS_LINUX_EVENTCOUNT_H
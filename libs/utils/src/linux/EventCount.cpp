@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <utils/linux/EventCount.h>
+
+#include <limits>
+
+#include "futex.h"
+
+namespace utils {
+
+void EventCount::wait_slow(Key key) noexcept {
+    linuxutil::futex_wait_ex(&mState, false, key, false, nullptr);
+}
+
+void EventCount::wake() noexcept {
+    linuxutil::futex_wake_ex(&mState, false, std::numeric_limits<int>::max());
+}
+
+} // namespace utils
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <utils/EventCount.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace utils;
+
+TEST(EventCountTest, PingPong) {
+    EventCount ping;
+    EventCount pong;
+    std::atomic_int value = { 0 };
+    constexpr int COUNT = 10000;
+
+    auto waitFor = [&value](EventCount& ec, int expected) {
+        while (true) {
+            EventCount::Key key = ec.prepareWait();
+            if (value.load() == expected) break;
+            ec.wait(key);
+        }
+    };
+
+    std::thread t([&]() {
+        for (int i = 0; i < COUNT; i++) {
+            waitFor(ping, 2 * i + 1);
+            value.store(2 * i + 2);
+            pong.notify_all();
+        }
+    });
+
+    for (int i = 0; i < COUNT; i++) {
+        value.store(2 * i + 1);
+        ping.notify_all();
+        waitFor(pong, 2 * i + 2);
+    }
+
+    t.join();
+    EXPECT_EQ(2 * COUNT, value.load());
+}
+
+TEST(EventCountTest, NotifyBeforeWait) {
+    EventCount ec;
+    EventCount::Key key = ec.prepareWait();
+    ec.notify_all();
+    // must not block
+    ec.wait(key);
+    EXPECT_NE(key, ec.prepareWait());
+}
@@ -24,7 +24,35 @@ vec2 getUV1() {
 #endif
 
 #if defined(HAS_SHADOWING) && defined(HAS_DIRECTIONAL_LIGHTING)
-HIGHP vec3 getLightSpacePosition() {
-    return vertex_lightSpacePosition.xyz * (1.0 / vertex_lightSpacePosition.w);
+/**
+ * Computes the position of the fragment in the shadow map texture. With cascaded shadow maps,
+ * the cascade is selected from the view space depth of the fragment, the splits of unused
+ * cascades are set to infinity.
+ * Returns false if the fragment is past the shadow far distance or outside of its cascade's
+ * viewport. It isn't shadowed then, the texels around it can belong to another shadow map of
+ * the shadow atlas.
+ */
+bool getLightSpacePosition(out HIGHP vec3 position) {
+    HIGHP float z = -(getViewFromWorldMatrix() * vec4(vertex_worldPosition, 1.0)).z;
+    if (z >= frameUniforms.shadowBias.z) {
+        return false;
+    }
+
+    ivec4 greater = ivec4(greaterThanEqual(vec4(z), frameUniforms.shadowCascadeSplits));
+    int cascade = greater.x + greater.y + greater.z + greater.w;
+
+    // the normal bias was computed for the texels of one cascade, this scales it for ours
+    HIGHP vec3 p = vertex_lightSpacePosition.xyz * (1.0 / vertex_lightSpacePosition.w);
+    p += vertex_lightSpaceNormalOffset * (frameUniforms.shadowCascadeNormalBias[cascade] - 1.0);
+
+    HIGHP vec4 scaleOffset = frameUniforms.shadowCascades[cascade];
+    HIGHP vec2 uv = p.xy * scaleOffset.xy + scaleOffset.zw;
+    if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))) {
+        return false;
+    }
+
+    HIGHP vec4 viewport = frameUniforms.shadowCascadeViewports[cascade];
+    position = vec3(uv * viewport.xy + viewport.zw, p.z);
+    return true;
 }
 #endif
@@ -6,14 +6,24 @@ mat4 getLightFromWorldMatrix() {
     return frameUniforms.lightFromWorldMatrix;
 }
 
+// Instanced draws bind the uniforms of all their instances at once, other draws bind the
+// uniforms of their renderable as the first and only instance.
+int getInstanceIndex() {
+#if defined(CODEGEN_TARGET_VULKAN_ENVIRONMENT)
+    return gl_InstanceIndex;
+#else
+    return gl_InstanceID;
+#endif
+}
+
 /** @public-api */
 mat4 getWorldFromModelMatrix() {
-    return objectUniforms.worldFromModelMatrix;
+    return objectUniforms.instances[getInstanceIndex()].worldFromModelMatrix;
 }
 
 /** @public-api */
 mat3 getWorldFromModelNormalMatrix() {
-    return objectUniforms.worldFromModelNormalMatrix;
+    return objectUniforms.instances[getInstanceIndex()].worldFromModelNormalMatrix;
 }
 
 //------------------------------------------------------------------------------
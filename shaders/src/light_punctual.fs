@@ -7,14 +7,18 @@
 #define FROXEL_BUFFER_WIDTH         (1u << FROXEL_BUFFER_WIDTH_SHIFT)
 #define FROXEL_BUFFER_WIDTH_MASK    (FROXEL_BUFFER_WIDTH - 1u)
 
-#define RECORD_BUFFER_WIDTH_SHIFT   5u
+#define RECORD_BUFFER_WIDTH_SHIFT   6u
 #define RECORD_BUFFER_WIDTH         (1u << RECORD_BUFFER_WIDTH_SHIFT)
 #define RECORD_BUFFER_WIDTH_MASK    (RECORD_BUFFER_WIDTH - 1u)
 
+#define LIGHT_BUFFER_WIDTH_SHIFT    6u
+#define LIGHT_BUFFER_WIDTH          (1u << LIGHT_BUFFER_WIDTH_SHIFT)
+#define LIGHT_BUFFER_WIDTH_MASK     (LIGHT_BUFFER_WIDTH - 1u)
+
 struct FroxelParams {
-    uint recordOffset; // offset at which the list of lights for this froxel starts
-    uint pointCount;   // number of point lights in this froxel
-    uint spotCount;    // number of spot lights in this froxel
+    HIGHP uint recordOffset; // offset at which the list of lights for this froxel starts
+    uint pointCount;         // number of point lights in this froxel
+    uint spotCount;          // number of spot lights in this froxel
 };
 
 /**
@@ -60,24 +64,34 @@ ivec2 getFroxelTexCoord(uint froxelIndex) {
  */
 FroxelParams getFroxelParams(uint froxelIndex) {
     ivec2 texCoord = getFroxelTexCoord(froxelIndex);
-    uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
+    HIGHP uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
 
     FroxelParams froxel;
     froxel.recordOffset = entry.r;
-    froxel.pointCount = entry.g & 0xFFu;
-    froxel.spotCount = entry.g >> 8u;
+    froxel.pointCount = entry.g & 0xFFFFu;
+    froxel.spotCount = entry.g >> 16u;
     return froxel;
 }
 
 /**
  * Returns the coordinates of the light record in the light_records texture
  * given the specified index. A light record is a single uint index into the
- * lights data buffer (lightsUniforms UBO).
+ * lights data texture (light_lights).
  */
-ivec2 getRecordTexCoord(uint index) {
+ivec2 getRecordTexCoord(HIGHP uint index) {
     return ivec2(index & RECORD_BUFFER_WIDTH_MASK, index >> RECORD_BUFFER_WIDTH_SHIFT);
 }
 
+/**
+ * Returns the i-th parameter of the specified light, from the light_lights texture.
+ * Each light uses 4 consecutive texels.
+ */
+HIGHP vec4 getLightData(uint lightIndex, uint i) {
+    uint texel = lightIndex * 4u + i;
+    return texelFetch(light_lights,
+            ivec2(texel & LIGHT_BUFFER_WIDTH_MASK, texel >> LIGHT_BUFFER_WIDTH_SHIFT), 0);
+}
+
 float getSquareFalloffAttenuation(float distanceSquare, float falloff) {
     float factor = distanceSquare * falloff;
     float smoothFactor = saturate(1.0 - factor * factor);
@@ -113,30 +127,53 @@ void setupPunctualLight(inout Light light, const HIGHP vec4 positionFalloff) {
     light.NoL = saturate(dot(shading_normal, light.l));
 }
 
+#if defined(HAS_SHADOWING)
+/**
+ * Returns the visibility of a spot light at the current fragment. shadowIndexBias holds the
+ * index of the light's shadow map in the shadow atlas (negative if the light doesn't cast
+ * shadows) and the world space distance by which the fragment is moved towards the light.
+ */
+float getSpotLightVisibility(const vec3 l, const vec2 shadowIndexBias) {
+    if (shadowIndexBias.x < 0.0) {
+        return 1.0;
+    }
+    HIGHP vec3 p = vertex_worldPosition + l * shadowIndexBias.y;
+    HIGHP vec4 shadowPosition =
+            frameUniforms.spotShadowMatrices[int(shadowIndexBias.x)] * vec4(p, 1.0);
+    return shadow(light_shadowMap, shadowPosition.xyz * (1.0 / shadowPosition.w));
+}
+#endif
+
 /**
  * Returns a Light structure (see common_lighting.fs) describing a spot light.
  * The colorIntensity field will store the *pre-exposed* intensity of the light
  * in the w component.
  *
  * The light parameters used to compute the Light structure are fetched from the
- * lightsUniforms uniform buffer.
+ * light_lights texture.
  */
-Light getSpotLight(uint index) {
+Light getSpotLight(HIGHP uint index) {
     Light light;
     ivec2 texCoord = getRecordTexCoord(index);
     uint lightIndex = texelFetch(light_records, texCoord, 0).r;
 
-    HIGHP vec4 positionFalloff = lightsUniforms.lights[lightIndex][0];
-    HIGHP vec4 colorIntensity  = lightsUniforms.lights[lightIndex][1];
-          vec4 directionIES    = lightsUniforms.lights[lightIndex][2];
-          vec2 scaleOffset     = lightsUniforms.lights[lightIndex][3].xy;
+    HIGHP vec4 positionFalloff = getLightData(lightIndex, 0u);
+    HIGHP vec4 colorIntensity  = getLightData(lightIndex, 1u);
+          vec4 directionIES    = getLightData(lightIndex, 2u);
+          vec4 scaleOffset     = getLightData(lightIndex, 3u);
 
     light.colorIntensity.rgb = colorIntensity.rgb;
     light.colorIntensity.w = computePreExposedIntensity(colorIntensity.w, frameUniforms.exposure);
 
     setupPunctualLight(light, positionFalloff);
 
-    light.attenuation *= getAngleAttenuation(-directionIES.xyz, light.l, scaleOffset);
+    light.attenuation *= getAngleAttenuation(-directionIES.xyz, light.l, scaleOffset.xy);
+
+#if defined(HAS_SHADOWING)
+    if (light.NoL > 0.0) {
+        light.attenuation *= getSpotLightVisibility(light.l, scaleOffset.zw);
+    }
+#endif
 
     return light;
 }
@@ -147,15 +184,15 @@ Light getSpotLight(uint index) {
  * in the w component.
  *
  * The light parameters used to compute the Light structure are fetched from the
- * lightsUniforms uniform buffer.
+ * light_lights texture.
  */
-Light getPointLight(uint index) {
+Light getPointLight(HIGHP uint index) {
     Light light;
     ivec2 texCoord = getRecordTexCoord(index);
     uint lightIndex = texelFetch(light_records, texCoord, 0).r;
 
-    HIGHP vec4 positionFalloff = lightsUniforms.lights[lightIndex][0];
-    HIGHP vec4 colorIntensity  = lightsUniforms.lights[lightIndex][1];
+    HIGHP vec4 positionFalloff = getLightData(lightIndex, 0u);
+    HIGHP vec4 colorIntensity  = getLightData(lightIndex, 1u);
 
     light.colorIntensity.rgb = colorIntensity.rgb;
     light.colorIntensity.w = computePreExposedIntensity(colorIntensity.w, frameUniforms.exposure);
@@ -179,10 +216,10 @@ void evaluatePunctualLights(const PixelParams pixel, inout vec3 color) {
     // the current fragment. A froxel also contains a record offset that
     // tells us where the indices of those lights are in the records
     // texture. The records texture contains the indices of the actual
-    // light data in the lightsUniforms uniform buffer
+    // light data in the light_lights texture
 
-    uint index = froxel.recordOffset;
-    uint end = index + froxel.pointCount;
+    HIGHP uint index = froxel.recordOffset;
+    HIGHP uint end = index + froxel.pointCount;
 
     // Iterate point lights
     for ( ; index < end; index++) {
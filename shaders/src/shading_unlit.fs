@@ -27,7 +27,12 @@ vec4 evaluateMaterial(const MaterialInputs material) {
 
 #if defined(HAS_DIRECTIONAL_LIGHTING)
 #if defined(HAS_SHADOWING)
-    color *= 1.0 - shadow(light_shadowMap, getLightSpacePosition());
+    HIGHP vec3 shadowPosition;
+    float visibility = 1.0;
+    if (getLightSpacePosition(shadowPosition)) {
+        visibility = shadow(light_shadowMap, shadowPosition);
+    }
+    color *= 1.0 - visibility;
 #else
     color = vec4(0.0);
 #endif
@@ -15,6 +15,9 @@
 
 #define SHADOW_RECEIVER_PLANE_DEPTH_BIAS_MIN_SAMPLING_METHOD    SHADOW_SAMPLING_PCF_MEDIUM
 
+// The footprint of the sampling method must fit in the border of the shadow atlas tiles,
+// ShadowMap::TILE_BORDER.
+
 #ifdef TARGET_MOBILE
   #define SHADOW_SAMPLING_METHOD            SHADOW_SAMPLING_PCF_LOW
   #define SHADOW_SAMPLING_ERROR             SHADOW_SAMPLING_ERROR_DISABLED
@@ -3,13 +3,7 @@
 //------------------------------------------------------------------------------
 
 #if defined(HAS_SHADOWING) && defined(HAS_DIRECTIONAL_LIGHTING)
-/**
- * Computes the light space position of the specified world space point.
- * The returned point may contain a bias to attempt to eliminate common
- * shadowing artifacts such as "acne". To achieve this, the world space
- * normal at the point must also be passed to this function.
- */
-vec4 getLightSpacePosition(const vec3 p, const vec3 n) {
+float getShadowNormalBias(const vec3 n) {
     float NoL = saturate(dot(n, frameUniforms.lightDirection));
 
 #ifdef TARGET_MOBILE
@@ -18,10 +12,29 @@ vec4 getLightSpacePosition(const vec3 p, const vec3 n) {
     float normalBias = sqrt(1.0 - NoL * NoL);
 #endif
 
-    vec3 offsetPosition = p + n * (normalBias * frameUniforms.shadowBias.y);
+    return normalBias * frameUniforms.shadowBias.y;
+}
+
+/**
+ * Computes the light space position of the specified world space point.
+ * The returned point may contain a bias to attempt to eliminate common
+ * shadowing artifacts such as "acne". To achieve this, the world space
+ * normal at the point must also be passed to this function.
+ */
+vec4 getLightSpacePosition(const vec3 p, const vec3 n) {
+    vec3 offsetPosition = p + n * getShadowNormalBias(n);
     vec4 lightSpacePosition = (getLightFromWorldMatrix() * vec4(offsetPosition, 1.0));
     lightSpacePosition.z -= frameUniforms.shadowBias.x;
 
     return lightSpacePosition;
 }
+
+/**
+ * Returns the light space offset applied along the normal by getLightSpacePosition().
+ * The bias is computed for the texels of the first shadow cascade, the fragment shader
+ * uses this offset to scale it to the texels of the cascade it samples.
+ */
+vec3 getLightSpaceNormalOffset(const vec3 n) {
+    return (getLightFromWorldMatrix() * vec4(n * getShadowNormalBias(n), 0.0)).xyz;
+}
 #endif